@@ -0,0 +1,856 @@
+#!/usr/bin/env python3
+"""In-memory stand-in for the vtfs server with latency and fault injection.
+
+Speaks the same protocol as server/ (GET /list /create /read /write /stat
+/delete /link /changes /sums, POST /write with a raw body, token and opid handling,
+JSON replies, and vtfs-rpc frames after an upgrade on GET /rpc) so the kernel
+client can be benchmarked without the JVM and PostgreSQL. Everything is kept
+in memory and lost on exit.
+
+Injected conditions apply per request, in this order:
+  reset      the connection is aborted with RST before any reply
+  latency    fixed delay plus uniform jitter, optionally per method
+  error      an HTTP error reply instead of executing the request
+  bandwidth  request and reply bytes share one link of the given rate
+
+All randomness comes from --seed, so a run is reproducible as long as the
+client issues the same sequence of requests.
+"""
+
+import argparse
+import base64
+import binascii
+import collections
+import json
+import posixpath
+import random
+import os
+import signal
+import socket
+import socketserver
+import struct
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlsplit
+
+ROOT_INO = 1000
+MODE_MASK = 0o777
+CHANGES_CAPACITY = 8192
+CHANGES_MAX_TIMEOUT_MS = 30000
+CHANGES_MAX_LIMIT = 256
+IDEMPOTENCY_CAPACITY = 16384
+
+METHODS = ("list", "create", "read", "write", "stat", "delete", "link", "changes", "sums")
+
+# vtfs-rpc/1, see module/rpc.h: op codes by method, field tags and types
+RPC_PROTOCOL = "vtfs-rpc/1"
+RPC_HEADER = struct.Struct("<IHHIHH")
+RPC_FIELD = struct.Struct("<HHI")
+RPC_MAX_FRAME = 64 << 20
+RPC_OPS = {1: "create", 2: "delete", 3: "read", 4: "write", 5: "stat", 6: "link", 7: "sums"}
+RPC_PATH, RPC_PATH2, RPC_OFFSET, RPC_SIZE, RPC_MODE, RPC_KIND, RPC_OPID, \
+    RPC_INO, RPC_MTIME, RPC_NLINK, RPC_DATA, RPC_RAW_SIZE, RPC_BLOCK, RPC_MAX = range(1, 15)
+RPC_COMPRESSION = "lz4"
+# Replies shorter than this, or saving less than an eighth, go uncompressed
+LZ4_MIN = 512
+# Block of the /sums manifest, the server's default chunk size, and most sums per reply
+STORE_BLOCK = 65536
+MAX_SUMS = 1024
+RPC_U64, RPC_STR, RPC_BYTES = 1, 2, 3
+# Where a raw request body goes in params; no query string can produce this key
+BODY = object()
+ERRNO = {"EPERM": 1, "ENOENT": 2, "EIO": 5, "EACCES": 13, "EBUSY": 16, "EEXIST": 17,
+         "ENOTDIR": 20, "EISDIR": 21, "EINVAL": 22, "ENOTEMPTY": 39}
+
+
+def _crc32c_table():
+    table = []
+    for n in range(256):
+        for _ in range(8):
+            n = (n >> 1) ^ 0x82F63B78 if n & 1 else n >> 1
+        table.append(n)
+    return table
+
+
+CRC32C_TABLE = _crc32c_table()
+
+
+def crc32c(data):
+    crc = 0xFFFFFFFF
+    for b in data:
+        crc = CRC32C_TABLE[(crc ^ b) & 0xFF] ^ (crc >> 8)
+    return crc ^ 0xFFFFFFFF
+
+
+class FsError(Exception):
+    def __init__(self, code):
+        super().__init__(code)
+        self.code = code
+
+
+class Inode:
+    def __init__(self, ino, kind, mode):
+        now = int(time.time())
+        self.ino = ino
+        self.kind = kind
+        self.mode = mode & MODE_MASK
+        self.nlink = 2 if kind == "dir" else 1
+        self.data = bytearray()
+        # CRC32C by block number, dropped on every write
+        self.sums = {}
+        self.atime = self.mtime = self.ctime = now
+
+
+class FileSystem:
+    """Path-indexed tree; hard links share one Inode."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.entries = {"/": Inode(ROOT_INO, "dir", MODE_MASK)}
+        self.children = {"/": {}}
+        self.next_ino = ROOT_INO + 1
+
+    @staticmethod
+    def normalize(path):
+        return posixpath.normpath("/" + path.lstrip("/")) if path else "/"
+
+    def _get(self, path):
+        inode = self.entries.get(path)
+        if inode is None:
+            raise FsError("ENOENT")
+        return inode
+
+    def _parent(self, path):
+        parent = posixpath.dirname(path)
+        inode = self.entries.get(parent)
+        if inode is None:
+            raise FsError("ENOENT")
+        if inode.kind != "dir":
+            raise FsError("ENOTDIR")
+        return parent, inode
+
+    def list(self, path):
+        path = self.normalize(path)
+        inode = self._get(path)
+        if inode.kind != "dir":
+            raise FsError("ENOTDIR")
+        return [{"name": name, "ino": child.ino, "type": child.kind,
+                 "mode": child.mode, "size": len(child.data), "mtime": child.mtime}
+                for name, child in self.children[path].items()]
+
+    def create(self, path, kind, mode):
+        path = self.normalize(path)
+        if path in self.entries:
+            raise FsError("EEXIST")
+        parent_path, parent = self._parent(path)
+        if kind not in ("file", "dir"):
+            raise FsError("EINVAL")
+
+        inode = Inode(self.next_ino, kind, mode)
+        self.next_ino += 1
+        self.entries[path] = inode
+        self.children[parent_path][posixpath.basename(path)] = inode
+        if kind == "dir":
+            self.children[path] = {}
+            parent.nlink += 1
+            parent.mtime = parent.ctime = inode.mtime
+        return inode, {"ino": inode.ino, "path": path}
+
+    def delete(self, path):
+        path = self.normalize(path)
+        if path == "/":
+            raise FsError("EBUSY")
+        inode = self._get(path)
+        if inode.kind == "dir" and self.children[path]:
+            raise FsError("ENOTEMPTY")
+
+        parent_path = posixpath.dirname(path)
+        del self.entries[path]
+        del self.children[parent_path][posixpath.basename(path)]
+        inode.nlink -= 1
+        inode.ctime = int(time.time())
+        if inode.kind == "dir":
+            del self.children[path]
+            parent = self.entries[parent_path]
+            parent.nlink -= 1
+            parent.mtime = parent.ctime = inode.ctime
+        return inode, {"deleted": path}
+
+    def read(self, path, offset, size):
+        inode = self._get(self.normalize(path))
+        if inode.kind != "file":
+            raise FsError("EISDIR")
+        if offset >= len(inode.data):
+            return b""
+        end = len(inode.data) if size is None else min(offset + size, len(inode.data))
+        inode.atime = int(time.time())
+        return bytes(inode.data[offset:end])
+
+    def write(self, path, offset, data):
+        path = self.normalize(path)
+        inode = self._get(path)
+        if inode.kind != "file":
+            raise FsError("EISDIR")
+        if offset > len(inode.data):
+            inode.data.extend(bytes(offset - len(inode.data)))
+        inode.data[offset:offset + len(data)] = data
+        inode.sums.clear()
+        inode.mtime = inode.ctime = int(time.time())
+        return inode, {"written": len(data)}
+
+    def stat(self, path):
+        inode = self._get(self.normalize(path))
+        return {"ino": inode.ino, "type": inode.kind, "mode": inode.mode,
+                "nlink": inode.nlink, "size": len(inode.data),
+                "atime": inode.atime, "mtime": inode.mtime, "ctime": inode.ctime}
+
+    def sums(self, path, offset, size, limit):
+        inode = self._get(self.normalize(path))
+        if inode.kind != "file":
+            raise FsError("EISDIR")
+        first = offset // STORE_BLOCK
+        end = min(-(-(offset + size) // STORE_BLOCK), -(-len(inode.data) // STORE_BLOCK),
+                  first + min(limit, MAX_SUMS))
+        for i in range(first, end):
+            if i not in inode.sums:
+                inode.sums[i] = crc32c(inode.data[i * STORE_BLOCK:(i + 1) * STORE_BLOCK])
+        return {"block": STORE_BLOCK, "size": len(inode.data),
+                "sums": [inode.sums[i] for i in range(first, end)]}
+
+    def link(self, oldpath, newpath):
+        oldpath = self.normalize(oldpath)
+        newpath = self.normalize(newpath)
+        inode = self._get(oldpath)
+        if inode.kind == "dir":
+            raise FsError("EPERM")
+        if newpath in self.entries:
+            raise FsError("EEXIST")
+        parent_path, _ = self._parent(newpath)
+
+        self.entries[newpath] = inode
+        self.children[parent_path][posixpath.basename(newpath)] = inode
+        inode.nlink += 1
+        inode.ctime = int(time.time())
+        return inode, {"linked": newpath}
+
+
+class ChangeLog:
+    """Bounded mutation log behind /changes, same window and reset rules as the server."""
+
+    def __init__(self):
+        self.cond = threading.Condition()
+        self.log = collections.deque(maxlen=CHANGES_CAPACITY)
+        self.last_seq = 0
+
+    def record(self, op, path, ino, client):
+        with self.cond:
+            self.last_seq += 1
+            change = {"seq": self.last_seq, "op": op, "path": path, "ino": ino}
+            if client:
+                change["client"] = client
+            self.log.append(change)
+            self.cond.notify_all()
+
+    def since(self, since, timeout_ms, limit):
+        with self.cond:
+            if since < 0:
+                return {"seq": self.last_seq, "reset": False, "changes": []}
+
+            deadline = time.monotonic() + min(max(timeout_ms, 0), CHANGES_MAX_TIMEOUT_MS) / 1000
+            while self.last_seq <= since:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0 or not self.cond.wait(remaining):
+                    break
+
+            oldest = self.log[0]["seq"] if self.log else self.last_seq + 1
+            if since > self.last_seq or since + 1 < oldest:
+                return {"seq": self.last_seq, "reset": True, "changes": []}
+
+            limit = min(max(limit, 1), CHANGES_MAX_LIMIT)
+            batch = [c for c in self.log if c["seq"] > since][:limit]
+            seq = batch[-1]["seq"] if batch else since
+            return {"seq": seq, "reset": False, "changes": batch}
+
+
+class Idempotency:
+    """Remembers the reply to each opid so a replayed mutation is not applied twice."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.replies = collections.OrderedDict()
+
+    def get(self, opid):
+        with self.lock:
+            reply = self.replies.get(opid)
+            if reply is not None:
+                self.replies.move_to_end(opid)
+            return reply
+
+    def put(self, opid, reply):
+        with self.lock:
+            self.replies[opid] = reply
+            while len(self.replies) > IDEMPOTENCY_CAPACITY:
+                self.replies.popitem(last=False)
+
+
+class Link:
+    """A single shared pipe: each transfer occupies it for nbytes / rate seconds."""
+
+    def __init__(self, rate):
+        self.rate = rate
+        self.lock = threading.Lock()
+        self.free_at = 0.0
+
+    def transfer(self, nbytes):
+        if not self.rate:
+            return
+        with self.lock:
+            start = max(time.monotonic(), self.free_at)
+            self.free_at = start + nbytes / self.rate
+            done = self.free_at
+        delay = done - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+
+class Faults:
+    def __init__(self, args):
+        self.rng = random.Random(args.seed)
+        self.lock = threading.Lock()
+        self.latency = {}
+        for spec in args.latency:
+            method, _, ms = spec.rpartition("=")
+            self.latency[method or None] = float(ms) / 1000
+        self.jitter = args.jitter / 1000
+        self.error_rate = args.error_rate
+        self.error_status = args.error_status
+        self.reset_rate = args.reset_rate
+        self.methods = set(args.fault_methods.split(",")) if args.fault_methods else set(METHODS)
+        self.link = Link(args.bandwidth)
+
+    def draw(self, method):
+        """Returns (reset, delay, error) for one request."""
+        with self.lock:
+            r_reset, r_jitter, r_error = self.rng.random(), self.rng.random(), self.rng.random()
+        faulty = method in self.methods
+        delay = self.latency.get(method, self.latency.get(None, 0.0)) + r_jitter * self.jitter
+        return (faulty and r_reset < self.reset_rate, delay,
+                faulty and r_error < self.error_rate)
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = collections.Counter()
+        self.errors = collections.Counter()
+        self.injected_errors = collections.Counter()
+        self.injected_resets = collections.Counter()
+        self.bytes_in = 0
+        self.bytes_out = 0
+
+    def snapshot(self):
+        with self.lock:
+            return {"requests": dict(self.requests), "errors": dict(self.errors),
+                    "injected_errors": dict(self.injected_errors),
+                    "injected_resets": dict(self.injected_resets),
+                    "bytes_in": self.bytes_in, "bytes_out": self.bytes_out}
+
+
+class StubServer(ThreadingHTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, address, args):
+        super().__init__(address, Handler)
+        self.fs = FileSystem()
+        self.changes = ChangeLog()
+        self.idempotency = Idempotency()
+        self.faults = Faults(args)
+        self.stats = Stats()
+        self.verbose = args.verbose
+        self.lz4 = args.lz4
+
+
+class UnixStubServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    """The same file system on a Unix socket, sharing state with the TCP server."""
+    daemon_threads = True
+
+    def __init__(self, path, tcp):
+        if os.path.exists(path):
+            os.unlink(path)
+        super().__init__(path, UnixHandler)
+        os.chmod(path, 0o666)
+        for name in ("fs", "changes", "idempotency", "faults", "stats", "verbose", "lz4"):
+            setattr(self, name, getattr(tcp, name))
+
+    def server_close(self):
+        super().server_close()
+        if os.path.exists(self.server_address):
+            os.unlink(self.server_address)
+
+
+def rpc_frame(op, status, req_id, fields=(), data=None):
+    """Header and fields as bytes; fields are (tag, int or str), data goes last."""
+    parts = []
+    for tag, value in fields:
+        if isinstance(value, str):
+            value = value.encode()
+            parts.append(RPC_FIELD.pack(tag, RPC_STR, len(value)) + value)
+        else:
+            parts.append(RPC_FIELD.pack(tag, RPC_U64, 8) + struct.pack("<Q", value))
+    if data is not None:
+        parts.append(RPC_FIELD.pack(RPC_DATA, RPC_BYTES, len(data)))
+    body = b"".join(parts)
+    length = len(body) + (len(data) if data is not None else 0)
+    return RPC_HEADER.pack(length, op, status, req_id, len(parts), 0) + body
+
+
+def lz4_compress(src):
+    """One LZ4 block, greedy with a single hash table entry per 4-byte key."""
+    n, out, table = len(src), bytearray(), {}
+    anchor = i = 0
+
+    def sequence(literals, offset=0, match=0):
+        lit, ml = len(literals), match - 4
+        out.append((min(lit, 15) << 4) | (min(ml, 15) if match else 0))
+        if lit >= 15:
+            lit -= 15
+            out.extend(b"\xff" * (lit // 255))
+            out.append(lit % 255)
+        out.extend(literals)
+        if match:
+            out.extend(struct.pack("<H", offset))
+            if ml >= 15:
+                ml -= 15
+                out.extend(b"\xff" * (ml // 255))
+                out.append(ml % 255)
+
+    # The format wants the last match to start 12 bytes and end 5 bytes before the end
+    while i < n - 12:
+        key = src[i:i + 4]
+        cand = table.get(key)
+        table[key] = i
+        if cand is None or i - cand > 0xffff:
+            i += 1
+            continue
+        end = i + 4
+        while end < n - 5 and src[end] == src[end - i + cand]:
+            end += 1
+        sequence(src[anchor:i], i - cand, end - i)
+        anchor = i = end
+    sequence(src[anchor:])
+    return bytes(out)
+
+
+def lz4_decompress(src, size):
+    out, i, n = bytearray(), 0, len(src)
+    while True:
+        token = src[i]
+        i += 1
+        lit = token >> 4
+        if lit == 15:
+            while True:
+                lit += src[i]
+                i += 1
+                if src[i - 1] != 255:
+                    break
+        out += src[i:i + lit]
+        i += lit
+        if i >= n:
+            break
+        offset = src[i] | src[i + 1] << 8
+        i += 2
+        ml = token & 15
+        if ml == 15:
+            while True:
+                ml += src[i]
+                i += 1
+                if src[i - 1] != 255:
+                    break
+        ml += 4
+        if not 0 < offset <= len(out) or len(out) + ml > size:
+            raise ValueError("bad lz4 block")
+        start = len(out) - offset
+        while ml > 0:
+            piece = out[start:start + min(ml, offset)]
+            out += piece
+            start += len(piece)
+            ml -= len(piece)
+    if len(out) != size:
+        raise ValueError("bad lz4 block")
+    return bytes(out)
+
+
+def json_bytes(obj):
+    # Compact like Jackson: changes.c matches "reset":true literally
+    return json.dumps(obj, separators=(",", ":")).encode()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    # Read payloads stay bytes on an upgraded connection
+    raw_data = False
+    # Headers and body are separate writes; Nagle would hold the body for an ACK
+    disable_nagle_algorithm = True
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            super().log_message(fmt, *args)
+
+    def address_string(self):
+        # Unix socket peers have no address
+        return self.client_address[0] if self.client_address else "unix"
+
+    def reply(self, status, obj, nbytes_in):
+        body = json_bytes(obj)
+        server = self.server
+        server.faults.link.transfer(nbytes_in + len(body))
+        with server.stats.lock:
+            server.stats.bytes_in += nbytes_in
+            server.stats.bytes_out += len(body)
+
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def abort(self):
+        # Zero linger turns the close into an RST
+        self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+        self.close_connection = True
+
+    def do_GET(self):
+        if urlsplit(self.path).path == "/rpc":
+            self.upgrade_rpc()
+            return
+        self.handle_request(None)
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", "0"))
+        self.handle_request(self.rfile.read(length))
+
+    def handle_request(self, body):
+        server = self.server
+        url = urlsplit(self.path)
+        method = url.path.strip("/")
+        params = {k: v[0] for k, v in parse_qs(url.query, keep_blank_values=True).items()}
+        nbytes_in = len(self.requestline) + 2 + (len(body) if body else 0)
+        if body is not None:
+            params[BODY] = body
+
+        if method == "stub/stats":
+            self.reply(200, server.stats.snapshot(), nbytes_in)
+            return
+
+        with server.stats.lock:
+            server.stats.requests[method] += 1
+
+        reset, delay, error = server.faults.draw(method)
+        if reset:
+            with server.stats.lock:
+                server.stats.injected_resets[method] += 1
+            self.abort()
+            return
+        if delay > 0:
+            time.sleep(delay)
+        if error:
+            with server.stats.lock:
+                server.stats.injected_errors[method] += 1
+            self.reply(server.faults.error_status, {"error": "EIO"}, nbytes_in)
+            return
+
+        status, obj = self.dispatch(method, params)
+        if status != 200:
+            with server.stats.lock:
+                server.stats.errors[method] += 1
+        self.reply(status, obj, nbytes_in)
+
+    def upgrade_rpc(self):
+        params = {k: v[0] for k, v in parse_qs(urlsplit(self.path).query).items()}
+        if self.headers.get("Upgrade", "").lower() != RPC_PROTOCOL or not params.get("token"):
+            self.reply(400, {"error": "EINVAL" if params.get("token") else "EACCES"},
+                       len(self.requestline) + 2)
+            return
+
+        # Pure Python LZ4 is slow, so compression is only offered with --lz4
+        self.lz4 = self.server.lz4 and \
+            self.headers.get("Vtfs-Compression", "").lower() == RPC_COMPRESSION
+        self.send_response(101)
+        self.send_header("Upgrade", RPC_PROTOCOL)
+        self.send_header("Connection", "Upgrade")
+        if self.lz4:
+            self.send_header("Vtfs-Compression", RPC_COMPRESSION)
+        self.end_headers()
+        self.wfile.flush()
+        self.close_connection = True
+        self.raw_data = True
+        self.write_lock = threading.Lock()
+        running = []
+        try:
+            while True:
+                frame = self.read_frame()
+                if frame is None:
+                    break
+                running = [t for t in running if t.is_alive()]
+                running.append(threading.Thread(target=self.serve_frame, args=(params,) + frame))
+                running[-1].start()
+        except (ConnectionError, ValueError, struct.error):
+            pass
+        for t in running:
+            t.join()
+
+    def read_frame(self):
+        """The next request as (bytes, op, id, fields), None when the client is done."""
+        header = self.rfile.read(RPC_HEADER.size)
+        if len(header) < RPC_HEADER.size:
+            return None
+        length, op, _, req_id, count, reserved = RPC_HEADER.unpack(header)
+        if reserved or length > RPC_MAX_FRAME - RPC_HEADER.size:
+            return None
+        frame = self.rfile.read(length)
+        if len(frame) < length:
+            return None
+
+        fields, pos = {}, 0
+        for _ in range(count):
+            tag, kind, n = RPC_FIELD.unpack_from(frame, pos)
+            pos += RPC_FIELD.size
+            value = frame[pos:pos + n]
+            if kind == RPC_U64:
+                value = struct.unpack("<Q", value)[0]
+            elif kind == RPC_STR:
+                value = value.decode()
+            fields[tag] = value
+            pos += n
+        return RPC_HEADER.size + length, op, req_id, fields
+
+    def serve_frame(self, conn_params, nbytes_in, op, req_id, fields):
+        """Runs on a thread of its own; replies go out as requests finish."""
+        server = self.server
+        method = RPC_OPS.get(op, "rpc")
+        params = {"token": conn_params.get("token"), "client": conn_params.get("client")}
+        path = fields.get(RPC_PATH, "")
+        params["oldpath" if method == "link" else "path"] = path
+        for tag, key in ((RPC_PATH2, "newpath"), (RPC_OFFSET, "offset"), (RPC_SIZE, "size"),
+                         (RPC_KIND, "type"), (RPC_OPID, "opid"), (RPC_MAX, "max")):
+            if tag in fields:
+                params[key] = str(fields[tag])
+        if RPC_MODE in fields:
+            params["mode"] = "%o" % fields[RPC_MODE]
+        if RPC_DATA in fields:
+            params[BODY] = fields[RPC_DATA]
+        if RPC_RAW_SIZE in fields:
+            try:
+                if not self.lz4:
+                    raise ValueError("compression not negotiated")
+                params[BODY] = lz4_decompress(params.get(BODY, b""), fields[RPC_RAW_SIZE])
+            except (ValueError, IndexError):
+                params[BODY] = None
+
+        with server.stats.lock:
+            server.stats.requests[method] += 1
+        reset, delay, error = server.faults.draw(method)
+        if reset:
+            with server.stats.lock:
+                server.stats.injected_resets[method] += 1
+            self.abort()
+            # The reader sees the end of the stream and the close sends the RST
+            self.connection.shutdown(socket.SHUT_RD)
+            return
+        if delay > 0:
+            time.sleep(delay)
+        if error:
+            with server.stats.lock:
+                server.stats.injected_errors[method] += 1
+            status, obj = server.faults.error_status, {"error": "EIO"}
+        elif params.get(BODY, b"") is None:
+            status, obj = 400, {"error": "EINVAL"}
+        else:
+            status, obj = self.dispatch(method, params)
+
+        data = None
+        reply_fields = []
+        if status != 200:
+            with server.stats.lock:
+                server.stats.errors[method] += 1
+            errno = ERRNO.get(obj.get("error"), ERRNO["EIO"])
+        else:
+            errno = 0
+            result = obj["result"]
+            if method == "read":
+                data = result["data"]
+            elif method == "stat":
+                reply_fields = [(RPC_KIND, result["type"]), (RPC_SIZE, result["size"]),
+                                (RPC_MTIME, result["mtime"]), (RPC_INO, result["ino"]),
+                                (RPC_MODE, result["mode"]), (RPC_NLINK, result["nlink"])]
+            elif method == "sums":
+                reply_fields = [(RPC_BLOCK, result["block"]), (RPC_SIZE, result["size"])]
+                data = struct.pack("<%dI" % len(result["sums"]), *result["sums"])
+        if self.lz4 and data is not None and len(data) >= LZ4_MIN:
+            packed = lz4_compress(data)
+            if len(packed) < len(data) - len(data) // 8:
+                reply_fields.append((RPC_RAW_SIZE, len(data)))
+                data = packed
+
+        reply = rpc_frame(op, errno, req_id, reply_fields, data)
+        nbytes_out = len(reply) + (len(data) if data is not None else 0)
+        server.faults.link.transfer(nbytes_in + nbytes_out)
+        with server.stats.lock:
+            server.stats.bytes_in += nbytes_in
+            server.stats.bytes_out += nbytes_out
+        try:
+            with self.write_lock:
+                self.wfile.write(reply + data if data is not None else reply)
+        except (ConnectionError, ValueError):
+            pass
+
+    def dispatch(self, method, params):
+        if not params.get("token"):
+            return 400, {"error": "EACCES"}
+        if method not in METHODS:
+            return 404, {"error": "ENOENT"}
+
+        opid = params.get("opid")
+        if opid:
+            cached = self.server.idempotency.get(opid)
+            if cached is not None:
+                return cached
+
+        try:
+            reply = 200, {"result": getattr(self, "op_" + method)(params)}
+        except FsError as e:
+            reply = 400, {"error": e.code}
+        except (KeyError, ValueError, binascii.Error):
+            reply = 400, {"error": "EINVAL"}
+
+        if opid:
+            self.server.idempotency.put(opid, reply)
+        return reply
+
+    def mutate(self, op, params, fn, *args):
+        fs = self.server.fs
+        with fs.lock:
+            inode, result = fn(*args)
+            path = result.get("path") or result.get("deleted") or result.get("linked") \
+                or fs.normalize(params["path"])
+            self.server.changes.record(op, path, inode.ino, params.get("client"))
+        return result
+
+    def op_list(self, params):
+        fs = self.server.fs
+        with fs.lock:
+            return fs.list(params.get("path", "/"))
+
+    def op_create(self, params):
+        fs = self.server.fs
+        mode = int(params.get("mode", "777"), 8)
+        return self.mutate("create", params, fs.create, params["path"],
+                           params.get("type", "file").lower(), mode)
+
+    def op_delete(self, params):
+        fs = self.server.fs
+        return self.mutate("delete", params, fs.delete, params["path"])
+
+    def op_read(self, params):
+        fs = self.server.fs
+        size = int(params["size"]) if "size" in params else None
+        with fs.lock:
+            data = fs.read(params["path"], int(params.get("offset", "0")), size)
+        if self.raw_data:
+            return {"data": data}
+        return {"data": base64.b64encode(data).decode()}
+
+    def op_write(self, params):
+        fs = self.server.fs
+        if BODY in params:
+            data = params[BODY]
+        else:
+            data = base64.b64decode(params["data"], validate=True)
+        return self.mutate("write", params, fs.write, params["path"],
+                           int(params.get("offset", "0")), data)
+
+    def op_stat(self, params):
+        fs = self.server.fs
+        with fs.lock:
+            return fs.stat(params["path"])
+
+    def op_sums(self, params):
+        fs = self.server.fs
+        offset = int(params.get("offset", "0"))
+        size = int(params["size"]) if "size" in params else 1 << 31
+        limit = int(params["max"]) if "max" in params else MAX_SUMS
+        if offset < 0 or size < 0 or limit < 0:
+            raise ValueError("negative range")
+        with fs.lock:
+            return fs.sums(params["path"], offset, size, limit)
+
+    def op_link(self, params):
+        fs = self.server.fs
+        return self.mutate("link", params, fs.link, params["oldpath"], params["newpath"])
+
+    def op_changes(self, params):
+        return self.server.changes.since(int(params.get("since", "-1")),
+                                         int(params.get("timeout", "0")),
+                                         int(params.get("limit", "64")))
+
+
+class UnixHandler(Handler):
+    disable_nagle_algorithm = False
+
+
+def parse_rate(text):
+    units = {"": 1, "k": 1 << 10, "m": 1 << 20, "g": 1 << 30}
+    text = text.lower().rstrip("b/s")
+    suffix = text[-1:] if text[-1:] in units else ""
+    return float(text[:len(text) - len(suffix)]) * units[suffix]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--unix", metavar="PATH",
+                        help="also listen on this Unix socket (server=unix:PATH)")
+    parser.add_argument("--latency", action="append", default=[], metavar="[METHOD=]MS",
+                        help="added delay per request; repeat with METHOD= to override one method")
+    parser.add_argument("--jitter", type=float, default=0.0, metavar="MS",
+                        help="uniform random delay added on top of --latency")
+    parser.add_argument("--bandwidth", type=parse_rate, default=0, metavar="RATE",
+                        help="shared link rate in bytes/s, k/m/g suffixes allowed")
+    parser.add_argument("--error-rate", type=float, default=0.0, metavar="P",
+                        help="fraction of requests answered with --error-status")
+    parser.add_argument("--error-status", type=int, default=500)
+    parser.add_argument("--reset-rate", type=float, default=0.0, metavar="P",
+                        help="fraction of connections aborted with RST instead of a reply")
+    parser.add_argument("--fault-methods", default="", metavar="LIST",
+                        help="comma separated methods errors and resets apply to (default all)")
+    parser.add_argument("--lz4", action="store_true",
+                        help="accept vtfs-rpc clients offering LZ4 compression")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    server = StubServer((args.host, args.port), args)
+    unix_server = UnixStubServer(args.unix, server) if args.unix else None
+    signal.signal(signal.SIGTERM, lambda *_: threading.Thread(target=server.shutdown).start())
+    print(f"vtfs stub listening on {args.host}:{args.port}", file=sys.stderr)
+    if unix_server:
+        threading.Thread(target=unix_server.serve_forever, daemon=True).start()
+        print(f"vtfs stub listening on unix:{args.unix}", file=sys.stderr)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+        if unix_server:
+            unix_server.shutdown()
+            unix_server.server_close()
+        print(json.dumps(server.stats.snapshot()), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,129 @@
+/*
+ * vtfs_base64_decode() on arbitrary text into a buffer that may be too
+ * small, then an encode/decode round trip of the raw input, the same
+ * round trip through the streaming read reply decoder, and the encoding
+ * with one character replaced. Every base64 implementation the CPU has
+ * must agree with the scalar one byte for byte.
+ */
+#include "vtfs_shim.h"
+#include "codec.h"
+
+static void decode_all(const char *text, unsigned char *ref, unsigned char *out,
+                       size_t capacity)
+{
+    size_t ref_len = capacity, len;
+    int ref_ret, ret, impl;
+
+    vtfs_base64_impl = VTFS_BASE64_SCALAR;
+    ref_ret = vtfs_base64_decode(text, ref, &ref_len);
+    if (ref_ret == 0 && ref_len > capacity)
+        abort();
+
+    for (impl = VTFS_BASE64_SCALAR + 1; impl <= vtfs_base64_best; impl++) {
+        vtfs_base64_impl = impl;
+        len = capacity;
+        ret = vtfs_base64_decode(text, out, &len);
+        if (ret != ref_ret || (ret == 0 && (len != ref_len || memcmp(out, ref, len) != 0)))
+            abort();
+    }
+}
+
+/*
+ * Feeds body through vtfs_data_stream_feed() in pieces and output windows whose
+ * sizes come from the input itself; returns the bytes decoded.
+ */
+static size_t stream_all(const char *body, size_t len, const uint8_t *sizes,
+                         size_t nr_sizes, unsigned char *out, size_t want)
+{
+    struct vtfs_data_stream s;
+    size_t pos = 0, copied = 0, k = 0;
+
+    vtfs_data_stream_init(&s, want);
+    while (pos < len) {
+        size_t piece = nr_sizes ? sizes[k++ % nr_sizes] % 64 + 1 : len;
+        size_t window = nr_sizes ? (sizes[k++ % nr_sizes] % 8 + 1) * 3 : want;
+        size_t end = min(pos + piece, len);
+
+        while (pos < end) {
+            size_t out_len = min(window, s.want);
+
+            pos += vtfs_data_stream_feed(&s, body + pos, end - pos, out + copied, &out_len);
+            copied += out_len;
+            if (copied > want)
+                abort();
+        }
+    }
+
+    return copied;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static bool initialized;
+    char *text = malloc(size + 1);
+    size_t encoded_size = VTFS_BASE64_SIZE(size);
+    char *encoded = malloc(encoded_size);
+    char *reference = malloc(encoded_size);
+    unsigned char *decoded = malloc(size + 1);
+    unsigned char *ref = malloc(size + 1);
+    char *body = NULL;
+    size_t len;
+    int impl;
+
+    if (!initialized) {
+        vtfs_codec_init();
+        initialized = true;
+    }
+
+    if (!text || !encoded || !reference || !decoded || !ref)
+        goto out;
+
+    memcpy(text, data, size);
+    text[size] = '\0';
+    decode_all(text, ref, decoded, size / 2);
+
+    vtfs_base64_impl = VTFS_BASE64_SCALAR;
+    if (vtfs_base64_encode(data, size, reference, encoded_size) != 0)
+        abort();
+    for (impl = VTFS_BASE64_SCALAR; impl <= vtfs_base64_best; impl++) {
+        vtfs_base64_impl = impl;
+        if (vtfs_base64_encode(data, size, encoded, encoded_size) != 0 ||
+            strcmp(encoded, reference) != 0)
+            abort();
+        len = size + 1;
+        if (vtfs_base64_decode(encoded, decoded, &len) != 0 || len != size ||
+            memcmp(decoded, data, size) != 0)
+            abort();
+    }
+
+    /* The same encoding as a read reply, decoded as it would arrive */
+    body = malloc(encoded_size + 32);
+    if (!body)
+        goto out;
+    len = snprintf(body, encoded_size + 32, "{\"result\":{\"data\": \"%s\"}}", reference);
+    for (impl = VTFS_BASE64_SCALAR; impl <= vtfs_base64_best; impl++) {
+        vtfs_base64_impl = impl;
+        if (stream_all(body, len, data, size, decoded, size) != size ||
+            memcmp(decoded, data, size) != 0)
+            abort();
+        if (size > 1 && stream_all(body, len, data, size, decoded, size - 1) != size - 1)
+            abort();
+    }
+    stream_all(text, size, data, size, decoded, size);
+
+    /* A bad character somewhere in otherwise valid input */
+    if (size > 0) {
+        encoded[data[0] % strlen(encoded)] = data[size - 1] ? data[size - 1] : '=';
+        decode_all(encoded, ref, decoded, size + 1);
+    }
+
+out:
+    vtfs_base64_impl = vtfs_base64_best;
+    free(text);
+    free(encoded);
+    free(reference);
+    free(decoded);
+    free(ref);
+    free(body);
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * vtfs_parse_http_response() on arbitrary replies. The kernel hands it a
+ * NUL-terminated receive buffer, so the input is terminated the same way.
+ */
+#include "vtfs_shim.h"
+#include "codec.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char *response = malloc(size + 1);
+    char body[512];
+    int status;
+    int len;
+
+    if (!response)
+        return 0;
+    memcpy(response, data, size);
+    response[size] = '\0';
+
+    len = vtfs_parse_http_response(response, body, sizeof(body), &status);
+    if (len < 0 || (size_t)len >= sizeof(body) || strlen(body) > (size_t)len)
+        abort();
+    if (status < 100 || status > 599)
+        abort();
+
+    free(response);
+    return 0;
+}
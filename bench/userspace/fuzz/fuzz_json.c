@@ -0,0 +1,45 @@
+/*
+ * vtfs_json_string(), vtfs_json_number() and vtfs_json_object_end() on
+ * arbitrary documents. The first byte picks the field name so the fuzzer
+ * can steer into every key the client looks up.
+ */
+#include "vtfs_shim.h"
+#include "codec.h"
+
+static const char *const fields[] = {
+    "result", "error", "data", "type", "size", "mtime", "seq", "op",
+    "path", "client", "reset", "changes", "name",
+};
+
+#define NR_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const char *field;
+    char *json;
+    char value[64];
+    char *end;
+
+    if (size < 1)
+        return 0;
+    field = fields[data[0] % NR_FIELDS];
+
+    json = malloc(size);
+    if (!json)
+        return 0;
+    memcpy(json, data + 1, size - 1);
+    json[size - 1] = '\0';
+
+    if (vtfs_json_string(json, field, value, sizeof(value)) == 0 &&
+        strlen(value) >= sizeof(value))
+        abort();
+    if (vtfs_json_number(json, field, value, sizeof(value)) == 0 &&
+        (strlen(value) == 0 || strlen(value) >= sizeof(value)))
+        abort();
+    end = vtfs_json_object_end(json);
+    if (end && (end < json || end >= json + size - 1 || *end != '}'))
+        abort();
+
+    free(json);
+    return 0;
+}
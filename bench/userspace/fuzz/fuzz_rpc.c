@@ -0,0 +1,108 @@
+/*
+ * vtfs-rpc frames: arbitrary bytes through the header and field parsers,
+ * given to them in every prefix length the way they arrive from a socket,
+ * then a frame built from the input and parsed back field for field.
+ */
+#include "vtfs_shim.h"
+#include "rpc.h"
+
+/* Whatever parses has to lie within what was given */
+static void parse_all(const uint8_t *data, size_t size)
+{
+    struct vtfs_rpc_msg msg;
+    const struct vtfs_rpc_field *f;
+    size_t avail, data_len, full;
+    char str[64];
+    u64 value;
+    int ret, tag;
+
+    if (size < VTFS_RPC_HEADER_SIZE || vtfs_rpc_parse_header(data, &msg.hdr))
+        return;
+
+    full = min_t(size_t, size - VTFS_RPC_HEADER_SIZE, msg.hdr.len);
+    for (avail = 0; avail <= full; avail++) {
+        ret = vtfs_rpc_parse_fields(&msg, data + VTFS_RPC_HEADER_SIZE, avail, &data_len);
+        if (ret == -EAGAIN && avail == msg.hdr.len)
+            abort();
+        if (ret)
+            continue;
+
+        for (tag = 0; tag < VTFS_RPC_NR_TAGS; tag++) {
+            f = &msg.field[tag];
+            if (f->type && (f->value < data + VTFS_RPC_HEADER_SIZE ||
+                            f->value + f->len > data + VTFS_RPC_HEADER_SIZE + avail))
+                abort();
+            vtfs_rpc_get_u64(&msg, tag, &value);
+            vtfs_rpc_get_str(&msg, tag, str, sizeof(str));
+        }
+        if (data_len < msg.field[VTFS_RPC_DATA].len)
+            abort();
+    }
+}
+
+static void round_trip(const uint8_t *data, size_t size)
+{
+    static const u16 str_tags[] = { VTFS_RPC_PATH, VTFS_RPC_PATH2, VTFS_RPC_KIND, VTFS_RPC_OPID };
+    static const u16 num_tags[] = { VTFS_RPC_OFFSET, VTFS_RPC_SIZE, VTFS_RPC_MODE, VTFS_RPC_MTIME };
+    u8 frame[512], *wire;
+    char strs[4][64], out[64];
+    struct vtfs_rpc_builder b;
+    struct vtfs_rpc_msg msg;
+    size_t data_len, payload = size;
+    u64 nums[4] = { 0 }, value;
+    int len, i;
+
+    for (i = 0; i < 4; i++) {
+        size_t n = min_t(size_t, size, i * 16 + 1);
+
+        memcpy(strs[i], data, n);
+        strs[i][n] = '\0';
+        if (size >= 8 * (i + 1))
+            memcpy(&nums[i], data + 8 * i, 8);
+    }
+
+    /* Even sizes get a buffer that may be too small */
+    vtfs_rpc_begin(&b, frame, size % 2 ? sizeof(frame) : min(size, sizeof(frame)),
+                   VTFS_RPC_WRITE, 0, size);
+    for (i = 0; i < 4; i++) {
+        vtfs_rpc_put_str(&b, str_tags[i], strs[i]);
+        vtfs_rpc_put_u64(&b, num_tags[i], nums[i]);
+    }
+    vtfs_rpc_put_data(&b, VTFS_RPC_DATA, payload);
+    len = vtfs_rpc_end(&b, payload);
+    if (len < 0) {
+        if (len != -EMSGSIZE || size % 2)
+            abort();
+        return;
+    }
+
+    wire = malloc(len + payload);
+    if (!wire)
+        return;
+    memcpy(wire, frame, len);
+    memcpy(wire + len, data, payload);
+
+    if (vtfs_rpc_parse_header(wire, &msg.hdr) || msg.hdr.op != VTFS_RPC_WRITE ||
+        msg.hdr.id != size || msg.hdr.count != 9 ||
+        msg.hdr.len != len - VTFS_RPC_HEADER_SIZE + payload ||
+        vtfs_rpc_parse_fields(&msg, wire + VTFS_RPC_HEADER_SIZE, msg.hdr.len, &data_len) ||
+        data_len != payload || msg.field[VTFS_RPC_DATA].len != payload ||
+        memcmp(msg.field[VTFS_RPC_DATA].value, data, payload) != 0)
+        abort();
+
+    for (i = 0; i < 4; i++) {
+        if (vtfs_rpc_get_str(&msg, str_tags[i], out, sizeof(out)) || strcmp(out, strs[i]) != 0)
+            abort();
+        if (vtfs_rpc_get_u64(&msg, num_tags[i], &value) || value != nums[i])
+            abort();
+    }
+
+    free(wire);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    parse_all(data, size);
+    round_trip(data, size);
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Runs a libFuzzer harness without libFuzzer: each file argument is one
+ * input (a saved crash or corpus entry). Without arguments it feeds
+ * pseudo-random inputs, which is enough for a quick sanitizer run on gcc.
+ */
+#include "vtfs_shim.h"
+
+#define RANDOM_RUNS 50000
+#define RANDOM_MAX_SIZE 4096
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static int run_file(const char *name)
+{
+    FILE *f = fopen(name, "rb");
+    uint8_t *buf = NULL;
+    long size;
+
+    if (!f)
+        return -errno;
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+        fseek(f, 0, SEEK_SET) == 0 && (buf = malloc(size + 1)) &&
+        fread(buf, 1, size, f) == (size_t)size) {
+        LLVMFuzzerTestOneInput(buf, size);
+        free(buf);
+        fclose(f);
+        return 0;
+    }
+
+    free(buf);
+    fclose(f);
+    return -EIO;
+}
+
+/* Mostly printable bytes, so the parsers get past their first strstr() */
+static void run_random(void)
+{
+    static const char alphabet[] =
+        "HTTP/1.1 200\r\n:{}[]\",=-+/0123456789abcdefABCDEF"
+        "Content-Length Transfer-Encoding chunked result data size";
+    uint8_t *buf = malloc(RANDOM_MAX_SIZE);
+    size_t size, i;
+    int run;
+
+    srand(1);
+    for (run = 0; run < RANDOM_RUNS; run++) {
+        size = rand() % RANDOM_MAX_SIZE;
+        for (i = 0; i < size; i++)
+            buf[i] = rand() % 8 ? alphabet[rand() % (sizeof(alphabet) - 1)] : rand();
+        LLVMFuzzerTestOneInput(buf, size);
+    }
+    free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    int i, ret;
+
+    if (argc < 2) {
+        run_random();
+        return 0;
+    }
+
+    for (i = 1; i < argc; i++) {
+        ret = run_file(argv[i]);
+        if (ret) {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(-ret));
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "vtfs_shim.h"
+#include "storage.h"
+#include "super.h"
+#include "vtfs.h"
+
+/*
+ * The benchmark measures the in-memory store alone: remote sync is a no-op,
+ * as with cache=offline, and stats are dropped.
+ */
+
+void vtfs_stat_op(struct vtfs_stats __percpu *stats, enum vtfs_stat_op op,
+                  u64 start, bool error)
+{
+}
+
+int vtfs_remote_create(struct vtfs_sb_info *sbi, const char *path, umode_t mode)
+{
+    return 0;
+}
+
+int vtfs_remote_delete(struct vtfs_sb_info *sbi, const char *path)
+{
+    return 0;
+}
+
+int vtfs_remote_write(struct vtfs_sb_info *sbi, const char *path,
+                      const char *data, size_t len, loff_t offset)
+{
+    return 0;
+}
+
+int vtfs_remote_write_delta(struct vtfs_sb_info *sbi, const char *path,
+                            const char *data, size_t len, loff_t offset)
+{
+    return 0;
+}
+
+int vtfs_remote_link(struct vtfs_sb_info *sbi, const char *oldpath,
+                     const char *newpath)
+{
+    return 0;
+}
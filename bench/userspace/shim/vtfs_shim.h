@@ -0,0 +1,276 @@
+#ifndef _VTFS_SHIM_H
+#define _VTFS_SHIM_H
+
+/*
+ * Just enough of the kernel API for storage.c and codec.c to build as
+ * ordinary C. Every <linux/...> header they include resolves to this file
+ * (the Makefile generates the one-line forwarders).
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Types */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef unsigned short umode_t;
+typedef s64 time64_t;
+typedef unsigned int gfp_t;
+
+typedef struct {
+    long long counter;
+} atomic64_t;
+
+struct timespec64 {
+    time64_t tv_sec;
+    long tv_nsec;
+};
+
+#define __percpu
+#define __user
+#define __packed __attribute__((packed))
+
+/* Helpers */
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define min(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define max_t(type, a, b) max((type)(a), (type)(b))
+#define U16_MAX ((u16)~0U)
+
+#define MAX_ERRNO 4095
+
+static inline void *ERR_PTR(long error)
+{
+    return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+    return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+    return (unsigned long)ptr >= (unsigned long)-MAX_ERRNO;
+}
+
+/* Logging */
+
+#define KERN_INFO ""
+#define KERN_ERR ""
+#define KERN_DEBUG ""
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+
+/* x86 SIMD; userspace may use vector registers anywhere */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONFIG_X86 1
+
+#define X86_FEATURE_SSSE3 "ssse3"
+#define X86_FEATURE_AVX2 "avx2"
+#define XFEATURE_MASK_SSE 0x2
+#define XFEATURE_MASK_YMM 0x4
+
+#define boot_cpu_has(feature) __builtin_cpu_supports(feature)
+#define cpu_has_xfeatures(mask, name) 1
+#define irq_fpu_usable() true
+#define kernel_fpu_begin() do { } while (0)
+#define kernel_fpu_end() do { } while (0)
+#endif
+
+/* Allocation */
+
+#define GFP_KERNEL 0u
+#define GFP_ATOMIC 0u
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+    (void)flags;
+    return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+    (void)flags;
+    return calloc(1, size);
+}
+
+static inline void *krealloc(void *ptr, size_t size, gfp_t flags)
+{
+    (void)flags;
+    return realloc(ptr, size);
+}
+
+#define kvmalloc kmalloc
+#define kfree free
+#define kvfree free
+
+/* Strings; glibc before 2.38 has no strlcat, so always use ours */
+
+static inline size_t vtfs_shim_strlcat(char *dst, const char *src, size_t size)
+{
+    size_t dlen = strnlen(dst, size);
+    size_t slen = strlen(src);
+
+    if (dlen == size)
+        return size + slen;
+    if (slen >= size - dlen)
+        slen = size - dlen - 1;
+    memcpy(dst + dlen, src, slen);
+    dst[dlen + slen] = '\0';
+    return dlen + slen;
+}
+#define strlcat vtfs_shim_strlcat
+
+#define simple_strtoul strtoul
+#define simple_strtol strtol
+
+/* Time */
+
+#define HZ 1000
+
+static inline u64 ktime_get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void ktime_get_real_ts64(struct timespec64 *ts)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    ts->tv_sec = now.tv_sec;
+    ts->tv_nsec = now.tv_nsec;
+}
+
+#define jiffies ((unsigned long)(ktime_get_ns() / (1000000000ull / HZ)))
+#define msecs_to_jiffies(ms) ((unsigned long)(ms) * HZ / 1000)
+
+/* Locking; a real lock so lock_wait stays part of what is measured */
+
+typedef pthread_spinlock_t spinlock_t;
+
+#define spin_lock_init(lock) pthread_spin_init(lock, PTHREAD_PROCESS_PRIVATE)
+#define spin_lock(lock) pthread_spin_lock(lock)
+#define spin_unlock(lock) pthread_spin_unlock(lock)
+#define spin_lock_irqsave(lock, flags) \
+    do { (flags) = 0; pthread_spin_lock(lock); } while (0)
+#define spin_unlock_irqrestore(lock, flags) \
+    do { (void)(flags); pthread_spin_unlock(lock); } while (0)
+
+/* Only embedded in vtfs_sb_info, never used by the code built here */
+struct mutex {
+    int unused;
+};
+
+struct delayed_work {
+    int unused;
+};
+
+struct super_block {
+    void *s_fs_info;
+};
+
+/* Lists */
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void __list_add(struct list_head *entry, struct list_head *prev,
+                              struct list_head *next)
+{
+    next->prev = entry;
+    entry->next = next;
+    entry->prev = prev;
+    prev->next = entry;
+}
+
+static inline void list_add(struct list_head *entry, struct list_head *head)
+{
+    __list_add(entry, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *entry, struct list_head *head)
+{
+    __list_add(entry, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+    return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry((ptr)->next, type, member)
+#define list_next_entry(pos, member) \
+    list_entry((pos)->member.next, __typeof__(*(pos)), member)
+
+#define list_for_each_entry(pos, head, member)                          \
+    for (pos = list_first_entry(head, __typeof__(*pos), member);        \
+         &pos->member != (head);                                        \
+         pos = list_next_entry(pos, member))
+
+#define list_for_each_entry_safe(pos, n, head, member)                  \
+    for (pos = list_first_entry(head, __typeof__(*pos), member),        \
+         n = list_next_entry(pos, member);                              \
+         &pos->member != (head);                                        \
+         pos = n, n = list_next_entry(n, member))
+
+/* Tracepoints compile to empty inlines */
+
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define TRACE_DEFINE_ENUM(x)
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args) \
+    static inline void trace_##name(proto) {}
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+    static inline void trace_##name(proto) {}
+
+#endif
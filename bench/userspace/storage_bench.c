@@ -0,0 +1,466 @@
+/*
+ * Throughput of the in-memory store (storage.c) and the wire codecs
+ * (codec.c) outside the kernel. One result per line, key=value pairs:
+ *
+ *   entries=100000 op=lookup ops=1000000 ns_per_op=85.2 ops_per_sec=11737089
+ *   bytes=4096 op=base64_encode impl=avx2 ops=... ns_per_op=... gb_per_sec=...
+ *   bytes=4096 op=parse_response ops=... ns_per_op=... mb_per_sec=...
+ *
+ * Creating the tree is always done in full. The other phases stop after
+ * as many operations as there are entries or after the time budget,
+ * whichever comes first, so O(n) operations stay measurable at 10M.
+ */
+#include <getopt.h>
+
+#include "vtfs_shim.h"
+#include "storage.h"
+#include "super.h"
+#include "codec.h"
+
+#define DEFAULT_SIZES "1000,10000,100000,1000000"
+#define DEFAULT_FANOUT 1000
+#define DEFAULT_IO_SIZE 4096
+#define DEFAULT_BUDGET_MS 2000
+#define MAX_SIZES 16
+/* Body bytes per receive on a streamed read (VTFS_HTTP_RECV_SIZE) */
+#define STREAM_PIECE 16384
+
+struct bench {
+    struct vtfs_sb_info *sbi;
+    struct vtfs_entry **dirs;
+    struct vtfs_entry **files;
+    unsigned long nr_files;
+    unsigned long nr_dirs;
+    unsigned int fanout;
+    size_t io_size;
+    char *io_buf;
+    u64 budget_ns;
+    u64 rng;
+};
+
+struct phase {
+    const char *name;
+    unsigned long limit;
+    u64 start;
+    unsigned long ops;
+};
+
+static u64 next_random(struct bench *b)
+{
+    /* xorshift64 */
+    b->rng ^= b->rng << 13;
+    b->rng ^= b->rng >> 7;
+    b->rng ^= b->rng << 17;
+    return b->rng;
+}
+
+static void format_name(char *buf, char prefix, unsigned long n)
+{
+    char digits[24];
+    int len = 0;
+
+    do {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+
+    *buf++ = prefix;
+    while (len)
+        *buf++ = digits[--len];
+    *buf = '\0';
+}
+
+static void phase_begin(struct phase *p, const char *name, unsigned long limit)
+{
+    p->name = name;
+    p->limit = limit;
+    p->ops = 0;
+    p->start = ktime_get_ns();
+}
+
+/* Checks the clock every 64 operations to keep it out of the measurement */
+static bool phase_more(struct bench *b, struct phase *p)
+{
+    if (p->ops >= p->limit)
+        return false;
+    if ((p->ops & 63) == 0 && p->ops && b->budget_ns &&
+        ktime_get_ns() - p->start >= b->budget_ns)
+        return false;
+    return true;
+}
+
+static void phase_end(struct bench *b, struct phase *p)
+{
+    u64 elapsed = ktime_get_ns() - p->start;
+    double ns_per_op = p->ops ? (double)elapsed / p->ops : 0;
+
+    printf("entries=%lu op=%s ops=%lu ns_per_op=%.1f ops_per_sec=%.0f\n",
+           b->nr_files, p->name, p->ops, ns_per_op,
+           elapsed ? p->ops * 1e9 / elapsed : 0);
+    fflush(stdout);
+}
+
+static struct vtfs_entry *file_dir(struct bench *b, unsigned long i)
+{
+    return b->dirs[i / b->fanout];
+}
+
+static int setup(struct bench *b)
+{
+    char name[32];
+    unsigned long i;
+
+    b->sbi = calloc(1, sizeof(*b->sbi));
+    if (!b->sbi || vtfs_storage_init(b->sbi))
+        return -ENOMEM;
+
+    b->nr_dirs = (b->nr_files + b->fanout - 1) / b->fanout;
+    b->dirs = calloc(b->nr_dirs, sizeof(*b->dirs));
+    b->files = calloc(b->nr_files, sizeof(*b->files));
+    if (!b->dirs || !b->files)
+        return -ENOMEM;
+
+    for (i = 0; i < b->nr_dirs; i++) {
+        format_name(name, 'd', i);
+        b->dirs[i] = vtfs_storage_create_entry(b->sbi, b->sbi->storage.root,
+                                               name, S_IFDIR | 0777, 0);
+        if (IS_ERR(b->dirs[i]))
+            return PTR_ERR(b->dirs[i]);
+    }
+
+    return 0;
+}
+
+static void teardown(struct bench *b)
+{
+    if (b->sbi) {
+        vtfs_storage_cleanup(b->sbi);
+        free(b->sbi);
+    }
+    free(b->dirs);
+    free(b->files);
+    b->sbi = NULL;
+    b->dirs = NULL;
+    b->files = NULL;
+}
+
+static int run_storage(struct bench *b)
+{
+    struct vtfs_entry *entry;
+    struct phase p;
+    char name[32];
+    char path[64];
+    unsigned long i;
+    int ret;
+
+    ret = setup(b);
+    if (ret)
+        return ret;
+
+    phase_begin(&p, "create", b->nr_files);
+    for (i = 0; i < b->nr_files; i++, p.ops++) {
+        format_name(name, 'f', i);
+        entry = vtfs_storage_create_entry(b->sbi, file_dir(b, i), name,
+                                          S_IFREG | 0777, 0);
+        if (IS_ERR(entry))
+            return PTR_ERR(entry);
+        b->files[i] = entry;
+    }
+    phase_end(b, &p);
+
+    phase_begin(&p, "lookup", b->nr_files);
+    for (; phase_more(b, &p); p.ops++) {
+        i = next_random(b) % b->nr_files;
+        format_name(name, 'f', i);
+        if (vtfs_storage_lookup(b->sbi, file_dir(b, i), name) != b->files[i])
+            return -ENOENT;
+    }
+    phase_end(b, &p);
+
+    phase_begin(&p, "lookup_path", b->nr_files);
+    for (; phase_more(b, &p); p.ops++) {
+        i = next_random(b) % b->nr_files;
+        path[0] = '/';
+        format_name(path + 1, 'd', i / b->fanout);
+        strcat(path, "/");
+        format_name(path + strlen(path), 'f', i);
+        if (vtfs_storage_lookup_path(b->sbi, path) != b->files[i])
+            return -ENOENT;
+    }
+    phase_end(b, &p);
+
+    /* Every VFS file operation starts by finding the entry by inode number */
+    phase_begin(&p, "get_by_ino", b->nr_files);
+    for (; phase_more(b, &p); p.ops++) {
+        entry = b->files[next_random(b) % b->nr_files];
+        if (vtfs_storage_get_by_ino(b->sbi, entry->ino) != entry)
+            return -ENOENT;
+    }
+    phase_end(b, &p);
+
+    phase_begin(&p, "write", b->nr_files);
+    for (; phase_more(b, &p); p.ops++) {
+        entry = b->files[next_random(b) % b->nr_files];
+        ret = vtfs_storage_write(b->sbi, entry, b->io_buf, b->io_size, 0);
+        if (ret < 0)
+            return ret;
+    }
+    phase_end(b, &p);
+
+    phase_begin(&p, "read", b->nr_files);
+    for (; phase_more(b, &p); p.ops++) {
+        entry = b->files[next_random(b) % b->nr_files];
+        ret = vtfs_storage_read(b->sbi, entry, b->io_buf, b->io_size, 0);
+        if (ret < 0)
+            return ret;
+    }
+    phase_end(b, &p);
+
+    /* Newest first; whatever the budget leaves is freed by teardown */
+    phase_begin(&p, "delete", b->nr_files);
+    for (; phase_more(b, &p); p.ops++) {
+        ret = vtfs_storage_delete_entry(b->sbi, b->files[b->nr_files - 1 - p.ops]);
+        if (ret)
+            return ret;
+    }
+    phase_end(b, &p);
+
+    teardown(b);
+    return 0;
+}
+
+static void codec_result(struct bench *b, const char *name, unsigned long ops,
+                         u64 start)
+{
+    u64 elapsed = ktime_get_ns() - start;
+
+    printf("bytes=%zu op=%s ops=%lu ns_per_op=%.1f mb_per_sec=%.1f\n",
+           b->io_size, name, ops, ops ? (double)elapsed / ops : 0,
+           elapsed ? (double)b->io_size * ops * 1e3 / elapsed : 0);
+}
+
+static void base64_result(struct bench *b, const char *name, int impl,
+                          unsigned long ops, u64 start)
+{
+    u64 elapsed = ktime_get_ns() - start;
+
+    printf("bytes=%zu op=%s impl=%s ops=%lu ns_per_op=%.1f gb_per_sec=%.3f\n",
+           b->io_size, name, vtfs_base64_impl_name(impl), ops,
+           ops ? (double)elapsed / ops : 0,
+           elapsed ? (double)b->io_size * ops / elapsed : 0);
+}
+
+/* Every base64 implementation the CPU has, each checked against the scalar one */
+static int run_base64(struct bench *b, u64 budget)
+{
+    size_t encoded_size = VTFS_BASE64_SIZE(b->io_size);
+    char *reference = malloc(encoded_size);
+    char *encoded = malloc(encoded_size);
+    unsigned char *decoded = malloc(b->io_size);
+    unsigned long ops;
+    size_t len = 0;
+    u64 start;
+    int impl;
+    int ret = -ENOMEM;
+
+    if (!reference || !encoded || !decoded)
+        goto out;
+
+    vtfs_base64_impl = VTFS_BASE64_SCALAR;
+    vtfs_base64_encode(b->io_buf, b->io_size, reference, encoded_size);
+
+    ret = -EINVAL;
+    for (impl = VTFS_BASE64_SCALAR; impl <= vtfs_base64_best; impl++) {
+        vtfs_base64_impl = impl;
+
+        start = ktime_get_ns();
+        for (ops = 0; ktime_get_ns() - start < budget; ops++)
+            vtfs_base64_encode(b->io_buf, b->io_size, encoded, encoded_size);
+        base64_result(b, "base64_encode", impl, ops, start);
+        if (strcmp(encoded, reference) != 0) {
+            fprintf(stderr, "base64 encode mismatch: %s\n", vtfs_base64_impl_name(impl));
+            goto out;
+        }
+
+        start = ktime_get_ns();
+        for (ops = 0; ktime_get_ns() - start < budget; ops++) {
+            len = b->io_size;
+            vtfs_base64_decode(encoded, decoded, &len);
+        }
+        base64_result(b, "base64_decode", impl, ops, start);
+        if (len != b->io_size || memcmp(decoded, b->io_buf, len) != 0) {
+            fprintf(stderr, "base64 round trip mismatch: %s\n", vtfs_base64_impl_name(impl));
+            goto out;
+        }
+    }
+
+    ret = 0;
+out:
+    vtfs_base64_impl = vtfs_base64_best;
+    free(reference);
+    free(encoded);
+    free(decoded);
+    return ret;
+}
+
+static int run_codec(struct bench *b)
+{
+    size_t encoded_size = VTFS_BASE64_SIZE(b->io_size);
+    size_t response_size = encoded_size + 256;
+    char *encoded = malloc(encoded_size);
+    char *response = malloc(response_size);
+    char *body = malloc(response_size);
+    unsigned char *decoded = malloc(b->io_size);
+    size_t body_len;
+    u64 budget = b->budget_ns ? b->budget_ns / 4 : 250000000ull;
+    unsigned long ops;
+    u64 start;
+    int status;
+    int ret = -ENOMEM;
+
+    if (!encoded || !response || !body || !decoded)
+        goto out;
+
+    ret = run_base64(b, budget);
+    if (ret)
+        goto out;
+    vtfs_base64_encode(b->io_buf, b->io_size, encoded, encoded_size);
+
+    /* A read reply as the server sends it; the body is what gets copied */
+    snprintf(response, response_size,
+             "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\n\r\n{\"result\":{\"data\":\"%s\"}}",
+             strlen(encoded) + 22, encoded);
+
+    start = ktime_get_ns();
+    for (ops = 0; ktime_get_ns() - start < budget; ops++)
+        vtfs_parse_http_response(response, body, response_size, &status);
+    codec_result(b, "parse_response", ops, start);
+
+    start = ktime_get_ns();
+    for (ops = 0; ktime_get_ns() - start < budget; ops++)
+        vtfs_json_string(body, "data", encoded, encoded_size);
+    codec_result(b, "json_string", ops, start);
+
+    /* What a streamed read does instead of the three steps above and a decode */
+    body_len = strlen(body);
+    start = ktime_get_ns();
+    for (ops = 0; ktime_get_ns() - start < budget; ops++) {
+        struct vtfs_data_stream stream;
+        size_t pos, used, out_len, copied = 0;
+
+        vtfs_data_stream_init(&stream, b->io_size);
+        for (pos = 0; pos < body_len; pos += used) {
+            out_len = stream.want;
+            used = vtfs_data_stream_feed(&stream, body + pos,
+                                         min_t(size_t, body_len - pos, STREAM_PIECE),
+                                         decoded + copied, &out_len);
+            copied += out_len;
+        }
+    }
+    codec_result(b, "read_reply_stream", ops, start);
+    if (memcmp(decoded, b->io_buf, b->io_size) != 0) {
+        fprintf(stderr, "streamed read reply mismatch\n");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    ret = 0;
+out:
+    free(encoded);
+    free(response);
+    free(body);
+    free(decoded);
+    return ret;
+}
+
+static int parse_sizes(const char *arg, unsigned long *sizes)
+{
+    char *copy = strdup(arg);
+    char *tok, *save = NULL;
+    int n = 0;
+
+    for (tok = strtok_r(copy, ",", &save); tok && n < MAX_SIZES;
+         tok = strtok_r(NULL, ",", &save))
+        sizes[n++] = strtoul(tok, NULL, 0);
+
+    free(copy);
+    return n;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n sizes] [-f fanout] [-s io_size] [-t budget_ms]\n"
+            "  -n  comma separated entry counts (default " DEFAULT_SIZES ")\n"
+            "  -f  files per directory (default %d)\n"
+            "  -s  bytes per read/write and codec buffer (default %d)\n"
+            "  -t  time budget per phase in ms, 0 for none (default %d)\n",
+            prog, DEFAULT_FANOUT, DEFAULT_IO_SIZE, DEFAULT_BUDGET_MS);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench b = { .rng = 0x9e3779b97f4a7c15ull };
+    unsigned long sizes[MAX_SIZES];
+    int nr_sizes = parse_sizes(DEFAULT_SIZES, sizes);
+    u64 budget_ms = DEFAULT_BUDGET_MS;
+    size_t i;
+    int opt, ret;
+
+    b.fanout = DEFAULT_FANOUT;
+    b.io_size = DEFAULT_IO_SIZE;
+
+    while ((opt = getopt(argc, argv, "n:f:s:t:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            nr_sizes = parse_sizes(optarg, sizes);
+            break;
+        case 'f':
+            b.fanout = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            b.io_size = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            budget_ms = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    if (!b.fanout || !b.io_size || b.io_size > VTFS_MAX_FILE_SIZE) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    b.budget_ns = budget_ms * 1000000ull;
+    b.io_buf = malloc(b.io_size);
+    if (!b.io_buf)
+        return 1;
+    for (i = 0; i < b.io_size; i++)
+        b.io_buf[i] = (char)next_random(&b);
+
+    vtfs_codec_init();
+    ret = run_codec(&b);
+    if (ret) {
+        fprintf(stderr, "codec: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    for (i = 0; i < (size_t)nr_sizes; i++) {
+        if (!sizes[i])
+            continue;
+        b.nr_files = sizes[i];
+        ret = run_storage(&b);
+        if (ret) {
+            fprintf(stderr, "entries=%lu: %s\n", b.nr_files, strerror(-ret));
+            return 1;
+        }
+    }
+
+    free(b.io_buf);
+    return 0;
+}
@@ -0,0 +1,842 @@
+/*
+ * End-to-end workloads against a mounted file system, usually vtfs with
+ * tmpfs as the baseline. Results go to stdout, one line per operation in
+ * the key=value form used by bench/userspace:
+ *
+ *   fs=vtfs workload=files op=create ops=10000 seconds=2.100 ops_per_sec=4761
+ *       p50_us=180.2 p99_us=950.0 p999_us=2400.1 max_us=5100.0
+ *
+ * With -b the same workloads run on the baseline directory afterwards and
+ * a compare line (target / baseline) follows for every operation.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VTFS_MAGIC 0x56544653
+#define TMPFS_MAGIC 0x01021994
+
+#define MAX_RESULTS 64
+#define PATH_LEN 512
+
+typedef uint64_t u64;
+
+struct config {
+    const char *workloads;
+    unsigned long files;        /* small-file storm size */
+    size_t small_size;
+    size_t large_size;          /* per file, vtfs caps files at 1 MiB */
+    unsigned long large_files;
+    size_t block_size;
+    unsigned long random_ops;
+    size_t random_size;
+    unsigned int tree_depth;
+    unsigned int tree_fanout;
+    unsigned long ls_entries;
+    unsigned int ls_repeat;
+    unsigned int threads;
+    unsigned int duration_s;
+    unsigned long mixed_files;
+};
+
+struct samples {
+    u64 *ns;
+    size_t n;
+    size_t cap;
+};
+
+struct summary {
+    char workload[16];
+    char op[16];
+    double ops_per_sec;
+    double p50, p99, p999;
+};
+
+struct run {
+    const struct config *cfg;
+    const char *label;
+    char root[PATH_LEN];
+    char *buf;
+    struct summary results[MAX_RESULTS];
+    int nr_results;
+};
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void die(const char *what, const char *path)
+{
+    fprintf(stderr, "%s %s: %s\n", what, path ? path : "", strerror(errno));
+    exit(1);
+}
+
+static void samples_add(struct samples *s, u64 ns)
+{
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->ns = realloc(s->ns, s->cap * sizeof(*s->ns));
+        if (!s->ns)
+            die("realloc", NULL);
+    }
+    s->ns[s->n++] = ns;
+}
+
+static void samples_merge(struct samples *dst, const struct samples *src)
+{
+    size_t i;
+
+    for (i = 0; i < src->n; i++)
+        samples_add(dst, src->ns[i]);
+}
+
+static void samples_free(struct samples *s)
+{
+    free(s->ns);
+    memset(s, 0, sizeof(*s));
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile in microseconds; samples must be sorted */
+static double percentile_us(const struct samples *s, double p)
+{
+    size_t rank;
+
+    if (!s->n)
+        return 0;
+    rank = (size_t)(p * s->n + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > s->n)
+        rank = s->n;
+    return s->ns[rank - 1] / 1000.0;
+}
+
+/*
+ * Prints one result line. elapsed is wall time for all samples; with
+ * several threads it is shorter than their sum.
+ */
+static void report(struct run *r, const char *workload, const char *op,
+                   struct samples *s, u64 elapsed, u64 bytes)
+{
+    struct summary *sum;
+    double seconds = elapsed / 1e9;
+
+    qsort(s->ns, s->n, sizeof(*s->ns), cmp_u64);
+
+    printf("fs=%s workload=%s op=%s ops=%zu seconds=%.3f ops_per_sec=%.0f "
+           "p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f",
+           r->label, workload, op, s->n, seconds,
+           seconds > 0 ? s->n / seconds : 0,
+           percentile_us(s, 0.50), percentile_us(s, 0.99),
+           percentile_us(s, 0.999), percentile_us(s, 1.0));
+    if (bytes)
+        printf(" mb_per_sec=%.1f", seconds > 0 ? bytes / seconds / (1 << 20) : 0);
+    printf("\n");
+    fflush(stdout);
+
+    if (r->nr_results < MAX_RESULTS) {
+        sum = &r->results[r->nr_results++];
+        snprintf(sum->workload, sizeof(sum->workload), "%s", workload);
+        snprintf(sum->op, sizeof(sum->op), "%s", op);
+        sum->ops_per_sec = seconds > 0 ? s->n / seconds : 0;
+        sum->p50 = percentile_us(s, 0.50);
+        sum->p99 = percentile_us(s, 0.99);
+        sum->p999 = percentile_us(s, 0.999);
+    }
+}
+
+static void path_join(char *dst, const char *dir, const char *fmt, unsigned long n)
+{
+    int len = snprintf(dst, PATH_LEN, "%s/", dir);
+
+    snprintf(dst + len, PATH_LEN - len, fmt, n);
+}
+
+static void make_dir(const char *path)
+{
+    if (mkdir(path, 0755) && errno != EEXIST)
+        die("mkdir", path);
+}
+
+/* Writes len bytes at offset with one pwrite per block */
+static void fill_file(const char *path, char *buf, size_t len, size_t block)
+{
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    size_t done, n;
+
+    if (fd < 0)
+        die("open", path);
+    for (done = 0; done < len; done += n) {
+        n = len - done < block ? len - done : block;
+        if (pwrite(fd, buf, n, done) != (ssize_t)n)
+            die("pwrite", path);
+    }
+    close(fd);
+}
+
+/* rm -r without following symlinks; untimed cleanup */
+static void remove_tree(const char *path)
+{
+    char child[PATH_LEN];
+    struct dirent *de;
+    DIR *dir = opendir(path);
+
+    if (!dir) {
+        unlink(path);
+        return;
+    }
+    while ((de = readdir(dir))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+        if (de->d_type == DT_DIR)
+            remove_tree(child);
+        else
+            unlink(child);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+static u64 xorshift(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* Small-file storm: create+write, stat, unlink */
+
+static void workload_files(struct run *r)
+{
+    const struct config *cfg = r->cfg;
+    struct samples s = { 0 };
+    char dir[PATH_LEN], path[PATH_LEN];
+    struct stat st;
+    unsigned long i;
+    u64 start, t;
+    int fd;
+
+    path_join(dir, r->root, "files", 0);
+    make_dir(dir);
+
+    start = now_ns();
+    for (i = 0; i < cfg->files; i++) {
+        path_join(path, dir, "f%lu", i);
+        t = now_ns();
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0)
+            die("open", path);
+        if (cfg->small_size && write(fd, r->buf, cfg->small_size) != (ssize_t)cfg->small_size)
+            die("write", path);
+        close(fd);
+        samples_add(&s, now_ns() - t);
+    }
+    report(r, "files", "create", &s, now_ns() - start, cfg->files * cfg->small_size);
+    samples_free(&s);
+
+    start = now_ns();
+    for (i = 0; i < cfg->files; i++) {
+        path_join(path, dir, "f%lu", i);
+        t = now_ns();
+        if (stat(path, &st))
+            die("stat", path);
+        samples_add(&s, now_ns() - t);
+    }
+    report(r, "files", "stat", &s, now_ns() - start, 0);
+    samples_free(&s);
+
+    start = now_ns();
+    for (i = 0; i < cfg->files; i++) {
+        path_join(path, dir, "f%lu", i);
+        t = now_ns();
+        if (unlink(path))
+            die("unlink", path);
+        samples_add(&s, now_ns() - t);
+    }
+    report(r, "files", "unlink", &s, now_ns() - start, 0);
+    samples_free(&s);
+
+    rmdir(dir);
+}
+
+/* Large sequential I/O in block_size calls */
+
+static void workload_seq(struct run *r)
+{
+    const struct config *cfg = r->cfg;
+    struct samples s = { 0 };
+    char dir[PATH_LEN], path[PATH_LEN];
+    unsigned long i;
+    size_t done, n;
+    u64 start, t;
+    int fd;
+
+    path_join(dir, r->root, "seq", 0);
+    make_dir(dir);
+
+    start = now_ns();
+    for (i = 0; i < cfg->large_files; i++) {
+        path_join(path, dir, "f%lu", i);
+        fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            die("open", path);
+        for (done = 0; done < cfg->large_size; done += n) {
+            n = cfg->large_size - done < cfg->block_size ?
+                cfg->large_size - done : cfg->block_size;
+            t = now_ns();
+            if (write(fd, r->buf, n) != (ssize_t)n)
+                die("write", path);
+            samples_add(&s, now_ns() - t);
+        }
+        close(fd);
+    }
+    report(r, "seq", "write", &s, now_ns() - start, cfg->large_files * cfg->large_size);
+    samples_free(&s);
+
+    start = now_ns();
+    for (i = 0; i < cfg->large_files; i++) {
+        path_join(path, dir, "f%lu", i);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            die("open", path);
+        for (;;) {
+            ssize_t ret;
+
+            t = now_ns();
+            ret = read(fd, r->buf, cfg->block_size);
+            if (ret < 0)
+                die("read", path);
+            if (ret == 0)
+                break;
+            samples_add(&s, now_ns() - t);
+        }
+        close(fd);
+    }
+    report(r, "seq", "read", &s, now_ns() - start, cfg->large_files * cfg->large_size);
+    samples_free(&s);
+
+    remove_tree(dir);
+}
+
+/* Random aligned I/O inside one file */
+
+static void workload_random(struct run *r)
+{
+    const struct config *cfg = r->cfg;
+    struct samples s = { 0 };
+    char path[PATH_LEN];
+    unsigned long i, blocks = cfg->large_size / cfg->random_size;
+    u64 rng = 88172645463325252ull;
+    u64 start, t;
+    off_t off;
+    int fd;
+
+    if (!blocks)
+        return;
+
+    path_join(path, r->root, "random", 0);
+    fill_file(path, r->buf, cfg->large_size, cfg->block_size);
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+        die("open", path);
+
+    start = now_ns();
+    for (i = 0; i < cfg->random_ops; i++) {
+        off = (off_t)(xorshift(&rng) % blocks) * cfg->random_size;
+        t = now_ns();
+        if (pread(fd, r->buf, cfg->random_size, off) != (ssize_t)cfg->random_size)
+            die("pread", path);
+        samples_add(&s, now_ns() - t);
+    }
+    report(r, "random", "read", &s, now_ns() - start, cfg->random_ops * cfg->random_size);
+    samples_free(&s);
+
+    start = now_ns();
+    for (i = 0; i < cfg->random_ops; i++) {
+        off = (off_t)(xorshift(&rng) % blocks) * cfg->random_size;
+        t = now_ns();
+        if (pwrite(fd, r->buf, cfg->random_size, off) != (ssize_t)cfg->random_size)
+            die("pwrite", path);
+        samples_add(&s, now_ns() - t);
+    }
+    report(r, "random", "write", &s, now_ns() - start, cfg->random_ops * cfg->random_size);
+    samples_free(&s);
+
+    close(fd);
+    unlink(path);
+}
+
+/* Deep tree: build, then walk with readdir + lstat like find(1) */
+
+static void build_tree(const struct config *cfg, const char *dir, unsigned int depth)
+{
+    char path[PATH_LEN];
+    unsigned int i;
+    int fd;
+
+    make_dir(dir);
+    for (i = 0; i < cfg->tree_fanout; i++) {
+        path_join(path, dir, "f%lu", i);
+        fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            die("open", path);
+        close(fd);
+    }
+    if (depth == cfg->tree_depth)
+        return;
+    for (i = 0; i < cfg->tree_fanout; i++) {
+        path_join(path, dir, "d%lu", i);
+        build_tree(cfg, path, depth + 1);
+    }
+}
+
+static void walk_tree(const char *path, struct samples *readdirs, struct samples *lstats)
+{
+    char child[PATH_LEN];
+    struct dirent *de;
+    struct stat st;
+    u64 t = now_ns();
+    DIR *dir = opendir(path);
+    char (*names)[256] = NULL;
+    size_t n = 0, i;
+
+    if (!dir)
+        die("opendir", path);
+    while ((de = readdir(dir))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        names = realloc(names, (n + 1) * sizeof(*names));
+        if (!names)
+            die("realloc", NULL);
+        snprintf(names[n++], sizeof(*names), "%s", de->d_name);
+    }
+    closedir(dir);
+    samples_add(readdirs, now_ns() - t);
+
+    for (i = 0; i < n; i++) {
+        snprintf(child, sizeof(child), "%s/%s", path, names[i]);
+        t = now_ns();
+        if (lstat(child, &st))
+            die("lstat", child);
+        samples_add(lstats, now_ns() - t);
+        if (S_ISDIR(st.st_mode))
+            walk_tree(child, readdirs, lstats);
+    }
+    free(names);
+}
+
+static void workload_tree(struct run *r)
+{
+    struct samples readdirs = { 0 }, lstats = { 0 };
+    char dir[PATH_LEN];
+    u64 start, elapsed;
+
+    path_join(dir, r->root, "tree", 0);
+    build_tree(r->cfg, dir, 1);
+
+    start = now_ns();
+    walk_tree(dir, &readdirs, &lstats);
+    elapsed = now_ns() - start;
+    report(r, "tree", "readdir", &readdirs, elapsed, 0);
+    report(r, "tree", "lstat", &lstats, elapsed, 0);
+    samples_free(&readdirs);
+    samples_free(&lstats);
+
+    remove_tree(dir);
+}
+
+/* ls -l of one large directory: a full listing per sample plus every lstat */
+
+static void workload_ls(struct run *r)
+{
+    const struct config *cfg = r->cfg;
+    struct samples listings = { 0 }, lstats = { 0 };
+    char dir[PATH_LEN], path[PATH_LEN];
+    struct dirent *de;
+    struct stat st;
+    unsigned long i;
+    unsigned int pass;
+    u64 start, t, t_list;
+    DIR *d;
+    int fd;
+
+    path_join(dir, r->root, "ls", 0);
+    make_dir(dir);
+    for (i = 0; i < cfg->ls_entries; i++) {
+        path_join(path, dir, "entry-%lu", i);
+        fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            die("open", path);
+        close(fd);
+    }
+
+    start = now_ns();
+    for (pass = 0; pass < cfg->ls_repeat; pass++) {
+        t_list = now_ns();
+        d = opendir(dir);
+        if (!d)
+            die("opendir", dir);
+        while ((de = readdir(d))) {
+            if (de->d_name[0] == '.')
+                continue;
+            if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= PATH_LEN)
+                continue;
+            t = now_ns();
+            if (lstat(path, &st))
+                die("lstat", path);
+            samples_add(&lstats, now_ns() - t);
+        }
+        closedir(d);
+        samples_add(&listings, now_ns() - t_list);
+    }
+    report(r, "ls", "listing", &listings, now_ns() - start, 0);
+    report(r, "ls", "lstat", &lstats, now_ns() - start, 0);
+    samples_free(&listings);
+    samples_free(&lstats);
+
+    remove_tree(dir);
+}
+
+/* Mixed load from several threads over a shared file pool */
+
+enum mixed_op { MIXED_STAT, MIXED_READ, MIXED_WRITE, MIXED_CREATE, MIXED_UNLINK, NR_MIXED };
+
+static const char *const mixed_names[NR_MIXED] = {
+    "stat", "read", "write", "create", "unlink",
+};
+
+/* Cumulative percentages: 40 stat, 30 read, 20 write, 5 create, 5 unlink */
+static const unsigned int mixed_mix[NR_MIXED] = { 40, 70, 90, 95, 100 };
+
+struct mixed_thread {
+    pthread_t thread;
+    struct run *run;
+    const char *dir;
+    unsigned int id;
+    u64 deadline;
+    struct samples s[NR_MIXED];
+};
+
+static void *mixed_worker(void *arg)
+{
+    struct mixed_thread *mt = arg;
+    const struct config *cfg = mt->run->cfg;
+    size_t io = cfg->random_size;
+    char *buf = malloc(io);
+    char path[PATH_LEN];
+    unsigned long created = 0, removed = 0;
+    u64 rng = 0x2545f4914f6cdd1dull * (mt->id + 1);
+    unsigned int pick, op;
+    struct stat st;
+    u64 t;
+    int fd, ret;
+
+    if (!buf)
+        die("malloc", NULL);
+    memset(buf, 'm', io);
+
+    while (now_ns() < mt->deadline) {
+        pick = xorshift(&rng) % 100;
+        for (op = 0; pick >= mixed_mix[op]; op++)
+            ;
+        if (op == MIXED_UNLINK && removed == created)
+            op = MIXED_CREATE;
+
+        if (op == MIXED_CREATE || op == MIXED_UNLINK) {
+            char name[32];
+
+            snprintf(name, sizeof(name), "t%u-%%lu", mt->id);
+            path_join(path, mt->dir, name, op == MIXED_CREATE ? created : removed);
+        } else {
+            path_join(path, mt->dir, "pool%lu", xorshift(&rng) % cfg->mixed_files);
+        }
+
+        t = now_ns();
+        switch (op) {
+        case MIXED_STAT:
+            ret = stat(path, &st);
+            break;
+        case MIXED_READ:
+        case MIXED_WRITE:
+            fd = open(path, op == MIXED_READ ? O_RDONLY : O_WRONLY);
+            ret = fd < 0 ? -1 : 0;
+            if (fd >= 0) {
+                off_t off = (off_t)(xorshift(&rng) % (cfg->block_size / io)) * io;
+
+                if (op == MIXED_READ)
+                    ret = pread(fd, buf, io, off) < 0 ? -1 : 0;
+                else
+                    ret = pwrite(fd, buf, io, off) != (ssize_t)io ? -1 : 0;
+                close(fd);
+            }
+            break;
+        case MIXED_CREATE:
+            fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+            ret = fd < 0 ? -1 : close(fd);
+            created++;
+            break;
+        default:
+            ret = unlink(path);
+            removed++;
+            break;
+        }
+        if (ret)
+            die(mixed_names[op], path);
+        samples_add(&mt->s[op], now_ns() - t);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static void workload_mixed(struct run *r)
+{
+    const struct config *cfg = r->cfg;
+    struct mixed_thread *threads = calloc(cfg->threads, sizeof(*threads));
+    struct samples all = { 0 }, s;
+    char dir[PATH_LEN], path[PATH_LEN];
+    unsigned long i;
+    unsigned int t, op;
+    u64 start, elapsed;
+
+    if (!threads || cfg->random_size > cfg->block_size)
+        return;
+
+    path_join(dir, r->root, "mixed", 0);
+    make_dir(dir);
+    for (i = 0; i < cfg->mixed_files; i++) {
+        path_join(path, dir, "pool%lu", i);
+        fill_file(path, r->buf, cfg->block_size, cfg->block_size);
+    }
+
+    start = now_ns();
+    for (t = 0; t < cfg->threads; t++) {
+        threads[t].run = r;
+        threads[t].dir = dir;
+        threads[t].id = t;
+        threads[t].deadline = start + cfg->duration_s * 1000000000ull;
+        if (pthread_create(&threads[t].thread, NULL, mixed_worker, &threads[t]))
+            die("pthread_create", NULL);
+    }
+    for (t = 0; t < cfg->threads; t++)
+        pthread_join(threads[t].thread, NULL);
+    elapsed = now_ns() - start;
+
+    for (op = 0; op < NR_MIXED; op++) {
+        memset(&s, 0, sizeof(s));
+        for (t = 0; t < cfg->threads; t++)
+            samples_merge(&s, &threads[t].s[op]);
+        samples_merge(&all, &s);
+        report(r, "mixed", mixed_names[op], &s, elapsed, 0);
+        samples_free(&s);
+    }
+    report(r, "mixed", "all", &all, elapsed, 0);
+    samples_free(&all);
+
+    for (t = 0; t < cfg->threads; t++)
+        for (op = 0; op < NR_MIXED; op++)
+            samples_free(&threads[t].s[op]);
+    free(threads);
+
+    remove_tree(dir);
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(struct run *r);
+} workloads[] = {
+    { "files", workload_files },
+    { "seq", workload_seq },
+    { "random", workload_random },
+    { "tree", workload_tree },
+    { "ls", workload_ls },
+    { "mixed", workload_mixed },
+};
+
+#define NR_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static bool selected(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = list;
+
+    if (!strcmp(list, "all"))
+        return true;
+    while ((p = strstr(p, name))) {
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+            return true;
+        p += len;
+    }
+    return false;
+}
+
+static const char *fs_label(const char *dir)
+{
+    struct statfs sfs;
+
+    if (statfs(dir, &sfs))
+        die("statfs", dir);
+    switch ((unsigned long)sfs.f_type) {
+    case VTFS_MAGIC:
+        return "vtfs";
+    case TMPFS_MAGIC:
+        return "tmpfs";
+    default:
+        return "other";
+    }
+}
+
+static void run_all(struct run *r, const char *dir)
+{
+    size_t i;
+
+    r->label = fs_label(dir);
+    snprintf(r->root, sizeof(r->root), "%s/vtfs-bench.%d", dir, (int)getpid());
+    make_dir(r->root);
+
+    for (i = 0; i < NR_WORKLOADS; i++)
+        if (selected(r->cfg->workloads, workloads[i].name))
+            workloads[i].fn(r);
+
+    remove_tree(r->root);
+}
+
+static double ratio(double a, double b)
+{
+    return b > 0 ? a / b : 0;
+}
+
+static void compare(const struct run *target, const struct run *base)
+{
+    int i;
+
+    for (i = 0; i < target->nr_results && i < base->nr_results; i++) {
+        const struct summary *t = &target->results[i], *b = &base->results[i];
+
+        printf("compare=%s/%s workload=%s op=%s ops_per_sec_ratio=%.3f "
+               "p50_ratio=%.2f p99_ratio=%.2f p999_ratio=%.2f\n",
+               target->label, base->label, t->workload, t->op,
+               ratio(t->ops_per_sec, b->ops_per_sec), ratio(t->p50, b->p50),
+               ratio(t->p99, b->p99), ratio(t->p999, b->p999));
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] DIR\n"
+            "  -b DIR   baseline directory, e.g. on tmpfs\n"
+            "  -w LIST  workloads: files,seq,random,tree,ls,mixed or all (default)\n"
+            "  -n N     files in the small-file storm (10000)\n"
+            "  -s SIZE  bytes written to each small file (1024)\n"
+            "  -S SIZE  size of each large file (1048576)\n"
+            "  -N N     number of large files (16)\n"
+            "  -B SIZE  block size for sequential I/O and mixed pool files (65536)\n"
+            "  -r N     random I/O operations (10000)\n"
+            "  -R SIZE  random I/O size (4096)\n"
+            "  -d N     tree depth (5), -f N tree fanout (4)\n"
+            "  -l N     entries in the ls directory (100000), -L N listings (3)\n"
+            "  -t N     mixed load threads (4), -T SEC duration (10), -p N pool (1000)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct config cfg = {
+        .workloads = "all",
+        .files = 10000,
+        .small_size = 1024,
+        .large_size = 1 << 20,
+        .large_files = 16,
+        .block_size = 64 << 10,
+        .random_ops = 10000,
+        .random_size = 4096,
+        .tree_depth = 5,
+        .tree_fanout = 4,
+        .ls_entries = 100000,
+        .ls_repeat = 3,
+        .threads = 4,
+        .duration_s = 10,
+        .mixed_files = 1000,
+    };
+    static struct run target, base;
+    const char *baseline = NULL;
+    size_t buf_size;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:w:n:s:S:N:B:r:R:d:f:l:L:t:T:p:h")) != -1) {
+        switch (opt) {
+        case 'b': baseline = optarg; break;
+        case 'w': cfg.workloads = optarg; break;
+        case 'n': cfg.files = strtoul(optarg, NULL, 0); break;
+        case 's': cfg.small_size = strtoul(optarg, NULL, 0); break;
+        case 'S': cfg.large_size = strtoul(optarg, NULL, 0); break;
+        case 'N': cfg.large_files = strtoul(optarg, NULL, 0); break;
+        case 'B': cfg.block_size = strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.random_ops = strtoul(optarg, NULL, 0); break;
+        case 'R': cfg.random_size = strtoul(optarg, NULL, 0); break;
+        case 'd': cfg.tree_depth = strtoul(optarg, NULL, 0); break;
+        case 'f': cfg.tree_fanout = strtoul(optarg, NULL, 0); break;
+        case 'l': cfg.ls_entries = strtoul(optarg, NULL, 0); break;
+        case 'L': cfg.ls_repeat = strtoul(optarg, NULL, 0); break;
+        case 't': cfg.threads = strtoul(optarg, NULL, 0); break;
+        case 'T': cfg.duration_s = strtoul(optarg, NULL, 0); break;
+        case 'p': cfg.mixed_files = strtoul(optarg, NULL, 0); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    if (optind != argc - 1 || !cfg.block_size || !cfg.random_size ||
+        !cfg.threads || !cfg.mixed_files) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    buf_size = cfg.block_size;
+    if (cfg.small_size > buf_size)
+        buf_size = cfg.small_size;
+    if (cfg.random_size > buf_size)
+        buf_size = cfg.random_size;
+
+    target.cfg = base.cfg = &cfg;
+    target.buf = base.buf = malloc(buf_size);
+    if (!target.buf)
+        die("malloc", NULL);
+    memset(target.buf, 'v', buf_size);
+
+    run_all(&target, argv[optind]);
+    if (baseline) {
+        run_all(&base, baseline);
+        compare(&target, &base);
+    }
+
+    free(target.buf);
+    return 0;
+}
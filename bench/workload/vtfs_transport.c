@@ -0,0 +1,547 @@
+/*
+ * Per-request latency of the server protocol over TCP loopback and over a
+ * Unix domain socket, with the same requests the module sends for
+ * metadata: create, stat, list and delete, one at a time on a keep-alive
+ * connection. Both addresses should reach the same server process.
+ *
+ *   transport=tcp op=stat ops=10000 seconds=0.810 ops_per_sec=12345
+ *       p50_us=78.0 p99_us=120.5 p999_us=300.2 max_us=900.0
+ *
+ * With both transports a compare=unix/tcp line follows for every op. With
+ * -r each transport is measured again on a connection upgraded to vtfs-rpc
+ * (proto=rpc; list has no RPC op and is left out), followed by
+ * compare=rpc/http lines. -p keeps that many RPC requests in flight on the
+ * connection, as concurrent callers sharing it do in the module; latency
+ * is then counted from each request's send to its reply.
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_OPS 4
+#define REQUEST_LEN 1024
+#define REPLY_LEN 65536
+#define MAX_DEPTH 256
+
+/* vtfs-rpc/1 as in module/rpc.h */
+#define RPC_HEADER_SIZE 16
+#define RPC_U64 1
+#define RPC_STR 2
+#define RPC_PATH 1
+#define RPC_MODE 5
+#define RPC_KIND 6
+
+typedef uint64_t u64;
+
+enum op { OP_CREATE, OP_STAT, OP_LIST, OP_DELETE };
+
+static const char *const op_names[MAX_OPS] = { "create", "stat", "list", "delete" };
+/* 0: no RPC op */
+static const uint16_t rpc_ops[MAX_OPS] = { 1, 5, 0, 2 };
+
+struct samples {
+    u64 *ns;
+    size_t n;
+};
+
+struct summary {
+    const char *op;
+    double ops_per_sec;
+    double p50, p99, p999;
+};
+
+struct transport {
+    const char *label;
+    const char *address;
+    bool rpc;
+    unsigned int depth;
+    uint32_t next_id;
+    int fd;
+    char reply[REPLY_LEN];
+    struct summary results[MAX_OPS];
+    int nr_results;
+};
+
+static const char *token = "bench";
+static const char *dir = "/vtfs-transport";
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void die(const char *what, const char *detail)
+{
+    fprintf(stderr, "%s %s: %s\n", what, detail ? detail : "",
+            errno ? strerror(errno) : "failed");
+    exit(1);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile in microseconds; samples must be sorted */
+static double percentile_us(const struct samples *s, double p)
+{
+    size_t rank;
+
+    if (!s->n)
+        return 0;
+    rank = (size_t)(p * s->n + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > s->n)
+        rank = s->n;
+    return s->ns[rank - 1] / 1000.0;
+}
+
+/* "http://host:port" or "unix:/path", as in the module's server= option */
+static int connect_to(const char *address)
+{
+    int fd, one = 1;
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+        if (strlen(address + 5) >= sizeof(sun.sun_path)) {
+            errno = ENAMETOOLONG;
+            die("connect", address);
+        }
+        strcpy(sun.sun_path, address + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&sun, sizeof(sun)))
+            die("connect", address);
+    } else {
+        struct sockaddr_in sin = { .sin_family = AF_INET };
+        const char *host = address;
+        char ip[64];
+        const char *colon;
+        int port = 8080;
+
+        if (strncmp(host, "http://", 7) == 0)
+            host += 7;
+        colon = strchr(host, ':');
+        snprintf(ip, sizeof(ip), "%.*s", colon ? (int)(colon - host) : (int)strlen(host), host);
+        if (colon)
+            port = atoi(colon + 1);
+        sin.sin_port = htons(port);
+        if (inet_pton(AF_INET, ip, &sin.sin_addr) != 1) {
+            errno = EINVAL;
+            die("address", address);
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&sin, sizeof(sin)))
+            die("connect", address);
+        /* The module does not cork its small requests either */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    return fd;
+}
+
+/* Reads one reply framed by Content-Length or chunked encoding; returns the status */
+static int read_reply(struct transport *t)
+{
+    size_t len = 0, body_len = 0;
+    const char *body = NULL, *value;
+    long content_length = -1;
+    bool chunked = false;
+    ssize_t n;
+
+    for (;;) {
+        n = read(t->fd, t->reply + len, REPLY_LEN - 1 - len);
+        if (n <= 0) {
+            if (n == 0)
+                errno = ECONNRESET;
+            die("read", t->address);
+        }
+        len += n;
+        t->reply[len] = '\0';
+
+        if (!body) {
+            body = strstr(t->reply, "\r\n\r\n");
+            if (!body)
+                continue;
+            body += 4;
+            value = strcasestr(t->reply, "\r\nContent-Length:");
+            if (value && value < body)
+                content_length = strtol(value + 17, NULL, 10);
+            value = strcasestr(t->reply, "\r\nTransfer-Encoding: chunked");
+            chunked = value && value < body;
+        }
+
+        body_len = len - (body - t->reply);
+        if (content_length >= 0 && body_len >= (size_t)content_length)
+            break;
+        if (chunked && body_len >= 5 && memcmp(t->reply + len - 5, "0\r\n\r\n", 5) == 0)
+            break;
+        if (len == REPLY_LEN - 1) {
+            errno = EMSGSIZE;
+            die("read", t->address);
+        }
+    }
+
+    return atoi(strchr(t->reply, ' ') + 1);
+}
+
+/* Switches the fresh connection to vtfs-rpc, as the module does */
+static void upgrade(struct transport *t)
+{
+    char request[REQUEST_LEN];
+    size_t len = 0;
+    int n;
+
+    n = snprintf(request, sizeof(request),
+                 "GET /rpc?token=%s&client=vtfs-transport HTTP/1.1\r\n"
+                 "Host: localhost\r\n"
+                 "Connection: Upgrade\r\n"
+                 "Upgrade: vtfs-rpc/1\r\n"
+                 "\r\n", token);
+    if (write(t->fd, request, n) != n)
+        die("write", t->address);
+
+    /* Byte by byte: the first frame must stay unread */
+    while (len < 4 || memcmp(t->reply + len - 4, "\r\n\r\n", 4) != 0) {
+        if (len == REPLY_LEN - 1 || read(t->fd, t->reply + len, 1) != 1)
+            die("upgrade", t->address);
+        len++;
+    }
+    t->reply[len] = '\0';
+    if (atoi(strchr(t->reply, ' ') + 1) != 101) {
+        errno = 0;
+        fprintf(stderr, "%s: no vtfs-rpc upgrade: %.*s\n", t->address,
+                (int)strcspn(t->reply, "\r"), t->reply);
+        exit(1);
+    }
+}
+
+static void read_fully(struct transport *t, char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = read(t->fd, buf, len);
+        if (n <= 0) {
+            if (n == 0)
+                errno = ECONNRESET;
+            die("read", t->address);
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static size_t put_field(char *p, uint16_t tag, uint16_t type, const void *value, uint32_t len)
+{
+    memcpy(p, &tag, 2);
+    memcpy(p + 2, &type, 2);
+    memcpy(p + 4, &len, 4);
+    memcpy(p + 8, value, len);
+    return 8 + len;
+}
+
+/* Little-endian hosts only, like the module's x86 and arm64 targets */
+static uint32_t rpc_send(struct transport *t, enum op op, const char *path, bool dir)
+{
+    char frame[REQUEST_LEN];
+    uint32_t len = RPC_HEADER_SIZE, id = ++t->next_id, reply_len;
+    uint16_t count = 1, zero = 0;
+    u64 mode = 0644;
+
+    len += put_field(frame + len, RPC_PATH, RPC_STR, path, strlen(path));
+    if (op == OP_CREATE) {
+        len += put_field(frame + len, RPC_KIND, RPC_STR, dir ? "dir" : "file", dir ? 3 : 4);
+        len += put_field(frame + len, RPC_MODE, RPC_U64, &mode, 8);
+        count += 2;
+    }
+    reply_len = len - RPC_HEADER_SIZE;
+    memcpy(frame, &reply_len, 4);
+    memcpy(frame + 4, &rpc_ops[op], 2);
+    memcpy(frame + 6, &zero, 2);
+    memcpy(frame + 8, &id, 4);
+    memcpy(frame + 12, &count, 2);
+    memcpy(frame + 14, &zero, 2);
+    if (write(t->fd, frame, len) != (ssize_t)len)
+        die("write", t->address);
+    return id;
+}
+
+/* Reads the next reply, whichever request it answers, and returns its id */
+static uint32_t rpc_recv(struct transport *t)
+{
+    uint32_t reply_len, id;
+    uint16_t op, status;
+
+    read_fully(t, t->reply, RPC_HEADER_SIZE);
+    memcpy(&reply_len, t->reply, 4);
+    memcpy(&op, t->reply + 4, 2);
+    memcpy(&status, t->reply + 6, 2);
+    memcpy(&id, t->reply + 8, 4);
+    if (reply_len > REPLY_LEN - RPC_HEADER_SIZE || !id || id > t->next_id) {
+        errno = EBADMSG;
+        die("reply", t->address);
+    }
+    read_fully(t, t->reply + RPC_HEADER_SIZE, reply_len);
+    if (status) {
+        errno = 0;
+        fprintf(stderr, "%s rpc op %u id %u: errno %u\n", t->address, op, id, status);
+        exit(1);
+    }
+    return id;
+}
+
+static void call_http(struct transport *t, enum op op, const char *path, bool dir)
+{
+    char request[REQUEST_LEN];
+    int len, status;
+
+    len = snprintf(request, sizeof(request),
+                   "GET /%s?token=%s&client=vtfs-transport&path=%s%s HTTP/1.1\r\n"
+                   "Host: localhost\r\n"
+                   "Connection: keep-alive\r\n"
+                   "\r\n", op_names[op], token, path,
+                   op != OP_CREATE ? "" : dir ? "&type=dir" : "&type=file&mode=644");
+
+    if (write(t->fd, request, len) != len)
+        die("write", t->address);
+    status = read_reply(t);
+    if (status != 200) {
+        errno = 0;
+        fprintf(stderr, "%s /%s %s: HTTP %d\n", t->address, op_names[op], path, status);
+        exit(1);
+    }
+}
+
+static u64 call(struct transport *t, enum op op, const char *path, bool dir)
+{
+    u64 start = now_ns();
+
+    if (t->rpc) {
+        rpc_send(t, op, path, dir);
+        rpc_recv(t);
+    } else
+        call_http(t, op, path, dir);
+    return now_ns() - start;
+}
+
+static void report(struct transport *t, const char *op, struct samples *s, u64 elapsed)
+{
+    struct summary *sum = &t->results[t->nr_results++];
+    double seconds = elapsed / 1e9;
+
+    qsort(s->ns, s->n, sizeof(*s->ns), cmp_u64);
+    sum->op = op;
+    sum->ops_per_sec = seconds > 0 ? s->n / seconds : 0;
+    sum->p50 = percentile_us(s, 0.50);
+    sum->p99 = percentile_us(s, 0.99);
+    sum->p999 = percentile_us(s, 0.999);
+
+    printf("transport=%s proto=%s depth=%u op=%s ops=%zu seconds=%.3f ops_per_sec=%.0f "
+           "p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n",
+           t->label, t->rpc ? "rpc" : "http", t->depth, op, s->n, seconds, sum->ops_per_sec,
+           sum->p50, sum->p99, sum->p999, percentile_us(s, 1.0));
+    fflush(stdout);
+}
+
+static void op_path(char *path, size_t size, enum op op, unsigned long i)
+{
+    if (op == OP_LIST)
+        snprintf(path, size, "/");
+    else
+        snprintf(path, size, "%s/f%lu", dir, i);
+}
+
+/* Up to depth requests outstanding; replies may come back in any order */
+static void run_pipelined(struct transport *t, enum op op, unsigned long files,
+                          struct samples *s)
+{
+    /* Requests in flight by slot; id 0 marks a free one */
+    static struct { uint32_t id; u64 start; } flight[MAX_DEPTH];
+    unsigned long sent = 0;
+    char path[256];
+    unsigned int i;
+    uint32_t id;
+
+    while (s->n < files) {
+        for (i = 0; sent < files && i < t->depth; i++) {
+            if (flight[i].id)
+                continue;
+            op_path(path, sizeof(path), op, sent++);
+            flight[i].start = now_ns();
+            flight[i].id = rpc_send(t, op, path, false);
+        }
+
+        id = rpc_recv(t);
+        for (i = 0; i < t->depth && flight[i].id != id; i++)
+            ;
+        if (i == t->depth) {
+            errno = EBADMSG;
+            die("reply", t->address);
+        }
+        s->ns[s->n++] = now_ns() - flight[i].start;
+        flight[i].id = 0;
+    }
+}
+
+static void run(struct transport *t, unsigned long files, unsigned long warmup)
+{
+    struct samples s;
+    char path[256];
+    unsigned long i;
+    int op;
+    u64 start;
+
+    s.ns = malloc(files * sizeof(*s.ns));
+    if (!s.ns)
+        die("malloc", NULL);
+
+    t->fd = connect_to(t->address);
+    if (t->rpc)
+        upgrade(t);
+    call(t, OP_CREATE, dir, true);
+
+    for (i = 0; i < warmup; i++)
+        call(t, OP_STAT, dir, false);
+
+    for (op = 0; op < MAX_OPS; op++) {
+        if (t->rpc && !rpc_ops[op])
+            continue;
+        s.n = 0;
+        start = now_ns();
+        if (t->depth > 1) {
+            run_pipelined(t, op, files, &s);
+        } else {
+            for (i = 0; i < files; i++) {
+                op_path(path, sizeof(path), op, i);
+                s.ns[s.n++] = call(t, op, path, false);
+            }
+        }
+        report(t, op_names[op], &s, now_ns() - start);
+    }
+
+    call(t, OP_DELETE, dir, false);
+    close(t->fd);
+    free(s.ns);
+}
+
+static double ratio(double a, double b)
+{
+    return b > 0 ? a / b : 0;
+}
+
+/* One line per op both have measured */
+static void compare(const char *what, const struct transport *a, const struct transport *b)
+{
+    int i, j;
+
+    for (i = 0; i < a->nr_results; i++) {
+        const struct summary *x = &a->results[i];
+
+        for (j = 0; j < b->nr_results; j++) {
+            const struct summary *y = &b->results[j];
+
+            if (strcmp(x->op, y->op) != 0)
+                continue;
+            printf("compare=%s%s%s op=%s ops_per_sec_ratio=%.3f "
+                   "p50_ratio=%.2f p99_ratio=%.2f p999_ratio=%.2f\n",
+                   what, a->rpc ? " transport=" : "", a->rpc ? a->label : "", x->op,
+                   ratio(x->ops_per_sec, y->ops_per_sec), ratio(x->p50, y->p50),
+                   ratio(x->p99, y->p99), ratio(x->p999, y->p999));
+        }
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -t URL   TCP address (http://127.0.0.1:8080)\n"
+            "  -u PATH  Unix socket of the same server, as unix:/path or /path\n"
+            "  -r       measure vtfs-rpc as well as HTTP\n"
+            "  -p N     vtfs-rpc requests in flight per connection (1)\n"
+            "  -n N     requests per operation (10000)\n"
+            "  -W N     warm-up requests per transport (1000)\n"
+            "  -k TOK   token (bench)\n"
+            "  -d PATH  scratch directory on the server (/vtfs-transport)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    static struct transport tcp = { .label = "tcp", .depth = 1 };
+    static struct transport uds = { .label = "unix", .depth = 1 };
+    static struct transport tcp_rpc = { .label = "tcp", .rpc = true };
+    static struct transport uds_rpc = { .label = "unix", .rpc = true };
+    static char unix_address[128];
+    unsigned long files = 10000, warmup = 1000, depth = 1;
+    bool rpc = false;
+    int opt;
+
+    tcp.address = "http://127.0.0.1:8080";
+
+    while ((opt = getopt(argc, argv, "t:u:rp:n:W:k:d:h")) != -1) {
+        switch (opt) {
+        case 't': tcp.address = optarg; break;
+        case 'u':
+            snprintf(unix_address, sizeof(unix_address), "%s%s",
+                     strncmp(optarg, "unix:", 5) ? "unix:" : "", optarg);
+            uds.address = unix_address;
+            break;
+        case 'r': rpc = true; break;
+        case 'p': depth = strtoul(optarg, NULL, 0); break;
+        case 'n': files = strtoul(optarg, NULL, 0); break;
+        case 'W': warmup = strtoul(optarg, NULL, 0); break;
+        case 'k': token = optarg; break;
+        case 'd': dir = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    if (optind != argc || !files || !depth || depth > MAX_DEPTH) {
+        usage(argv[0]);
+        return 2;
+    }
+    tcp_rpc.address = tcp.address;
+    uds_rpc.address = uds.address;
+    tcp_rpc.depth = uds_rpc.depth = depth;
+
+    run(&tcp, files, warmup);
+    if (uds.address)
+        run(&uds, files, warmup);
+    if (rpc) {
+        run(&tcp_rpc, files, warmup);
+        if (uds.address)
+            run(&uds_rpc, files, warmup);
+    }
+
+    if (uds.address)
+        compare("unix/tcp", &uds, &tcp);
+    if (rpc) {
+        compare("rpc/http", &tcp_rpc, &tcp);
+        if (uds.address)
+            compare("rpc/http", &uds_rpc, &uds);
+    }
+    return 0;
+}
@@ -0,0 +1,253 @@
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/dcache.h>
+#include <linux/namei.h>
+#include <linux/sched/signal.h>
+#include "storage.h"
+#include "http.h"
+#include "super.h"
+#include "vtfs.h"
+
+#define VTFS_CHANGES_TIMEOUT_MS 25000
+#define VTFS_CHANGES_LIMIT 32
+#define VTFS_CHANGES_BUFFER_SIZE (32 * 1024)
+#define VTFS_CHANGES_RETRY_MS 1000
+
+static struct dentry *find_cached_dentry(struct super_block *sb, const char *path)
+{
+    struct dentry *dentry = dget(sb->s_root);
+    struct dentry *child;
+    struct qstr name;
+    const char *end;
+
+    while (dentry && *path) {
+        while (*path == '/')
+            path++;
+        if (!*path)
+            break;
+
+        end = strchrnul(path, '/');
+        name.name = path;
+        name.len = end - path;
+
+        child = d_hash_and_lookup(dentry, &name);
+        dput(dentry);
+        dentry = IS_ERR(child) ? NULL : child;
+        path = end;
+    }
+
+    return dentry;
+}
+
+static void apply_delete(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                         struct dentry *dentry)
+{
+    struct inode *dir = NULL;
+    struct inode *inode = NULL;
+
+    if (dentry) {
+        dir = d_inode(dentry->d_parent);
+        inode = d_inode(dentry);
+        inode_lock(dir);
+    }
+
+    if (entry && !(S_ISDIR(entry->mode) && !list_empty(&entry->children))) {
+        if (vtfs_storage_delete_entry_no_sync(sbi, entry) == 0 && inode) {
+            if (S_ISDIR(inode->i_mode))
+                clear_nlink(inode);
+            else if (inode->i_nlink)
+                drop_nlink(inode);
+        }
+    }
+
+    if (dir)
+        inode_unlock(dir);
+
+    if (dentry)
+        d_invalidate(dentry);
+}
+
+static void apply_change(struct super_block *sb, const char *op, const char *path)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(sb);
+    struct vtfs_entry *entry = vtfs_storage_lookup_path(sbi, path);
+    struct dentry *dentry = find_cached_dentry(sb, path);
+    struct inode *inode = dentry && d_really_is_positive(dentry) ? d_inode(dentry) : NULL;
+
+    /*
+     * Local changes not yet flushed are newer than the server's: a refresh
+     * would overwrite unsent data, a delete would drop a queued recreate
+     */
+    if ((strcmp(op, "write") == 0 || strcmp(op, "delete") == 0) &&
+        vtfs_remote_pending(sbi, path)) {
+        dput(dentry);
+        return;
+    }
+
+    if (strcmp(op, "write") == 0) {
+        if (entry && S_ISREG(entry->mode))
+            vtfs_refresh_from_remote(sbi, entry, inode);
+    } else if (strcmp(op, "delete") == 0) {
+        apply_delete(sbi, entry, dentry);
+    } else if (dentry && d_really_is_negative(dentry)) {
+        /* create and link: forget the cached miss so the next lookup asks the server */
+        d_invalidate(dentry);
+    }
+
+    dput(dentry);
+}
+
+static int apply_changes(struct super_block *sb, char *changes, s64 *since)
+{
+    char op[16];
+    char path[VTFS_MAX_PATH_LEN];
+    char client[32];
+    char seq_str[32];
+    char *obj, *end, saved;
+    s64 seq;
+
+    obj = strchr(changes, '[');
+
+    while (obj && (obj = strchr(obj, '{')) != NULL) {
+        end = vtfs_json_object_end(obj + 1);
+        if (!end)
+            break;
+
+        saved = end[1];
+        end[1] = '\0';
+
+        if (vtfs_json_number(obj, "seq", seq_str, sizeof(seq_str)) == 0 &&
+            kstrtos64(seq_str, 10, &seq) == 0 &&
+            vtfs_json_string(obj, "op", op, sizeof(op)) == 0 &&
+            vtfs_json_string(obj, "path", path, sizeof(path)) == 0) {
+            if (vtfs_json_string(obj, "client", client, sizeof(client)) != 0 ||
+                strcmp(client, VTFS_SB(sb)->http.client_id) != 0)
+                apply_change(sb, op, path);
+            *since = seq;
+        }
+
+        end[1] = saved;
+        obj = end + 1;
+    }
+
+    return 0;
+}
+
+static int poll_changes(struct super_block *sb, s64 *since)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(sb);
+    char since_str[32];
+    char timeout_str[16];
+    char limit_str[16];
+    char seq_str[32];
+    char *result, *changes;
+    bool reset;
+    s64 seq;
+    int ret;
+
+    snprintf(since_str, sizeof(since_str), "%lld", *since);
+    snprintf(timeout_str, sizeof(timeout_str), "%d",
+             *since < 0 ? 0 : VTFS_CHANGES_TIMEOUT_MS);
+    snprintf(limit_str, sizeof(limit_str), "%d", VTFS_CHANGES_LIMIT);
+
+    ret = vtfs_http_call(&sbi->http, "changes", sbi->changes_buffer,
+                         VTFS_CHANGES_BUFFER_SIZE, 3,
+                         "since", since_str,
+                         "timeout", timeout_str,
+                         "limit", limit_str);
+    if (ret)
+        return ret < 0 ? ret : -EIO;
+
+    result = strstr(sbi->changes_buffer, "\"result\"");
+    if (!result)
+        return -EIO;
+
+    changes = strstr(result, "\"changes\"");
+    if (!changes)
+        return -EIO;
+
+    /* "seq" and "reset" precede "changes" in the result object */
+    *changes = '\0';
+    ret = vtfs_json_number(result, "seq", seq_str, sizeof(seq_str));
+    if (ret == 0)
+        ret = kstrtos64(seq_str, 10, &seq);
+    reset = strstr(result, "\"reset\":true") != NULL;
+    *changes = '"';
+    if (ret)
+        return -EIO;
+
+    if (reset) {
+        VTFS_LOG("change feed reset at seq %lld, expiring the cache\n", seq);
+        shrink_dcache_sb(sb);
+        vtfs_remote_expire(sbi);
+        *since = seq;
+        return 0;
+    }
+
+    if (*since < 0) {
+        *since = seq;
+        return 0;
+    }
+
+    return apply_changes(sb, changes, since);
+}
+
+static int changes_thread(void *data)
+{
+    struct super_block *sb = data;
+    s64 since = -1;
+    int ret;
+
+    allow_signal(SIGKILL);
+
+    while (!kthread_should_stop()) {
+        ret = poll_changes(sb, &since);
+
+        if (signal_pending(current))
+            flush_signals(current);
+
+        if (ret < 0 && !kthread_should_stop())
+            msleep_interruptible(VTFS_CHANGES_RETRY_MS);
+    }
+
+    return 0;
+}
+
+int vtfs_changes_start(struct super_block *sb)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(sb);
+    struct task_struct *task;
+
+    if (!vtfs_use_remote(sbi) || sbi->changes_task)
+        return 0;
+
+    sbi->changes_buffer = kmalloc(VTFS_CHANGES_BUFFER_SIZE, GFP_KERNEL);
+    if (!sbi->changes_buffer)
+        return -ENOMEM;
+
+    task = kthread_run(changes_thread, sb, "vtfs-changes");
+    if (IS_ERR(task)) {
+        kfree(sbi->changes_buffer);
+        sbi->changes_buffer = NULL;
+        return PTR_ERR(task);
+    }
+
+    sbi->changes_task = task;
+    return 0;
+}
+
+void vtfs_changes_stop(struct super_block *sb)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(sb);
+
+    if (!sbi->changes_task)
+        return;
+
+    /* Break the thread out of a blocking long-poll recv */
+    send_sig(SIGKILL, sbi->changes_task, 1);
+    kthread_stop(sbi->changes_task);
+    sbi->changes_task = NULL;
+
+    kfree(sbi->changes_buffer);
+    sbi->changes_buffer = NULL;
+}
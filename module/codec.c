@@ -0,0 +1,532 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
+
+#include "codec.h"
+
+int vtfs_url_encode(const char *src, char *dst, size_t dst_size)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t i, j;
+
+    for (i = 0, j = 0; src[i] && j + 3 < dst_size; i++) {
+        char c = src[i];
+        if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+            (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' || c == '~') {
+            dst[j++] = c;
+        } else {
+            dst[j++] = '%';
+            dst[j++] = hex[(c >> 4) & 0x0F];
+            dst[j++] = hex[c & 0x0F];
+        }
+    }
+    dst[j] = '\0';
+
+    return src[i] ? -ENOSPC : j;
+}
+
+int vtfs_parse_http_response(const char *response, char *body,
+                              size_t body_size, int *status_code)
+{
+    const char *body_start;
+    const char *status_start;
+    size_t body_len;
+
+    status_start = strstr(response, "HTTP/1.");
+    if (!status_start) {
+        *status_code = 500;
+        return 0;
+    }
+    
+    status_start = strchr(status_start, ' ');
+    if (!status_start) {
+        *status_code = 500;
+        return 0;
+    }
+    
+    status_start++;
+    unsigned long status_ul = simple_strtoul(status_start, NULL, 10);
+    if (status_ul >= 100 && status_ul <= 599) {
+        *status_code = (int)status_ul;
+    } else {
+        *status_code = 500;
+    }
+
+    body_start = strstr(response, "\r\n\r\n");
+    if (!body_start)
+        body_start = strstr(response, "\n\n");
+    
+    if (!body_start) {
+        body[0] = '\0';
+        return 0;
+    }
+
+    body_start += (response[body_start - response] == '\r') ? 4 : 2;
+
+    if (strstr(response, "Transfer-Encoding: chunked")) {
+        const char *chunk_ptr = body_start;
+        char *output_ptr = body;
+        size_t total_decoded = 0;
+        
+        while (total_decoded < body_size - 1) {
+            unsigned long chunk_size;
+            char *endptr;
+            
+            chunk_size = simple_strtoul(chunk_ptr, &endptr, 16);
+            if (chunk_size == 0) break;
+            
+            chunk_ptr = endptr;
+            while (*chunk_ptr == '\r' || *chunk_ptr == '\n') chunk_ptr++;
+            
+            if (total_decoded + chunk_size >= body_size - 1)
+                chunk_size = body_size - 1 - total_decoded;
+            /* A truncated response may announce more than it carries */
+            chunk_size = strnlen(chunk_ptr, chunk_size);
+            
+            memcpy(output_ptr, chunk_ptr, chunk_size);
+            output_ptr += chunk_size;
+            total_decoded += chunk_size;
+            
+            chunk_ptr += chunk_size;
+            while (*chunk_ptr == '\r' || *chunk_ptr == '\n') chunk_ptr++;
+        }
+        
+        *output_ptr = '\0';
+        return total_decoded;
+    }
+
+    body_len = strlen(body_start);
+    if (body_len >= body_size)
+        body_len = body_size - 1;
+
+    memcpy(body, body_start, body_len);
+    body[body_len] = '\0';
+
+    return body_len;
+}
+
+/* Every byte outside the alphabet, '=' included, decodes as zero */
+static const u8 base64_decode_table[256] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 62,  0,  0,  0, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61,  0,  0,  0,  0,  0,  0,
+     0,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,  0,  0,  0,  0,  0,
+     0, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51,  0,  0,  0,  0,  0,
+};
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const char *const base64_impl_names[] = {
+    [VTFS_BASE64_SCALAR] = "scalar",
+    [VTFS_BASE64_SSSE3] = "ssse3",
+    [VTFS_BASE64_AVX2] = "avx2",
+};
+
+int vtfs_base64_impl = VTFS_BASE64_SCALAR;
+int vtfs_base64_best = VTFS_BASE64_SCALAR;
+
+const char *vtfs_base64_impl_name(int impl)
+{
+    return base64_impl_names[impl];
+}
+
+void vtfs_codec_init(void)
+{
+#ifdef CONFIG_X86
+    if (boot_cpu_has(X86_FEATURE_AVX2) &&
+        cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL))
+        vtfs_base64_best = VTFS_BASE64_AVX2;
+    else if (boot_cpu_has(X86_FEATURE_SSSE3))
+        vtfs_base64_best = VTFS_BASE64_SSSE3;
+#endif
+    vtfs_base64_impl = vtfs_base64_best;
+}
+
+#ifdef CONFIG_X86
+/* Bounds how long preemption stays off for one kernel_fpu_begin() */
+#define BASE64_SIMD_CHUNK 16384
+
+/* Whole blocks of src through the SIMD path; returns the bytes consumed */
+static size_t base64_encode_simd(const u8 *src, size_t len, char *dst)
+{
+    size_t done = 0;
+
+    while (len - done >= 16 && irq_fpu_usable()) {
+        size_t chunk = min_t(size_t, len - done, BASE64_SIMD_CHUNK);
+        size_t n;
+
+        kernel_fpu_begin();
+        if (vtfs_base64_impl == VTFS_BASE64_AVX2)
+            n = vtfs_base64_encode_avx2(src + done, chunk, dst + done / 3 * 4);
+        else
+            n = vtfs_base64_encode_ssse3(src + done, chunk, dst + done / 3 * 4);
+        kernel_fpu_end();
+
+        done += n;
+    }
+
+    return done;
+}
+
+/* The same for decoding; stops at the first block with padding or junk */
+static size_t base64_decode_simd(const char *src, size_t len, u8 *dst)
+{
+    size_t done = 0;
+
+    while (len - done >= 16 && irq_fpu_usable()) {
+        size_t chunk = min_t(size_t, len - done, BASE64_SIMD_CHUNK);
+        size_t n;
+
+        kernel_fpu_begin();
+        if (vtfs_base64_impl == VTFS_BASE64_AVX2)
+            n = vtfs_base64_decode_avx2(src + done, chunk, dst + done / 4 * 3);
+        else
+            n = vtfs_base64_decode_ssse3(src + done, chunk, dst + done / 4 * 3);
+        kernel_fpu_end();
+
+        done += n;
+        if (chunk - n >= 16)
+            break;
+    }
+
+    return done;
+}
+#endif
+
+int vtfs_base64_decode(const char *input, unsigned char *output, size_t *output_len)
+{
+    return vtfs_base64_decode_len(input, strlen(input), output, output_len);
+}
+
+int vtfs_base64_decode_len(const char *input, size_t in_len,
+                           unsigned char *output, size_t *output_len)
+{
+    size_t capacity = *output_len;
+    size_t i = 0, j = 0;
+    u32 group;
+
+    if (in_len % 4 != 0)
+        return -EINVAL;
+
+    *output_len = (in_len / 4) * 3;
+    if (in_len > 0 && input[in_len - 1] == '=') (*output_len)--;
+    if (in_len > 1 && input[in_len - 2] == '=') (*output_len)--;
+    if (*output_len > capacity)
+        *output_len = capacity;
+
+#ifdef CONFIG_X86
+    /* Only groups whose three bytes all fit go through SIMD */
+    if (vtfs_base64_impl != VTFS_BASE64_SCALAR) {
+        i = base64_decode_simd(input, min_t(size_t, in_len, *output_len / 3 * 4), output);
+        j = i / 4 * 3;
+    }
+#endif
+
+    for (; i < in_len; i += 4) {
+        group = (u32)base64_decode_table[(u8)input[i]] << 18 |
+                (u32)base64_decode_table[(u8)input[i + 1]] << 12 |
+                (u32)base64_decode_table[(u8)input[i + 2]] << 6 |
+                base64_decode_table[(u8)input[i + 3]];
+
+        if (j + 3 <= *output_len) {
+            output[j++] = group >> 16;
+            output[j++] = group >> 8;
+            output[j++] = group;
+            continue;
+        }
+        if (j < *output_len) output[j++] = group >> 16;
+        if (j < *output_len) output[j++] = group >> 8;
+        break;
+    }
+
+    return 0;
+}
+
+int vtfs_base64_encode(const void *data, size_t len, char *base64, size_t base64_size)
+{
+    const unsigned char *bytes = data;
+    size_t i = 0, j = 0;
+    u32 group;
+
+    if (base64_size < ((len + 2) / 3) * 4 + 1)
+        return -EINVAL;
+
+#ifdef CONFIG_X86
+    if (vtfs_base64_impl != VTFS_BASE64_SCALAR) {
+        i = base64_encode_simd(bytes, len, base64);
+        j = i / 3 * 4;
+    }
+#endif
+
+    for (; i + 3 <= len; i += 3) {
+        group = (u32)bytes[i] << 16 | (u32)bytes[i + 1] << 8 | bytes[i + 2];
+        base64[j++] = base64_chars[group >> 18];
+        base64[j++] = base64_chars[(group >> 12) & 0x3F];
+        base64[j++] = base64_chars[(group >> 6) & 0x3F];
+        base64[j++] = base64_chars[group & 0x3F];
+    }
+
+    if (i < len) {
+        group = (u32)bytes[i] << 16 | ((i + 1 < len) ? (u32)bytes[i + 1] << 8 : 0);
+        base64[j++] = base64_chars[group >> 18];
+        base64[j++] = base64_chars[(group >> 12) & 0x3F];
+        base64[j++] = (i + 1 < len) ? base64_chars[(group >> 6) & 0x3F] : '=';
+        base64[j++] = '=';
+    }
+
+    base64[j] = '\0';
+    return 0;
+}
+
+enum {
+    DATA_SEEK,
+    DATA_COLON,
+    DATA_VALUE,
+    DATA_DONE,
+};
+
+#define DATA_KEY "\"data\""
+
+void vtfs_data_stream_init(struct vtfs_data_stream *s, size_t want)
+{
+    memset(s, 0, sizeof(*s));
+    s->state = DATA_SEEK;
+    s->want = want;
+}
+
+bool vtfs_data_stream_done(const struct vtfs_data_stream *s)
+{
+    return s->state == DATA_DONE;
+}
+
+/* Base64 characters of the value into out; returns how many were consumed */
+static size_t data_stream_decode(struct vtfs_data_stream *s, const char *in, size_t n,
+                                 u8 *out, size_t cap, size_t *produced)
+{
+    size_t i = 0, done = 0;
+    size_t room, quads, len;
+    u8 tmp[3];
+
+    while (i < n) {
+        if (!s->want) {
+            s->quad_len = 0;
+            i = n;
+            break;
+        }
+        room = min(cap - done, s->want);
+        if (!room)
+            break;
+
+        /* A quad split across pieces, or the last few bytes wanted */
+        if (s->quad_len || n - i < 4 || room < 3) {
+            while (s->quad_len < 4 && i < n)
+                s->quad[s->quad_len++] = in[i++];
+            if (s->quad_len < 4)
+                break;
+
+            len = sizeof(tmp);
+            vtfs_base64_decode_len(s->quad, 4, tmp, &len);
+            len = min(len, room);
+            memcpy(out + done, tmp, len);
+            done += len;
+            s->want -= len;
+            s->quad_len = 0;
+            continue;
+        }
+
+        quads = min((n - i) / 4, room / 3);
+        len = quads * 3;
+        vtfs_base64_decode_len(in + i, quads * 4, out + done, &len);
+        i += quads * 4;
+        done += len;
+        s->want -= len;
+    }
+
+    *produced = done;
+    return i;
+}
+
+size_t vtfs_data_stream_feed(struct vtfs_data_stream *s, const char *in, size_t len,
+                             u8 *out, size_t *out_len)
+{
+    size_t cap = *out_len;
+    size_t produced = 0;
+    size_t i = 0, n, used, got;
+    const char *end;
+
+    while (i < len) {
+        switch (s->state) {
+        case DATA_SEEK:
+            if (in[i] == DATA_KEY[s->matched])
+                s->matched++;
+            else
+                s->matched = in[i] == '"';
+            if (s->matched == sizeof(DATA_KEY) - 1)
+                s->state = DATA_COLON;
+            i++;
+            break;
+
+        case DATA_COLON:
+            if (in[i] == '"') {
+                s->state = DATA_VALUE;
+            } else if (in[i] != ':' && in[i] != ' ' && in[i] != '\t') {
+                /* "data" was a value, not the key */
+                s->state = DATA_SEEK;
+                s->matched = 0;
+                continue;
+            }
+            i++;
+            break;
+
+        case DATA_VALUE:
+            end = memchr(in + i, '"', len - i);
+            n = end ? end - (in + i) : len - i;
+            used = data_stream_decode(s, in + i, n, out + produced, cap - produced, &got);
+            i += used;
+            produced += got;
+            if (used < n)
+                goto out;
+            if (end) {
+                if (s->quad_len)
+                    s->error = -EINVAL;
+                s->state = DATA_DONE;
+                i++;
+            }
+            break;
+
+        default:
+            i = len;
+            break;
+        }
+    }
+
+out:
+    *out_len = produced;
+    return i;
+}
+
+int vtfs_json_string(const char *json, const char *field, char *value, size_t value_size)
+{
+    char pattern[128];
+    const char *field_start;
+    const char *value_start;
+    const char *value_end;
+    size_t value_len;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\"", field);
+    field_start = strstr(json, pattern);
+    if (!field_start)
+        return -ENOENT;
+
+    value_start = strchr(field_start + strlen(pattern), '"');
+    if (!value_start)
+        return -EINVAL;
+    value_start++;
+
+    value_end = strchr(value_start, '"');
+    if (!value_end)
+        return -EINVAL;
+
+    value_len = value_end - value_start;
+    if (value_len >= value_size)
+        value_len = value_size - 1;
+
+    memcpy(value, value_start, value_len);
+    value[value_len] = '\0';
+
+    return 0;
+}
+
+int vtfs_json_number(const char *json, const char *field, char *value, size_t value_size)
+{
+    char pattern[128];
+    const char *field_start;
+    const char *value_start;
+    const char *value_end;
+    size_t value_len;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\"", field);
+    field_start = strstr(json, pattern);
+    if (!field_start)
+        return -ENOENT;
+
+    value_start = strchr(field_start + strlen(pattern), ':');
+    if (!value_start)
+        return -EINVAL;
+    value_start++;
+
+    while (*value_start == ' ' || *value_start == '\t')
+        value_start++;
+
+    value_end = value_start;
+    while (*value_end && *value_end != ',' && *value_end != '}' && 
+           *value_end != ']' && *value_end != ' ' && *value_end != '\t' &&
+           *value_end != '\n' && *value_end != '\r') {
+        value_end++;
+    }
+
+    value_len = value_end - value_start;
+    if (value_len == 0)
+        return -EINVAL;
+    
+    if (value_len >= value_size)
+        value_len = value_size - 1;
+
+    memcpy(value, value_start, value_len);
+    value[value_len] = '\0';
+
+    return 0;
+}
+
+char *vtfs_json_object_end(char *p)
+{
+    bool in_string = false;
+
+    for (; *p; p++) {
+        if (in_string) {
+            if (*p == '\\' && p[1])
+                p++;
+            else if (*p == '"')
+                in_string = false;
+        } else if (*p == '"') {
+            in_string = true;
+        } else if (*p == '}') {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+#define VTFS_COMPRESS_SAMPLES 1024
+
+bool vtfs_compressible(const void *data, size_t len)
+{
+    const u8 *p = data;
+    u16 counts[256] = { 0 };
+    size_t step, i, n = 0;
+    u64 sum = 0;
+
+    if (len < VTFS_COMPRESS_MIN)
+        return false;
+
+    step = max_t(size_t, len / VTFS_COMPRESS_SAMPLES, 1);
+    for (i = 0; i < len && n < VTFS_COMPRESS_SAMPLES; i += step, n++)
+        counts[p[i]]++;
+    for (i = 0; i < 256; i++)
+        sum += (u64)counts[i] * counts[i];
+
+    /*
+     * sum / n^2 is the chance two samples are the same byte, and its
+     * inverse the number of byte values in effective use: about 200 for
+     * random bytes of this sample size, tens for text.
+     */
+    return sum * 64 > (u64)n * n;
+}
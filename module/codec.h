@@ -0,0 +1,88 @@
+#ifndef _VTFS_CODEC_H
+#define _VTFS_CODEC_H
+
+#include <linux/types.h>
+
+/*
+ * Pure parsing and encoding helpers used by the HTTP client. They touch no
+ * kernel state, so bench/userspace builds them as ordinary C as well.
+ */
+
+/* Buffer size needed to base64-encode len bytes, terminating NUL included */
+#define VTFS_BASE64_SIZE(len) ((((len) + 2) / 3) * 4 + 1)
+
+/*
+ * Base64 implementations, slowest first. vtfs_codec_init() sets
+ * vtfs_base64_best to the fastest one the CPU supports and selects it;
+ * anything up to vtfs_base64_best may be selected instead.
+ */
+enum vtfs_base64_impl {
+    VTFS_BASE64_SCALAR,
+    VTFS_BASE64_SSSE3,
+    VTFS_BASE64_AVX2,
+};
+
+extern int vtfs_base64_impl;
+extern int vtfs_base64_best;
+
+void vtfs_codec_init(void);
+const char *vtfs_base64_impl_name(int impl);
+
+int vtfs_base64_encode(const void *data, size_t len, char *base64, size_t base64_size);
+/* *output_len is the capacity of output on entry and the decoded length on return */
+int vtfs_base64_decode(const char *input, unsigned char *output, size_t *output_len);
+/* The same for in_len characters that need not be NUL-terminated */
+int vtfs_base64_decode_len(const char *input, size_t in_len,
+                           unsigned char *output, size_t *output_len);
+/* Returns the encoded length, -ENOSPC if src does not fit */
+int vtfs_url_encode(const char *src, char *dst, size_t dst_size);
+int vtfs_parse_http_response(const char *response, char *body,
+                             size_t body_size, int *status_code);
+
+#ifdef CONFIG_X86
+/* codec_simd.c; whole blocks only, return the input consumed */
+size_t vtfs_base64_encode_ssse3(const u8 *src, size_t len, char *dst);
+size_t vtfs_base64_encode_avx2(const u8 *src, size_t len, char *dst);
+size_t vtfs_base64_decode_ssse3(const char *src, size_t len, u8 *dst);
+size_t vtfs_base64_decode_avx2(const char *src, size_t len, u8 *dst);
+#endif
+
+/*
+ * Decodes the "data" string of a read reply while the body arrives, in
+ * pieces of any size. want is how many bytes the caller takes in total;
+ * anything past it is dropped.
+ */
+struct vtfs_data_stream {
+    int state;
+    unsigned int matched;
+    unsigned int quad_len;
+    char quad[4];
+    size_t want;
+    int error;
+};
+
+void vtfs_data_stream_init(struct vtfs_data_stream *s, size_t want);
+/*
+ * Consumes up to len bytes of body and decodes into out, whose capacity is
+ * *out_len on entry (a multiple of 3, or everything still wanted) and
+ * the bytes written on return. Returns the bytes of in consumed, which is
+ * less than len only when out is full.
+ */
+size_t vtfs_data_stream_feed(struct vtfs_data_stream *s, const char *in, size_t len,
+                             u8 *out, size_t *out_len);
+bool vtfs_data_stream_done(const struct vtfs_data_stream *s);
+
+/*
+ * Whether a payload looks worth compressing, from the byte values of a
+ * sample of it: false for short payloads and for near-uniform ones, as
+ * random and already compressed data are.
+ */
+#define VTFS_COMPRESS_MIN 512
+bool vtfs_compressible(const void *data, size_t len);
+
+int vtfs_json_string(const char *json, const char *field, char *value, size_t value_size);
+int vtfs_json_number(const char *json, const char *field, char *value, size_t value_size);
+/* The '}' closing a flat object whose body starts at p, skipping strings; NULL if cut short */
+char *vtfs_json_object_end(char *p);
+
+#endif
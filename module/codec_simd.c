@@ -0,0 +1,264 @@
+#include <linux/types.h>
+#include <linux/string.h>
+
+#include "codec.h"
+
+/*
+ * SSSE3 and AVX2 base64 loops, written with the compiler's vector
+ * extensions so the same source builds in the kernel and in bench/userspace.
+ * They handle whole blocks only and return how much input they consumed;
+ * codec.c calls them between kernel_fpu_begin() and kernel_fpu_end() and
+ * finishes the rest with the scalar code.
+ *
+ * The lookups follow Wojciech Muła's vectorised base64: pshufb tables index
+ * by nibble to classify and translate characters, pmaddubsw/pmaddwd pack
+ * the 6-bit values.
+ */
+
+#define __ssse3 __attribute__((target("ssse3")))
+#define __avx2 __attribute__((target("avx2")))
+
+typedef char v16qi __attribute__((vector_size(16)));
+typedef short v8hi __attribute__((vector_size(16)));
+typedef signed char v16s8 __attribute__((vector_size(16)));
+typedef u32 v4u32 __attribute__((vector_size(16)));
+typedef u64 v2u64 __attribute__((vector_size(16)));
+
+typedef char v32qi __attribute__((vector_size(32)));
+typedef short v16hi __attribute__((vector_size(32)));
+typedef signed char v32s8 __attribute__((vector_size(32)));
+typedef u32 v8u32 __attribute__((vector_size(32)));
+typedef u64 v4u64 __attribute__((vector_size(32)));
+
+/* Each 32-bit lane gets input bytes 1, 0, 2, 1 of its triple */
+#define ENC_SHUFFLE 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+/* The same for a lane loaded 4 bytes early */
+#define ENC_SHUFFLE_LATE 5, 4, 6, 5, 8, 7, 9, 8, 11, 10, 12, 11, 14, 13, 15, 14
+/* Offset to add to a 6-bit index, by ENC_SLOT() */
+#define ENC_OFFSETS 65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0
+
+/* Character class bits by low and high nibble; a valid character shares none */
+#define DEC_LUT_LO 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, \
+                   0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a
+#define DEC_LUT_HI 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, \
+                   0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+/* Offset from character to value by high nibble, '/' moved to its own slot */
+#define DEC_ROLL 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+/* Bytes 2, 1, 0 of each decoded 24-bit lane, then four zeroes */
+#define DEC_PACK 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+/*
+ * The arithmetic is the same at both widths, so it is written once for any
+ * vector type; the width-specific part is only pshufb and the two
+ * multiply-adds.
+ */
+
+/* b1 b0 b2 b1 in each 32-bit lane to four 6-bit indices */
+#define ENC_SPLIT(t) \
+    ((((t) >> 10) & 0x3f) | (((t) << 4) & 0x3f00) | \
+     (((t) >> 6) & 0x3f0000) | (((t) << 8) & 0x3f000000))
+
+/* 0..25 -> 0, 26..51 -> 1, 52..61 -> 2..11, 62 -> 12, 63 -> 13 */
+#define ENC_SLOT(idx) \
+    ((((idx) - 51) & ((idx) > 51)) - ((idx) > 25))
+
+static inline __ssse3 v16s8 load16(const void *p)
+{
+    v16s8 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline __avx2 v32s8 load32(const void *p)
+{
+    v32s8 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline __ssse3 v16s8 shuffle16(v16s8 v, v16s8 mask)
+{
+    return (v16s8)__builtin_ia32_pshufb128((v16qi)v, (v16qi)mask);
+}
+
+static inline __avx2 v32s8 shuffle32(v32s8 v, v32s8 mask)
+{
+    return (v32s8)__builtin_ia32_pshufb256((v32qi)v, (v32qi)mask);
+}
+
+static inline __ssse3 v16s8 encode16(v16s8 in, v16s8 shuffle)
+{
+    const v16s8 offsets = { ENC_OFFSETS };
+    v4u32 t = (v4u32)shuffle16(in, shuffle);
+    v16s8 idx = (v16s8)ENC_SPLIT(t);
+
+    return idx + shuffle16(offsets, ENC_SLOT(idx));
+}
+
+static inline __avx2 v32s8 encode32(v32s8 in, v32s8 shuffle)
+{
+    const v32s8 offsets = { ENC_OFFSETS, ENC_OFFSETS };
+    v8u32 t = (v8u32)shuffle32(in, shuffle);
+    v32s8 idx = (v32s8)ENC_SPLIT(t);
+
+    return idx + shuffle32(offsets, ENC_SLOT(idx));
+}
+
+/* Characters to 6-bit values; returns false if any is outside the alphabet */
+static inline __ssse3 bool translate16(v16s8 *str)
+{
+    const v16s8 lut_lo = { DEC_LUT_LO };
+    const v16s8 lut_hi = { DEC_LUT_HI };
+    const v16s8 roll = { DEC_ROLL };
+    v16s8 hi_nibbles = (v16s8)((v4u32)*str >> 4) & 0x2f;
+    v16s8 lo_nibbles = *str & 0x2f;
+    v2u64 bad = (v2u64)(shuffle16(lut_lo, lo_nibbles) & shuffle16(lut_hi, hi_nibbles));
+
+    if (bad[0] | bad[1])
+        return false;
+
+    *str += shuffle16(roll, hi_nibbles + (*str == '/'));
+    return true;
+}
+
+static inline __avx2 bool translate32(v32s8 *str)
+{
+    const v32s8 lut_lo = { DEC_LUT_LO, DEC_LUT_LO };
+    const v32s8 lut_hi = { DEC_LUT_HI, DEC_LUT_HI };
+    const v32s8 roll = { DEC_ROLL, DEC_ROLL };
+    v32s8 hi_nibbles = (v32s8)((v8u32)*str >> 4) & 0x2f;
+    v32s8 lo_nibbles = *str & 0x2f;
+    v4u64 bad = (v4u64)(shuffle32(lut_lo, lo_nibbles) & shuffle32(lut_hi, hi_nibbles));
+
+    if (bad[0] | bad[1] | bad[2] | bad[3])
+        return false;
+
+    *str += shuffle32(roll, hi_nibbles + (*str == '/'));
+    return true;
+}
+
+/* Four 6-bit values per 32-bit lane to three bytes, packed into the low 12 of each 16 */
+static inline __ssse3 v16s8 pack16(v16s8 val)
+{
+    const v16s8 merge_ab = { 0x40, 0x01, 0x40, 0x01, 0x40, 0x01, 0x40, 0x01,
+                             0x40, 0x01, 0x40, 0x01, 0x40, 0x01, 0x40, 0x01 };
+    const v8hi merge_abc = { 0x1000, 0x0001, 0x1000, 0x0001,
+                             0x1000, 0x0001, 0x1000, 0x0001 };
+    const v16s8 pack = { DEC_PACK };
+    v8hi ab = __builtin_ia32_pmaddubsw128((v16qi)val, (v16qi)merge_ab);
+
+    return shuffle16((v16s8)__builtin_ia32_pmaddwd128(ab, merge_abc), pack);
+}
+
+static inline __avx2 v32s8 pack32(v32s8 val)
+{
+    const v32s8 merge_ab = { 0x40, 0x01, 0x40, 0x01, 0x40, 0x01, 0x40, 0x01,
+                             0x40, 0x01, 0x40, 0x01, 0x40, 0x01, 0x40, 0x01,
+                             0x40, 0x01, 0x40, 0x01, 0x40, 0x01, 0x40, 0x01,
+                             0x40, 0x01, 0x40, 0x01, 0x40, 0x01, 0x40, 0x01 };
+    const v16hi merge_abc = { 0x1000, 0x0001, 0x1000, 0x0001,
+                              0x1000, 0x0001, 0x1000, 0x0001,
+                              0x1000, 0x0001, 0x1000, 0x0001,
+                              0x1000, 0x0001, 0x1000, 0x0001 };
+    const v32s8 pack = { DEC_PACK, DEC_PACK };
+    v16hi ab = __builtin_ia32_pmaddubsw256((v32qi)val, (v32qi)merge_ab);
+
+    return shuffle32((v32s8)__builtin_ia32_pmaddwd256(ab, merge_abc), pack);
+}
+
+size_t __ssse3 vtfs_base64_encode_ssse3(const u8 *src, size_t len, char *dst)
+{
+    const v16s8 shuffle = { ENC_SHUFFLE };
+    size_t done = 0;
+
+    /* Each step loads 16 bytes and consumes 12 */
+    while (len - done >= 16) {
+        v16s8 out = encode16(load16(src + done), shuffle);
+
+        memcpy(dst, &out, 16);
+        dst += 16;
+        done += 12;
+    }
+
+    return done;
+}
+
+size_t __ssse3 vtfs_base64_decode_ssse3(const char *src, size_t len, u8 *dst)
+{
+    size_t done = 0;
+
+    while (len - done >= 16) {
+        v16s8 str = load16(src + done);
+        v16s8 out;
+
+        /* Padding or junk; the scalar code takes it from here */
+        if (!translate16(&str))
+            break;
+
+        out = pack16(str);
+        memcpy(dst, &out, 12);
+        dst += 12;
+        done += 16;
+    }
+
+    return done;
+}
+
+/*
+ * pshufb works within 128-bit lanes, so each lane needs its own 12 input
+ * bytes. Loading 32 bytes from 4 before the block puts bytes 0..11 at the
+ * top of the low lane and 12..23 at the bottom of the high lane, which
+ * the per-lane shuffle then picks up. The first block has nothing before
+ * it and goes through SSSE3.
+ */
+size_t __avx2 vtfs_base64_encode_avx2(const u8 *src, size_t len, char *dst)
+{
+    const v16s8 first = { ENC_SHUFFLE };
+    const v32s8 shuffle = { ENC_SHUFFLE_LATE, ENC_SHUFFLE };
+    v16s8 head;
+    size_t done;
+
+    if (len < 16)
+        return 0;
+
+    head = encode16(load16(src), first);
+    memcpy(dst, &head, 16);
+    dst += 16;
+    done = 12;
+
+    while (len - done >= 28) {
+        v32s8 out = encode32(load32(src + done - 4), shuffle);
+
+        memcpy(dst, &out, 32);
+        dst += 32;
+        done += 24;
+    }
+
+    return done + vtfs_base64_encode_ssse3(src + done, len - done, dst);
+}
+
+size_t __avx2 vtfs_base64_decode_avx2(const char *src, size_t len, u8 *dst)
+{
+    size_t done = 0;
+
+    while (len - done >= 32) {
+        v32s8 str = load32(src + done);
+        union {
+            v32s8 v;
+            u8 bytes[32];
+        } out;
+
+        if (!translate32(&str))
+            break;
+
+        out.v = pack32(str);
+        memcpy(dst, out.bytes, 12);
+        memcpy(dst + 12, out.bytes + 16, 12);
+        dst += 24;
+        done += 32;
+    }
+
+    return done + vtfs_base64_decode_ssse3(src + done, len - done, dst);
+}
@@ -0,0 +1,95 @@
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kdev_t.h>
+#include <linux/fs.h>
+#include "super.h"
+#include "vtfs.h"
+
+/* /sys/kernel/debug/vtfs/<major:minor>/ for every mounted superblock */
+static struct dentry *vtfs_debugfs_root;
+
+static int journal_show(struct seq_file *m, void *v)
+{
+    vtfs_remote_show(m, m->private);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(journal);
+
+static int ops_show(struct seq_file *m, void *v)
+{
+    struct vtfs_sb_info *sbi = m->private;
+
+    vtfs_stats_show_ops(m, sbi->stats);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ops);
+
+static int http_show(struct seq_file *m, void *v)
+{
+    struct vtfs_sb_info *sbi = m->private;
+
+    vtfs_stats_show_http(m, sbi->stats);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(http);
+
+static int histograms_show(struct seq_file *m, void *v)
+{
+    struct vtfs_sb_info *sbi = m->private;
+
+    vtfs_stats_show_histograms(m, sbi->stats);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(histograms);
+
+/* Any write zeroes the counters and histograms of this mount */
+static ssize_t reset_write(struct file *file, const char __user *buf,
+                           size_t count, loff_t *ppos)
+{
+    struct vtfs_sb_info *sbi = file->private_data;
+
+    vtfs_stats_reset(sbi->stats);
+    return count;
+}
+
+static const struct file_operations reset_fops = {
+    .owner = THIS_MODULE,
+    .open  = simple_open,
+    .write = reset_write,
+};
+
+void vtfs_debugfs_register(struct super_block *sb)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(sb);
+    char name[32];
+
+    if (IS_ERR_OR_NULL(vtfs_debugfs_root))
+        return;
+
+    snprintf(name, sizeof(name), "%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+    sbi->debugfs_dir = debugfs_create_dir(name, vtfs_debugfs_root);
+
+    debugfs_create_file("journal", 0444, sbi->debugfs_dir, sbi, &journal_fops);
+    debugfs_create_file("ops", 0444, sbi->debugfs_dir, sbi, &ops_fops);
+    debugfs_create_file("http", 0444, sbi->debugfs_dir, sbi, &http_fops);
+    debugfs_create_file("histograms", 0444, sbi->debugfs_dir, sbi, &histograms_fops);
+    debugfs_create_file("reset", 0200, sbi->debugfs_dir, sbi, &reset_fops);
+}
+
+void vtfs_debugfs_unregister(struct vtfs_sb_info *sbi)
+{
+    debugfs_remove_recursive(sbi->debugfs_dir);
+    sbi->debugfs_dir = NULL;
+}
+
+int vtfs_debugfs_init(void)
+{
+    vtfs_debugfs_root = debugfs_create_dir("vtfs", NULL);
+    return 0;
+}
+
+void vtfs_debugfs_exit(void)
+{
+    debugfs_remove_recursive(vtfs_debugfs_root);
+    vtfs_debugfs_root = NULL;
+}
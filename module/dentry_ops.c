@@ -0,0 +1,63 @@
+#include <linux/fs.h>
+#include <linux/dcache.h>
+#include <linux/namei.h>
+#include <linux/jiffies.h>
+#include "storage.h"
+#include "super.h"
+#include "vtfs.h"
+#include "vtfs_trace.h"
+
+static int __vtfs_d_revalidate(struct dentry *dentry, unsigned int flags)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(dentry->d_sb);
+    struct inode *inode;
+    struct vtfs_entry *entry;
+    int ret;
+    
+    if (!vtfs_use_remote(sbi))
+        return 1;
+    
+    if (time_before(jiffies, dentry->d_time + vtfs_entry_ttl(sbi)))
+        return 1;
+    
+    if (flags & LOOKUP_RCU)
+        return -ECHILD;
+    
+    inode = d_inode(dentry);
+    if (!inode)
+        return 0;
+    
+    entry = vtfs_storage_get_by_ino(sbi, inode->i_ino);
+    if (!entry || entry->stale)
+        return 0;
+    
+    ret = vtfs_revalidate_entry(sbi, entry, inode, false);
+    if (ret == -ENOENT || ret == -ESTALE)
+        return 0;
+    
+    /* On network errors keep trusting the cached dentry */
+    dentry->d_time = jiffies;
+    return 1;
+}
+
+static int vtfs_d_revalidate(struct dentry *dentry, unsigned int flags)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(dentry->d_sb);
+    unsigned long ino = d_really_is_positive(dentry) ? d_inode(dentry)->i_ino : 0;
+    u64 start = vtfs_stat_start();
+    int ret;
+    
+    /* d_name is only stable outside RCU walk */
+    if (!(flags & LOOKUP_RCU))
+        trace_vtfs_op_start(VTFS_STAT_REVALIDATE, ino, dentry->d_name.name);
+    ret = __vtfs_d_revalidate(dentry, flags);
+    if (ret != -ECHILD)
+        vtfs_stat_op(sbi->stats, VTFS_STAT_REVALIDATE, start, ret < 0);
+    if (!(flags & LOOKUP_RCU))
+        trace_vtfs_op_end(VTFS_STAT_REVALIDATE, ino, dentry->d_name.name, ret, start);
+    return ret;
+}
+
+const struct dentry_operations vtfs_dentry_ops = {
+    .d_revalidate = vtfs_d_revalidate,
+};
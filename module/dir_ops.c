@@ -4,27 +4,32 @@
 #include <linux/string.h>
 #include <linux/spinlock.h>
 #include "storage.h"
+#include "super.h"
 #include "vtfs.h"
+#include "vtfs_trace.h"
 
-extern struct vtfs_storage vtfs_store;
-
-int vtfs_iterate(struct file *filp, struct dir_context *ctx)
+static int __vtfs_iterate(struct file *filp, struct dir_context *ctx)
 {
     struct dentry *dentry = filp->f_path.dentry;
     struct inode *inode = d_inode(dentry);
+    struct vtfs_sb_info *sbi = VTFS_SB(inode->i_sb);
     struct vtfs_entry *dir_entry, *child_entry;
     unsigned long offset = ctx->pos;
     ino_t parent_ino;
     int stored = 0;
     unsigned long flags;
     
-    dir_entry = vtfs_storage_get_by_ino(inode->i_ino);
+    dir_entry = vtfs_storage_get_by_ino(sbi, inode->i_ino);
     if (!dir_entry)
         return -ENOENT;
     
     if (!S_ISDIR(dir_entry->mode))
         return -ENOTDIR;
     
+    /* The listing goes on in the background; what is known locally is emitted now */
+    if (offset == 0)
+        vtfs_prefetch_dir(sbi, inode);
+    
     if (offset == 0) {
         if (!dir_emit(ctx, ".", 1, inode->i_ino, DT_DIR))
             return stored;
@@ -46,11 +51,14 @@ int vtfs_iterate(struct file *filp, struct dir_context *ctx)
         offset++;
     }
     
-    spin_lock_irqsave(&vtfs_store.lock, flags);
+    vtfs_store_lock(sbi, &flags);
     
     list_for_each_entry(child_entry, &dir_entry->children, sibling) {
         unsigned char dtype;
         
+        if (child_entry->stale)
+            continue;
+        
         if (offset > 2) {
             offset--;
             continue;
@@ -63,23 +71,38 @@ int vtfs_iterate(struct file *filp, struct dir_context *ctx)
         else
             dtype = DT_UNKNOWN;
         
-        spin_unlock_irqrestore(&vtfs_store.lock, flags);
+        vtfs_store_unlock(sbi, flags);
         
         if (!dir_emit(ctx, child_entry->name, strlen(child_entry->name),
                      child_entry->ino, dtype))
             return stored;
         
-        spin_lock_irqsave(&vtfs_store.lock, flags);
+        vtfs_store_lock(sbi, &flags);
         
         ctx->pos++;
         stored++;
     }
     
-    spin_unlock_irqrestore(&vtfs_store.lock, flags);
+    vtfs_store_unlock(sbi, flags);
     
     return stored;
 }
 
+int vtfs_iterate(struct file *filp, struct dir_context *ctx)
+{
+    struct inode *inode = file_inode(filp);
+    struct vtfs_sb_info *sbi = VTFS_SB(inode->i_sb);
+    const char *name = filp->f_path.dentry->d_name.name;
+    u64 start = vtfs_stat_start();
+    int ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_ITERATE, inode->i_ino, name);
+    ret = __vtfs_iterate(filp, ctx);
+    vtfs_stat_op(sbi->stats, VTFS_STAT_ITERATE, start, ret < 0);
+    trace_vtfs_op_end(VTFS_STAT_ITERATE, inode->i_ino, name, ret, start);
+    return ret;
+}
+
 const struct file_operations vtfs_dir_ops = {
     .owner = THIS_MODULE,
     .iterate_shared = vtfs_iterate,
@@ -1,70 +1,428 @@
 #include <linux/fs.h>
 #include <linux/module.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/slab.h>
+#include <linux/mempool.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 #include "storage.h"
 #include "http.h"
+#include "super.h"
 #include "vtfs.h"
+#include "vtfs_trace.h"
 
-static ssize_t vtfs_read(struct file *filp, char __user *buffer,
-                         size_t len, loff_t *offset)
+/*
+ * Local reads and writes go through fixed chunks from a mempool rather than
+ * a kmalloc() of the whole length: no allocation in steady state, and no
+ * large contiguous one that can fail under fragmentation. The chunks are
+ * whole pages, so a write-through upload can splice them into the socket.
+ */
+#define VTFS_IO_CHUNK_ORDER 2
+#define VTFS_IO_CHUNK (PAGE_SIZE << VTFS_IO_CHUNK_ORDER)
+#define VTFS_IO_MIN_CHUNKS 4
+
+static mempool_t *vtfs_chunk_pool;
+
+/* Compound, so that the socket can take a reference on any page of a chunk */
+static void *chunk_alloc(gfp_t gfp, void *data)
+{
+    return alloc_pages(gfp | __GFP_COMP, VTFS_IO_CHUNK_ORDER);
+}
+
+static void chunk_free(void *element, void *data)
+{
+    __free_pages(element, VTFS_IO_CHUNK_ORDER);
+}
+
+int vtfs_file_init(void)
+{
+    vtfs_chunk_pool = mempool_create(VTFS_IO_MIN_CHUNKS, chunk_alloc, chunk_free, NULL);
+    return vtfs_chunk_pool ? 0 : -ENOMEM;
+}
+
+void vtfs_file_exit(void)
+{
+    mempool_destroy(vtfs_chunk_pool);
+}
+
+static char *chunk_get(void)
+{
+    return page_address(mempool_alloc(vtfs_chunk_pool, GFP_KERNEL));
+}
+
+static void chunk_put(char *chunk)
+{
+    mempool_free(virt_to_page(chunk), vtfs_chunk_pool);
+}
+
+/*
+ * The mount's window, locked; NULL if another transfer has it or it cannot be
+ * allocated. Nobody waits for it: the holder keeps it across uploads.
+ */
+static char *window_get(struct vtfs_sb_info *sbi)
+{
+    char *window;
+
+    if (!mutex_trylock(&sbi->window_lock))
+        return NULL;
+    if (!sbi->window)
+        sbi->window = kvmalloc(VTFS_MAX_FILE_SIZE, GFP_KERNEL);
+    window = sbi->window;
+    if (!window)
+        mutex_unlock(&sbi->window_lock);
+    return window;
+}
+
+static void window_put(struct vtfs_sb_info *sbi)
+{
+    mutex_unlock(&sbi->window_lock);
+}
+
+/*
+ * A read from the server. One long enough to stripe is gathered a window of
+ * stripes ranges at a time in the mount's window, since the workers cannot
+ * reach the caller's memory; anything else, or with the window busy, is
+ * decoded straight into the user buffer as the reply arrives.
+ */
+static ssize_t remote_read(struct vtfs_sb_info *sbi, const char *path,
+                           char __user *buffer, size_t len, loff_t offset)
+{
+    size_t stripe_size = READ_ONCE(sbi->http.stripe_size);
+    unsigned int stripes = READ_ONCE(sbi->http.stripes);
+    struct iov_iter iter;
+    size_t count, step;
+    char *window = NULL;
+    ssize_t done = 0, n;
+    u64 start;
+    int ret;
+
+    if (stripe_size && stripes > 1 && len > stripe_size)
+        window = window_get(sbi);
+    if (!window) {
+        ret = import_ubuf(ITER_DEST, buffer, len, &iter);
+        if (ret)
+            return ret;
+        return vtfs_http_read_iter(&sbi->http, path, &iter, offset);
+    }
+
+    step = min_t(size_t, stripe_size * stripes, VTFS_MAX_FILE_SIZE);
+    while (done < len) {
+        count = min_t(size_t, len - done, step);
+        n = vtfs_http_read(&sbi->http, path, window, count, offset + done);
+        if (n <= 0) {
+            if (n < 0 && !done)
+                done = n;
+            break;
+        }
+
+        start = vtfs_stat_start();
+        if (copy_to_user(buffer + done, window, n)) {
+            if (!done)
+                done = -EFAULT;
+            break;
+        }
+        vtfs_stat_op(sbi->stats, VTFS_STAT_COPY, start, false);
+
+        done += n;
+        if (n < count)
+            break;
+    }
+
+    window_put(sbi);
+    return done;
+}
+
+/*
+ * Readahead for cache=none, where each read() would otherwise ask the server
+ * for exactly the bytes asked for. A read starting where the previous one on
+ * the same file ended earns a window, doubling from VTFS_RA_MIN up to the
+ * readahead= limit, and the next window is fetched in the background while
+ * the reader works through the current one. Any other read drops the window,
+ * so random access makes the one request it always made and nothing more.
+ */
+#define VTFS_RA_MIN (64 * 1024)
+
+struct vtfs_ra_buf {
+    u8 *data;
+    loff_t start;
+    size_t len;
+};
+
+struct vtfs_readahead {
+    struct vtfs_sb_info *sbi;
+    struct mutex lock;
+    /* Where a sequential read starts, -1 before the first read */
+    loff_t next;
+    size_t window;
+    /* The fetch of ahead came back short */
+    bool eof;
+    /* Data being served, and the window being fetched behind it while busy */
+    struct vtfs_ra_buf cur;
+    struct vtfs_ra_buf ahead;
+    size_t ahead_size;
+    bool busy;
+    struct work_struct work;
+    char path[VTFS_MAX_PATH_LEN];
+};
+
+static void ra_work(struct work_struct *work)
+{
+    struct vtfs_readahead *ra = container_of(work, struct vtfs_readahead, work);
+    int ret;
+
+    ret = vtfs_http_read(&ra->sbi->http, ra->path, ra->ahead.data, ra->ahead_size,
+                         ra->ahead.start);
+    ra->ahead.len = ret > 0 ? ret : 0;
+    vtfs_stat_inc(ra->sbi->stats, readahead_bytes, ra->ahead.len);
+}
+
+static void ra_buf_free(struct vtfs_ra_buf *buf)
+{
+    kvfree(buf->data);
+    buf->data = NULL;
+    buf->start = 0;
+    buf->len = 0;
+}
+
+/* Waits for the fetch in flight; returns whether ahead holds any data */
+static bool ra_reap(struct vtfs_readahead *ra)
+{
+    if (!ra->busy)
+        return false;
+
+    flush_work(&ra->work);
+    ra->busy = false;
+    if (!ra->ahead.len) {
+        ra_buf_free(&ra->ahead);
+        return false;
+    }
+    return true;
+}
+
+static struct vtfs_readahead *ra_get(struct file *filp, struct vtfs_sb_info *sbi)
+{
+    struct vtfs_readahead *ra = READ_ONCE(filp->private_data);
+
+    if (ra)
+        return ra;
+
+    ra = kzalloc(sizeof(*ra), GFP_KERNEL);
+    if (!ra)
+        return NULL;
+    ra->sbi = sbi;
+    mutex_init(&ra->lock);
+    ra->next = -1;
+    INIT_WORK(&ra->work, ra_work);
+
+    /* Two readers of one file may race to set it up */
+    if (cmpxchg(&filp->private_data, NULL, ra)) {
+        kfree(ra);
+        ra = READ_ONCE(filp->private_data);
+    }
+    return ra;
+}
+
+/* Forget everything read ahead, as after a write through the same file */
+static void ra_drop(struct vtfs_readahead *ra)
+{
+    ra_reap(ra);
+    ra_buf_free(&ra->ahead);
+    ra_buf_free(&ra->cur);
+    ra->next = -1;
+    ra->window = 0;
+    ra->eof = false;
+}
+
+static ssize_t ra_read(struct vtfs_readahead *ra, const char *path,
+                       char __user *buffer, size_t len, loff_t offset, size_t limit)
+{
+    struct vtfs_sb_info *sbi = ra->sbi;
+    size_t done = 0, avail;
+    ssize_t ret;
+    loff_t pos;
+    u64 start;
+
+    mutex_lock(&ra->lock);
+
+    if (offset == ra->next) {
+        ra->window = min_t(size_t, max_t(size_t, ra->window * 2, VTFS_RA_MIN), limit);
+    } else {
+        ra_buf_free(&ra->cur);
+        ra->window = 0;
+        ra->eof = false;
+    }
+
+    while (done < len) {
+        pos = offset + done;
+        if (pos < ra->cur.start || pos >= ra->cur.start + (loff_t)ra->cur.len) {
+            /* Only a stream waits, and only for the window that continues it */
+            if (!ra->window || !ra->busy || ra->ahead.start != pos || !ra_reap(ra))
+                break;
+            if (ra->ahead.len < ra->ahead_size)
+                ra->eof = true;
+            ra_buf_free(&ra->cur);
+            ra->cur = ra->ahead;
+            ra->ahead.data = NULL;
+            ra->ahead.len = 0;
+            continue;
+        }
+
+        avail = min_t(size_t, len - done, ra->cur.start + ra->cur.len - pos);
+        start = vtfs_stat_start();
+        if (copy_to_user(buffer + done, ra->cur.data + (pos - ra->cur.start), avail)) {
+            ret = -EFAULT;
+            goto fail;
+        }
+        vtfs_stat_op(sbi->stats, VTFS_STAT_COPY, start, false);
+        vtfs_stat_inc(sbi->stats, readahead_hit_bytes, avail);
+        done += avail;
+    }
+
+    /* The rest is read as without readahead */
+    if (done < len) {
+        ret = remote_read(sbi, path, buffer + done, len - done, offset + done);
+        if (ret < 0)
+            goto fail;
+        ra->eof = (size_t)ret < len - done;
+        done += ret;
+    }
+
+    ra->next = offset + done;
+    if (!ra->window || ra->eof)
+        goto out;
+
+    /* Keep one window in flight past what has been read or fetched */
+    pos = max_t(loff_t, ra->next, ra->cur.start + ra->cur.len);
+    if (ra->busy && ra->ahead.start != pos) {
+        ra_reap(ra);
+        ra_buf_free(&ra->ahead);
+    }
+    if (ra->busy || pos >= VTFS_MAX_FILE_SIZE)
+        goto out;
+
+    ra->ahead.data = kvmalloc(ra->window, GFP_KERNEL);
+    if (ra->ahead.data) {
+        ra->ahead.start = pos;
+        ra->ahead.len = 0;
+        ra->ahead_size = ra->window;
+        strscpy(ra->path, path, sizeof(ra->path));
+        ra->busy = true;
+        queue_work(system_unbound_wq, &ra->work);
+    }
+out:
+    mutex_unlock(&ra->lock);
+    return done;
+
+fail:
+    /* Bytes already copied make a short read */
+    ra->next = done ? offset + done : -1;
+    mutex_unlock(&ra->lock);
+    return done ? done : ret;
+}
+
+static ssize_t __vtfs_read(struct file *filp, char __user *buffer,
+                           size_t len, loff_t *offset)
 {
     struct inode *inode = file_inode(filp);
+    struct vtfs_sb_info *sbi = VTFS_SB(inode->i_sb);
     struct vtfs_entry *entry;
-    char *kbuffer;
-    ssize_t bytes_read;
+    char *chunk;
+    ssize_t bytes_read = 0;
+    ssize_t n;
+    bool remote;
+    u64 start;
     
-    entry = vtfs_storage_get_by_ino(inode->i_ino);
+    entry = vtfs_storage_get_by_ino(sbi, inode->i_ino);
     if (!entry)
         return -ENOENT;
     
     if (!S_ISREG(entry->mode))
         return -EISDIR;
     
-    if (*offset >= entry->size)
-        return 0;
+    /* Only cache=none asks the server, whose copy may be longer than ours */
+    remote = vtfs_use_remote(sbi) && vtfs_cache_mode(sbi) == VTFS_CACHE_NONE;
     
-    kbuffer = kmalloc(len, GFP_KERNEL);
-    if (!kbuffer)
-        return -ENOMEM;
+    if (!remote && *offset >= entry->size)
+        return 0;
     
-    bytes_read = -1;
-    if (use_remote_server()) {
-        char full_path[256];
+    if (remote) {
+        size_t limit = READ_ONCE(sbi->opts.readahead);
+        struct vtfs_readahead *ra = NULL;
+        char full_path[VTFS_MAX_PATH_LEN];
+        
+        /* Nothing lies past the largest file, which bounds what the server is asked for */
+        if (*offset >= VTFS_MAX_FILE_SIZE)
+            return 0;
+        len = min_t(size_t, len, VTFS_MAX_FILE_SIZE - *offset);
         
         vtfs_get_full_path(entry, full_path, sizeof(full_path));
-        bytes_read = vtfs_http_read(full_path, kbuffer, len, *offset);
+        if (limit)
+            ra = ra_get(filp, sbi);
+        if (ra)
+            bytes_read = ra_read(ra, full_path, buffer, len, *offset, limit);
+        else
+            bytes_read = remote_read(sbi, full_path, buffer, len, *offset);
+        if (bytes_read < 0)
+            return bytes_read == -EFAULT ? -EFAULT : -EIO;
+        
+        *offset += bytes_read;
+        inode->i_size = entry->size;
+        return bytes_read;
     }
     
-    if (bytes_read < 0) {
-        bytes_read = vtfs_storage_read(entry, kbuffer, len, *offset);
-        if (bytes_read < 0) {
-            kfree(kbuffer);
-            return bytes_read;
+    chunk = chunk_get();
+    
+    while (bytes_read < len) {
+        n = vtfs_storage_read(sbi, entry, chunk,
+                              min_t(size_t, len - bytes_read, VTFS_IO_CHUNK),
+                              *offset + bytes_read);
+        if (n <= 0) {
+            if (n < 0 && !bytes_read)
+                bytes_read = n;
+            break;
+        }
+        
+        start = vtfs_stat_start();
+        if (copy_to_user(buffer + bytes_read, chunk, n)) {
+            if (!bytes_read)
+                bytes_read = -EFAULT;
+            break;
         }
+        vtfs_stat_op(sbi->stats, VTFS_STAT_COPY, start, false);
+        
+        bytes_read += n;
+        if (n < VTFS_IO_CHUNK)
+            break;
     }
     
-    if (copy_to_user(buffer, kbuffer, bytes_read)) {
-        kfree(kbuffer);
-        return -EFAULT;
-    }
+    chunk_put(chunk);
+    if (bytes_read < 0)
+        return bytes_read;
     
-    kfree(kbuffer);
     *offset += bytes_read;
     inode->i_size = entry->size;
     
     return bytes_read;
 }
 
-static ssize_t vtfs_write(struct file *filp, const char __user *buffer,
-                          size_t len, loff_t *offset)
+static ssize_t __vtfs_write(struct file *filp, const char __user *buffer,
+                            size_t len, loff_t *offset)
 {
     struct inode *inode = file_inode(filp);
+    struct vtfs_sb_info *sbi = VTFS_SB(inode->i_sb);
     struct vtfs_entry *entry;
-    char *kbuffer;
-    ssize_t bytes_written;
+    char *chunk;
+    ssize_t bytes_written = 0;
+    ssize_t n;
+    size_t count, step = 0;
+    size_t stripe_size = READ_ONCE(sbi->http.stripe_size);
+    unsigned int stripes = READ_ONCE(sbi->http.stripes);
+    struct vtfs_readahead *ra = READ_ONCE(filp->private_data);
+    bool window = false;
+    u64 start;
     
-    entry = vtfs_storage_get_by_ino(inode->i_ino);
+    entry = vtfs_storage_get_by_ino(sbi, inode->i_ino);
     if (!entry)
         return -ENOENT;
     
@@ -77,29 +435,61 @@ static ssize_t vtfs_write(struct file *filp, const char __user *buffer,
     if (filp->f_flags & O_APPEND)
         *offset = entry->size;
     
-    kbuffer = kmalloc(len, GFP_KERNEL);
-    if (!kbuffer)
-        return -ENOMEM;
-    
-    if (copy_from_user(kbuffer, buffer, len)) {
-        kfree(kbuffer);
-        return -EFAULT;
+    /*
+     * A write long enough to stripe is handed on in windows of stripes ranges,
+     * so that each upload can go out over several connections at once. So is
+     * a long rewrite, to be compared with the server's blocks whole. Both use
+     * the mount's window, which len never exceeds; while another transfer
+     * has it, the write goes in pool chunks instead.
+     */
+    chunk = NULL;
+    if (vtfs_use_remote(sbi) && stripe_size && stripes > 1 && len > stripe_size)
+        step = min_t(size_t, len, stripe_size * stripes);
+    else if (vtfs_use_remote(sbi) && len >= VTFS_DELTA_MIN && *offset < entry->size)
+        step = len;
+    if (step > VTFS_IO_CHUNK) {
+        chunk = window_get(sbi);
+        window = chunk != NULL;
+    }
+    if (!window) {
+        step = VTFS_IO_CHUNK;
+        chunk = chunk_get();
     }
     
-    bytes_written = vtfs_storage_write(entry, kbuffer, len, *offset);
-    
-    if (bytes_written < 0) {
-        kfree(kbuffer);
-        return bytes_written;
+    /* A failure past the first chunk ends the write short, as usual */
+    while (bytes_written < len) {
+        count = min_t(size_t, len - bytes_written, step);
+        
+        start = vtfs_stat_start();
+        if (copy_from_user(chunk, buffer + bytes_written, count)) {
+            n = -EFAULT;
+        } else {
+            vtfs_stat_op(sbi->stats, VTFS_STAT_COPY, start, false);
+            n = vtfs_storage_write(sbi, entry, chunk, count,
+                                   *offset + bytes_written);
+        }
+        if (n < 0) {
+            if (!bytes_written)
+                bytes_written = n;
+            break;
+        }
+        
+        bytes_written += n;
     }
     
-    if (use_remote_server()) {
-        char full_path[256];
-        vtfs_get_full_path(entry, full_path, sizeof(full_path));
-        vtfs_http_write(full_path, kbuffer, len, *offset);
+    if (window)
+        window_put(sbi);
+    else
+        chunk_put(chunk);
+    
+    if (ra) {
+        mutex_lock(&ra->lock);
+        ra_drop(ra);
+        mutex_unlock(&ra->lock);
     }
     
-    kfree(kbuffer);
+    if (bytes_written < 0)
+        return bytes_written;
     
     *offset += bytes_written;
     inode->i_size = entry->size;
@@ -108,9 +498,74 @@ static ssize_t vtfs_write(struct file *filp, const char __user *buffer,
     return bytes_written;
 }
 
+static ssize_t vtfs_read(struct file *filp, char __user *buffer,
+                         size_t len, loff_t *offset)
+{
+    struct inode *inode = file_inode(filp);
+    struct vtfs_sb_info *sbi = VTFS_SB(inode->i_sb);
+    const char *name = filp->f_path.dentry->d_name.name;
+    u64 start = vtfs_stat_start();
+    ssize_t ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_READ, inode->i_ino, name);
+    ret = __vtfs_read(filp, buffer, len, offset);
+    vtfs_stat_op(sbi->stats, VTFS_STAT_READ, start, ret < 0);
+    trace_vtfs_op_end(VTFS_STAT_READ, inode->i_ino, name, ret, start);
+    return ret;
+}
+
+static ssize_t vtfs_write(struct file *filp, const char __user *buffer,
+                          size_t len, loff_t *offset)
+{
+    struct inode *inode = file_inode(filp);
+    struct vtfs_sb_info *sbi = VTFS_SB(inode->i_sb);
+    const char *name = filp->f_path.dentry->d_name.name;
+    u64 start = vtfs_stat_start();
+    ssize_t ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_WRITE, inode->i_ino, name);
+    ret = __vtfs_write(filp, buffer, len, offset);
+    vtfs_stat_op(sbi->stats, VTFS_STAT_WRITE, start, ret < 0);
+    trace_vtfs_op_end(VTFS_STAT_WRITE, inode->i_ino, name, ret, start);
+    return ret;
+}
+
+/* An entry added by a directory prefetch gets its data on first open */
+static int vtfs_open(struct inode *inode, struct file *filp)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(inode->i_sb);
+    struct vtfs_entry *entry = vtfs_storage_get_by_ino(sbi, inode->i_ino);
+    int ret;
+    
+    if (!entry || !entry->unloaded)
+        return 0;
+    
+    ret = vtfs_refresh_from_remote(sbi, entry, inode);
+    if (!ret && entry->unloaded)
+        ret = -EIO;
+    if (ret)
+        return ret == -ENOENT ? ret : -EIO;
+    
+    inode->i_size = entry->size;
+    return 0;
+}
+
+static int vtfs_release(struct inode *inode, struct file *filp)
+{
+    struct vtfs_readahead *ra = filp->private_data;
+    
+    if (ra) {
+        ra_drop(ra);
+        kfree(ra);
+    }
+    return 0;
+}
+
 const struct file_operations vtfs_file_ops = {
     .owner   = THIS_MODULE,
     .read    = vtfs_read,
     .write   = vtfs_write,
+    .open    = vtfs_open,
+    .release = vtfs_release,
     .llseek  = generic_file_llseek,
 };
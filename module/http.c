@@ -2,21 +2,43 @@
 #include <linux/module.h>
 #include <linux/net.h>
 #include <linux/in.h>
+#include <linux/un.h>
 #include <linux/socket.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
 #include <linux/string.h>
 #include <linux/inet.h>
+#include <linux/random.h>
+#include <linux/uio.h>
+#include <linux/bvec.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/kref.h>
+#include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/lz4.h>
 #include <net/sock.h>
 #include <linux/stdarg.h>
 
 #include "vtfs.h"
 #include "http.h"
-
-static char server_host[256] = "127.0.0.1";
-static int server_port = 8080;
-static bool http_initialized = false;
-
-static int parse_url(const char *url)
+#include "vtfs_trace.h"
+
+/*
+ * A connection owns the buffers a call needs, allocated once when it is
+ * made and kept while it sits in the pool, so a request allocates nothing.
+ */
+struct vtfs_http_conn {
+    struct socket *sock;
+    struct list_head list;
+    char request[VTFS_HTTP_BUFFER_SIZE];
+    char buf[VTFS_HTTP_RECV_SIZE];
+    u8 bounce[VTFS_HTTP_BOUNCE_SIZE];
+    /* Time the last reply spent blocked on the socket */
+    u64 waited;
+};
+
+static int parse_url(struct vtfs_http_client *client, const char *url)
 {
     const char *host_start;
     const char *port_start;
@@ -25,6 +47,17 @@ static int parse_url(const char *url)
     if (!url)
         return -EINVAL;
 
+    /* A co-located server on a Unix socket; the path must be absolute */
+    if (strncmp(url, "unix:", 5) == 0) {
+        if (url[5] != '/' ||
+            strscpy(client->unix_path, url + 5, sizeof(client->unix_path)) < 0)
+            return -EINVAL;
+        client->host[0] = '\0';
+        client->port = 0;
+        return 0;
+    }
+    client->unix_path[0] = '\0';
+
     if (strncmp(url, "http://", 7) == 0)
         host_start = url + 7;
     else
@@ -33,11 +66,11 @@ static int parse_url(const char *url)
     port_start = strchr(host_start, ':');
     if (port_start) {
         host_len = port_start - host_start;
-        if (kstrtoint(port_start + 1, 10, &server_port) != 0)
-            server_port = 8080;
+        if (kstrtoint(port_start + 1, 10, &client->port) != 0)
+            client->port = 8080;
     } else {
         host_len = strlen(host_start);
-        server_port = 8080;
+        client->port = 8080;
     }
 
     {
@@ -46,62 +79,111 @@ static int parse_url(const char *url)
             host_len = slash - host_start;
     }
 
-    if (host_len >= sizeof(server_host))
-        host_len = sizeof(server_host) - 1;
+    if (host_len >= sizeof(client->host))
+        host_len = sizeof(client->host) - 1;
 
-    strncpy(server_host, host_start, host_len);
-    server_host[host_len] = '\0';
+    strncpy(client->host, host_start, host_len);
+    client->host[host_len] = '\0';
 
     return 0;
 }
 
-int vtfs_http_init(const char *server_url)
+int vtfs_http_init(struct vtfs_http_client *client, const char *server_url,
+                   const char *token, unsigned int pool_size, bool rpc)
 {
     int ret;
 
-    if (server_url) {
-        ret = parse_url(server_url);
-        if (ret)
-            return ret;
-    }
+    ret = parse_url(client, server_url);
+    if (ret)
+        return ret;
 
-    http_initialized = true;
+    if (client->unix_path[0])
+        strscpy(client->authority, "localhost", sizeof(client->authority));
+    else
+        snprintf(client->authority, sizeof(client->authority), "%s:%d",
+                 client->host, client->port);
+
+    strscpy(client->token, token ? token : "", sizeof(client->token));
+    snprintf(client->client_id, sizeof(client->client_id), "%016llx",
+             get_random_u64());
+
+    spin_lock_init(&client->pool_lock);
+    INIT_LIST_HEAD(&client->idle);
+    mutex_init(&client->channel_lock);
+    memset(client->channels, 0, sizeof(client->channels));
+    client->idle_count = 0;
+    client->pool_size = pool_size;
+    client->rpc = rpc;
+
+    client->initialized = true;
     return 0;
 }
 
-void vtfs_http_cleanup(void)
+static void conn_free(struct vtfs_http_conn *conn)
 {
-    http_initialized = false;
+    if (conn->sock)
+        sock_release(conn->sock);
+    kvfree(conn);
 }
 
-void vtfs_http_set_server(const char *url)
+static void channel_release(struct kref *ref);
+
+void vtfs_http_cleanup(struct vtfs_http_client *client)
 {
-    if (url)
-        parse_url(url);
+    struct vtfs_http_conn *conn, *tmp;
+    int i;
+
+    if (!client->initialized)
+        return;
+
+    client->initialized = false;
+
+    list_for_each_entry_safe(conn, tmp, &client->idle, list) {
+        list_del(&conn->list);
+        conn_free(conn);
+    }
+    client->idle_count = 0;
+
+    for (i = 0; i < VTFS_HTTP_MAX_CHANNELS; i++) {
+        if (client->channels[i])
+            kref_put(&client->channels[i]->ref, channel_release);
+        client->channels[i] = NULL;
+    }
 }
 
-static struct socket *create_connection(void)
+static struct socket *create_connection(struct vtfs_http_client *client)
 {
     struct socket *sock = NULL;
-    struct sockaddr_in server_addr;
+    struct sockaddr_storage addr;
+    int addr_len;
     int ret;
 
-    ret = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
+    memset(&addr, 0, sizeof(addr));
+    if (client->unix_path[0]) {
+        struct sockaddr_un *sun = (struct sockaddr_un *)&addr;
+
+        sun->sun_family = AF_UNIX;
+        strscpy(sun->sun_path, client->unix_path, sizeof(sun->sun_path));
+        addr_len = offsetof(struct sockaddr_un, sun_path) + strlen(sun->sun_path) + 1;
+        ret = sock_create_kern(&init_net, AF_UNIX, SOCK_STREAM, 0, &sock);
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(client->port);
+        if (in4_pton(client->host, -1, (u8 *)&sin->sin_addr.s_addr, -1, NULL) != 1)
+            return NULL;
+        addr_len = sizeof(*sin);
+        ret = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
+    }
     if (ret < 0)
         return NULL;
 
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(server_port);
+    /* Bounds connect and send; a dead server must not stall callers for minutes */
+    sock->sk->sk_sndtimeo = VTFS_HTTP_SEND_TIMEOUT;
+    sock->sk->sk_rcvtimeo = VTFS_HTTP_RECV_TIMEOUT;
 
-    ret = in4_pton(server_host, -1, (u8 *)&server_addr.sin_addr.s_addr, -1, NULL);
-    if (ret != 1) {
-        sock_release(sock);
-        return NULL;
-    }
-
-    ret = kernel_connect(sock, (struct sockaddr *)&server_addr,
-                         sizeof(server_addr), 0);
+    ret = kernel_connect(sock, (struct sockaddr *)&addr, addr_len, 0);
     if (ret < 0) {
         sock_release(sock);
         return NULL;
@@ -110,18 +192,84 @@ static struct socket *create_connection(void)
     return sock;
 }
 
-static int socket_send(struct socket *sock, const char *buf, size_t len)
+static void conn_put(struct vtfs_http_client *client, struct vtfs_http_conn *conn,
+                     bool reusable)
+{
+    if (reusable) {
+        spin_lock(&client->pool_lock);
+        if (client->initialized && client->idle_count < client->pool_size) {
+            list_add(&conn->list, &client->idle);
+            client->idle_count++;
+            conn = NULL;
+        }
+        spin_unlock(&client->pool_lock);
+    }
+
+    if (conn)
+        conn_free(conn);
+}
+
+static int socket_send(struct socket *sock, const char *buf, size_t len,
+                       int flags)
 {
     struct kvec iov;
     struct msghdr msg;
 
     memset(&msg, 0, sizeof(msg));
+    msg.msg_flags = flags;
     iov.iov_base = (void *)buf;
     iov.iov_len = len;
 
     return kernel_sendmsg(sock, &msg, &iov, 1, len);
 }
 
+static struct page *body_page(const void *p)
+{
+    return is_vmalloc_addr(p) ? vmalloc_to_page(p) : virt_to_page(p);
+}
+
+/*
+ * Sends a request body straight from the memory it lives in. Page-backed
+ * memory is spliced with MSG_SPLICE_PAGES: the socket takes references on
+ * the pages instead of copying them. Slab memory cannot be spliced and is
+ * copied by the socket as usual. The caller keeps the data unchanged until
+ * the reply arrives, by which time the server has every byte.
+ */
+static int socket_send_body(struct socket *sock, const void *data, size_t len)
+{
+    struct bio_vec bvec[VTFS_HTTP_BODY_SEGS];
+    struct msghdr msg;
+    size_t sent = 0, bytes, n;
+    const u8 *p;
+    bool splice;
+    int nr, ret;
+
+    while (sent < len) {
+        nr = 0;
+        bytes = 0;
+        splice = true;
+        while (sent + bytes < len && nr < VTFS_HTTP_BODY_SEGS) {
+            p = data + sent + bytes;
+            n = min_t(size_t, len - sent - bytes, PAGE_SIZE - offset_in_page(p));
+            bvec_set_page(&bvec[nr], body_page(p), n, offset_in_page(p));
+            if (!sendpage_ok(bvec[nr].bv_page))
+                splice = false;
+            nr++;
+            bytes += n;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_flags = splice ? MSG_SPLICE_PAGES : 0;
+        iov_iter_bvec(&msg.msg_iter, ITER_SOURCE, bvec, nr, bytes);
+        ret = sock_sendmsg(sock, &msg);
+        if (ret <= 0)
+            return ret ? ret : -EIO;
+        sent += ret;
+    }
+
+    return sent;
+}
+
 static int socket_recv(struct socket *sock, char *buf, size_t len)
 {
     struct kvec iov;
@@ -134,413 +282,1321 @@ static int socket_recv(struct socket *sock, char *buf, size_t len)
     return kernel_recvmsg(sock, &msg, &iov, 1, len, 0);
 }
 
-static int url_encode(const char *src, char *dst, size_t dst_size)
+static const char *find_header(const char *headers, const char *end,
+                               const char *name)
 {
-    static const char hex[] = "0123456789ABCDEF";
-    size_t i, j;
-
-    for (i = 0, j = 0; src[i] && j < dst_size - 3; i++) {
-        char c = src[i];
-        if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
-            (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' || c == '~') {
-            dst[j++] = c;
-        } else {
-            dst[j++] = '%';
-            dst[j++] = hex[(c >> 4) & 0x0F];
-            dst[j++] = hex[c & 0x0F];
+    size_t len = strlen(name);
+    const char *line = strstr(headers, "\r\n");
+
+    while (line && line < end) {
+        line += 2;
+        if (strncasecmp(line, name, len) == 0 && line[len] == ':') {
+            line += len + 1;
+            while (*line == ' ')
+                line++;
+            return line;
         }
+        line = strstr(line, "\r\n");
     }
-    dst[j] = '\0';
 
-    return j;
+    return NULL;
 }
 
-static int parse_http_response(const char *response, char *body,
-                               size_t body_size, int *status_code)
+/*
+ * A response read incrementally through a fixed buffer: headers first,
+ * then the body in pieces with chunked framing removed.
+ */
+struct body_reader {
+    struct socket *sock;
+    char *buf;
+    size_t size;
+    /* Received but not yet consumed: buf[start, end) */
+    size_t start;
+    size_t end;
+    /* Payload left in the current chunk, or in the whole body */
+    size_t left;
+    bool chunked;
+    /* No framing at all; the body ends when the server closes */
+    bool until_close;
+    bool close;
+    bool done;
+    size_t received;
+    /* If set, time spent in socket_recv is added here */
+    u64 *waited;
+};
+
+/* Returns the bytes added, 0 when the server closed the connection */
+static int body_fill(struct body_reader *r)
 {
-    const char *body_start;
-    const char *status_start;
-    size_t body_len;
+    u64 start;
+    int ret;
 
-    status_start = strstr(response, "HTTP/1.");
-    if (!status_start) {
-        *status_code = 500;
-        return 0;
+    if (r->start) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
     }
-    
-    status_start = strchr(status_start, ' ');
-    if (!status_start) {
-        *status_code = 500;
-        return 0;
+    if (r->end == r->size - 1)
+        return -EMSGSIZE;
+
+    start = r->waited ? vtfs_stat_start() : 0;
+    ret = socket_recv(r->sock, r->buf + r->end, r->size - 1 - r->end);
+    if (r->waited)
+        *r->waited += vtfs_stat_start() - start;
+    if (ret <= 0)
+        return ret;
+
+    r->end += ret;
+    r->received += ret;
+    r->buf[r->end] = '\0';
+    return ret;
+}
+
+/* Returns the HTTP status, 0 if the server closed before sending headers */
+static int body_headers(struct body_reader *r)
+{
+    const char *body;
+    const char *value;
+    unsigned long status;
+    int ret;
+
+    r->buf[0] = '\0';
+    while (!(body = strstr(r->buf, "\r\n\r\n"))) {
+        ret = body_fill(r);
+        if (ret <= 0)
+            return ret ? ret : (r->received ? -ECONNRESET : 0);
     }
-    
-    status_start++;
-    unsigned long status_ul = simple_strtoul(status_start, NULL, 10);
-    if (status_ul >= 100 && status_ul <= 599) {
-        *status_code = (int)status_ul;
-    } else {
-        *status_code = 500;
+    body += 4;
+
+    value = strchr(r->buf, ' ');
+    status = value ? simple_strtoul(value + 1, NULL, 10) : 0;
+    if (status < 100 || status > 599)
+        status = 500;
+
+    value = find_header(r->buf, body, "Transfer-Encoding");
+    r->chunked = value && strncasecmp(value, "chunked", 7) == 0;
+
+    value = find_header(r->buf, body, "Connection");
+    r->close = value && strncasecmp(value, "close", 5) == 0;
+
+    value = find_header(r->buf, body, "Content-Length");
+    if (r->chunked)
+        r->left = 0;
+    else if (value)
+        r->left = simple_strtoul(value, NULL, 10);
+    else
+        r->until_close = true;
+
+    r->start = body - r->buf;
+    return status;
+}
+
+/* Consumes a chunk-size line, skipping the CRLF after the previous chunk */
+static int body_next_chunk(struct body_reader *r)
+{
+    bool last = false;
+    char *line, *eol;
+    int ret;
+
+    for (;;) {
+        line = r->buf + r->start;
+        eol = memchr(line, '\n', r->end - r->start);
+        if (!eol) {
+            ret = body_fill(r);
+            if (ret <= 0)
+                return ret ? ret : -ECONNRESET;
+            continue;
+        }
+
+        r->start = eol + 1 - r->buf;
+        if (eol == line || (eol == line + 1 && *line == '\r')) {
+            if (last) {
+                r->done = true;
+                return 0;
+            }
+            continue;
+        }
+        /* Trailer fields after the last chunk are ignored */
+        if (last)
+            continue;
+
+        r->left = simple_strtoul(line, NULL, 16);
+        if (r->left)
+            return 0;
+        last = true;
     }
+}
 
-    body_start = strstr(response, "\r\n\r\n");
-    if (!body_start)
-        body_start = strstr(response, "\n\n");
-    
-    if (!body_start) {
-        body[0] = '\0';
+/*
+ * Points *data at the next piece of body and returns its length, 0 at the
+ * end of the body. The piece stays valid until the next call.
+ */
+static ssize_t body_next(struct body_reader *r, const char **data)
+{
+    size_t n;
+    int ret;
+
+    if (r->chunked && !r->left && !r->done) {
+        ret = body_next_chunk(r);
+        if (ret < 0)
+            return ret;
+    }
+    if (r->done || (!r->left && !r->until_close)) {
+        r->done = true;
         return 0;
     }
 
-    body_start += (response[body_start - response] == '\r') ? 4 : 2;
-
-    if (strstr(response, "Transfer-Encoding: chunked")) {
-        const char *chunk_ptr = body_start;
-        char *output_ptr = body;
-        size_t total_decoded = 0;
-        
-        while (total_decoded < body_size - 1) {
-            unsigned long chunk_size;
-            char *endptr;
-            
-            chunk_size = simple_strtoul(chunk_ptr, &endptr, 16);
-            if (chunk_size == 0) break;
-            
-            chunk_ptr = endptr;
-            while (*chunk_ptr == '\r' || *chunk_ptr == '\n') chunk_ptr++;
-            
-            if (total_decoded + chunk_size >= body_size - 1)
-                chunk_size = body_size - 1 - total_decoded;
-            
-            memcpy(output_ptr, chunk_ptr, chunk_size);
-            output_ptr += chunk_size;
-            total_decoded += chunk_size;
-            
-            chunk_ptr += chunk_size;
-            while (*chunk_ptr == '\r' || *chunk_ptr == '\n') chunk_ptr++;
+    if (r->start == r->end) {
+        ret = body_fill(r);
+        if (ret < 0)
+            return ret;
+        if (ret == 0) {
+            if (!r->until_close)
+                return -ECONNRESET;
+            r->done = true;
+            return 0;
         }
-        
-        *output_ptr = '\0';
-        return total_decoded;
     }
 
-    body_len = strlen(body_start);
-    if (body_len >= body_size)
-        body_len = body_size - 1;
+    n = r->end - r->start;
+    if (!r->until_close) {
+        n = min(n, r->left);
+        r->left -= n;
+    }
+    *data = r->buf + r->start;
+    r->start += n;
+    return n;
+}
 
-    memcpy(body, body_start, body_len);
-    body[body_len] = '\0';
+/* Pipelined bytes past the body would belong to nobody */
+static bool body_reusable(const struct body_reader *r)
+{
+    return r->done && !r->close && !r->until_close && r->start == r->end;
+}
+
+/*
+ * Receives the response on conn into ctx. Returns the bytes received, 0 or
+ * a negative error on failure; *received says whether anything arrived.
+ */
+typedef int (*http_recv_fn)(struct vtfs_http_conn *conn, void *ctx,
+                            size_t *received, bool *keep_alive);
+
+struct http_args {
+    const char *method;
+    /* The first path argument, for tracing */
+    const char *path;
+    size_t count;
+    const char *keys[VTFS_HTTP_MAX_ARGS];
+    const char *values[VTFS_HTTP_MAX_ARGS];
+    /* Sent as the body of a POST when set; the request line carries the rest */
+    const void *body;
+    size_t body_len;
+    /* vtfs-rpc only: set when body is an LZ4 block, to its length before */
+    size_t raw_len;
+};
 
-    return body_len;
+static int append_encoded(char *request, size_t *len, const char *value)
+{
+    int ret = vtfs_url_encode(value, request + *len, VTFS_HTTP_BUFFER_SIZE - *len);
+
+    if (ret < 0)
+        return -EMSGSIZE;
+
+    *len += ret;
+    return 0;
 }
 
-int64_t vtfs_http_call(const char *token,
-                       const char *method,
-                       char *response_buffer,
-                       size_t buffer_size,
-                       size_t arg_size,
-                       ...)
+static __printf(3, 4) int append(char *request, size_t *len, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, fmt);
+    ret = vsnprintf(request + *len, VTFS_HTTP_BUFFER_SIZE - *len, fmt, ap);
+    va_end(ap);
+    if (*len + ret >= VTFS_HTTP_BUFFER_SIZE)
+        return -EMSGSIZE;
+
+    *len += ret;
+    return 0;
+}
+
+/* Writes the request into the connection's buffer; -EMSGSIZE if it does not fit */
+static ssize_t build_request(struct vtfs_http_client *client, char *request,
+                             const struct http_args *args)
+{
+    size_t len = 0, i;
+    int ret;
+
+    ret = append(request, &len, "%s /%s?token=%s&client=%s",
+                 args->body ? "POST" : "GET", args->method,
+                 client->token, client->client_id);
+
+    for (i = 0; !ret && i < args->count; i++) {
+        ret = append(request, &len, "&%s=", args->keys[i]);
+        if (!ret)
+            ret = append_encoded(request, &len, args->values[i]);
+    }
+
+    if (!ret)
+        ret = append(request, &len,
+            " HTTP/1.1\r\n"
+            "Host: %s\r\n"
+            "Connection: %s\r\n",
+            client->authority,
+            client->pool_size ? "keep-alive" : "close");
+
+    if (!ret && args->body)
+        ret = append(request, &len,
+            "Content-Type: application/octet-stream\r\n"
+            "Content-Length: %zu\r\n",
+            args->body_len);
+
+    if (!ret)
+        ret = append(request, &len, "\r\n");
+
+    return ret ? ret : len;
+}
+
+static int args_init(struct http_args *args, const char *method, size_t count,
+                     va_list ap)
 {
-    struct socket *sock = NULL;
-    char *request = NULL;
-    char *response = NULL;
-    char *query_params = NULL;
-    va_list args;
-    int ret = 0;
-    int http_status = 0;
-    size_t request_len;
     size_t i;
 
-    if (!http_initialized)
+    if (count > VTFS_HTTP_MAX_ARGS)
         return -EINVAL;
 
-    request = kmalloc(VTFS_HTTP_BUFFER_SIZE, GFP_KERNEL);
-    response = kmalloc(VTFS_HTTP_BUFFER_SIZE, GFP_KERNEL);
-    query_params = kmalloc(VTFS_HTTP_BUFFER_SIZE, GFP_KERNEL);
+    memset(args, 0, sizeof(*args));
+    args->method = method;
+    args->path = "";
+    args->count = count;
+    for (i = 0; i < count; i++) {
+        args->keys[i] = va_arg(ap, const char *);
+        args->values[i] = va_arg(ap, const char *);
+
+        if (!*args->path && (strcmp(args->keys[i], "path") == 0 ||
+                             strcmp(args->keys[i], "oldpath") == 0))
+            args->path = args->values[i];
+    }
 
-    if (!request || !response || !query_params) {
-        ret = -ENOMEM;
-        goto out;
+    return 0;
+}
+
+/*
+ * Asks the server to switch a fresh connection to vtfs-rpc. Any answer but
+ * 101 means it only speaks HTTP: the client stops asking, and the
+ * connection, with the answer drained, is left for HTTP requests. *lz4
+ * says whether the server took an offer of compression.
+ */
+static int rpc_upgrade(struct vtfs_http_client *client, struct vtfs_http_conn *conn,
+                       bool *lz4)
+{
+    bool offer = READ_ONCE(client->compress);
+    struct body_reader r = {
+        .sock = conn->sock,
+        .buf = conn->buf,
+        .size = VTFS_HTTP_RECV_SIZE,
+    };
+    const char *piece;
+    size_t len = 0;
+    ssize_t n;
+    int ret;
+
+    ret = append(conn->request, &len,
+        "GET /rpc?token=%s&client=%s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Connection: Upgrade\r\n"
+        "Upgrade: " VTFS_RPC_PROTOCOL "\r\n"
+        "%s"
+        "\r\n",
+        client->token, client->client_id, client->authority,
+        offer ? "Vtfs-Compression: " VTFS_RPC_COMPRESSION "\r\n" : "");
+    if (!ret)
+        ret = socket_send(conn->sock, conn->request, len, 0);
+    if (ret >= 0)
+        ret = body_headers(&r);
+    if (ret <= 0)
+        return ret ? ret : -ECONNRESET;
+
+    /* The server sends no frame before our first request */
+    if (ret == 101) {
+        piece = find_header(r.buf, r.buf + r.start, "Vtfs-Compression");
+        *lz4 = offer && piece && strncasecmp(piece, VTFS_RPC_COMPRESSION,
+                                             strlen(VTFS_RPC_COMPRESSION)) == 0;
+        return r.start == r.end ? 0 : -EBADMSG;
     }
 
-    query_params[0] = '\0';
-    va_start(args, arg_size);
-    for (i = 0; i < arg_size; i++) {
-        const char *key = va_arg(args, const char *);
-        const char *value = va_arg(args, const char *);
-        char encoded_value[512];
-
-        if (i > 0)
-            strlcat(query_params, "&", VTFS_HTTP_BUFFER_SIZE);
-
-        strlcat(query_params, key, VTFS_HTTP_BUFFER_SIZE);
-        strlcat(query_params, "=", VTFS_HTTP_BUFFER_SIZE);
-        
-        url_encode(value, encoded_value, sizeof(encoded_value));
-        strlcat(query_params, encoded_value, VTFS_HTTP_BUFFER_SIZE);
-    }
-    va_end(args);
-
-    if (strlen(query_params) > 0) {
-        request_len = snprintf(request, VTFS_HTTP_BUFFER_SIZE,
-            "GET /%s?token=%s&%s HTTP/1.1\r\n"
-            "Host: %s:%d\r\n"
-            "Connection: close\r\n"
-            "\r\n",
-            method, token ? token : "", query_params,
-            server_host, server_port);
-    } else {
-        request_len = snprintf(request, VTFS_HTTP_BUFFER_SIZE,
-            "GET /%s?token=%s HTTP/1.1\r\n"
-            "Host: %s:%d\r\n"
-            "Connection: close\r\n"
-            "\r\n",
-            method, token ? token : "",
-            server_host, server_port);
-    }
-
-    sock = create_connection();
-    if (!sock) {
-        ret = -ECONNREFUSED;
-        goto out;
+    if (READ_ONCE(client->rpc)) {
+        WRITE_ONCE(client->rpc, false);
+        VTFS_LOG("Server answered %d to an RPC upgrade, using HTTP\n", ret);
     }
+    while ((n = body_next(&r, &piece)) > 0)
+        ;
+    if (n < 0 || !body_reusable(&r)) {
+        sock_release(conn->sock);
+        conn->sock = NULL;
+    }
+    return -EPROTONOSUPPORT;
+}
 
-    ret = socket_send(sock, request, request_len);
-    if (ret < 0)
-        goto out;
+static struct vtfs_http_conn *conn_get(struct vtfs_http_client *client, bool *reused)
+{
+    struct vtfs_http_conn *conn = NULL;
 
-    memset(response, 0, VTFS_HTTP_BUFFER_SIZE);
-    ret = socket_recv(sock, response, VTFS_HTTP_BUFFER_SIZE - 1);
-    if (ret < 0)
-        goto out;
+    spin_lock(&client->pool_lock);
+    if (!list_empty(&client->idle)) {
+        conn = list_first_entry(&client->idle, struct vtfs_http_conn, list);
+        list_del(&conn->list);
+        client->idle_count--;
+    }
+    spin_unlock(&client->pool_lock);
 
-    response[ret] = '\0';
-    
-    parse_http_response(response, response_buffer, buffer_size, &http_status);
+    *reused = conn != NULL;
+    if (conn)
+        return conn;
 
-    if (http_status >= 400)
-        ret = http_status;
-    else
-        ret = 0;
+    conn = kvmalloc(sizeof(*conn), GFP_KERNEL);
+    if (!conn)
+        return NULL;
 
-out:
-    if (sock)
-        sock_release(sock);
-    kfree(request);
-    kfree(response);
-    kfree(query_params);
+    conn->sock = create_connection(client);
+    if (!conn->sock) {
+        kvfree(conn);
+        return NULL;
+    }
 
-    return ret;
+    return conn;
 }
 
-static int base64_decode(const char *input, unsigned char *output, size_t *output_len)
+static const u16 rpc_ops[VTFS_NR_HTTP_METHODS] = {
+    [VTFS_HTTP_CREATE] = VTFS_RPC_CREATE,
+    [VTFS_HTTP_DELETE] = VTFS_RPC_DELETE,
+    [VTFS_HTTP_READ]   = VTFS_RPC_READ,
+    [VTFS_HTTP_WRITE]  = VTFS_RPC_WRITE,
+    [VTFS_HTTP_STAT]   = VTFS_RPC_STAT,
+    [VTFS_HTTP_LINK]   = VTFS_RPC_LINK,
+    [VTFS_HTTP_SUMS]   = VTFS_RPC_SUMS,
+};
+
+/* Query arguments as frame fields; those with a base are sent as numbers */
+static const struct {
+    const char *key;
+    u16 tag;
+    unsigned int base;
+} rpc_keys[] = {
+    { "path",    VTFS_RPC_PATH,   0 },
+    { "oldpath", VTFS_RPC_PATH,   0 },
+    { "newpath", VTFS_RPC_PATH2,  0 },
+    { "type",    VTFS_RPC_KIND,   0 },
+    { "opid",    VTFS_RPC_OPID,   0 },
+    { "offset",  VTFS_RPC_OFFSET, 10 },
+    { "size",    VTFS_RPC_SIZE,   10 },
+    { "mode",    VTFS_RPC_MODE,   8 },
+    { "max",     VTFS_RPC_MAX,    10 },
+};
+
+/* Writes the frame for args into request; -EMSGSIZE if it does not fit */
+static ssize_t rpc_build(char *request, enum vtfs_http_method index,
+                         const struct http_args *args, u32 id)
 {
-    static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    size_t in_len = strlen(input);
-    size_t i, j;
-    unsigned char a, b, c, d;
-    const char *pos;
+    struct vtfs_rpc_builder b;
+    size_t i, k;
+    u64 value;
 
-    if (in_len % 4 != 0)
+    if (!rpc_ops[index])
         return -EINVAL;
 
-    *output_len = (in_len / 4) * 3;
-    if (in_len > 0 && input[in_len - 1] == '=') (*output_len)--;
-    if (in_len > 1 && input[in_len - 2] == '=') (*output_len)--;
-
-    for (i = 0, j = 0; i < in_len;) {
-        if (input[i] == '=') {
-            a = 0;
+    vtfs_rpc_begin(&b, request, VTFS_HTTP_BUFFER_SIZE, rpc_ops[index], 0, id);
+    for (i = 0; i < args->count; i++) {
+        for (k = 0; k < ARRAY_SIZE(rpc_keys); k++)
+            if (strcmp(args->keys[i], rpc_keys[k].key) == 0)
+                break;
+        if (k == ARRAY_SIZE(rpc_keys))
+            return -EINVAL;
+
+        if (!rpc_keys[k].base) {
+            /* An empty string is what HTTP sends for no value */
+            if (*args->values[i])
+                vtfs_rpc_put_str(&b, rpc_keys[k].tag, args->values[i]);
+        } else if (kstrtou64(args->values[i], rpc_keys[k].base, &value)) {
+            return -EINVAL;
         } else {
-            pos = strchr(base64_chars, input[i]);
-            a = pos ? (pos - base64_chars) : 0;
+            vtfs_rpc_put_u64(&b, rpc_keys[k].tag, value);
         }
-        i++;
+    }
+    if (args->raw_len)
+        vtfs_rpc_put_u64(&b, VTFS_RPC_RAW_SIZE, args->raw_len);
+    if (args->body)
+        vtfs_rpc_put_data(&b, VTFS_RPC_DATA, args->body_len);
 
-        if (input[i] == '=') {
-            b = 0;
-        } else {
-            pos = strchr(base64_chars, input[i]);
-            b = pos ? (pos - base64_chars) : 0;
+    return vtfs_rpc_end(&b, args->body ? args->body_len : 0);
+}
+
+/*
+ * Builds the request in a pooled connection, sends it and lets recv read
+ * the response. An idle pooled connection may have been closed by the
+ * server, so a reused one that got nothing back is reconnected once and
+ * the request, still in its buffer, sent again.
+ */
+static int http_exchange(struct vtfs_http_client *client, enum vtfs_http_method index,
+                         const struct http_args *args, http_recv_fn recv, void *ctx,
+                         size_t *sent)
+{
+    struct vtfs_http_conn *conn;
+    size_t received;
+    ssize_t len;
+    bool reused;
+    bool keep_alive;
+    u64 start;
+    int ret;
+
+    start = vtfs_stat_start();
+    conn = conn_get(client, &reused);
+    if (!reused)
+        vtfs_stat_http(client->stats, index, VTFS_PHASE_CONNECT, start, !conn);
+    if (!conn)
+        return -ECONNREFUSED;
+    if (reused)
+        vtfs_stat_inc(client->stats, conn_reused, 1);
+    else
+        vtfs_stat_inc(client->stats, conn_new, 1);
+
+    len = build_request(client, conn->request, args);
+    if (len < 0) {
+        conn_put(client, conn, true);
+        return len;
+    }
+
+    for (;;) {
+        received = 0;
+        keep_alive = false;
+        start = vtfs_stat_start();
+        ret = socket_send(conn->sock, conn->request, len,
+                          args->body_len ? MSG_MORE : 0);
+        if (ret >= 0 && args->body_len) {
+            vtfs_stat_inc(client->stats, http_bytes_sent, ret);
+            *sent += ret;
+            ret = socket_send_body(conn->sock, args->body, args->body_len);
+        }
+        vtfs_stat_http(client->stats, index, VTFS_PHASE_SEND, start, ret < 0);
+        if (ret >= 0) {
+            vtfs_stat_inc(client->stats, http_bytes_sent, ret);
+            *sent += ret;
+            conn->waited = 0;
+            start = vtfs_stat_start();
+            ret = recv(conn, ctx, &received, &keep_alive);
+            vtfs_stat_http(client->stats, index, VTFS_PHASE_RECV, start, ret <= 0);
+            /* Parsing is what recv spent off the socket: framing, decoding, copies */
+            if (ret > 0)
+                vtfs_stat_http(client->stats, index, VTFS_PHASE_PARSE,
+                               start + conn->waited, false);
+        }
+        if (ret > 0) {
+            conn_put(client, conn, keep_alive);
+            return ret;
         }
-        i++;
 
-        if (input[i] == '=') {
-            c = 0;
-        } else {
-            pos = strchr(base64_chars, input[i]);
-            c = pos ? (pos - base64_chars) : 0;
+        if (ret == 0)
+            ret = -ECONNRESET;
+        if (!reused || received)
+            break;
+
+        reused = false;
+        sock_release(conn->sock);
+        start = vtfs_stat_start();
+        conn->sock = create_connection(client);
+        vtfs_stat_http(client->stats, index, VTFS_PHASE_CONNECT, start, !conn->sock);
+        if (!conn->sock) {
+            ret = -ECONNREFUSED;
+            break;
         }
-        i++;
+        vtfs_stat_inc(client->stats, conn_new, 1);
+    }
+
+    conn_put(client, conn, false);
+    return ret;
+}
+
+/* The de-chunked body, NUL-terminated and cut to fit the caller's buffer */
+struct copy_reply {
+    char *buf;
+    size_t size;
+    size_t len;
+    int status;
+};
 
-        if (input[i] == '=') {
-            d = 0;
+static int recv_copy_reply(struct vtfs_http_conn *conn, void *ctx,
+                           size_t *received, bool *keep_alive)
+{
+    struct copy_reply *reply = ctx;
+    struct body_reader r = {
+        .sock = conn->sock,
+        .buf = conn->buf,
+        .size = VTFS_HTTP_RECV_SIZE,
+        .waited = &conn->waited,
+    };
+    const char *piece;
+    size_t room;
+    ssize_t n;
+    int ret;
+
+    ret = body_headers(&r);
+    *received = r.received;
+    if (ret <= 0)
+        return ret;
+    reply->status = ret;
+
+    /* What does not fit is drained, to keep the connection usable */
+    reply->len = 0;
+    while ((n = body_next(&r, &piece)) > 0) {
+        room = min_t(size_t, n, reply->size - 1 - reply->len);
+        memcpy(reply->buf + reply->len, piece, room);
+        reply->len += room;
+    }
+    reply->buf[reply->len] = '\0';
+
+    *received = r.received;
+    if (n < 0)
+        return n;
+
+    *keep_alive = body_reusable(&r);
+    return r.received;
+}
+
+static int64_t http_call(struct vtfs_http_client *client, const struct http_args *args,
+                         char *response_buffer, size_t buffer_size)
+{
+    struct copy_reply reply = { response_buffer, buffer_size, 0, 0 };
+    enum vtfs_http_method index;
+    size_t sent = 0, received = 0;
+    u64 call_start;
+    int ret;
+
+    index = vtfs_http_method_index(args->method);
+    call_start = vtfs_stat_start();
+    response_buffer[0] = '\0';
+
+    ret = http_exchange(client, index, args, recv_copy_reply, &reply, &sent);
+    if (ret >= 0) {
+        vtfs_stat_inc(client->stats, http_bytes_received, ret);
+        received = ret;
+        ret = reply.status >= 400 ? reply.status : 0;
+    }
+
+    vtfs_stat_http(client->stats, index, VTFS_PHASE_TOTAL, call_start, ret != 0);
+    trace_vtfs_http_request(args->method, args->path, sent, received,
+                            ret < 0 ? ret : reply.status, call_start);
+    return ret;
+}
+
+int64_t vtfs_http_call(struct vtfs_http_client *client,
+                       const char *method,
+                       char *response_buffer,
+                       size_t buffer_size,
+                       size_t arg_size,
+                       ...)
+{
+    struct http_args args;
+    va_list ap;
+    int ret;
+
+    if (!client || !client->initialized || !buffer_size)
+        return -EINVAL;
+
+    va_start(ap, arg_size);
+    ret = args_init(&args, method, arg_size, ap);
+    va_end(ap);
+    if (ret)
+        return ret;
+
+    return http_call(client, &args, response_buffer, buffer_size);
+}
+
+/*
+ * A vtfs-rpc reply. The receive thread fills in the status and fields; a
+ * DATA payload is received by the caller itself, straight into its buffer
+ * or iov_iter, at most want bytes of it.
+ */
+struct rpc_reply {
+    /* 0 or the errno the server reported */
+    int status;
+    /* Attributes, for a stat reply */
+    bool attrs;
+    char kind[8];
+    u64 size;
+    u64 mtime;
+    /* For a block manifest, with the file's size in size */
+    u64 block;
+    u8 *buffer;
+    struct iov_iter *to;
+    size_t want;
+    size_t copied;
+};
+
+static int rpc_recv_data(struct socket *sock, struct rpc_reply *reply, size_t len)
+{
+    struct msghdr msg;
+    struct kvec iov;
+    int ret;
+
+    while (len) {
+        memset(&msg, 0, sizeof(msg));
+        if (reply->buffer) {
+            iov.iov_base = reply->buffer + reply->copied;
+            iov.iov_len = len;
+            iov_iter_kvec(&msg.msg_iter, ITER_DEST, &iov, 1, len);
         } else {
-            pos = strchr(base64_chars, input[i]);
-            d = pos ? (pos - base64_chars) : 0;
+            msg.msg_iter = *reply->to;
+            iov_iter_truncate(&msg.msg_iter, len);
         }
-        i++;
 
-        if (j < *output_len) output[j++] = (a << 2) | (b >> 4);
-        if (j < *output_len) output[j++] = (b << 4) | (c >> 2);
-        if (j < *output_len) output[j++] = (c << 6) | d;
+        ret = sock_recvmsg(sock, &msg, 0);
+        if (ret <= 0)
+            return ret ? ret : -ECONNRESET;
+        if (!reply->buffer)
+            iov_iter_advance(reply->to, ret);
+        reply->copied += ret;
+        len -= ret;
     }
 
     return 0;
 }
 
-static int bytes_to_base64(const void *data, size_t len, char *base64, size_t base64_size)
+/*
+ * vtfs-rpc calls share a few connections, each with any number of frames
+ * in flight. A sender holds send_lock only while its frame goes out; the
+ * channel's receive thread reads replies in whatever order the server
+ * finishes them and wakes the caller whose id each one carries, so a slow
+ * request holds up nobody else's. A channel that fails fails every call
+ * pending on it and is replaced by the next caller that finds it dead.
+ */
+struct vtfs_rpc_channel {
+    struct vtfs_http_client *client;
+    struct vtfs_http_conn *conn;
+    struct task_struct *task;
+    struct kref ref;
+    /* Calls using the channel, to spread callers over channels */
+    atomic_t inflight;
+    /* Held while a frame is built in conn->request and sent */
+    struct mutex send_lock;
+    u32 next_id;
+    /* Protects pending and dead */
+    spinlock_t lock;
+    struct list_head pending;
+    bool dead;
+    /* Payloads may be LZ4-compressed both ways */
+    bool lz4;
+    /* The caller a payload was handed to is done with it */
+    struct completion data_done;
+    int data_error;
+};
+
+struct rpc_waiter {
+    /* On the channel's pending list until the reply or a failure comes */
+    struct list_head list;
+    u32 id;
+    struct rpc_reply *reply;
+    struct completion done;
+    /* Set instead of a reply when the channel failed or the payload did not fit */
+    int error;
+    size_t received;
+    /*
+     * A payload for the caller to receive: user memory can only be written
+     * from its context, and the payload is the rest of the frame anyway.
+     * data_buffered bytes of it already sit in the receive buffer.
+     */
+    const u8 *data;
+    size_t data_buffered;
+    size_t data_len;
+    /* Set when the payload is an LZ4 block, to its length decompressed */
+    size_t raw_len;
+};
+
+/* Reads and drops len bytes of a payload, through the connection's bounce buffer */
+static int channel_drain(struct vtfs_rpc_channel *chan, size_t len)
 {
-    static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    const unsigned char *bytes = data;
-    size_t i, j;
-    
-    if (base64_size < ((len + 2) / 3) * 4 + 1)
-        return -EINVAL;
-    
-    for (i = 0, j = 0; i < len; i += 3) {
-        unsigned char a = bytes[i];
-        unsigned char b = (i + 1 < len) ? bytes[i + 1] : 0;
-        unsigned char c = (i + 2 < len) ? bytes[i + 2] : 0;
-        
-        base64[j++] = base64_chars[(a >> 2) & 0x3F];
-        base64[j++] = base64_chars[((a << 4) | (b >> 4)) & 0x3F];
-        base64[j++] = (i + 1 < len) ? base64_chars[((b << 2) | (c >> 6)) & 0x3F] : '=';
-        base64[j++] = (i + 2 < len) ? base64_chars[c & 0x3F] : '=';
+    struct rpc_reply scratch = { .buffer = chan->conn->bounce };
+    size_t n;
+    int ret;
+
+    while (len) {
+        n = min_t(size_t, len, VTFS_HTTP_BOUNCE_SIZE);
+        scratch.copied = 0;
+        ret = rpc_recv_data(chan->conn->sock, &scratch, n);
+        if (ret)
+            return ret;
+        len -= n;
     }
-    
-    base64[j] = '\0';
+
     return 0;
 }
 
-static int extract_json_field(const char *json, const char *field, char *value, size_t value_size)
+static void channel_fail(struct vtfs_rpc_channel *chan, int error)
 {
-    char pattern[128];
-    const char *field_start;
-    const char *value_start;
-    const char *value_end;
-    size_t value_len;
+    struct rpc_waiter *w, *tmp;
+
+    spin_lock(&chan->lock);
+    chan->dead = true;
+    list_for_each_entry_safe(w, tmp, &chan->pending, list) {
+        list_del_init(&w->list);
+        w->error = error;
+        complete(&w->done);
+    }
+    spin_unlock(&chan->lock);
 
-    snprintf(pattern, sizeof(pattern), "\"%s\"", field);
-    field_start = strstr(json, pattern);
-    if (!field_start)
-        return -ENOENT;
+    /* Wakes the receive thread and fails senders still on the socket */
+    kernel_sock_shutdown(chan->conn->sock, SHUT_RDWR);
+}
 
-    value_start = strchr(field_start + strlen(pattern), '"');
-    if (!value_start)
-        return -EINVAL;
-    value_start++;
+static struct rpc_waiter *channel_claim(struct vtfs_rpc_channel *chan, u32 id)
+{
+    struct rpc_waiter *w, *found = NULL;
+
+    spin_lock(&chan->lock);
+    list_for_each_entry(w, &chan->pending, list) {
+        if (w->id == id) {
+            list_del_init(&w->list);
+            found = w;
+            break;
+        }
+    }
+    spin_unlock(&chan->lock);
 
-    value_end = strchr(value_start, '"');
-    if (!value_end)
-        return -EINVAL;
+    return found;
+}
 
-    value_len = value_end - value_start;
-    if (value_len >= value_size)
-        value_len = value_size - 1;
+/* body_fill() for the receive thread, which waits as long as the server is quiet */
+static int channel_fill(struct body_reader *r)
+{
+    int ret;
 
-    memcpy(value, value_start, value_len);
-    value[value_len] = '\0';
+    do {
+        ret = body_fill(r);
+    } while (ret == -EAGAIN && !kthread_should_stop());
 
-    return 0;
+    return ret > 0 ? 0 : (ret ? ret : -ECONNRESET);
 }
 
-static int extract_json_number(const char *json, const char *field, char *value, size_t value_size)
+/* Reads one reply and completes its caller */
+static int channel_recv_one(struct vtfs_rpc_channel *chan, struct body_reader *r)
 {
-    char pattern[128];
-    const char *field_start;
-    const char *value_start;
-    const char *value_end;
-    size_t value_len;
+    const struct vtfs_rpc_field *data;
+    struct vtfs_rpc_msg msg;
+    struct rpc_reply *reply;
+    struct rpc_waiter *w;
+    size_t avail, data_len, buffered, unread;
+    u64 raw_len = 0;
+    int ret = 0;
 
-    snprintf(pattern, sizeof(pattern), "\"%s\"", field);
-    field_start = strstr(json, pattern);
-    if (!field_start)
-        return -ENOENT;
+    while (!ret && r->end - r->start < VTFS_RPC_HEADER_SIZE)
+        ret = channel_fill(r);
+    if (!ret)
+        ret = vtfs_rpc_parse_header(r->buf + r->start, &msg.hdr);
+
+    /* Everything before the payload has to fit in the receive buffer */
+    while (!ret) {
+        avail = min_t(size_t, r->end - r->start - VTFS_RPC_HEADER_SIZE, msg.hdr.len);
+        ret = vtfs_rpc_parse_fields(&msg, r->buf + r->start + VTFS_RPC_HEADER_SIZE,
+                                    avail, &data_len);
+        if (ret != -EAGAIN)
+            break;
+        ret = channel_fill(r);
+    }
+    if (ret)
+        return ret;
 
-    value_start = strchr(field_start + strlen(pattern), ':');
-    if (!value_start)
-        return -EINVAL;
-    value_start++;
+    /* A reply to nobody means the stream is out of step */
+    w = channel_claim(chan, msg.hdr.id);
+    if (!w)
+        return -EBADMSG;
+
+    reply = w->reply;
+    reply->status = msg.hdr.status;
+    reply->attrs = !vtfs_rpc_get_str(&msg, VTFS_RPC_KIND, reply->kind, sizeof(reply->kind)) &&
+                   !vtfs_rpc_get_u64(&msg, VTFS_RPC_SIZE, &reply->size) &&
+                   !vtfs_rpc_get_u64(&msg, VTFS_RPC_MTIME, &reply->mtime);
+    if (!vtfs_rpc_get_u64(&msg, VTFS_RPC_BLOCK, &reply->block))
+        vtfs_rpc_get_u64(&msg, VTFS_RPC_SIZE, &reply->size);
+    w->received = VTFS_RPC_HEADER_SIZE + msg.hdr.len;
+    buffered = min_t(size_t, r->end - r->start, w->received);
+
+    data = &msg.field[VTFS_RPC_DATA];
+    if (data_len)
+        vtfs_rpc_get_u64(&msg, VTFS_RPC_RAW_SIZE, &raw_len);
+    if ((raw_len && (!chan->lz4 || data_len > LZ4_compressBound(raw_len))) ||
+        (data_len && !reply->buffer && !reply->to)) {
+        w->error = -EBADMSG;
+        complete(&w->done);
+        return -EBADMSG;
+    }
+    /* More than the caller has room for fails that call only; the stream is still in step */
+    if ((raw_len ? raw_len : data_len) > reply->want) {
+        unread = data_len - data->len;
+        w->error = -EMSGSIZE;
+        complete(&w->done);
+        r->start += buffered;
+        return channel_drain(chan, unread);
+    }
+    if (!data_len) {
+        complete(&w->done);
+        r->start += buffered;
+        return 0;
+    }
+
+    /* w is the caller's until it is done with the payload */
+    w->data = data->value;
+    w->data_buffered = data->len;
+    w->data_len = data_len;
+    w->raw_len = raw_len;
+    reinit_completion(&chan->data_done);
+    complete(&w->done);
+    wait_for_completion(&chan->data_done);
+
+    /* What was not buffered the caller took from the socket */
+    r->start += buffered;
+    return chan->data_error;
+}
+
+static int channel_thread(void *arg)
+{
+    struct vtfs_rpc_channel *chan = arg;
+    struct body_reader r = {
+        .sock = chan->conn->sock,
+        .buf = chan->conn->buf,
+        .size = VTFS_HTTP_RECV_SIZE,
+    };
+    int ret;
 
-    while (*value_start == ' ' || *value_start == '\t')
-        value_start++;
+    do {
+        ret = channel_recv_one(chan, &r);
+    } while (!ret);
+    channel_fail(chan, ret);
 
-    value_end = value_start;
-    while (*value_end && *value_end != ',' && *value_end != '}' && 
-           *value_end != ']' && *value_end != ' ' && *value_end != '\t' &&
-           *value_end != '\n' && *value_end != '\r') {
-        value_end++;
+    /* The channel is dead; its last reference stops the thread */
+    set_current_state(TASK_INTERRUPTIBLE);
+    while (!kthread_should_stop()) {
+        schedule();
+        set_current_state(TASK_INTERRUPTIBLE);
     }
+    __set_current_state(TASK_RUNNING);
+    return 0;
+}
 
-    value_len = value_end - value_start;
-    if (value_len == 0)
-        return -EINVAL;
-    
-    if (value_len >= value_size)
-        value_len = value_size - 1;
+static void channel_release(struct kref *ref)
+{
+    struct vtfs_rpc_channel *chan = container_of(ref, struct vtfs_rpc_channel, ref);
 
-    memcpy(value, value_start, value_len);
-    value[value_len] = '\0';
+    kernel_sock_shutdown(chan->conn->sock, SHUT_RDWR);
+    kthread_stop(chan->task);
+    conn_free(chan->conn);
+    kfree(chan);
+}
 
-    return 0;
+static void channel_put(struct vtfs_rpc_channel *chan)
+{
+    atomic_dec(&chan->inflight);
+    kref_put(&chan->ref, channel_release);
 }
 
-int vtfs_http_create(const char *path, const char *type, int mode)
+/* A new connection, upgraded, with its receive thread running */
+static struct vtfs_rpc_channel *channel_open(struct vtfs_http_client *client)
 {
-    char response[VTFS_HTTP_BUFFER_SIZE];
-    char mode_str[16];
+    struct vtfs_rpc_channel *chan;
+    struct vtfs_http_conn *conn;
     int ret;
 
-    if (!http_initialized)
-        return 0; // Not an error, just skip remote sync
+    chan = kzalloc(sizeof(*chan), GFP_KERNEL);
+    conn = kvmalloc(sizeof(*conn), GFP_KERNEL);
+    if (!chan || !conn) {
+        kfree(chan);
+        kvfree(conn);
+        return ERR_PTR(-ENOMEM);
+    }
 
-    snprintf(mode_str, sizeof(mode_str), "%o", mode);
+    conn->sock = create_connection(client);
+    ret = conn->sock ? rpc_upgrade(client, conn, &chan->lz4) : -ECONNREFUSED;
+    if (ret) {
+        conn_put(client, conn, ret == -EPROTONOSUPPORT && conn->sock);
+        kfree(chan);
+        return ERR_PTR(ret);
+    }
+
+    chan->client = client;
+    chan->conn = conn;
+    kref_init(&chan->ref);
+    atomic_set(&chan->inflight, 1);
+    mutex_init(&chan->send_lock);
+    spin_lock_init(&chan->lock);
+    INIT_LIST_HEAD(&chan->pending);
+    init_completion(&chan->data_done);
+
+    chan->task = kthread_run(channel_thread, chan, "vtfs-rpc");
+    if (IS_ERR(chan->task)) {
+        ret = PTR_ERR(chan->task);
+        conn_free(conn);
+        kfree(chan);
+        return ERR_PTR(ret);
+    }
 
-    ret = vtfs_http_call(vtfs_get_token(), "create", response, sizeof(response), 3,
-                         "path", path,
-                         "type", type,
-                         "mode", mode_str);
+    return chan;
+}
 
-    if (ret < 0) {
-        return ret;
+/*
+ * The least busy live channel, unless it is busy and *slot, a place for
+ * another channel, is >= 0. Up to pool_size channels are kept.
+ */
+static struct vtfs_rpc_channel *channel_find(struct vtfs_http_client *client, int *slot)
+{
+    unsigned int n = clamp_t(unsigned int, READ_ONCE(client->pool_size), 1,
+                             VTFS_HTTP_MAX_CHANNELS);
+    struct vtfs_rpc_channel *chan, *best = NULL;
+    unsigned int i;
+
+    *slot = -1;
+    spin_lock(&client->pool_lock);
+    for (i = 0; i < n; i++) {
+        chan = client->channels[i];
+        if (!chan || READ_ONCE(chan->dead)) {
+            if (*slot < 0)
+                *slot = i;
+        } else if (!best || atomic_read(&chan->inflight) < atomic_read(&best->inflight)) {
+            best = chan;
+        }
+    }
+    if (best && (!atomic_read(&best->inflight) || *slot < 0)) {
+        kref_get(&best->ref);
+        atomic_inc(&best->inflight);
+    } else {
+        best = NULL;
     }
+    spin_unlock(&client->pool_lock);
 
-    if (strstr(response, "\"error\"")) {
-        return -EIO;
+    return best;
+}
+
+static struct vtfs_rpc_channel *channel_get(struct vtfs_http_client *client, bool *reused)
+{
+    struct vtfs_rpc_channel *chan, *old = NULL;
+    int slot;
+
+    *reused = true;
+    chan = channel_find(client, &slot);
+    if (chan)
+        return chan;
+
+    /* One caller opens a channel while the others wait to see it */
+    mutex_lock(&client->channel_lock);
+    chan = channel_find(client, &slot);
+    if (chan)
+        goto out;
+
+    *reused = false;
+    chan = channel_open(client);
+    if (IS_ERR(chan))
+        goto out;
+
+    spin_lock(&client->pool_lock);
+    if (client->initialized) {
+        old = client->channels[slot];
+        client->channels[slot] = chan;
+        kref_get(&chan->ref);
     }
+    spin_unlock(&client->pool_lock);
 
-    return 0;
+out:
+    mutex_unlock(&client->channel_lock);
+    if (old)
+        kref_put(&old->ref, channel_release);
+    return chan;
 }
 
-int vtfs_http_write(const char *path, const void *data, size_t size, loff_t offset)
+/* Puts w on the pending list and sends its frame; 0 or the call has failed */
+static int channel_send(struct vtfs_rpc_channel *chan, enum vtfs_http_method index,
+                        const struct http_args *args, struct rpc_waiter *w,
+                        size_t *sent)
 {
-    char response[VTFS_HTTP_BUFFER_SIZE];
-    char *base64_data;
-    char offset_str[32];
+    struct vtfs_http_client *client = chan->client;
+    struct socket *sock = chan->conn->sock;
+    ssize_t len;
+    bool dead;
+    u64 start;
     int ret;
 
-    if (!http_initialized)
+    start = vtfs_stat_start();
+    mutex_lock(&chan->send_lock);
+    w->id = ++chan->next_id;
+    len = rpc_build(chan->conn->request, index, args, w->id);
+    if (len < 0) {
+        mutex_unlock(&chan->send_lock);
+        return len;
+    }
+
+    spin_lock(&chan->lock);
+    dead = chan->dead;
+    if (!dead)
+        list_add_tail(&w->list, &chan->pending);
+    spin_unlock(&chan->lock);
+    if (dead) {
+        mutex_unlock(&chan->send_lock);
+        w->error = -ECONNRESET;
+        return w->error;
+    }
+
+    ret = socket_send(sock, chan->conn->request, len, args->body_len ? MSG_MORE : 0);
+    if (ret >= 0 && args->body_len) {
+        vtfs_stat_inc(client->stats, http_bytes_sent, ret);
+        *sent += ret;
+        ret = socket_send_body(sock, args->body, args->body_len);
+    }
+    if (ret >= 0) {
+        vtfs_stat_inc(client->stats, http_bytes_sent, ret);
+        *sent += ret;
+    }
+    mutex_unlock(&chan->send_lock);
+
+    vtfs_stat_http(client->stats, index, VTFS_PHASE_SEND, start, ret < 0);
+    if (ret >= 0)
         return 0;
 
-    base64_data = kmalloc(((size + 2) / 3) * 4 + 1, GFP_KERNEL);
-    if (!base64_data)
+    /* Part of a frame may have gone out; nothing after it can be read right */
+    channel_fail(chan, ret);
+    return w->error;
+}
+
+/*
+ * A compressed payload is gathered whole, then decompressed into the
+ * caller's buffer, or through a bounce buffer into its iov_iter.
+ */
+static int channel_take_lz4(struct vtfs_rpc_channel *chan, struct rpc_waiter *w)
+{
+    struct rpc_reply *reply = w->reply;
+    struct rpc_reply packed = {};
+    u8 *out;
+    int ret;
+
+    packed.buffer = kvmalloc(w->data_len + (reply->buffer ? 0 : w->raw_len), GFP_KERNEL);
+    if (!packed.buffer)
         return -ENOMEM;
 
-    ret = bytes_to_base64(data, size, base64_data, ((size + 2) / 3) * 4 + 1);
-    if (ret) {
-        kfree(base64_data);
-        return ret;
+    memcpy(packed.buffer, w->data, w->data_buffered);
+    packed.copied = w->data_buffered;
+    ret = rpc_recv_data(chan->conn->sock, &packed, w->data_len - w->data_buffered);
+    if (ret)
+        goto out;
+
+    out = reply->buffer ? reply->buffer : packed.buffer + w->data_len;
+    ret = LZ4_decompress_safe((const char *)packed.buffer, (char *)out,
+                              w->data_len, w->raw_len);
+    if (ret != w->raw_len) {
+        ret = -EBADMSG;
+        goto out;
     }
+    ret = 0;
+    if (!reply->buffer && copy_to_iter(out, w->raw_len, reply->to) != w->raw_len)
+        ret = -EFAULT;
+    reply->copied = w->raw_len;
+    vtfs_stat_inc(chan->client->stats, lz4_raw_bytes, w->raw_len);
+    vtfs_stat_inc(chan->client->stats, lz4_wire_bytes, w->data_len);
 
-    snprintf(offset_str, sizeof(offset_str), "%lld", (long long)offset);
+out:
+    kvfree(packed.buffer);
+    return ret;
+}
+
+/* Receives the payload handed over to w, then lets the receive thread go on */
+static int channel_take_data(struct vtfs_rpc_channel *chan, struct rpc_waiter *w)
+{
+    struct rpc_reply *reply = w->reply;
+    size_t done = w->data_buffered;
+    int ret = 0;
 
-    ret = vtfs_http_call(vtfs_get_token(), "write", response, sizeof(response), 3,
-                         "path", path,
-                         "offset", offset_str,
-                         "data", base64_data);
+    if (w->raw_len) {
+        ret = channel_take_lz4(chan, w);
+        /* It reads the whole frame unless there was no memory to read it into */
+        if (ret != -ENOMEM)
+            done = w->data_len;
+    } else {
+        if (reply->buffer)
+            memcpy(reply->buffer, w->data, done);
+        else if (copy_to_iter(w->data, done, reply->to) != done)
+            ret = -EFAULT;
+        if (!ret) {
+            reply->copied = done;
+            ret = rpc_recv_data(chan->conn->sock, reply, w->data_len - done);
+            done = reply->copied;
+        }
+    }
+
+    /*
+     * A bad user buffer or a failed allocation is this caller's alone: the
+     * rest of the payload is dropped and the channel stays in step
+     */
+    if (ret == -EFAULT || ret == -ENOMEM)
+        chan->data_error = channel_drain(chan, w->data_len - done);
+    else
+        chan->data_error = ret;
+    complete(&chan->data_done);
+    return ret;
+}
+
+static int channel_wait(struct vtfs_rpc_channel *chan, struct rpc_waiter *w)
+{
+    bool pending;
+
+    if (!wait_for_completion_timeout(&w->done, VTFS_HTTP_RECV_TIMEOUT)) {
+        spin_lock(&chan->lock);
+        pending = !list_empty(&w->list);
+        list_del_init(&w->list);
+        spin_unlock(&chan->lock);
+
+        /*
+         * A reply still to come would be to nobody. The calls sharing the
+         * channel are failed to be retried elsewhere.
+         */
+        if (pending) {
+            channel_fail(chan, -ECONNABORTED);
+            return -ETIMEDOUT;
+        }
+        /* The receive thread is reading the reply right now */
+        wait_for_completion(&w->done);
+    }
+
+    if (w->error)
+        return w->error;
+    return w->data_len ? channel_take_data(chan, w) : 0;
+}
+
+/*
+ * For a channel that takes LZ4: a payload that compresses well is put in
+ * packed as one block, and the buffer holding it returned. NULL leaves the
+ * payload to go as it is.
+ */
+static u8 *rpc_compress(struct vtfs_http_client *client, const struct http_args *args,
+                        struct http_args *packed)
+{
+    size_t len = args->body_len;
+    u8 *buf;
+    int ret;
+
+    if (!args->body || len < VTFS_COMPRESS_MIN || len > LZ4_MAX_INPUT_SIZE ||
+        !READ_ONCE(client->compress))
+        return NULL;
+    if (!vtfs_compressible(args->body, len))
+        goto skip;
+
+    buf = kvmalloc(LZ4_MEM_COMPRESS + len, GFP_KERNEL);
+    if (!buf)
+        return NULL;
+
+    /* Saving less than an eighth is not worth the server's time to decompress */
+    ret = LZ4_compress_default(args->body, (char *)buf + LZ4_MEM_COMPRESS, len,
+                               len - len / 8, buf);
+    if (ret <= 0) {
+        kvfree(buf);
+        goto skip;
+    }
 
-    kfree(base64_data);
+    *packed = *args;
+    packed->body = buf + LZ4_MEM_COMPRESS;
+    packed->body_len = ret;
+    packed->raw_len = len;
+    vtfs_stat_inc(client->stats, lz4_raw_bytes, len);
+    vtfs_stat_inc(client->stats, lz4_wire_bytes, ret);
+    return buf;
+
+skip:
+    vtfs_stat_inc(client->stats, lz4_skipped, 1);
+    return NULL;
+}
 
+/*
+ * Sends args as a vtfs-rpc frame and reads the reply into reply. Returns
+ * 0 with the server's answer in reply->status, a transport error, or
+ * -EPROTONOSUPPORT when the server only speaks HTTP. A channel may have
+ * been closed by the server while idle, so a call that fails with its
+ * channel before anything came back is retried once on a new one.
+ */
+static int rpc_call(struct vtfs_http_client *client, const struct http_args *args,
+                    struct rpc_reply *reply)
+{
+    struct vtfs_rpc_channel *chan;
+    struct rpc_waiter w = { .reply = reply };
+    enum vtfs_http_method index;
+    struct http_args packed;
+    u8 *lz4 = NULL;
+    size_t sent = 0;
+    bool reused, retried = false, compressed = false;
+    u64 call_start, start;
+    int ret;
+
+    if (!READ_ONCE(client->rpc))
+        return -EPROTONOSUPPORT;
+
+    index = vtfs_http_method_index(args->method);
+    call_start = vtfs_stat_start();
+    INIT_LIST_HEAD(&w.list);
+    init_completion(&w.done);
+
+    for (;;) {
+        start = vtfs_stat_start();
+        chan = channel_get(client, &reused);
+        ret = PTR_ERR_OR_ZERO(chan);
+        if (!reused)
+            vtfs_stat_http(client->stats, index, VTFS_PHASE_CONNECT, start,
+                           ret && ret != -EPROTONOSUPPORT);
+        if (ret == -EPROTONOSUPPORT) {
+            kvfree(lz4);
+            return ret;
+        }
+        if (ret)
+            break;
+        if (reused)
+            vtfs_stat_inc(client->stats, conn_reused, 1);
+        else
+            vtfs_stat_inc(client->stats, conn_new, 1);
+
+        /* Compressed once, for the first channel that takes it */
+        if (chan->lz4 && !compressed) {
+            lz4 = rpc_compress(client, args, &packed);
+            compressed = true;
+        }
+        ret = channel_send(chan, index, chan->lz4 && lz4 ? &packed : args, &w, &sent);
+        if (!ret) {
+            start = vtfs_stat_start();
+            ret = channel_wait(chan, &w);
+            vtfs_stat_http(client->stats, index, VTFS_PHASE_RECV, start, ret != 0);
+        }
+        channel_put(chan);
+
+        if (!w.error || w.received || !reused || retried)
+            break;
+        retried = true;
+        w.error = 0;
+        reinit_completion(&w.done);
+    }
+    kvfree(lz4);
+
+    if (w.received)
+        vtfs_stat_inc(client->stats, http_bytes_received, w.received);
+    vtfs_stat_http(client->stats, index, VTFS_PHASE_TOTAL, call_start,
+                   ret || reply->status);
+    trace_vtfs_http_request(args->method, args->path, sent, w.received,
+                            ret ? ret : reply->status, call_start);
+    return ret;
+}
+
+/* 0, -EIO if the server refused the operation, or a transport error */
+static int call_simple(struct vtfs_http_client *client, const struct http_args *args)
+{
+    char response[VTFS_HTTP_REPLY_SIZE];
+    struct rpc_reply reply = {};
+    int ret;
+
+    ret = rpc_call(client, args, &reply);
+    if (ret != -EPROTONOSUPPORT)
+        return ret ? ret : (reply.status ? -EIO : 0);
+
+    ret = http_call(client, args, response, sizeof(response));
     if (ret < 0) {
         return ret;
     }
@@ -549,113 +1605,465 @@ int vtfs_http_write(const char *path, const void *data, size_t size, loff_t offs
         return -EIO;
     }
 
-    return size;
+    return 0;
 }
 
-int vtfs_http_read(const char *path, void *buffer, size_t size, loff_t offset)
+int vtfs_http_create(struct vtfs_http_client *client, const char *path,
+                     const char *type, int mode, const char *opid)
+{
+    char mode_str[16];
+    struct http_args args = {
+        .method = "create",
+        .path = path,
+        .count = 4,
+        .keys = { "path", "type", "mode", "opid" },
+        .values = { path, type, mode_str, opid ? opid : "" },
+    };
+
+    if (!client->initialized)
+        return 0; // Not an error, just skip remote sync
+
+    snprintf(mode_str, sizeof(mode_str), "%o", mode);
+
+    return call_simple(client, &args);
+}
+
+/* The data goes out as the request payload, spliced from its pages when it can be */
+static int http_write(struct vtfs_http_client *client, const char *path,
+                      const void *data, size_t size, loff_t offset,
+                      const char *opid)
 {
-    char response[VTFS_HTTP_BUFFER_SIZE];
-    char data_str[VTFS_HTTP_BUFFER_SIZE];
     char offset_str[32];
-    char size_str[32];
-    unsigned char *decoded;
-    size_t decoded_len = size;
-    const char *result_ptr;
+    struct http_args args = {
+        .method = "write",
+        .path = path,
+        .count = 3,
+        .keys = { "path", "offset", "opid" },
+        .values = { path, offset_str, opid ? opid : "" },
+        .body = data ? data : "",
+        .body_len = size,
+    };
     int ret;
 
-    if (!http_initialized) {
-        return -ENOENT;
-    }
+    if (!client->initialized)
+        return 0;
 
     snprintf(offset_str, sizeof(offset_str), "%lld", (long long)offset);
-    snprintf(size_str, sizeof(size_str), "%zu", size);
 
-    ret = vtfs_http_call(vtfs_get_token(), "read", response, sizeof(response), 3,
-                         "path", path,
-                         "offset", offset_str,
-                         "size", size_str);
+    ret = call_simple(client, &args);
+    return ret ? ret : size;
+}
 
-    if (ret != 0) {
-        return -ENOENT;
-    }
+/*
+ * A read reply decoded while it is received: the base64 "data" string goes
+ * straight into the caller's kernel buffer, or through the connection's
+ * bounce buffer into an iov_iter (user memory cannot be written directly).
+ */
+struct read_reply {
+    struct vtfs_data_stream data;
+    u8 *buffer;
+    struct iov_iter *to;
+    size_t copied;
+    int status;
+};
+
+static int read_reply_feed(struct read_reply *reply, u8 *bounce,
+                           const char *in, size_t len)
+{
+    size_t used, out_len;
+    u8 *out;
 
-    if (strstr(response, "\"error\"")) {
-        return -ENOENT;
-    }
+    while (len) {
+        if (reply->buffer) {
+            out = reply->buffer + reply->copied;
+            out_len = reply->data.want;
+        } else {
+            out = bounce;
+            out_len = VTFS_HTTP_BOUNCE_SIZE;
+        }
 
-    result_ptr = strstr(response, "\"result\"");
-    if (!result_ptr) {
-        return -ENOENT;
-    }
+        used = vtfs_data_stream_feed(&reply->data, in, len, out, &out_len);
+        if (!reply->buffer && out_len &&
+            copy_to_iter(out, out_len, reply->to) != out_len)
+            return -EFAULT;
 
-    result_ptr = strstr(result_ptr, "\"data\"");
-    if (!result_ptr) {
-        return -ENOENT;
+        reply->copied += out_len;
+        in += used;
+        len -= used;
     }
 
-    ret = extract_json_field(result_ptr, "data", data_str, sizeof(data_str));
-    if (ret) {
+    return reply->data.error;
+}
+
+static int recv_read_reply(struct vtfs_http_conn *conn, void *ctx,
+                           size_t *received, bool *keep_alive)
+{
+    struct read_reply *reply = ctx;
+    struct body_reader r = {
+        .sock = conn->sock,
+        .buf = conn->buf,
+        .size = VTFS_HTTP_RECV_SIZE,
+        .waited = &conn->waited,
+    };
+    const char *piece;
+    ssize_t n;
+    int ret;
+
+    ret = body_headers(&r);
+    *received = r.received;
+    if (ret <= 0)
         return ret;
+    reply->status = ret;
+
+    /* Error replies are only drained, to keep the connection usable */
+    while ((n = body_next(&r, &piece)) > 0) {
+        if (reply->status >= 400)
+            continue;
+        ret = read_reply_feed(reply, conn->bounce, piece, n);
+        if (ret) {
+            n = ret;
+            break;
+        }
     }
 
-    decoded = kmalloc(size, GFP_KERNEL);
-    if (!decoded) {
-        return -ENOMEM;
-    }
+    *received = r.received;
+    if (n < 0)
+        return n;
 
-    decoded_len = size;
-    ret = base64_decode(data_str, decoded, &decoded_len);
-    if (ret) {
-        kfree(decoded);
-        return ret;
+    *keep_alive = body_reusable(&r);
+    return r.received;
+}
+
+/* Exactly one of buffer and to is set */
+static ssize_t http_read(struct vtfs_http_client *client, const char *path,
+                         u8 *buffer, struct iov_iter *to, size_t size, loff_t offset)
+{
+    struct read_reply reply = { .buffer = buffer, .to = to };
+    struct rpc_reply rpc = { .buffer = buffer, .to = to, .want = size };
+    enum vtfs_http_method index = vtfs_http_method_index("read");
+    char offset_str[32];
+    char size_str[32];
+    struct http_args args = {
+        .method = "read",
+        .path = path,
+        .count = 3,
+        .keys = { "path", "offset", "size" },
+        .values = { path, offset_str, size_str },
+    };
+    size_t sent = 0, received = 0;
+    ssize_t ret;
+    u64 call_start;
+
+    if (!client->initialized)
+        return -ENOENT;
+
+    snprintf(offset_str, sizeof(offset_str), "%lld", (long long)offset);
+    snprintf(size_str, sizeof(size_str), "%zu", size);
+
+    /* The payload arrives raw, so nothing is decoded and nothing bounces */
+    ret = rpc_call(client, &args, &rpc);
+    if (ret != -EPROTONOSUPPORT)
+        return ret ? ret : (rpc.status ? -ENOENT : rpc.copied);
+
+    call_start = vtfs_stat_start();
+    vtfs_data_stream_init(&reply.data, size);
+
+    ret = http_exchange(client, index, &args, recv_read_reply, &reply, &sent);
+    if (ret < 0)
+        goto out;
+
+    vtfs_stat_inc(client->stats, http_bytes_received, ret);
+    received = ret;
+    if (reply.status >= 400 || !vtfs_data_stream_done(&reply.data))
+        ret = -ENOENT;
+    else
+        ret = reply.copied;
+
+out:
+    vtfs_stat_http(client->stats, index, VTFS_PHASE_TOTAL, call_start, ret < 0);
+    trace_vtfs_http_request("read", path, sent, received,
+                            reply.status ? reply.status : ret, call_start);
+    return ret;
+}
+
+/*
+ * A read or write longer than stripe_size is split into stripe_size ranges.
+ * Up to stripes workers take the ranges in turn, the caller being one of
+ * them. Each worker makes ordinary calls on its own pooled connection or
+ * vtfs-rpc channel, so the ranges cross the network side by side, and each
+ * lands at its own place in the buffer.
+ */
+struct stripe_job {
+    struct vtfs_http_client *client;
+    const char *path;
+    /* Read into buffer, or write data */
+    u8 *buffer;
+    const u8 *data;
+    const char *opid;
+    size_t size;
+    loff_t offset;
+    size_t stripe_size;
+    unsigned int nr_ranges;
+    atomic_t next;
+    spinlock_t lock;
+    /* size, or where the first short read range ended */
+    size_t end;
+    int error;
+};
+
+struct stripe_worker {
+    struct work_struct work;
+    struct stripe_job *job;
+};
+
+/* Whether a transfer of size bytes is striped, and how */
+static bool stripe_plan(struct vtfs_http_client *client, size_t size,
+                        size_t *stripe_size, unsigned int *stripes)
+{
+    *stripe_size = READ_ONCE(client->stripe_size);
+    *stripes = min_t(unsigned int, READ_ONCE(client->stripes), VTFS_HTTP_MAX_STRIPES);
+
+    return client->initialized && *stripe_size && *stripes > 1 && size > *stripe_size;
+}
+
+static void stripe_run(struct stripe_job *job)
+{
+    char opid[64];
+    unsigned int i;
+    size_t start, len;
+    ssize_t ret;
+
+    while ((i = atomic_inc_return(&job->next) - 1) < job->nr_ranges &&
+           !READ_ONCE(job->error)) {
+        start = (size_t)i * job->stripe_size;
+        len = min(job->stripe_size, job->size - start);
+
+        if (job->buffer) {
+            ret = http_read(job->client, job->path, job->buffer + start, NULL, len,
+                            job->offset + start);
+        } else {
+            /* Each range is a mutation of its own to the server */
+            if (job->opid)
+                snprintf(opid, sizeof(opid), "%s.%u", job->opid, i);
+            ret = http_write(job->client, job->path, job->data + start, len,
+                             job->offset + start, job->opid ? opid : NULL);
+        }
+
+        spin_lock(&job->lock);
+        if (ret < 0 && !job->error)
+            job->error = ret;
+        else if (ret >= 0 && (size_t)ret < len)
+            job->end = min(job->end, start + ret);
+        spin_unlock(&job->lock);
     }
+}
 
-    if (decoded_len > size) {
-        decoded_len = size;
+static void stripe_work(struct work_struct *work)
+{
+    stripe_run(container_of(work, struct stripe_worker, work)->job);
+}
+
+/* Bytes transferred, up to the first short range, or the first error */
+static ssize_t stripe_transfer(struct stripe_job *job, unsigned int stripes)
+{
+    struct stripe_worker workers[VTFS_HTTP_MAX_STRIPES - 1];
+    unsigned int i, n;
+
+    job->nr_ranges = DIV_ROUND_UP(job->size, job->stripe_size);
+    atomic_set(&job->next, 0);
+    spin_lock_init(&job->lock);
+    job->end = job->size;
+    job->error = 0;
+
+    n = min(stripes, job->nr_ranges) - 1;
+    for (i = 0; i < n; i++) {
+        workers[i].job = job;
+        INIT_WORK_ONSTACK(&workers[i].work, stripe_work);
+        queue_work(system_unbound_wq, &workers[i].work);
+    }
+    stripe_run(job);
+    for (i = 0; i < n; i++) {
+        flush_work(&workers[i].work);
+        destroy_work_on_stack(&workers[i].work);
     }
-    memcpy(buffer, decoded, decoded_len);
-    kfree(decoded);
 
-    return decoded_len;
+    vtfs_stat_inc(job->client->stats, striped_transfers, 1);
+    vtfs_stat_inc(job->client->stats, stripe_ranges, job->nr_ranges);
+    return job->error ? job->error : job->end;
 }
 
-int vtfs_http_delete(const char *path)
+int vtfs_http_write(struct vtfs_http_client *client, const char *path,
+                    const void *data, size_t size, loff_t offset,
+                    const char *opid)
 {
-    char response[VTFS_HTTP_BUFFER_SIZE];
-    int ret;
+    struct stripe_job job = {
+        .client = client, .path = path, .data = data, .opid = opid,
+        .size = size, .offset = offset,
+    };
+    unsigned int stripes;
+
+    if (!stripe_plan(client, size, &job.stripe_size, &stripes))
+        return http_write(client, path, data, size, offset, opid);
+
+    return stripe_transfer(&job, stripes);
+}
+
+int vtfs_http_read(struct vtfs_http_client *client, const char *path,
+                   void *buffer, size_t size, loff_t offset)
+{
+    struct stripe_job job = {
+        .client = client, .path = path, .buffer = buffer,
+        .size = size, .offset = offset,
+    };
+    unsigned int stripes;
 
-    if (!http_initialized)
+    if (!stripe_plan(client, size, &job.stripe_size, &stripes))
+        return http_read(client, path, buffer, NULL, size, offset);
+
+    return stripe_transfer(&job, stripes);
+}
+
+/* Workers cannot reach the caller's memory, so this one is never striped */
+ssize_t vtfs_http_read_iter(struct vtfs_http_client *client, const char *path,
+                            struct iov_iter *to, loff_t offset)
+{
+    return http_read(client, path, NULL, to, iov_iter_count(to), offset);
+}
+
+int vtfs_http_delete(struct vtfs_http_client *client, const char *path,
+                     const char *opid)
+{
+    struct http_args args = {
+        .method = "delete",
+        .path = path,
+        .count = 2,
+        .keys = { "path", "opid" },
+        .values = { path, opid ? opid : "" },
+    };
+
+    if (!client->initialized)
         return 0; // Not an error, just skip remote sync
 
-    ret = vtfs_http_call(vtfs_get_token(), "delete", response, sizeof(response), 1,
-                         "path", path);
+    return call_simple(client, &args);
+}
 
-    if (ret < 0) {
-        return ret;
-    }
+int vtfs_http_link(struct vtfs_http_client *client, const char *oldpath,
+                   const char *newpath, const char *opid)
+{
+    struct http_args args = {
+        .method = "link",
+        .path = oldpath,
+        .count = 3,
+        .keys = { "oldpath", "newpath", "opid" },
+        .values = { oldpath, newpath, opid ? opid : "" },
+    };
+
+    if (!client->initialized)
+        return 0;
 
-    if (strstr(response, "\"error\"")) {
+    return call_simple(client, &args);
+}
+
+int vtfs_http_sums(struct vtfs_http_client *client, const char *path,
+                   loff_t offset, size_t size, u32 *sums, unsigned int max,
+                   size_t *block, loff_t *file_size)
+{
+    char offset_str[32];
+    char size_str[32];
+    char max_str[16];
+    struct rpc_reply reply = {
+        .buffer = (u8 *)sums,
+        .want = max * sizeof(u32),
+    };
+    struct http_args args = {
+        .method = "sums",
+        .path = path,
+        .count = 4,
+        .keys = { "path", "offset", "size", "max" },
+        .values = { path, offset_str, size_str, max_str },
+    };
+    unsigned int i, n;
+    int ret;
+
+    if (!client->initialized)
+        return -ENOENT;
+
+    snprintf(offset_str, sizeof(offset_str), "%lld", (long long)offset);
+    snprintf(size_str, sizeof(size_str), "%zu", size);
+    snprintf(max_str, sizeof(max_str), "%u", max);
+
+    ret = rpc_call(client, &args, &reply);
+    if (ret)
+        return ret;
+    if (reply.status)
+        return reply.status == ENOENT ? -ENOENT : -EIO;
+    if (!reply.block || reply.block > VTFS_MAX_FILE_SIZE || reply.copied % sizeof(u32))
         return -EIO;
+
+    n = reply.copied / sizeof(u32);
+    for (i = 0; i < n; i++)
+        sums[i] = le32_to_cpu((__force __le32)sums[i]);
+    *block = reply.block;
+    *file_size = reply.size;
+    return n;
+}
+
+static int stat_result(const char *type, long long size_val, long long mtime_val,
+                       umode_t *mode, loff_t *size, time64_t *mtime)
+{
+    if (mode) {
+        if (strcmp(type, "file") == 0)
+            *mode = S_IFREG | 0777;
+        else if (strcmp(type, "dir") == 0)
+            *mode = S_IFDIR | 0777;
+        else {
+            return -EIO;
+        }
     }
 
+    if (size)
+        *size = size_val;
+
+    if (mtime)
+        *mtime = mtime_val;
+
     return 0;
 }
 
-int vtfs_http_stat(const char *path, umode_t *mode, loff_t *size)
+int vtfs_http_stat(struct vtfs_http_client *client, const char *path,
+                   umode_t *mode, loff_t *size, time64_t *mtime)
 {
-    char response[VTFS_HTTP_BUFFER_SIZE];
+    char response[VTFS_HTTP_REPLY_SIZE];
     char type_str[16];
     char size_str[32];
-    const char *result_start, *result_end;
-    char result_json[VTFS_HTTP_BUFFER_SIZE];
+    char *result_start, *result_end;
+    struct rpc_reply reply = {};
+    struct http_args args = {
+        .method = "stat",
+        .path = path,
+        .count = 1,
+        .keys = { "path" },
+        .values = { path },
+    };
     int ret;
     long long size_val;
+    long long mtime_val = 0;
 
-    if (!http_initialized)
+    if (!client->initialized)
         return -ENOENT;
 
-    ret = vtfs_http_call(vtfs_get_token(), "stat", response, sizeof(response), 1,
-                         "path", path);
+    ret = rpc_call(client, &args, &reply);
+    if (ret != -EPROTONOSUPPORT) {
+        if (ret)
+            return ret;
+        if (reply.status)
+            return -ENOENT;
+        if (!reply.attrs)
+            return -EIO;
+        return stat_result(reply.kind, reply.size, reply.mtime, mode, size, mtime);
+    }
+
+    ret = http_call(client, &args, response, sizeof(response));
 
     if (ret < 0) {
         return ret;
@@ -689,17 +2097,14 @@ int vtfs_http_stat(const char *path, umode_t *mode, loff_t *size)
         return -EIO;
     }
     
-    size_t result_len = result_end - result_start;
-    if (result_len >= sizeof(result_json))
-        result_len = sizeof(result_json) - 1;
-    memcpy(result_json, result_start, result_len);
-    result_json[result_len] = '\0';
+    /* The result object is parsed in place */
+    *result_end = '\0';
 
-    if (extract_json_field(result_json, "type", type_str, sizeof(type_str)) != 0) {
+    if (vtfs_json_string(result_start, "type", type_str, sizeof(type_str)) != 0) {
         return -EIO;
     }
 
-    if (extract_json_number(result_json, "size", size_str, sizeof(size_str)) != 0) {
+    if (vtfs_json_number(result_start, "size", size_str, sizeof(size_str)) != 0) {
         return -EIO;
     }
 
@@ -707,18 +2112,10 @@ int vtfs_http_stat(const char *path, umode_t *mode, loff_t *size)
         return -EIO;
     }
 
-    if (mode) {
-        if (strcmp(type_str, "file") == 0)
-            *mode = S_IFREG | 0777;
-        else if (strcmp(type_str, "dir") == 0)
-            *mode = S_IFDIR | 0777;
-        else {
-            return -EIO;
-        }
-    }
-
-    if (size)
-        *size = size_val;
+    if (mtime &&
+        (vtfs_json_number(result_start, "mtime", size_str, sizeof(size_str)) != 0 ||
+         kstrtoll(size_str, 10, &mtime_val) != 0))
+        return -EIO;
 
-    return 0;
+    return stat_result(type_str, size_val, mtime_val, mode, size, mtime);
 }
@@ -2,25 +2,118 @@
 #define _VTFS_HTTP_H
 
 #include <linux/types.h>
+#include <linux/time64.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/jiffies.h>
+#include "stats.h"
+#include "codec.h"
+#include "rpc.h"
 
+struct iov_iter;
+struct vtfs_rpc_channel;
+
+/* Per-connection buffers: the request, the socket receive buffer, and decoded bytes per copy_to_iter() */
 #define VTFS_HTTP_BUFFER_SIZE 4096
+#define VTFS_HTTP_RECV_SIZE 16384
+#define VTFS_HTTP_BOUNCE_SIZE 3072
 #define VTFS_HTTP_MAX_ARGS 10
+/* Pages handed to the socket per sendmsg() of a request body */
+#define VTFS_HTTP_BODY_SEGS 16
+/* Body of a create/write/delete/link/stat reply, kept on the caller's stack */
+#define VTFS_HTTP_REPLY_SIZE 512
+#define VTFS_HTTP_MAX_HOST_LEN 256
+/* sizeof(sockaddr_un.sun_path) */
+#define VTFS_HTTP_MAX_UNIX_PATH 108
+#define VTFS_HTTP_MAX_TOKEN_LEN 128
+#define VTFS_HTTP_SEND_TIMEOUT (3 * HZ)
+/* Longer than the change feed long-poll, which legitimately waits for data */
+#define VTFS_HTTP_RECV_TIMEOUT (35 * HZ)
+/* vtfs-rpc connections, each shared by any number of calls in flight */
+#define VTFS_HTTP_MAX_CHANNELS 8
+/* Ranges of one read or write in flight at once */
+#define VTFS_HTTP_MAX_STRIPES 16
+
+struct vtfs_http_client {
+    char host[VTFS_HTTP_MAX_HOST_LEN];
+    int port;
+    /* Set for a unix:/path server, which host and port then do not describe */
+    char unix_path[VTFS_HTTP_MAX_UNIX_PATH];
+    /* Host header value */
+    char authority[VTFS_HTTP_MAX_HOST_LEN + 8];
+    char token[VTFS_HTTP_MAX_TOKEN_LEN];
+    char client_id[17];
+    bool initialized;
+    /* Upgrade connections to vtfs-rpc; cleared for good if the server declines */
+    bool rpc;
+
+    /* Idle keep-alive connections, at most pool_size of them */
+    spinlock_t pool_lock;
+    struct list_head idle;
+    unsigned int idle_count;
+    unsigned int pool_size;
+
+    /* Slots under pool_lock, min(pool_size, VTFS_HTTP_MAX_CHANNELS) used; channel_lock serialises opening */
+    struct mutex channel_lock;
+    struct vtfs_rpc_channel *channels[VTFS_HTTP_MAX_CHANNELS];
+
+    /* Reads and writes longer than stripe_size go as that many ranges at once; 0 or 1 turn it off */
+    size_t stripe_size;
+    unsigned int stripes;
+    /*
+     * Offer LZ4 when upgrading, and compress payloads worth it on channels
+     * where the server took the offer. Replies may come compressed on those
+     * whatever it is set to now.
+     */
+    bool compress;
+
+    /* Owned by the mount, may be NULL */
+    struct vtfs_stats __percpu *stats;
+};
 
-int64_t vtfs_http_call(const char *token,
+/* Always plain HTTP, whichever protocol the calls below use */
+int64_t vtfs_http_call(struct vtfs_http_client *client,
                        const char *method,
                        char *response_buffer,
                        size_t buffer_size,
                        size_t arg_size,
                        ...);
 
-int vtfs_http_init(const char *server_url);
-void vtfs_http_cleanup(void);
-void vtfs_http_set_server(const char *url);
+int vtfs_http_init(struct vtfs_http_client *client, const char *server_url,
+                   const char *token, unsigned int pool_size, bool rpc);
+void vtfs_http_cleanup(struct vtfs_http_client *client);
 
-int vtfs_http_create(const char *path, const char *type, int mode);
-int vtfs_http_write(const char *path, const void *data, size_t size, loff_t offset);
-int vtfs_http_read(const char *path, void *buffer, size_t size, loff_t offset);
-int vtfs_http_delete(const char *path);
-int vtfs_http_stat(const char *path, umode_t *mode, loff_t *size);
+/*
+ * opid, when not NULL, lets the server recognise a replayed mutation. A
+ * striped write sends each range under opid with the range number appended.
+ */
+int vtfs_http_create(struct vtfs_http_client *client, const char *path,
+                     const char *type, int mode, const char *opid);
+int vtfs_http_write(struct vtfs_http_client *client, const char *path,
+                    const void *data, size_t size, loff_t offset,
+                    const char *opid);
+/*
+ * Both decode the reply as it arrives; the _iter variant reads iov_iter_count(to) bytes
+ * and is never striped, so a caller wanting that gathers the ranges in a buffer of its own.
+ */
+int vtfs_http_read(struct vtfs_http_client *client, const char *path,
+                   void *buffer, size_t size, loff_t offset);
+ssize_t vtfs_http_read_iter(struct vtfs_http_client *client, const char *path,
+                            struct iov_iter *to, loff_t offset);
+int vtfs_http_delete(struct vtfs_http_client *client, const char *path,
+                     const char *opid);
+int vtfs_http_link(struct vtfs_http_client *client, const char *oldpath,
+                   const char *newpath, const char *opid);
+int vtfs_http_stat(struct vtfs_http_client *client, const char *path,
+                   umode_t *mode, loff_t *size, time64_t *mtime);
+/*
+ * The server's CRC32C of each block of path from the one holding offset
+ * on, covering size bytes, at most max of them. Returns how many, with the
+ * block size and the file's size. vtfs-rpc only: -EPROTONOSUPPORT over HTTP.
+ */
+int vtfs_http_sums(struct vtfs_http_client *client, const char *path,
+                   loff_t offset, size_t size, u32 *sums, unsigned int max,
+                   size_t *block, loff_t *file_size);
 
 #endif
@@ -5,16 +5,139 @@
 #include <linux/mount.h>
 #include "storage.h"
 #include "http.h"
+#include "super.h"
 #include "vtfs.h"
+#include "vtfs_trace.h"
 
-static struct vtfs_entry *fetch_from_remote(struct vtfs_entry *parent, const char *name)
+/*
+ * The server's copy is read in full before anything local changes; readers
+ * keep seeing the old contents until it replaces them in one step, under
+ * the inode lock when there is an inode.
+ */
+static int load_remote_data(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                            struct inode *inode, const char *full_path, loff_t size)
+{
+    char *buffer = NULL;
+    ssize_t bytes = 0;
+    int ret;
+
+    if (size > VTFS_MAX_FILE_SIZE)
+        return -EFBIG;
+
+    if (size > 0) {
+        buffer = kvmalloc(size, GFP_KERNEL);
+        if (!buffer)
+            return -ENOMEM;
+
+        bytes = vtfs_http_read(&sbi->http, full_path, buffer, size, 0);
+        if (bytes < 0) {
+            kvfree(buffer);
+            return bytes;
+        }
+    }
+
+    if (inode)
+        inode_lock(inode);
+    ret = vtfs_storage_replace_no_sync(sbi, entry, buffer, bytes);
+    if (!ret) {
+        entry->unloaded = false;
+        if (inode)
+            i_size_write(inode, entry->size);
+    }
+    if (inode)
+        inode_unlock(inode);
+
+    kvfree(buffer);
+    return ret;
+}
+
+int vtfs_refresh_from_remote(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                             struct inode *inode)
+{
+    char full_path[VTFS_MAX_PATH_LEN];
+    umode_t mode;
+    loff_t size;
+    time64_t mtime;
+    int ret;
+
+    if (!vtfs_use_remote(sbi) || !S_ISREG(entry->mode))
+        return 0;
+
+    vtfs_get_full_path(entry, full_path, sizeof(full_path));
+
+    ret = vtfs_http_stat(&sbi->http, full_path, &mode, &size, &mtime);
+    if (ret)
+        return ret;
+
+    ret = load_remote_data(sbi, entry, inode, full_path, size);
+    if (ret == 0) {
+        entry->remote_mtime = mtime;
+        entry->attr_time = jiffies;
+    }
+    return ret;
+}
+
+int vtfs_revalidate_entry(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                          struct inode *inode, bool force)
+{
+    char full_path[VTFS_MAX_PATH_LEN];
+    umode_t mode;
+    loff_t size;
+    time64_t mtime;
+    int ret;
+
+    if (!vtfs_use_remote(sbi))
+        return 0;
+
+    if (!force && time_before(jiffies, entry->attr_time + vtfs_attr_ttl(sbi)))
+        return 0;
+
+    vtfs_get_full_path(entry, full_path, sizeof(full_path));
+
+    /* Local changes not yet flushed are newer than anything on the server */
+    if (vtfs_remote_pending(sbi, full_path)) {
+        entry->attr_time = jiffies;
+        return 0;
+    }
+
+    ret = vtfs_http_stat(&sbi->http, full_path, &mode, &size, &mtime);
+    if (ret == -ENOENT) {
+        entry->stale = true;
+        return ret;
+    }
+    if (ret)
+        return ret;
+
+    if ((mode ^ entry->mode) & S_IFMT) {
+        entry->stale = true;
+        return -ESTALE;
+    }
+
+    /* remote_mtime == 0 after our own write: adopt the server's mtime as is */
+    if (S_ISREG(mode) &&
+        (size != entry->size || (entry->remote_mtime && mtime != entry->remote_mtime)))
+        ret = load_remote_data(sbi, entry, inode, full_path, size);
+
+    entry->remote_mtime = mtime;
+    entry->attr_time = jiffies;
+
+    if (inode)
+        i_size_write(inode, entry->size);
+
+    return ret;
+}
+
+static struct vtfs_entry *fetch_from_remote(struct vtfs_sb_info *sbi,
+                                           struct vtfs_entry *parent,
+                                           const char *name)
 {
     struct vtfs_entry *entry;
-    char full_path[512];
+    char full_path[VTFS_MAX_PATH_LEN];
     umode_t mode;
     loff_t size;
+    time64_t mtime;
     
-    if (!use_remote_server())
+    if (!vtfs_use_remote(sbi))
         return NULL;
     
     vtfs_get_full_path(parent, full_path, sizeof(full_path));
@@ -22,41 +145,63 @@ static struct vtfs_entry *fetch_from_remote(struct vtfs_entry *parent, const cha
         strlcat(full_path, "/", sizeof(full_path));
     strlcat(full_path, name, sizeof(full_path));
     
-    if (vtfs_http_stat(full_path, &mode, &size) != 0)
+    /* A queued delete must not be undone by what the server still has */
+    if (vtfs_remote_pending(sbi, full_path))
         return NULL;
     
-    entry = vtfs_storage_create_entry_no_sync(parent, name, mode, 0);
-    if (!entry)
+    if (vtfs_http_stat(&sbi->http, full_path, &mode, &size, &mtime) != 0)
         return NULL;
     
-    if (S_ISREG(mode) && size > 0) {
-        char *buffer = kmalloc(size, GFP_KERNEL);
-        if (buffer) {
-            ssize_t bytes = vtfs_http_read(full_path, buffer, size, 0);
-            if (bytes > 0)
-                vtfs_storage_write(entry, buffer, bytes, 0);
-            kfree(buffer);
-        }
-    }
+    entry = vtfs_storage_create_entry_no_sync(sbi, parent, name, mode, 0);
+    if (IS_ERR(entry))
+        return NULL;
+    
+    if (S_ISREG(mode) && size > 0)
+        load_remote_data(sbi, entry, NULL, full_path, size);
+    
+    entry->remote_mtime = mtime;
     
     return entry;
 }
 
-static struct dentry *vtfs_lookup(struct inode *parent_inode,
-                                  struct dentry *child_dentry,
-                                  unsigned int flags)
+static struct dentry *__vtfs_lookup(struct inode *parent_inode,
+                                    struct dentry *child_dentry,
+                                    unsigned int flags)
 {
+    struct vtfs_sb_info *sbi = VTFS_SB(parent_inode->i_sb);
     struct vtfs_entry *parent, *child;
     struct inode *inode = NULL;
     const char *name = child_dentry->d_name.name;
     
-    parent = vtfs_storage_get_by_ino(parent_inode->i_ino);
+    parent = vtfs_storage_get_by_ino(sbi, parent_inode->i_ino);
     if (!parent)
         return ERR_PTR(-ENOENT);
     
-    child = vtfs_storage_lookup(parent, name);
-    if (!child)
-        child = fetch_from_remote(parent, name);
+    child = vtfs_storage_lookup(sbi, parent, name);
+    
+    /* A cached entry past its attribute TTL is checked like a cached dentry would be */
+    if (child && !child->stale)
+        vtfs_revalidate_entry(sbi, child, NULL, false);
+    
+    /*
+     * d_revalidate found this name gone on the server. Lookups of one name
+     * are serialized by the dcache, so it is safe to reap the entry here.
+     */
+    if (child && child->stale) {
+        vtfs_storage_delete_entry_no_sync(sbi, child);
+        child = NULL;
+    }
+    
+    if (child && child->prefetched) {
+        child->prefetched = false;
+        vtfs_stat_inc(sbi->stats, prefetch_hits, 1);
+    }
+    
+    /* Siblings of a name we had to ask for are likely to be asked for next */
+    if (!child) {
+        vtfs_prefetch_dir(sbi, parent_inode);
+        child = fetch_from_remote(sbi, parent, name);
+    }
     
     if (child) {
         inode = vtfs_get_inode(parent_inode->i_sb, parent_inode,
@@ -68,32 +213,34 @@ static struct dentry *vtfs_lookup(struct inode *parent_inode,
         inode->i_size = child->size;
     }
     
+    child_dentry->d_time = jiffies;
     d_add(child_dentry, inode);
     return NULL;
 }
 
-static int vtfs_create(struct mnt_idmap *idmap,
-                       struct inode *parent_inode,
-                       struct dentry *child_dentry,
-                       umode_t mode,
-                       bool excl)
+static int __vtfs_create(struct mnt_idmap *idmap,
+                         struct inode *parent_inode,
+                         struct dentry *child_dentry,
+                         umode_t mode,
+                         bool excl)
 {
+    struct vtfs_sb_info *sbi = VTFS_SB(parent_inode->i_sb);
     struct vtfs_entry *parent, *entry;
     struct inode *inode;
     
-    parent = vtfs_storage_get_by_ino(parent_inode->i_ino);
+    parent = vtfs_storage_get_by_ino(sbi, parent_inode->i_ino);
     if (!parent)
         return -ENOENT;
     
-    entry = vtfs_storage_create_entry(parent, child_dentry->d_name.name,
+    entry = vtfs_storage_create_entry(sbi, parent, child_dentry->d_name.name,
                                       S_IFREG | 0777, 0);
-    if (!entry)
-        return -EEXIST;
+    if (IS_ERR(entry))
+        return PTR_ERR(entry);
     
     inode = vtfs_get_inode(parent_inode->i_sb, parent_inode,
                            entry->mode, entry->ino);
     if (!inode) {
-        vtfs_storage_delete_entry(entry);
+        vtfs_storage_delete_entry(sbi, entry);
         return -ENOMEM;
     }
     
@@ -102,20 +249,21 @@ static int vtfs_create(struct mnt_idmap *idmap,
     return 0;
 }
 
-static int vtfs_unlink(struct inode *parent_inode, struct dentry *child_dentry)
+static int __vtfs_unlink(struct inode *parent_inode, struct dentry *child_dentry)
 {
+    struct vtfs_sb_info *sbi = VTFS_SB(parent_inode->i_sb);
     struct vtfs_entry *parent, *child;
     int ret;
     
-    parent = vtfs_storage_get_by_ino(parent_inode->i_ino);
+    parent = vtfs_storage_get_by_ino(sbi, parent_inode->i_ino);
     if (!parent)
         return -ENOENT;
     
-    child = vtfs_storage_lookup(parent, child_dentry->d_name.name);
+    child = vtfs_storage_lookup(sbi, parent, child_dentry->d_name.name);
     if (!child)
         return -ENOENT;
     
-    ret = vtfs_storage_delete_entry(child);
+    ret = vtfs_storage_delete_entry(sbi, child);
     if (ret)
         return ret;
     
@@ -124,29 +272,30 @@ static int vtfs_unlink(struct inode *parent_inode, struct dentry *child_dentry)
     return 0;
 }
 
-static int vtfs_mkdir(struct mnt_idmap *idmap,
-                      struct inode *parent_inode,
-                      struct dentry *child_dentry,
-                      umode_t mode)
+static int __vtfs_mkdir(struct mnt_idmap *idmap,
+                        struct inode *parent_inode,
+                        struct dentry *child_dentry,
+                        umode_t mode)
 {
+    struct vtfs_sb_info *sbi = VTFS_SB(parent_inode->i_sb);
     struct vtfs_entry *parent, *entry;
     struct inode *inode;
     
-    parent = vtfs_storage_get_by_ino(parent_inode->i_ino);
+    parent = vtfs_storage_get_by_ino(sbi, parent_inode->i_ino);
     if (!parent)
         return -ENOENT;
     
-    entry = vtfs_storage_create_entry(parent, child_dentry->d_name.name,
+    entry = vtfs_storage_create_entry(sbi, parent, child_dentry->d_name.name,
                                       S_IFDIR | 0777, 0);
-    if (!entry)
-        return -EEXIST;
+    if (IS_ERR(entry))
+        return PTR_ERR(entry);
     
     entry->nlink = 2;
     
     inode = vtfs_get_inode(parent_inode->i_sb, parent_inode,
                            entry->mode, entry->ino);
     if (!inode) {
-        vtfs_storage_delete_entry(entry);
+        vtfs_storage_delete_entry(sbi, entry);
         return -ENOMEM;
     }
     
@@ -156,16 +305,17 @@ static int vtfs_mkdir(struct mnt_idmap *idmap,
     return 0;
 }
 
-static int vtfs_rmdir(struct inode *parent_inode, struct dentry *child_dentry)
+static int __vtfs_rmdir(struct inode *parent_inode, struct dentry *child_dentry)
 {
+    struct vtfs_sb_info *sbi = VTFS_SB(parent_inode->i_sb);
     struct vtfs_entry *parent, *child;
     int ret;
     
-    parent = vtfs_storage_get_by_ino(parent_inode->i_ino);
+    parent = vtfs_storage_get_by_ino(sbi, parent_inode->i_ino);
     if (!parent)
         return -ENOENT;
     
-    child = vtfs_storage_lookup(parent, child_dentry->d_name.name);
+    child = vtfs_storage_lookup(sbi, parent, child_dentry->d_name.name);
     if (!child)
         return -ENOENT;
     
@@ -175,7 +325,7 @@ static int vtfs_rmdir(struct inode *parent_inode, struct dentry *child_dentry)
     if (!list_empty(&child->children))
         return -ENOTEMPTY;
     
-    ret = vtfs_storage_delete_entry(child);
+    ret = vtfs_storage_delete_entry(sbi, child);
     if (ret)
         return ret;
     
@@ -185,37 +335,38 @@ static int vtfs_rmdir(struct inode *parent_inode, struct dentry *child_dentry)
     return 0;
 }
 
-static int vtfs_link(struct dentry *old_dentry,
-                     struct inode *parent_dir,
-                     struct dentry *new_dentry)
+static int __vtfs_link(struct dentry *old_dentry,
+                       struct inode *parent_dir,
+                       struct dentry *new_dentry)
 {
+    struct vtfs_sb_info *sbi = VTFS_SB(parent_dir->i_sb);
     struct vtfs_entry *target, *parent, *link;
     struct inode *inode = d_inode(old_dentry);
     int ret;
     
-    target = vtfs_storage_get_by_ino(inode->i_ino);
+    target = vtfs_storage_get_by_ino(sbi, inode->i_ino);
     if (!target)
         return -ENOENT;
     
     if (S_ISDIR(target->mode))
         return -EPERM;
     
-    parent = vtfs_storage_get_by_ino(parent_dir->i_ino);
+    parent = vtfs_storage_get_by_ino(sbi, parent_dir->i_ino);
     if (!parent)
         return -ENOENT;
     
-        link = vtfs_storage_create_entry_no_sync(parent, new_dentry->d_name.name,
-                                              target->mode, target->ino);
-    if (!link)
-        return -EEXIST;
+    link = vtfs_storage_create_entry_no_sync(sbi, parent, new_dentry->d_name.name,
+                                             target->mode, target->ino);
+    if (IS_ERR(link))
+        return PTR_ERR(link);
     
     link->data = target->data;
     link->size = target->size;
     link->capacity = target->capacity;
     
-    ret = vtfs_storage_add_link(target, parent, new_dentry->d_name.name);
+    ret = vtfs_storage_add_link(sbi, target, parent, new_dentry->d_name.name);
     if (ret) {
-        vtfs_storage_delete_entry(link);
+        vtfs_storage_delete_entry_no_sync(sbi, link);
         return ret;
     }
     
@@ -226,8 +377,143 @@ static int vtfs_link(struct dentry *old_dentry,
     return 0;
 }
 
+static int __vtfs_getattr(struct mnt_idmap *idmap,
+                          const struct path *path,
+                          struct kstat *stat,
+                          u32 request_mask,
+                          unsigned int query_flags)
+{
+    struct inode *inode = d_inode(path->dentry);
+    struct vtfs_sb_info *sbi = VTFS_SB(inode->i_sb);
+    struct vtfs_entry *entry;
+    
+    entry = vtfs_storage_get_by_ino(sbi, inode->i_ino);
+    if (entry && !(query_flags & AT_STATX_DONT_SYNC))
+        vtfs_revalidate_entry(sbi, entry, inode, query_flags & AT_STATX_FORCE_SYNC);
+    
+    generic_fillattr(idmap, request_mask, inode, stat);
+    return 0;
+}
+
+/* Timed entry points; the __ variants above do the work */
+
+static struct dentry *vtfs_lookup(struct inode *parent_inode,
+                                  struct dentry *child_dentry,
+                                  unsigned int flags)
+{
+    const char *name = child_dentry->d_name.name;
+    unsigned long ino = parent_inode->i_ino;
+    u64 start = vtfs_stat_start();
+    struct dentry *ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_LOOKUP, ino, name);
+    ret = __vtfs_lookup(parent_inode, child_dentry, flags);
+    vtfs_stat_op(VTFS_SB(parent_inode->i_sb)->stats, VTFS_STAT_LOOKUP, start,
+                 IS_ERR(ret));
+    trace_vtfs_op_end(VTFS_STAT_LOOKUP, ino, name, PTR_ERR_OR_ZERO(ret), start);
+    return ret;
+}
+
+static int vtfs_create(struct mnt_idmap *idmap,
+                       struct inode *parent_inode,
+                       struct dentry *child_dentry,
+                       umode_t mode,
+                       bool excl)
+{
+    const char *name = child_dentry->d_name.name;
+    unsigned long ino = parent_inode->i_ino;
+    u64 start = vtfs_stat_start();
+    int ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_CREATE, ino, name);
+    ret = __vtfs_create(idmap, parent_inode, child_dentry, mode, excl);
+    vtfs_stat_op(VTFS_SB(parent_inode->i_sb)->stats, VTFS_STAT_CREATE, start, ret);
+    trace_vtfs_op_end(VTFS_STAT_CREATE, ino, name, ret, start);
+    return ret;
+}
+
+static int vtfs_unlink(struct inode *parent_inode, struct dentry *child_dentry)
+{
+    const char *name = child_dentry->d_name.name;
+    unsigned long ino = parent_inode->i_ino;
+    u64 start = vtfs_stat_start();
+    int ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_UNLINK, ino, name);
+    ret = __vtfs_unlink(parent_inode, child_dentry);
+    vtfs_stat_op(VTFS_SB(parent_inode->i_sb)->stats, VTFS_STAT_UNLINK, start, ret);
+    trace_vtfs_op_end(VTFS_STAT_UNLINK, ino, name, ret, start);
+    return ret;
+}
+
+static int vtfs_mkdir(struct mnt_idmap *idmap,
+                      struct inode *parent_inode,
+                      struct dentry *child_dentry,
+                      umode_t mode)
+{
+    const char *name = child_dentry->d_name.name;
+    unsigned long ino = parent_inode->i_ino;
+    u64 start = vtfs_stat_start();
+    int ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_MKDIR, ino, name);
+    ret = __vtfs_mkdir(idmap, parent_inode, child_dentry, mode);
+    vtfs_stat_op(VTFS_SB(parent_inode->i_sb)->stats, VTFS_STAT_MKDIR, start, ret);
+    trace_vtfs_op_end(VTFS_STAT_MKDIR, ino, name, ret, start);
+    return ret;
+}
+
+static int vtfs_rmdir(struct inode *parent_inode, struct dentry *child_dentry)
+{
+    const char *name = child_dentry->d_name.name;
+    unsigned long ino = parent_inode->i_ino;
+    u64 start = vtfs_stat_start();
+    int ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_RMDIR, ino, name);
+    ret = __vtfs_rmdir(parent_inode, child_dentry);
+    vtfs_stat_op(VTFS_SB(parent_inode->i_sb)->stats, VTFS_STAT_RMDIR, start, ret);
+    trace_vtfs_op_end(VTFS_STAT_RMDIR, ino, name, ret, start);
+    return ret;
+}
+
+static int vtfs_link(struct dentry *old_dentry,
+                     struct inode *parent_dir,
+                     struct dentry *new_dentry)
+{
+    const char *name = new_dentry->d_name.name;
+    unsigned long ino = parent_dir->i_ino;
+    u64 start = vtfs_stat_start();
+    int ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_LINK, ino, name);
+    ret = __vtfs_link(old_dentry, parent_dir, new_dentry);
+    vtfs_stat_op(VTFS_SB(parent_dir->i_sb)->stats, VTFS_STAT_LINK, start, ret);
+    trace_vtfs_op_end(VTFS_STAT_LINK, ino, name, ret, start);
+    return ret;
+}
+
+static int vtfs_getattr(struct mnt_idmap *idmap,
+                        const struct path *path,
+                        struct kstat *stat,
+                        u32 request_mask,
+                        unsigned int query_flags)
+{
+    const char *name = path->dentry->d_name.name;
+    unsigned long ino = d_inode(path->dentry)->i_ino;
+    u64 start = vtfs_stat_start();
+    int ret;
+    
+    trace_vtfs_op_start(VTFS_STAT_GETATTR, ino, name);
+    ret = __vtfs_getattr(idmap, path, stat, request_mask, query_flags);
+    vtfs_stat_op(VTFS_SB(path->dentry->d_sb)->stats, VTFS_STAT_GETATTR, start, ret);
+    trace_vtfs_op_end(VTFS_STAT_GETATTR, ino, name, ret, start);
+    return ret;
+}
+
 const struct inode_operations vtfs_inode_ops = {
     .lookup = vtfs_lookup,
+    .getattr = vtfs_getattr,
     .create = vtfs_create,
     .unlink = vtfs_unlink,
     .mkdir  = vtfs_mkdir,
@@ -236,4 +522,5 @@ const struct inode_operations vtfs_inode_ops = {
 };
 
 const struct inode_operations vtfs_file_inode_ops = {
+    .getattr = vtfs_getattr,
 };
@@ -0,0 +1,187 @@
+#include <linux/fs.h>
+#include <linux/jiffies.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
+#include "storage.h"
+#include "http.h"
+#include "super.h"
+#include "vtfs.h"
+
+/*
+ * find, du and rsync stat every entry of a directory right after reading
+ * it, and each name not known locally costs a stat and a read. The first
+ * readdir of a directory, or the first lookup in it that misses, instead
+ * queues one /list of the whole directory; the entries it brings are added
+ * with their size and mtime, and a file's data is only fetched when it is
+ * opened. A directory is listed at most once per entry_ttl_ms.
+ */
+
+#define VTFS_PREFETCH_BUFFER_SIZE (256 * 1024)
+
+struct vtfs_prefetch {
+    struct work_struct work;
+    struct vtfs_sb_info *sbi;
+    /* Held until the work is done; its lock keeps the directory from changing under us */
+    struct inode *dir;
+};
+
+static void prefetch_add(struct vtfs_sb_info *sbi, struct vtfs_entry *dir_entry,
+                         char *obj, const char *dir_path)
+{
+    static const char *const keys[] = { "name", "ino", "type", "mode", "size", "mtime" };
+    struct vtfs_entry *entry;
+    char name[VTFS_MAX_NAME_LEN + 1];
+    char full_path[VTFS_MAX_PATH_LEN];
+    char type[16];
+    char num[32];
+    long long size = 0, mtime = 0;
+    umode_t mode;
+    int i;
+
+    /* Names the simple JSON helpers would get wrong are left to lookup */
+    if (vtfs_json_string(obj, "name", name, sizeof(name)) != 0 || !name[0] ||
+        strchr(name, '\\') || strchr(name, '/'))
+        return;
+    for (i = 0; i < ARRAY_SIZE(keys); i++)
+        if (strcmp(name, keys[i]) == 0)
+            return;
+    if (vtfs_json_string(obj, "type", type, sizeof(type)) != 0)
+        return;
+    if (strcmp(type, "file") == 0)
+        mode = S_IFREG | 0777;
+    else if (strcmp(type, "dir") == 0)
+        mode = S_IFDIR | 0777;
+    else
+        return;
+
+    if (vtfs_json_number(obj, "size", num, sizeof(num)) == 0 && kstrtoll(num, 10, &size))
+        return;
+    if (vtfs_json_number(obj, "mtime", num, sizeof(num)) == 0 && kstrtoll(num, 10, &mtime))
+        return;
+    if (size < 0 || size > VTFS_MAX_FILE_SIZE)
+        return;
+
+    if (vtfs_storage_lookup(sbi, dir_entry, name))
+        return;
+
+    snprintf(full_path, sizeof(full_path), "%s/%s",
+             strcmp(dir_path, "/") == 0 ? "" : dir_path, name);
+
+    /* A queued delete must not be undone by what the server still has */
+    if (vtfs_remote_pending(sbi, full_path))
+        return;
+
+    entry = vtfs_storage_create_entry_no_sync(sbi, dir_entry, name, mode, 0);
+    if (IS_ERR(entry))
+        return;
+
+    if (S_ISREG(mode) && size > 0) {
+        entry->size = size;
+        entry->unloaded = true;
+    }
+    entry->remote_mtime = mtime;
+    entry->prefetched = true;
+    vtfs_stat_inc(sbi->stats, prefetch_entries, 1);
+}
+
+static void prefetch_work(struct work_struct *work)
+{
+    struct vtfs_prefetch *p = container_of(work, struct vtfs_prefetch, work);
+    struct vtfs_sb_info *sbi = p->sbi;
+    struct vtfs_entry *dir_entry;
+    char dir_path[VTFS_MAX_PATH_LEN];
+    char *buffer, *obj, *end, saved;
+    int ret;
+
+    buffer = kvmalloc(VTFS_PREFETCH_BUFFER_SIZE, GFP_KERNEL);
+    if (!buffer)
+        goto out;
+
+    dir_entry = vtfs_storage_get_by_ino(sbi, p->dir->i_ino);
+    if (!dir_entry || !vtfs_use_remote(sbi))
+        goto out;
+    vtfs_get_full_path(dir_entry, dir_path, sizeof(dir_path));
+
+    /* The directory is only locked once the listing is in */
+    ret = vtfs_http_call(&sbi->http, "list", buffer, VTFS_PREFETCH_BUFFER_SIZE, 1,
+                         "path", dir_path);
+    if (ret)
+        goto out;
+    vtfs_stat_inc(sbi->stats, prefetch_lists, 1);
+
+    obj = strstr(buffer, "\"result\"");
+    obj = obj ? strchr(obj, '[') : NULL;
+    if (!obj)
+        goto out;
+
+    inode_lock(p->dir);
+    dir_entry = vtfs_storage_get_by_ino(sbi, p->dir->i_ino);
+    if (IS_DEADDIR(p->dir) || !dir_entry || !S_ISDIR(dir_entry->mode))
+        goto unlock;
+
+    /* A listing cut short by the buffer still adds the entries it holds whole */
+    while ((obj = strchr(obj, '{')) != NULL) {
+        end = vtfs_json_object_end(obj + 1);
+        if (!end)
+            break;
+
+        saved = end[1];
+        end[1] = '\0';
+        prefetch_add(sbi, dir_entry, obj, dir_path);
+        end[1] = saved;
+        obj = end + 1;
+    }
+
+unlock:
+    inode_unlock(p->dir);
+out:
+    kvfree(buffer);
+    iput(p->dir);
+    kfree(p);
+}
+
+void vtfs_prefetch_dir(struct vtfs_sb_info *sbi, struct inode *dir)
+{
+    struct vtfs_entry *dir_entry;
+    struct vtfs_prefetch *p;
+
+    /* With cache=none every lookup asks the server anyway */
+    if (!sbi->prefetch_wq || !vtfs_use_remote(sbi) ||
+        vtfs_cache_mode(sbi) == VTFS_CACHE_NONE)
+        return;
+
+    dir_entry = vtfs_storage_get_by_ino(sbi, dir->i_ino);
+    if (!dir_entry || !S_ISDIR(dir_entry->mode))
+        return;
+
+    if (dir_entry->list_time &&
+        time_before(jiffies, dir_entry->list_time + vtfs_entry_ttl(sbi)))
+        return;
+    dir_entry->list_time = jiffies ? jiffies : 1;
+
+    p = kmalloc(sizeof(*p), GFP_KERNEL);
+    if (!p)
+        return;
+
+    INIT_WORK(&p->work, prefetch_work);
+    p->sbi = sbi;
+    p->dir = dir;
+    ihold(dir);
+    queue_work(sbi->prefetch_wq, &p->work);
+}
+
+int vtfs_prefetch_start(struct vtfs_sb_info *sbi)
+{
+    sbi->prefetch_wq = alloc_workqueue("vtfs-prefetch", WQ_UNBOUND, 0);
+    return sbi->prefetch_wq ? 0 : -ENOMEM;
+}
+
+/* Waits for queued listings, which hold directory inodes */
+void vtfs_prefetch_stop(struct vtfs_sb_info *sbi)
+{
+    if (!sbi->prefetch_wq)
+        return;
+
+    destroy_workqueue(sbi->prefetch_wq);
+    sbi->prefetch_wq = NULL;
+}
@@ -0,0 +1,723 @@
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <linux/crc32.h>
+#include <linux/crc32c.h>
+#include <linux/math64.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+#include "http.h"
+#include "super.h"
+#include "vtfs.h"
+
+#define VTFS_WRITEBACK_DELAY_MS 1000
+#define VTFS_WRITEBACK_RETRY_MS 5000
+
+#define VTFS_JOURNAL_MAGIC 0x564a524e /* "VJRN" */
+#define VTFS_OPID_LEN 40
+#define VTFS_JOURNAL_PATH_MAX VTFS_MAX_PATH_LEN
+/* Block sums asked for per rewrite; the rest of a longer one is sent whole */
+#define VTFS_DELTA_MAX_BLOCKS 64
+
+enum vtfs_op_type {
+    VTFS_OP_CREATE,
+    VTFS_OP_DELETE,
+    VTFS_OP_WRITE,
+    VTFS_OP_LINK,
+};
+
+struct vtfs_pending_op {
+    struct list_head list;
+    enum vtfs_op_type type;
+    char opid[VTFS_OPID_LEN];
+    char *path;
+    char *path2;
+    umode_t mode;
+    loff_t offset;
+    size_t len;
+    char data[];
+};
+
+/*
+ * On-disk journal record, followed by opid, path, path2 and data. crc covers
+ * everything after itself, so a torn append at the tail is detected on replay.
+ */
+struct vtfs_journal_record {
+    __le32 magic;
+    __le32 crc;
+    __le16 type;
+    __le16 mode;
+    __le16 opid_len;
+    __le16 path_len;
+    __le16 path2_len;
+    __le16 reserved;
+    __le32 len;
+    __le64 offset;
+} __packed;
+
+static int run_op(struct vtfs_sb_info *sbi, enum vtfs_op_type type,
+                  const char *opid, const char *path, const char *path2,
+                  umode_t mode, const char *data, size_t len, loff_t offset)
+{
+    int ret;
+
+    switch (type) {
+    case VTFS_OP_CREATE:
+        ret = vtfs_http_create(&sbi->http, path, S_ISDIR(mode) ? "dir" : "file",
+                               mode & 0777, opid);
+        break;
+    case VTFS_OP_DELETE:
+        ret = vtfs_http_delete(&sbi->http, path, opid);
+        break;
+    case VTFS_OP_WRITE:
+        ret = vtfs_http_write(&sbi->http, path, data, len, offset, opid);
+        break;
+    case VTFS_OP_LINK:
+        ret = vtfs_http_link(&sbi->http, path, path2, opid);
+        break;
+    default:
+        ret = -EINVAL;
+    }
+
+    if (ret > 0)
+        ret = 0;
+    return ret;
+}
+
+/*
+ * Only a failure to reach the server may succeed later. Anything else, the
+ * server's -EIO or a local or protocol error, would fail the same way on
+ * every retry and wedge the journal behind it.
+ */
+static bool is_transient(int err)
+{
+    switch (err) {
+    case -ECONNREFUSED:
+    case -ECONNRESET:
+    case -ECONNABORTED:
+    case -ENOTCONN:
+    case -ETIMEDOUT:
+    case -EPIPE:
+    case -EHOSTUNREACH:
+    case -ENETUNREACH:
+    case -ENETDOWN:
+    case -EAGAIN:
+    /* A signal cut the call short; the change itself is fine */
+    case -EINTR:
+    case -ERESTARTSYS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void mark_down(struct vtfs_sb_info *sbi)
+{
+    if (READ_ONCE(sbi->server_down))
+        return;
+
+    sbi->down_since = jiffies;
+    WRITE_ONCE(sbi->server_down, true);
+    VTFS_ERR("server unreachable, journaling changes\n");
+}
+
+static void mark_up(struct vtfs_sb_info *sbi)
+{
+    if (!READ_ONCE(sbi->server_down))
+        return;
+
+    WRITE_ONCE(sbi->server_down, false);
+    VTFS_LOG("server reachable again, journal replayed\n");
+}
+
+static size_t op_bytes(struct vtfs_pending_op *op)
+{
+    return struct_size(op, data, op->len) + strlen(op->path) + 1 +
+           (op->path2 ? strlen(op->path2) + 1 : 0);
+}
+
+static struct vtfs_pending_op *alloc_op(enum vtfs_op_type type, const char *opid,
+                                        const char *path, const char *path2,
+                                        umode_t mode, const char *data,
+                                        size_t len, loff_t offset)
+{
+    struct vtfs_pending_op *op;
+
+    op = kmalloc(struct_size(op, data, len), GFP_KERNEL);
+    if (!op)
+        return NULL;
+
+    op->type = type;
+    op->mode = mode;
+    op->offset = offset;
+    op->len = len;
+    strscpy(op->opid, opid, sizeof(op->opid));
+    op->path = kstrdup(path, GFP_KERNEL);
+    op->path2 = path2 ? kstrdup(path2, GFP_KERNEL) : NULL;
+    if (!op->path || (path2 && !op->path2)) {
+        kfree(op->path);
+        kfree(op->path2);
+        kfree(op);
+        return NULL;
+    }
+    if (len)
+        memcpy(op->data, data, len);
+
+    return op;
+}
+
+static void free_op(struct vtfs_pending_op *op)
+{
+    kfree(op->path);
+    kfree(op->path2);
+    kfree(op);
+}
+
+static int journal_append(struct vtfs_sb_info *sbi, struct vtfs_pending_op *op)
+{
+    struct vtfs_journal_record *rec;
+    size_t opid_len = strlen(op->opid);
+    size_t path_len = strlen(op->path);
+    size_t path2_len = op->path2 ? strlen(op->path2) : 0;
+    size_t total = sizeof(*rec) + opid_len + path_len + path2_len + op->len;
+    char *p;
+    ssize_t written;
+    loff_t pos = sbi->journal_pos;
+    int ret;
+
+    rec = kvmalloc(total, GFP_KERNEL);
+    if (!rec)
+        return -ENOMEM;
+
+    rec->magic = cpu_to_le32(VTFS_JOURNAL_MAGIC);
+    rec->type = cpu_to_le16(op->type);
+    rec->mode = cpu_to_le16(op->mode);
+    rec->opid_len = cpu_to_le16(opid_len);
+    rec->path_len = cpu_to_le16(path_len);
+    rec->path2_len = cpu_to_le16(path2_len);
+    rec->reserved = 0;
+    rec->len = cpu_to_le32(op->len);
+    rec->offset = cpu_to_le64(op->offset);
+
+    p = (char *)(rec + 1);
+    memcpy(p, op->opid, opid_len);
+    p += opid_len;
+    memcpy(p, op->path, path_len);
+    p += path_len;
+    if (path2_len)
+        memcpy(p, op->path2, path2_len);
+    p += path2_len;
+    memcpy(p, op->data, op->len);
+
+    rec->crc = cpu_to_le32(crc32_le(~0, (u8 *)&rec->type,
+                                    total - offsetof(struct vtfs_journal_record, type)));
+
+    written = kernel_write(sbi->journal_file, rec, total, &pos);
+    kvfree(rec);
+    if (written != total)
+        return written < 0 ? written : -EIO;
+
+    ret = vfs_fsync(sbi->journal_file, 1);
+    if (ret)
+        return ret;
+
+    sbi->journal_pos = pos;
+    return 0;
+}
+
+static int queue_op(struct vtfs_sb_info *sbi, enum vtfs_op_type type,
+                    const char *opid, const char *path, const char *path2,
+                    umode_t mode, const char *data, size_t len, loff_t offset)
+{
+    struct vtfs_pending_op *op;
+    size_t bytes;
+    int ret = 0;
+
+    op = alloc_op(type, opid, path, path2, mode, data, len, offset);
+    if (!op)
+        return -ENOMEM;
+    bytes = op_bytes(op);
+
+    mutex_lock(&sbi->journal_lock);
+
+    if (sbi->pending_bytes + bytes > READ_ONCE(sbi->opts.journal_max)) {
+        ret = -ENOSPC;
+        goto out;
+    }
+
+    if (sbi->journal_file) {
+        ret = journal_append(sbi, op);
+        if (ret)
+            goto out;
+    }
+
+    list_add_tail(&op->list, &sbi->pending);
+    sbi->pending_count++;
+    sbi->pending_bytes += bytes;
+    op = NULL;
+
+out:
+    mutex_unlock(&sbi->journal_lock);
+    if (op)
+        free_op(op);
+    if (ret)
+        return ret;
+
+    if (vtfs_cache_mode(sbi) == VTFS_CACHE_WRITEBACK)
+        queue_delayed_work(system_wq, &sbi->flush_work,
+                           msecs_to_jiffies(VTFS_WRITEBACK_DELAY_MS));
+    else if (vtfs_cache_mode(sbi) != VTFS_CACHE_OFFLINE)
+        queue_delayed_work(system_wq, &sbi->flush_work,
+                           msecs_to_jiffies(VTFS_WRITEBACK_RETRY_MS));
+    return 0;
+}
+
+/*
+ * Synchronous modes send the change right away, unless the server is down
+ * or older changes are still queued: then the change joins the journal so
+ * that the caller never waits on a dead server and ordering is preserved.
+ */
+static int dispatch(struct vtfs_sb_info *sbi, enum vtfs_op_type type,
+                    const char *path, const char *path2, umode_t mode,
+                    const char *data, size_t len, loff_t offset)
+{
+    char opid[VTFS_OPID_LEN];
+    int ret;
+
+    if (!sbi->http.initialized)
+        return 0;
+
+    snprintf(opid, sizeof(opid), "%s-%llu", sbi->http.client_id,
+             (unsigned long long)atomic64_inc_return(&sbi->next_opid));
+
+    switch (vtfs_cache_mode(sbi)) {
+    case VTFS_CACHE_WRITEBACK:
+    case VTFS_CACHE_OFFLINE:
+        break;
+    default:
+        if (READ_ONCE(sbi->server_down))
+            break;
+        if (READ_ONCE(sbi->pending_count) && vtfs_remote_flush(sbi))
+            break;
+
+        ret = run_op(sbi, type, opid, path, path2, mode, data, len, offset);
+        if (!is_transient(ret))
+            return ret;
+        mark_down(sbi);
+        break;
+    }
+
+    return queue_op(sbi, type, opid, path, path2, mode, data, len, offset);
+}
+
+int vtfs_remote_create(struct vtfs_sb_info *sbi, const char *path, umode_t mode)
+{
+    return dispatch(sbi, VTFS_OP_CREATE, path, NULL, mode, NULL, 0, 0);
+}
+
+int vtfs_remote_delete(struct vtfs_sb_info *sbi, const char *path)
+{
+    return dispatch(sbi, VTFS_OP_DELETE, path, NULL, 0, NULL, 0, 0);
+}
+
+int vtfs_remote_write(struct vtfs_sb_info *sbi, const char *path,
+                      const char *data, size_t len, loff_t offset)
+{
+    return dispatch(sbi, VTFS_OP_WRITE, path, NULL, 0, data, len, offset);
+}
+
+/*
+ * A rewrite of data the server may largely have already: the blocks it
+ * covers whole are compared by CRC32C with the server's manifest, and only
+ * the runs between matching blocks are sent. The manifest has to describe
+ * what the write applies to, so this is only tried with nothing queued in
+ * a synchronous mode; otherwise, or if the server cannot tell, the whole
+ * range goes as usual.
+ */
+int vtfs_remote_write_delta(struct vtfs_sb_info *sbi, const char *path,
+                            const char *data, size_t len, loff_t offset)
+{
+    loff_t sent = offset, end = offset + len, start, size;
+    size_t block, skipped = 0;
+    u32 *sums;
+    int i, n, ret = 0;
+
+    switch (vtfs_cache_mode(sbi)) {
+    case VTFS_CACHE_WRITEBACK:
+    case VTFS_CACHE_OFFLINE:
+        return vtfs_remote_write(sbi, path, data, len, offset);
+    default:
+        break;
+    }
+    if (!sbi->http.initialized || READ_ONCE(sbi->server_down) ||
+        READ_ONCE(sbi->pending_count) || len < VTFS_DELTA_MIN)
+        return vtfs_remote_write(sbi, path, data, len, offset);
+
+    sums = kmalloc_array(VTFS_DELTA_MAX_BLOCKS, sizeof(*sums), GFP_KERNEL);
+    if (!sums)
+        return vtfs_remote_write(sbi, path, data, len, offset);
+
+    n = vtfs_http_sums(&sbi->http, path, offset, len, sums, VTFS_DELTA_MAX_BLOCKS,
+                       &block, &size);
+    if (n <= 0) {
+        kfree(sums);
+        return vtfs_remote_write(sbi, path, data, len, offset);
+    }
+
+    start = div_u64(offset, block) * block;
+    for (i = 0; i < n && !ret; i++, start += block) {
+        /* Partly covered blocks, and the server's short last one, are sent */
+        if (start < offset || start + block > end || start + block > size ||
+            ~crc32c(~0, data + (start - offset), block) != sums[i])
+            continue;
+
+        if (start > sent)
+            ret = vtfs_remote_write(sbi, path, data + (sent - offset), start - sent, sent);
+        sent = start + block;
+        skipped += block;
+    }
+    if (!ret && sent < end)
+        ret = vtfs_remote_write(sbi, path, data + (sent - offset), end - sent, sent);
+    kfree(sums);
+
+    vtfs_stat_inc(sbi->stats, delta_writes, 1);
+    vtfs_stat_inc(sbi->stats, delta_skipped_bytes, skipped);
+    return ret;
+}
+
+int vtfs_remote_link(struct vtfs_sb_info *sbi, const char *oldpath,
+                     const char *newpath)
+{
+    return dispatch(sbi, VTFS_OP_LINK, oldpath, newpath, 0, NULL, 0, 0);
+}
+
+/* Called with journal_lock held */
+static bool pending_locked(struct vtfs_sb_info *sbi, const char *path)
+{
+    struct vtfs_pending_op *op;
+
+    list_for_each_entry(op, &sbi->pending, list) {
+        if (strcmp(op->path, path) == 0 ||
+            (op->path2 && strcmp(op->path2, path) == 0))
+            return true;
+    }
+    return false;
+}
+
+bool vtfs_remote_pending(struct vtfs_sb_info *sbi, const char *path)
+{
+    bool found;
+
+    if (!READ_ONCE(sbi->pending_count))
+        return false;
+
+    mutex_lock(&sbi->journal_lock);
+    found = pending_locked(sbi, path);
+    mutex_unlock(&sbi->journal_lock);
+
+    return found;
+}
+
+/*
+ * After the change feed lost track: every cached entry is checked with the
+ * server on its next lookup or revalidation, and a file's data reloaded,
+ * a directory relisted. Entries with changes still queued are left alone,
+ * their local state being newer than the server's.
+ */
+void vtfs_remote_expire(struct vtfs_sb_info *sbi)
+{
+    char path[VTFS_MAX_PATH_LEN];
+    struct vtfs_entry *entry;
+    unsigned long flags;
+
+    mutex_lock(&sbi->journal_lock);
+    vtfs_store_lock(sbi, &flags);
+    list_for_each_entry(entry, &sbi->storage.all_entries, global_list) {
+        if (sbi->pending_count) {
+            vtfs_get_full_path(entry, path, sizeof(path));
+            if (pending_locked(sbi, path))
+                continue;
+        }
+
+        entry->attr_time = 0;
+        if (S_ISDIR(entry->mode))
+            entry->list_time = 0;
+        /* Matches no mtime the server reports, so the data is reloaded */
+        else
+            entry->remote_mtime = -1;
+    }
+    vtfs_store_unlock(sbi, flags);
+    mutex_unlock(&sbi->journal_lock);
+}
+
+static void journal_reset(struct vtfs_sb_info *sbi)
+{
+    int ret;
+
+    if (!sbi->journal_file || sbi->journal_pos == 0)
+        return;
+
+    ret = vfs_truncate(&sbi->journal_file->f_path, 0);
+    if (ret) {
+        VTFS_ERR("cannot truncate journal: %d\n", ret);
+        return;
+    }
+    sbi->journal_pos = 0;
+}
+
+/*
+ * Replays queued operations in order. Only the flusher removes entries, so
+ * the head stays valid while it is sent; new operations go to the tail.
+ * The backing file is truncated once everything has been applied.
+ */
+int vtfs_remote_flush(struct vtfs_sb_info *sbi)
+{
+    struct vtfs_pending_op *op;
+    int ret = 0;
+
+    if (!sbi->http.initialized)
+        return 0;
+
+    mutex_lock(&sbi->flush_lock);
+
+    for (;;) {
+        mutex_lock(&sbi->journal_lock);
+        op = list_first_entry_or_null(&sbi->pending, struct vtfs_pending_op, list);
+        if (!op)
+            journal_reset(sbi);
+        mutex_unlock(&sbi->journal_lock);
+        if (!op)
+            break;
+
+        ret = run_op(sbi, op->type, op->opid, op->path, op->path2, op->mode,
+                     op->data, op->len, op->offset);
+        if (is_transient(ret)) {
+            mark_down(sbi);
+            break;
+        }
+        if (ret)
+            VTFS_ERR("server rejected queued change to %s: %d\n", op->path, ret);
+
+        mutex_lock(&sbi->journal_lock);
+        list_del(&op->list);
+        sbi->pending_count--;
+        sbi->pending_bytes -= op_bytes(op);
+        mutex_unlock(&sbi->journal_lock);
+        free_op(op);
+        ret = 0;
+    }
+
+    if (!ret)
+        mark_up(sbi);
+
+    mutex_unlock(&sbi->flush_lock);
+    return ret;
+}
+
+static void flush_worker(struct work_struct *work)
+{
+    struct vtfs_sb_info *sbi = container_of(to_delayed_work(work),
+                                            struct vtfs_sb_info, flush_work);
+
+    if (vtfs_cache_mode(sbi) == VTFS_CACHE_OFFLINE)
+        return;
+
+    if (vtfs_remote_flush(sbi))
+        queue_delayed_work(system_wq, &sbi->flush_work,
+                           msecs_to_jiffies(VTFS_WRITEBACK_RETRY_MS));
+}
+
+void vtfs_remote_kick(struct vtfs_sb_info *sbi)
+{
+    if (READ_ONCE(sbi->pending_count))
+        queue_delayed_work(system_wq, &sbi->flush_work, 0);
+}
+
+static char *read_string(struct file *file, loff_t *pos, size_t len)
+{
+    char *str;
+
+    str = kmalloc(len + 1, GFP_KERNEL);
+    if (!str)
+        return NULL;
+
+    if (kernel_read(file, str, len, pos) != len) {
+        kfree(str);
+        return NULL;
+    }
+    str[len] = '\0';
+    return str;
+}
+
+/* Loads records left by a previous mount; a torn or corrupt tail is cut off */
+static int journal_load(struct vtfs_sb_info *sbi)
+{
+    struct file *file = sbi->journal_file;
+    struct vtfs_journal_record rec;
+    struct vtfs_pending_op *op;
+    loff_t pos = 0, good = 0;
+    char *opid, *path, *path2, *data;
+    size_t opid_len, path_len, path2_len, len;
+    u32 crc;
+
+    for (;;) {
+        opid = path = path2 = data = NULL;
+        op = NULL;
+
+        if (kernel_read(file, &rec, sizeof(rec), &pos) != sizeof(rec) ||
+            le32_to_cpu(rec.magic) != VTFS_JOURNAL_MAGIC)
+            break;
+
+        opid_len = le16_to_cpu(rec.opid_len);
+        path_len = le16_to_cpu(rec.path_len);
+        path2_len = le16_to_cpu(rec.path2_len);
+        len = le32_to_cpu(rec.len);
+        if (opid_len >= VTFS_OPID_LEN || path_len >= VTFS_JOURNAL_PATH_MAX ||
+            path2_len >= VTFS_JOURNAL_PATH_MAX || len > VTFS_MAX_FILE_SIZE)
+            break;
+
+        opid = read_string(file, &pos, opid_len);
+        path = read_string(file, &pos, path_len);
+        path2 = read_string(file, &pos, path2_len);
+        data = kvmalloc(len ? len : 1, GFP_KERNEL);
+        if (!opid || !path || !path2 || !data ||
+            kernel_read(file, data, len, &pos) != len)
+            goto bad;
+
+        crc = crc32_le(~0, (u8 *)&rec.type,
+                       sizeof(rec) - offsetof(struct vtfs_journal_record, type));
+        crc = crc32_le(crc, opid, opid_len);
+        crc = crc32_le(crc, path, path_len);
+        crc = crc32_le(crc, path2, path2_len);
+        crc = crc32_le(crc, data, len);
+        if (crc != le32_to_cpu(rec.crc))
+            goto bad;
+
+        op = alloc_op(le16_to_cpu(rec.type), opid, path,
+                      path2_len ? path2 : NULL, le16_to_cpu(rec.mode),
+                      data, len, le64_to_cpu(rec.offset));
+        if (!op)
+            goto bad;
+
+        list_add_tail(&op->list, &sbi->pending);
+        sbi->pending_count++;
+        sbi->pending_bytes += op_bytes(op);
+        good = pos;
+
+        kfree(opid);
+        kfree(path);
+        kfree(path2);
+        kvfree(data);
+        continue;
+bad:
+        kfree(opid);
+        kfree(path);
+        kfree(path2);
+        kvfree(data);
+        break;
+    }
+
+    if (good != i_size_read(file_inode(file))) {
+        VTFS_ERR("journal: discarding %lld bytes of damaged tail\n",
+                 i_size_read(file_inode(file)) - good);
+        vfs_truncate(&file->f_path, good);
+    }
+    sbi->journal_pos = good;
+
+    if (sbi->pending_count)
+        VTFS_LOG("journal: %u changes to replay\n", sbi->pending_count);
+    return 0;
+}
+
+void vtfs_remote_init(struct vtfs_sb_info *sbi)
+{
+    mutex_init(&sbi->journal_lock);
+    INIT_LIST_HEAD(&sbi->pending);
+    sbi->pending_count = 0;
+    sbi->pending_bytes = 0;
+    atomic64_set(&sbi->next_opid, 0);
+    mutex_init(&sbi->flush_lock);
+    INIT_DELAYED_WORK(&sbi->flush_work, flush_worker);
+}
+
+int vtfs_remote_start(struct vtfs_sb_info *sbi)
+{
+    struct file *file;
+    int ret;
+
+    if (!sbi->http.initialized || !sbi->opts.journal[0])
+        return 0;
+
+    file = filp_open(sbi->opts.journal, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+    if (IS_ERR(file))
+        return PTR_ERR(file);
+
+    if (!S_ISREG(file_inode(file)->i_mode)) {
+        fput(file);
+        return -EINVAL;
+    }
+
+    sbi->journal_file = file;
+    ret = journal_load(sbi);
+    if (ret)
+        return ret;
+
+    vtfs_remote_kick(sbi);
+    return 0;
+}
+
+void vtfs_remote_cleanup(struct vtfs_sb_info *sbi)
+{
+    struct vtfs_pending_op *op, *tmp;
+
+    cancel_delayed_work_sync(&sbi->flush_work);
+
+    if (vtfs_cache_mode(sbi) != VTFS_CACHE_OFFLINE && !sbi->server_down)
+        vtfs_remote_flush(sbi);
+
+    if (sbi->pending_count) {
+        if (sbi->journal_file)
+            VTFS_LOG("journal: %u changes kept for the next mount\n",
+                     sbi->pending_count);
+        else
+            VTFS_ERR("dropping %u changes not applied on the server\n",
+                     sbi->pending_count);
+    }
+
+    list_for_each_entry_safe(op, tmp, &sbi->pending, list) {
+        list_del(&op->list);
+        free_op(op);
+    }
+    sbi->pending_count = 0;
+    sbi->pending_bytes = 0;
+
+    if (sbi->journal_file) {
+        fput(sbi->journal_file);
+        sbi->journal_file = NULL;
+    }
+}
+
+void vtfs_remote_show(struct seq_file *m, struct vtfs_sb_info *sbi)
+{
+    struct vtfs_pending_op *op;
+    unsigned long down_ms = 0;
+
+    mutex_lock(&sbi->journal_lock);
+    seq_printf(m, "ops: %u\n", sbi->pending_count);
+    seq_printf(m, "bytes: %zu\n", sbi->pending_bytes);
+    seq_printf(m, "max_bytes: %zu\n", READ_ONCE(sbi->opts.journal_max));
+    seq_printf(m, "backing_bytes: %lld\n", sbi->journal_pos);
+    list_for_each_entry(op, &sbi->pending, list) {
+        seq_printf(m, "head: %s %s\n", op->opid, op->path);
+        break;
+    }
+    mutex_unlock(&sbi->journal_lock);
+
+    seq_printf(m, "backing: %s\n", sbi->journal_file ? sbi->opts.journal : "none");
+    seq_printf(m, "next_opid: %lld\n", (long long)atomic64_read(&sbi->next_opid) + 1);
+    if (READ_ONCE(sbi->server_down))
+        down_ms = jiffies_to_msecs(jiffies - sbi->down_since);
+    seq_printf(m, "server: %s\n", READ_ONCE(sbi->server_down) ? "down" : "up");
+    seq_printf(m, "down_ms: %lu\n", down_ms);
+}
@@ -0,0 +1,210 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+
+#include "rpc.h"
+
+static void put_le16(u8 *p, u16 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(u8 *p, u32 v)
+{
+    put_le16(p, v);
+    put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(u8 *p, u64 v)
+{
+    put_le32(p, v);
+    put_le32(p + 4, v >> 32);
+}
+
+static u16 get_le16(const u8 *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static u32 get_le32(const u8 *p)
+{
+    return get_le16(p) | (u32)get_le16(p + 2) << 16;
+}
+
+static u64 get_le64(const u8 *p)
+{
+    return get_le32(p) | (u64)get_le32(p + 4) << 32;
+}
+
+void vtfs_rpc_begin(struct vtfs_rpc_builder *b, void *buf, size_t size,
+                    u16 op, u16 status, u32 id)
+{
+    b->buf = buf;
+    b->size = size;
+    b->len = VTFS_RPC_HEADER_SIZE;
+    b->count = 0;
+    b->error = size < VTFS_RPC_HEADER_SIZE ? -EMSGSIZE : 0;
+    if (b->error)
+        return;
+
+    memset(b->buf, 0, VTFS_RPC_HEADER_SIZE);
+    put_le16(b->buf + 4, op);
+    put_le16(b->buf + 6, status);
+    put_le32(b->buf + 8, id);
+}
+
+/* Reserves a field of value_len bytes and returns where its value goes */
+static u8 *put_field(struct vtfs_rpc_builder *b, u16 tag, u16 type, u32 len,
+                     size_t value_len)
+{
+    u8 *p;
+
+    if (b->error)
+        return NULL;
+    if (value_len > b->size - b->len ||
+        VTFS_RPC_FIELD_SIZE > b->size - b->len - value_len || b->count == U16_MAX) {
+        b->error = -EMSGSIZE;
+        return NULL;
+    }
+
+    p = b->buf + b->len;
+    put_le16(p, tag);
+    put_le16(p + 2, type);
+    put_le32(p + 4, len);
+    b->len += VTFS_RPC_FIELD_SIZE + value_len;
+    b->count++;
+    return p + VTFS_RPC_FIELD_SIZE;
+}
+
+void vtfs_rpc_put_u64(struct vtfs_rpc_builder *b, u16 tag, u64 value)
+{
+    u8 *p = put_field(b, tag, VTFS_RPC_U64, 8, 8);
+
+    if (p)
+        put_le64(p, value);
+}
+
+void vtfs_rpc_put_str(struct vtfs_rpc_builder *b, u16 tag, const char *value)
+{
+    size_t len = strlen(value);
+    u8 *p = put_field(b, tag, VTFS_RPC_STR, len, len);
+
+    if (p)
+        memcpy(p, value, len);
+}
+
+void vtfs_rpc_put_data(struct vtfs_rpc_builder *b, u16 tag, u32 len)
+{
+    put_field(b, tag, VTFS_RPC_BYTES, len, 0);
+}
+
+int vtfs_rpc_end(struct vtfs_rpc_builder *b, size_t data_len)
+{
+    size_t len = b->len - VTFS_RPC_HEADER_SIZE + data_len;
+
+    if (!b->error && len > VTFS_RPC_MAX_FRAME - VTFS_RPC_HEADER_SIZE)
+        b->error = -EMSGSIZE;
+    if (b->error)
+        return b->error;
+
+    put_le32(b->buf, len);
+    put_le16(b->buf + 12, b->count);
+    return b->len;
+}
+
+int vtfs_rpc_parse_header(const void *buf, struct vtfs_rpc_header *hdr)
+{
+    const u8 *p = buf;
+
+    hdr->len = get_le32(p);
+    hdr->op = get_le16(p + 4);
+    hdr->status = get_le16(p + 6);
+    hdr->id = get_le32(p + 8);
+    hdr->count = get_le16(p + 12);
+
+    if (hdr->len > VTFS_RPC_MAX_FRAME - VTFS_RPC_HEADER_SIZE ||
+        (size_t)hdr->count * VTFS_RPC_FIELD_SIZE > hdr->len || get_le16(p + 14))
+        return -EBADMSG;
+    return 0;
+}
+
+int vtfs_rpc_parse_fields(struct vtfs_rpc_msg *msg, const void *buf, size_t len,
+                          size_t *data_len)
+{
+    const u8 *p = buf;
+    size_t total = msg->hdr.len;
+    size_t pos = 0;
+    u16 i, tag, type;
+    u32 value_len;
+
+    memset(msg->field, 0, sizeof(msg->field));
+    *data_len = 0;
+    if (len > total)
+        return -EBADMSG;
+
+    for (i = 0; i < msg->hdr.count; i++) {
+        if (VTFS_RPC_FIELD_SIZE > total - pos)
+            return -EBADMSG;
+        if (VTFS_RPC_FIELD_SIZE > len - pos)
+            return -EAGAIN;
+
+        tag = get_le16(p + pos);
+        type = get_le16(p + pos + 2);
+        value_len = get_le32(p + pos + 4);
+        pos += VTFS_RPC_FIELD_SIZE;
+
+        if (value_len > total - pos ||
+            (type == VTFS_RPC_U64 && value_len != 8) ||
+            type < VTFS_RPC_U64 || type > VTFS_RPC_BYTES)
+            return -EBADMSG;
+
+        /* The payload runs to the end of the frame and may still be arriving */
+        if (tag == VTFS_RPC_DATA) {
+            if (i + 1 != msg->hdr.count || pos + value_len != total ||
+                type != VTFS_RPC_BYTES)
+                return -EBADMSG;
+            msg->field[tag].value = p + pos;
+            msg->field[tag].len = min_t(size_t, value_len, len - pos);
+            msg->field[tag].type = type;
+            *data_len = value_len;
+            return 0;
+        }
+
+        if (value_len > len - pos)
+            return -EAGAIN;
+        if (tag < VTFS_RPC_NR_TAGS) {
+            msg->field[tag].value = p + pos;
+            msg->field[tag].len = value_len;
+            msg->field[tag].type = type;
+        }
+        pos += value_len;
+    }
+
+    return pos == total ? 0 : -EBADMSG;
+}
+
+int vtfs_rpc_get_u64(const struct vtfs_rpc_msg *msg, u16 tag, u64 *value)
+{
+    if (tag >= VTFS_RPC_NR_TAGS || msg->field[tag].type != VTFS_RPC_U64)
+        return -ENOENT;
+
+    *value = get_le64(msg->field[tag].value);
+    return 0;
+}
+
+int vtfs_rpc_get_str(const struct vtfs_rpc_msg *msg, u16 tag, char *dst, size_t size)
+{
+    const struct vtfs_rpc_field *f;
+
+    if (tag >= VTFS_RPC_NR_TAGS || msg->field[tag].type != VTFS_RPC_STR)
+        return -ENOENT;
+
+    f = &msg->field[tag];
+    if (f->len >= size || memchr(f->value, '\0', f->len))
+        return -EMSGSIZE;
+
+    memcpy(dst, f->value, f->len);
+    dst[f->len] = '\0';
+    return 0;
+}
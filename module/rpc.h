@@ -0,0 +1,129 @@
+#ifndef _VTFS_RPC_H
+#define _VTFS_RPC_H
+
+#include <linux/types.h>
+
+/*
+ * vtfs-rpc/1, the binary protocol a connection switches to after an HTTP
+ * upgrade (GET /rpc with "Upgrade: vtfs-rpc/1", answered by 101). Frames
+ * go both ways; every integer is little-endian.
+ *
+ *   frame  = header field*
+ *   header = len:u32 op:u16 status:u16 id:u32 count:u16 reserved:u16
+ *   field  = tag:u16 type:u16 len:u32 value[len]
+ *
+ * len counts the bytes after the header, count the fields. A reply carries
+ * the op and id of its request, so several requests may be outstanding on
+ * one connection, and a status of 0 or a positive errno. A DATA field comes
+ * last, so its payload can be sent and received in place. Encoding and
+ * parsing touch no kernel state; bench/userspace builds them too.
+ *
+ * An upgrade request may offer "Vtfs-Compression: lz4"; if the 101 repeats
+ * it, either side may send a DATA payload as one LZ4 block, flagged by a
+ * RAW_SIZE field holding its length before compression.
+ */
+#define VTFS_RPC_PROTOCOL "vtfs-rpc/1"
+#define VTFS_RPC_COMPRESSION "lz4"
+#define VTFS_RPC_HEADER_SIZE 16
+#define VTFS_RPC_FIELD_SIZE 8
+/* Largest frame either side accepts, payload included */
+#define VTFS_RPC_MAX_FRAME (64 << 20)
+
+enum vtfs_rpc_op {
+    VTFS_RPC_CREATE = 1,
+    VTFS_RPC_DELETE,
+    VTFS_RPC_READ,
+    VTFS_RPC_WRITE,
+    VTFS_RPC_STAT,
+    VTFS_RPC_LINK,
+    /*
+     * The block manifest of a file: BLOCK, SIZE and as DATA the CRC32C of
+     * each block from the one holding OFFSET on, for SIZE bytes, as u32s,
+     * at most MAX of them
+     */
+    VTFS_RPC_SUMS,
+};
+
+enum vtfs_rpc_tag {
+    VTFS_RPC_PATH = 1,
+    /* The new name of a link */
+    VTFS_RPC_PATH2,
+    VTFS_RPC_OFFSET,
+    VTFS_RPC_SIZE,
+    VTFS_RPC_MODE,
+    /* "file" or "dir" */
+    VTFS_RPC_KIND,
+    VTFS_RPC_OPID,
+    VTFS_RPC_INO,
+    VTFS_RPC_MTIME,
+    VTFS_RPC_NLINK,
+    VTFS_RPC_DATA,
+    /* Set when DATA is LZ4-compressed: its length once decompressed */
+    VTFS_RPC_RAW_SIZE,
+    VTFS_RPC_BLOCK,
+    /* Most entries the reply may carry */
+    VTFS_RPC_MAX,
+    VTFS_RPC_NR_TAGS,
+};
+
+enum vtfs_rpc_type {
+    VTFS_RPC_U64 = 1,
+    VTFS_RPC_STR,
+    VTFS_RPC_BYTES,
+};
+
+struct vtfs_rpc_header {
+    u32 len;
+    u16 op;
+    u16 status;
+    u32 id;
+    u16 count;
+};
+
+/* A parsed field points into the frame it came from */
+struct vtfs_rpc_field {
+    const u8 *value;
+    u32 len;
+    u16 type;
+};
+
+/* Fields indexed by tag; unknown tags are skipped, absent ones have type 0 */
+struct vtfs_rpc_msg {
+    struct vtfs_rpc_header hdr;
+    struct vtfs_rpc_field field[VTFS_RPC_NR_TAGS];
+};
+
+/* Appends a frame to a fixed buffer; the first error sticks */
+struct vtfs_rpc_builder {
+    u8 *buf;
+    size_t size;
+    size_t len;
+    u16 count;
+    int error;
+};
+
+void vtfs_rpc_begin(struct vtfs_rpc_builder *b, void *buf, size_t size,
+                    u16 op, u16 status, u32 id);
+void vtfs_rpc_put_u64(struct vtfs_rpc_builder *b, u16 tag, u64 value);
+void vtfs_rpc_put_str(struct vtfs_rpc_builder *b, u16 tag, const char *value);
+/* The field header only: len payload bytes follow the frame on the wire */
+void vtfs_rpc_put_data(struct vtfs_rpc_builder *b, u16 tag, u32 len);
+/* Fills in the header; returns the bytes built or -EMSGSIZE */
+int vtfs_rpc_end(struct vtfs_rpc_builder *b, size_t data_len);
+
+/* -EBADMSG on a malformed header */
+int vtfs_rpc_parse_header(const void *buf, struct vtfs_rpc_header *hdr);
+/*
+ * Parses msg->hdr.count fields from the first len of the msg->hdr.len bytes
+ * after the header. -EAGAIN while a field before DATA is incomplete,
+ * -EBADMSG on a malformed frame. DATA may be partial: its value holds what
+ * has arrived and *data_len gets its full length (0 without one).
+ */
+int vtfs_rpc_parse_fields(struct vtfs_rpc_msg *msg, const void *buf, size_t len,
+                          size_t *data_len);
+
+/* -ENOENT when the field is absent or of another type */
+int vtfs_rpc_get_u64(const struct vtfs_rpc_msg *msg, u16 tag, u64 *value);
+int vtfs_rpc_get_str(const struct vtfs_rpc_msg *msg, u16 tag, char *dst, size_t size);
+
+#endif
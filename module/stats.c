@@ -0,0 +1,256 @@
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include "stats.h"
+
+static const char *const op_names[VTFS_NR_STAT_OPS] = {
+    [VTFS_STAT_LOOKUP]     = "lookup",
+    [VTFS_STAT_READ]       = "read",
+    [VTFS_STAT_WRITE]      = "write",
+    [VTFS_STAT_ITERATE]    = "iterate",
+    [VTFS_STAT_CREATE]     = "create",
+    [VTFS_STAT_UNLINK]     = "unlink",
+    [VTFS_STAT_MKDIR]      = "mkdir",
+    [VTFS_STAT_RMDIR]      = "rmdir",
+    [VTFS_STAT_LINK]       = "link",
+    [VTFS_STAT_GETATTR]    = "getattr",
+    [VTFS_STAT_REVALIDATE] = "revalidate",
+    [VTFS_STAT_LOCK_WAIT]  = "lock_wait",
+    [VTFS_STAT_COPY]       = "copy",
+};
+
+static const char *const method_names[VTFS_NR_HTTP_METHODS] = {
+    [VTFS_HTTP_LIST]    = "list",
+    [VTFS_HTTP_CREATE]  = "create",
+    [VTFS_HTTP_DELETE]  = "delete",
+    [VTFS_HTTP_READ]    = "read",
+    [VTFS_HTTP_WRITE]   = "write",
+    [VTFS_HTTP_STAT]    = "stat",
+    [VTFS_HTTP_LINK]    = "link",
+    [VTFS_HTTP_SUMS]    = "sums",
+    [VTFS_HTTP_CHANGES] = "changes",
+    [VTFS_HTTP_OTHER]   = "other",
+};
+
+static const char *const phase_names[VTFS_NR_HTTP_PHASES] = {
+    [VTFS_PHASE_CONNECT] = "connect",
+    [VTFS_PHASE_SEND]    = "send",
+    [VTFS_PHASE_RECV]    = "recv",
+    [VTFS_PHASE_PARSE]   = "parse",
+    [VTFS_PHASE_TOTAL]   = "total",
+};
+
+enum vtfs_http_method vtfs_http_method_index(const char *method)
+{
+    int i;
+
+    for (i = 0; i < VTFS_HTTP_OTHER; i++) {
+        if (strcmp(method, method_names[i]) == 0)
+            return i;
+    }
+    return VTFS_HTTP_OTHER;
+}
+
+static void latency_add(struct vtfs_latency *lat, u64 ns, bool error)
+{
+    unsigned int bucket = ns ? ilog2(ns) : 0;
+
+    lat->count++;
+    if (error)
+        lat->errors++;
+    lat->sum_ns += ns;
+    lat->buckets[min_t(unsigned int, bucket, VTFS_HIST_BUCKETS - 1)]++;
+}
+
+void vtfs_stat_op(struct vtfs_stats __percpu *stats, enum vtfs_stat_op op,
+                  u64 start, bool error)
+{
+    u64 ns = ktime_get_ns() - start;
+
+    if (!stats)
+        return;
+
+    latency_add(&get_cpu_ptr(stats)->ops[op], ns, error);
+    put_cpu_ptr(stats);
+}
+
+void vtfs_stat_http(struct vtfs_stats __percpu *stats, enum vtfs_http_method method,
+                    enum vtfs_http_phase phase, u64 start, bool error)
+{
+    u64 ns = ktime_get_ns() - start;
+
+    if (!stats)
+        return;
+
+    latency_add(&get_cpu_ptr(stats)->http[method][phase], ns, error);
+    put_cpu_ptr(stats);
+}
+
+void vtfs_stats_reset(struct vtfs_stats __percpu *stats)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(stats, cpu), 0, sizeof(struct vtfs_stats));
+}
+
+static void latency_merge(struct vtfs_latency *sum, const struct vtfs_latency *lat)
+{
+    int i;
+
+    sum->count += lat->count;
+    sum->errors += lat->errors;
+    sum->sum_ns += lat->sum_ns;
+    for (i = 0; i < VTFS_HIST_BUCKETS; i++)
+        sum->buckets[i] += lat->buckets[i];
+}
+
+static void op_sum(struct vtfs_stats __percpu *stats, int op, struct vtfs_latency *sum)
+{
+    int cpu;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu)
+        latency_merge(sum, &per_cpu_ptr(stats, cpu)->ops[op]);
+}
+
+static void http_sum(struct vtfs_stats __percpu *stats, int method, int phase,
+                     struct vtfs_latency *sum)
+{
+    int cpu;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu)
+        latency_merge(sum, &per_cpu_ptr(stats, cpu)->http[method][phase]);
+}
+
+/* Upper bound of the bucket holding the given percentile, in ns */
+static u64 latency_percentile(struct vtfs_latency *lat, unsigned int permille)
+{
+    u64 target, seen = 0;
+    int i;
+
+    if (!lat->count)
+        return 0;
+
+    target = div_u64(lat->count * permille + 999, 1000);
+    for (i = 0; i < VTFS_HIST_BUCKETS; i++) {
+        seen += lat->buckets[i];
+        if (seen >= target)
+            return 2ULL << i;
+    }
+    return 2ULL << (VTFS_HIST_BUCKETS - 1);
+}
+
+static void show_latency(struct seq_file *m, const char *name, const char *phase,
+                         struct vtfs_latency *lat)
+{
+    seq_printf(m, "%-11s %-8s %10llu %8llu %10llu %10llu %10llu %10llu\n",
+               name, phase, lat->count, lat->errors,
+               lat->count ? div64_u64(lat->sum_ns, lat->count) / 1000 : 0,
+               latency_percentile(lat, 500) / 1000,
+               latency_percentile(lat, 990) / 1000,
+               latency_percentile(lat, 999) / 1000);
+}
+
+void vtfs_stats_show_ops(struct seq_file *m, struct vtfs_stats __percpu *stats)
+{
+    struct vtfs_latency lat;
+    int op;
+
+    seq_printf(m, "%-11s %-8s %10s %8s %10s %10s %10s %10s\n",
+               "op", "", "count", "errors", "avg_us", "p50_us", "p99_us", "p999_us");
+
+    for (op = 0; op < VTFS_NR_STAT_OPS; op++) {
+        op_sum(stats, op, &lat);
+        show_latency(m, op_names[op], "", &lat);
+    }
+}
+
+void vtfs_stats_show_http(struct seq_file *m, struct vtfs_stats __percpu *stats)
+{
+    struct vtfs_latency lat;
+    u64 sent = 0, received = 0, reused = 0, fresh = 0, striped = 0, ranges = 0;
+    u64 ra = 0, ra_hit = 0, lists = 0, prefetched = 0, hits = 0;
+    u64 lz4_raw = 0, lz4_wire = 0, lz4_skipped = 0, deltas = 0, delta_skipped = 0;
+    int method, phase, cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct vtfs_stats *s = per_cpu_ptr(stats, cpu);
+
+        sent += s->http_bytes_sent;
+        received += s->http_bytes_received;
+        reused += s->conn_reused;
+        fresh += s->conn_new;
+        striped += s->striped_transfers;
+        ranges += s->stripe_ranges;
+        ra += s->readahead_bytes;
+        ra_hit += s->readahead_hit_bytes;
+        lists += s->prefetch_lists;
+        prefetched += s->prefetch_entries;
+        hits += s->prefetch_hits;
+        lz4_raw += s->lz4_raw_bytes;
+        lz4_wire += s->lz4_wire_bytes;
+        lz4_skipped += s->lz4_skipped;
+        deltas += s->delta_writes;
+        delta_skipped += s->delta_skipped_bytes;
+    }
+
+    seq_printf(m, "bytes_sent %llu\nbytes_received %llu\n", sent, received);
+    seq_printf(m, "connections_new %llu\nconnections_reused %llu\n", fresh, reused);
+    seq_printf(m, "striped_transfers %llu\nstripe_ranges %llu\n", striped, ranges);
+    seq_printf(m, "readahead_bytes %llu\nreadahead_hit_bytes %llu\n", ra, ra_hit);
+    seq_printf(m, "prefetch_lists %llu\nprefetch_entries %llu\nprefetch_hits %llu\n",
+               lists, prefetched, hits);
+    seq_printf(m, "lz4_raw_bytes %llu\nlz4_wire_bytes %llu\nlz4_skipped %llu\n",
+               lz4_raw, lz4_wire, lz4_skipped);
+    seq_printf(m, "delta_writes %llu\ndelta_skipped_bytes %llu\n\n", deltas, delta_skipped);
+
+    seq_printf(m, "%-11s %-8s %10s %8s %10s %10s %10s %10s\n",
+               "method", "phase", "count", "errors", "avg_us", "p50_us", "p99_us", "p999_us");
+
+    for (method = 0; method < VTFS_NR_HTTP_METHODS; method++) {
+        for (phase = 0; phase < VTFS_NR_HTTP_PHASES; phase++) {
+            http_sum(stats, method, phase, &lat);
+            if (lat.count)
+                show_latency(m, method_names[method], phase_names[phase], &lat);
+        }
+    }
+}
+
+static void show_buckets(struct seq_file *m, const char *prefix, const char *name,
+                         const char *phase, struct vtfs_latency *lat)
+{
+    int i;
+
+    if (!lat->count)
+        return;
+
+    seq_printf(m, "%s%s%s%s:", prefix, name, *phase ? "." : "", phase);
+    for (i = 0; i < VTFS_HIST_BUCKETS; i++) {
+        if (lat->buckets[i])
+            seq_printf(m, " %d=%llu", i, lat->buckets[i]);
+    }
+    seq_putc(m, '\n');
+}
+
+/* One line per series: "<log2 ns>=<count>" for every non-empty bucket */
+void vtfs_stats_show_histograms(struct seq_file *m, struct vtfs_stats __percpu *stats)
+{
+    struct vtfs_latency lat;
+    int op, method, phase;
+
+    for (op = 0; op < VTFS_NR_STAT_OPS; op++) {
+        op_sum(stats, op, &lat);
+        show_buckets(m, "", op_names[op], "", &lat);
+    }
+
+    for (method = 0; method < VTFS_NR_HTTP_METHODS; method++) {
+        for (phase = 0; phase < VTFS_NR_HTTP_PHASES; phase++) {
+            http_sum(stats, method, phase, &lat);
+            show_buckets(m, "http.", method_names[method], phase_names[phase], &lat);
+        }
+    }
+}
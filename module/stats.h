@@ -0,0 +1,111 @@
+#ifndef _VTFS_STATS_H
+#define _VTFS_STATS_H
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+
+/* log2(ns) buckets: bucket i counts latencies in [2^i, 2^(i+1)) ns, the last one is open */
+#define VTFS_HIST_BUCKETS 32
+
+enum vtfs_stat_op {
+    VTFS_STAT_LOOKUP,
+    VTFS_STAT_READ,
+    VTFS_STAT_WRITE,
+    VTFS_STAT_ITERATE,
+    VTFS_STAT_CREATE,
+    VTFS_STAT_UNLINK,
+    VTFS_STAT_MKDIR,
+    VTFS_STAT_RMDIR,
+    VTFS_STAT_LINK,
+    VTFS_STAT_GETATTR,
+    VTFS_STAT_REVALIDATE,
+    /* Time spent waiting for the storage spinlock and copying to/from user */
+    VTFS_STAT_LOCK_WAIT,
+    VTFS_STAT_COPY,
+    VTFS_NR_STAT_OPS,
+};
+
+enum vtfs_http_method {
+    VTFS_HTTP_LIST,
+    VTFS_HTTP_CREATE,
+    VTFS_HTTP_DELETE,
+    VTFS_HTTP_READ,
+    VTFS_HTTP_WRITE,
+    VTFS_HTTP_STAT,
+    VTFS_HTTP_LINK,
+    VTFS_HTTP_SUMS,
+    VTFS_HTTP_CHANGES,
+    VTFS_HTTP_OTHER,
+    VTFS_NR_HTTP_METHODS,
+};
+
+enum vtfs_http_phase {
+    VTFS_PHASE_CONNECT,
+    VTFS_PHASE_SEND,
+    VTFS_PHASE_RECV,
+    VTFS_PHASE_PARSE,
+    VTFS_PHASE_TOTAL,
+    VTFS_NR_HTTP_PHASES,
+};
+
+struct vtfs_latency {
+    u64 count;
+    u64 errors;
+    u64 sum_ns;
+    u64 buckets[VTFS_HIST_BUCKETS];
+};
+
+/* One instance per CPU and per mount; summed when read through debugfs */
+struct vtfs_stats {
+    struct vtfs_latency ops[VTFS_NR_STAT_OPS];
+    struct vtfs_latency http[VTFS_NR_HTTP_METHODS][VTFS_NR_HTTP_PHASES];
+    u64 http_bytes_sent;
+    u64 http_bytes_received;
+    u64 conn_reused;
+    u64 conn_new;
+    /* Reads and writes split across connections, and the ranges they made */
+    u64 striped_transfers;
+    u64 stripe_ranges;
+    /* Bytes fetched ahead of sequential readers, and those then read */
+    u64 readahead_bytes;
+    u64 readahead_hit_bytes;
+    /* Directory listings prefetched, the entries they added, and lookups those answered */
+    u64 prefetch_lists;
+    u64 prefetch_entries;
+    u64 prefetch_hits;
+    /* Payloads sent or received LZ4-compressed, before and after; those not worth it */
+    u64 lz4_raw_bytes;
+    u64 lz4_wire_bytes;
+    u64 lz4_skipped;
+    /* Rewrites compared with the server's block sums, and the bytes not sent for them */
+    u64 delta_writes;
+    u64 delta_skipped_bytes;
+};
+
+struct seq_file;
+
+static inline u64 vtfs_stat_start(void)
+{
+    return ktime_get_ns();
+}
+
+void vtfs_stat_op(struct vtfs_stats __percpu *stats, enum vtfs_stat_op op,
+                  u64 start, bool error);
+void vtfs_stat_http(struct vtfs_stats __percpu *stats, enum vtfs_http_method method,
+                    enum vtfs_http_phase phase, u64 start, bool error);
+enum vtfs_http_method vtfs_http_method_index(const char *method);
+
+void vtfs_stats_reset(struct vtfs_stats __percpu *stats);
+void vtfs_stats_show_ops(struct seq_file *m, struct vtfs_stats __percpu *stats);
+void vtfs_stats_show_http(struct seq_file *m, struct vtfs_stats __percpu *stats);
+void vtfs_stats_show_histograms(struct seq_file *m, struct vtfs_stats __percpu *stats);
+
+/* Counters are bumped with preemption disabled, so plain increments are enough */
+#define vtfs_stat_inc(stats, field, n)              \
+    do {                                            \
+        if (stats)                                  \
+            this_cpu_add((stats)->field, (n));      \
+    } while (0)
+
+#endif
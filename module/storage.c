@@ -4,26 +4,26 @@
 #include <linux/time.h>
 #include <linux/fs.h>
 #include <linux/errno.h>
+#include <linux/jiffies.h>
 #include "storage.h"
 #include "http.h"
+#include "super.h"
 #include "vtfs.h"
+#include "vtfs_trace.h"
 
-struct vtfs_storage vtfs_store;
-
-bool use_remote_server(void)
+static bool is_root(struct vtfs_entry *entry)
 {
-    const char *url = vtfs_get_server_url();
-    return url && strlen(url) > 0;
+    return entry->parent == entry;
 }
 
 static void build_path(struct vtfs_entry *entry, char *path, size_t size)
 {
-    if (!entry || entry == vtfs_store.root) {
+    if (!entry || is_root(entry)) {
         strncpy(path, "/", size);
         return;
     }
     
-    if (entry->parent && entry->parent != vtfs_store.root) {
+    if (entry->parent && !is_root(entry->parent)) {
         build_path(entry->parent, path, size);
         strlcat(path, "/", size);
         strlcat(path, entry->name, size);
@@ -37,36 +37,6 @@ void vtfs_get_full_path(struct vtfs_entry *entry, char *buf, size_t size)
     build_path(entry, buf, size);
 }
 
-static void sync_create_to_server(const char *path, const char *type)
-{
-    char response[256];
-    
-    if (!use_remote_server())
-        return;
-    
-    vtfs_http_call(vtfs_get_token(), "create", response, sizeof(response),
-                   2, "path", path, "type", type);
-}
-
-static void sync_delete_to_server(const char *path)
-{
-    char response[256];
-    
-    if (!use_remote_server())
-        return;
-    
-    vtfs_http_call(vtfs_get_token(), "delete", response, sizeof(response),
-                   1, "path", path);
-}
-
-static void sync_write_to_server(const char *path, const char *data, size_t len)
-{
-    if (!use_remote_server())
-        return;
-    
-    vtfs_http_write(path, data, len, 0);
-}
-
 static struct vtfs_entry *alloc_entry(const char *name, umode_t mode, ino_t ino)
 {
     struct vtfs_entry *entry;
@@ -90,6 +60,7 @@ static struct vtfs_entry *alloc_entry(const char *name, umode_t mode, ino_t ino)
     ktime_get_real_ts64(&entry->atime);
     entry->mtime = entry->atime;
     entry->ctime = entry->atime;
+    entry->attr_time = jiffies;
 
     INIT_LIST_HEAD(&entry->children);
     INIT_LIST_HEAD(&entry->sibling);
@@ -109,22 +80,25 @@ static void free_entry(struct vtfs_entry *entry)
     kfree(entry);
 }
 
-int vtfs_storage_init(void)
+int vtfs_storage_init(struct vtfs_sb_info *sbi)
 {
-    spin_lock_init(&vtfs_store.lock);
+    struct vtfs_storage *store = &sbi->storage;
+
+    spin_lock_init(&store->lock);
     
-    INIT_LIST_HEAD(&vtfs_store.all_entries);
+    INIT_LIST_HEAD(&store->all_entries);
     
-    vtfs_store.next_ino = VTFS_ROOT_INO + 1;
+    store->next_ino = VTFS_ROOT_INO + 1;
+    store->bytes_used = 0;
 
-    vtfs_store.root = alloc_entry("/", S_IFDIR | 0777, VTFS_ROOT_INO);
-    if (!vtfs_store.root)
+    store->root = alloc_entry("/", S_IFDIR | 0777, VTFS_ROOT_INO);
+    if (!store->root)
         return -ENOMEM;
 
-    vtfs_store.root->parent = vtfs_store.root;
-    vtfs_store.root->nlink = 2;
+    store->root->parent = store->root;
+    store->root->nlink = 2;
 
-    list_add(&vtfs_store.root->global_list, &vtfs_store.all_entries);
+    list_add(&store->root->global_list, &store->all_entries);
 
     return 0;
 }
@@ -146,134 +120,157 @@ static void free_entries_recursive(struct vtfs_entry *dir)
     }
 }
 
-void vtfs_storage_cleanup(void)
+void vtfs_storage_cleanup(struct vtfs_sb_info *sbi)
 {
+    struct vtfs_storage *store = &sbi->storage;
     unsigned long flags;
 
-    spin_lock_irqsave(&vtfs_store.lock, flags);
+    vtfs_store_lock(sbi, &flags);
 
-    if (vtfs_store.root) {
-        free_entries_recursive(vtfs_store.root);
+    if (store->root) {
+        free_entries_recursive(store->root);
         
-        list_del(&vtfs_store.root->global_list);
+        list_del(&store->root->global_list);
         
-        free_entry(vtfs_store.root);
-        vtfs_store.root = NULL;
+        free_entry(store->root);
+        store->root = NULL;
     }
 
-    spin_unlock_irqrestore(&vtfs_store.lock, flags);
+    vtfs_store_unlock(sbi, flags);
 }
 
-struct vtfs_entry *vtfs_storage_get_root(void)
+struct vtfs_entry *vtfs_storage_get_root(struct vtfs_sb_info *sbi)
 {
-    return vtfs_store.root;
+    return sbi->storage.root;
 }
 
-static struct vtfs_entry *create_entry_internal(struct vtfs_entry *parent,
+static int delete_entry_internal(struct vtfs_sb_info *sbi,
+                                 struct vtfs_entry *entry, bool skip_sync);
+
+static struct vtfs_entry *create_entry_internal(struct vtfs_sb_info *sbi,
+                                                struct vtfs_entry *parent,
                                                 const char *name,
                                                 umode_t mode,
                                                 ino_t ino,
                                                 bool skip_sync)
 {
+    struct vtfs_storage *store = &sbi->storage;
     struct vtfs_entry *entry;
     unsigned long flags;
 
+    int ret;
+
     if (!parent || !S_ISDIR(parent->mode))
-        return NULL;
+        return ERR_PTR(-ENOTDIR);
 
-    if (vtfs_storage_lookup(parent, name))
-        return NULL;
+    if (vtfs_storage_lookup(sbi, parent, name))
+        return ERR_PTR(-EEXIST);
 
-    spin_lock_irqsave(&vtfs_store.lock, flags);
+    vtfs_store_lock(sbi, &flags);
 
     if (ino == 0)
-        ino = vtfs_store.next_ino++;
+        ino = store->next_ino++;
 
     entry = alloc_entry(name, mode, ino);
     if (!entry) {
-        spin_unlock_irqrestore(&vtfs_store.lock, flags);
-        return NULL;
+        vtfs_store_unlock(sbi, flags);
+        return ERR_PTR(-ENOMEM);
     }
 
     entry->parent = parent;
     
     list_add(&entry->sibling, &parent->children);
     
-    list_add(&entry->global_list, &vtfs_store.all_entries);
+    list_add(&entry->global_list, &store->all_entries);
 
     if (S_ISDIR(mode))
         parent->nlink++;
 
-    spin_unlock_irqrestore(&vtfs_store.lock, flags);
+    vtfs_store_unlock(sbi, flags);
 
-    if (!skip_sync && use_remote_server()) {
-        char path[512];
+    trace_vtfs_storage_create(parent->ino, name, ino, mode);
+
+    if (!skip_sync) {
+        char path[VTFS_MAX_PATH_LEN];
         build_path(entry, path, sizeof(path));
-        sync_create_to_server(path, S_ISDIR(mode) ? "dir" : "file");
+        ret = vtfs_remote_create(sbi, path, mode);
+        if (ret) {
+            delete_entry_internal(sbi, entry, true);
+            return ERR_PTR(ret);
+        }
     }
 
     return entry;
 }
 
-struct vtfs_entry *vtfs_storage_create_entry(struct vtfs_entry *parent,
+struct vtfs_entry *vtfs_storage_create_entry(struct vtfs_sb_info *sbi,
+                                             struct vtfs_entry *parent,
                                              const char *name,
                                              umode_t mode,
                                              ino_t ino)
 {
-    return create_entry_internal(parent, name, mode, ino, false);
+    return create_entry_internal(sbi, parent, name, mode, ino, false);
 }
 
-struct vtfs_entry *vtfs_storage_create_entry_no_sync(struct vtfs_entry *parent,
+struct vtfs_entry *vtfs_storage_create_entry_no_sync(struct vtfs_sb_info *sbi,
+                                                     struct vtfs_entry *parent,
                                                      const char *name,
                                                      umode_t mode,
                                                      ino_t ino)
 {
-    return create_entry_internal(parent, name, mode, ino, true);
+    return create_entry_internal(sbi, parent, name, mode, ino, true);
 }
 
-int vtfs_storage_delete_entry(struct vtfs_entry *entry)
+static int delete_entry_internal(struct vtfs_sb_info *sbi,
+                                 struct vtfs_entry *entry, bool skip_sync)
 {
+    struct vtfs_storage *store = &sbi->storage;
     unsigned long flags;
     struct vtfs_entry *other;
     ino_t ino;
     char *shared_data = NULL;
     int other_count = 0;
-    char path[512];
-    bool do_sync = false;
+    char path[VTFS_MAX_PATH_LEN];
+    int ret;
 
     if (!entry)
         return -EINVAL;
 
-    if (entry == vtfs_store.root)
+    if (entry == store->root)
         return -EBUSY;
 
     if (S_ISDIR(entry->mode) && !list_empty(&entry->children))
         return -ENOTEMPTY;
 
-    spin_lock_irqsave(&vtfs_store.lock, flags);
+    if (!skip_sync) {
+        build_path(entry, path, sizeof(path));
+        ret = vtfs_remote_delete(sbi, path);
+        if (ret)
+            return ret;
+    }
+
+    vtfs_store_lock(sbi, &flags);
 
     ino = entry->ino;
     shared_data = entry->data;
 
-    if (use_remote_server()) {
-        build_path(entry, path, sizeof(path));
-        do_sync = true;
-    }
-
     if (S_ISDIR(entry->mode) && entry->parent)
         entry->parent->nlink--;
 
     list_del(&entry->sibling);
     list_del(&entry->global_list);
 
-    list_for_each_entry(other, &vtfs_store.all_entries, global_list) {
+    list_for_each_entry(other, &store->all_entries, global_list) {
         if (other->ino == ino) {
             other->nlink--;
             other_count++;
         }
     }
 
-    spin_unlock_irqrestore(&vtfs_store.lock, flags);
+    if (other_count == 0 && shared_data)
+        store->bytes_used -= entry->capacity;
+
+    vtfs_store_unlock(sbi, flags);
 
     if (other_count == 0 && shared_data) {
         kfree(shared_data);
@@ -283,16 +280,26 @@ int vtfs_storage_delete_entry(struct vtfs_entry *entry)
         entry->data = NULL;
     }
 
-    kfree(entry);
+    trace_vtfs_storage_delete(ino, entry->name, other_count);
 
-    if (do_sync) {
-        sync_delete_to_server(path);
-    }
+    kfree(entry);
 
     return 0;
 }
 
-struct vtfs_entry *vtfs_storage_lookup(struct vtfs_entry *parent,
+int vtfs_storage_delete_entry(struct vtfs_sb_info *sbi, struct vtfs_entry *entry)
+{
+    return delete_entry_internal(sbi, entry, false);
+}
+
+int vtfs_storage_delete_entry_no_sync(struct vtfs_sb_info *sbi,
+                                      struct vtfs_entry *entry)
+{
+    return delete_entry_internal(sbi, entry, true);
+}
+
+struct vtfs_entry *vtfs_storage_lookup(struct vtfs_sb_info *sbi,
+                                       struct vtfs_entry *parent,
                                        const char *name)
 {
     struct vtfs_entry *child;
@@ -301,39 +308,71 @@ struct vtfs_entry *vtfs_storage_lookup(struct vtfs_entry *parent,
     if (!parent || !S_ISDIR(parent->mode))
         return NULL;
 
-    spin_lock_irqsave(&vtfs_store.lock, flags);
+    vtfs_store_lock(sbi, &flags);
 
     list_for_each_entry(child, &parent->children, sibling) {
         if (strcmp(child->name, name) == 0) {
-            spin_unlock_irqrestore(&vtfs_store.lock, flags);
+            trace_vtfs_storage_lookup(parent->ino, name, child->ino);
+            vtfs_store_unlock(sbi, flags);
             return child;
         }
     }
 
-    spin_unlock_irqrestore(&vtfs_store.lock, flags);
+    vtfs_store_unlock(sbi, flags);
+    trace_vtfs_storage_lookup(parent->ino, name, 0);
     return NULL;
 }
 
-struct vtfs_entry *vtfs_storage_get_by_ino(ino_t ino)
+struct vtfs_entry *vtfs_storage_lookup_path(struct vtfs_sb_info *sbi,
+                                            const char *path)
 {
+    struct vtfs_entry *entry = sbi->storage.root;
+    char name[VTFS_MAX_NAME_LEN + 1];
+    const char *end;
+    size_t len;
+
+    while (entry && *path) {
+        while (*path == '/')
+            path++;
+        if (!*path)
+            break;
+
+        end = strchrnul(path, '/');
+        len = end - path;
+        if (len > VTFS_MAX_NAME_LEN)
+            return NULL;
+
+        memcpy(name, path, len);
+        name[len] = '\0';
+
+        entry = vtfs_storage_lookup(sbi, entry, name);
+        path = end;
+    }
+
+    return entry;
+}
+
+struct vtfs_entry *vtfs_storage_get_by_ino(struct vtfs_sb_info *sbi, ino_t ino)
+{
+    struct vtfs_storage *store = &sbi->storage;
     struct vtfs_entry *entry;
     unsigned long flags;
 
-    spin_lock_irqsave(&vtfs_store.lock, flags);
+    vtfs_store_lock(sbi, &flags);
 
-    list_for_each_entry(entry, &vtfs_store.all_entries, global_list) {
+    list_for_each_entry(entry, &store->all_entries, global_list) {
         if (entry->ino == ino) {
-            spin_unlock_irqrestore(&vtfs_store.lock, flags);
+            vtfs_store_unlock(sbi, flags);
             return entry;
         }
     }
 
-    spin_unlock_irqrestore(&vtfs_store.lock, flags);
+    vtfs_store_unlock(sbi, flags);
     return NULL;
 }
 
-int vtfs_storage_read(struct vtfs_entry *entry, char *buffer,
-                      size_t len, loff_t offset)
+int vtfs_storage_read(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                      char *buffer, size_t len, loff_t offset)
 {
     size_t bytes_to_read;
     unsigned long flags;
@@ -341,10 +380,11 @@ int vtfs_storage_read(struct vtfs_entry *entry, char *buffer,
     if (!entry || !S_ISREG(entry->mode))
         return -EINVAL;
 
-    spin_lock_irqsave(&vtfs_store.lock, flags);
+    vtfs_store_lock(sbi, &flags);
 
     if (offset >= entry->size) {
-        spin_unlock_irqrestore(&vtfs_store.lock, flags);
+        vtfs_store_unlock(sbi, flags);
+        trace_vtfs_storage_read(entry->ino, offset, len, 0);
         return 0;
     }
 
@@ -355,17 +395,50 @@ int vtfs_storage_read(struct vtfs_entry *entry, char *buffer,
 
     ktime_get_real_ts64(&entry->atime);
 
-    spin_unlock_irqrestore(&vtfs_store.lock, flags);
+    vtfs_store_unlock(sbi, flags);
 
+    trace_vtfs_storage_read(entry->ino, offset, len, bytes_to_read);
     return bytes_to_read;
 }
 
-int vtfs_storage_write(struct vtfs_entry *entry, const char *buffer,
-                       size_t len, loff_t offset)
+/* Called with the store lock held; capacity only ever grows */
+static int reserve_locked(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                          size_t new_size)
 {
-    size_t new_size;
+    struct vtfs_storage *store = &sbi->storage;
+    size_t new_capacity;
     char *new_data;
+
+    if (new_size <= entry->capacity)
+        return 0;
+
+    new_capacity = max(new_size, entry->capacity * 2);
+    if (new_capacity < 64)
+        new_capacity = 64;
+
+    if (sbi->opts.max_bytes &&
+        store->bytes_used + (new_capacity - entry->capacity) > sbi->opts.max_bytes)
+        return -ENOSPC;
+
+    new_data = krealloc(entry->data, new_capacity, GFP_ATOMIC);
+    if (!new_data)
+        return -ENOMEM;
+
+    trace_vtfs_storage_grow(entry->ino, entry->capacity, new_capacity);
+    store->bytes_used += new_capacity - entry->capacity;
+    entry->data = new_data;
+    entry->capacity = new_capacity;
+    return 0;
+}
+
+static int write_internal(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                          const char *buffer, size_t len, loff_t offset,
+                          bool skip_sync)
+{
+    size_t new_size;
     unsigned long flags;
+    bool rewrite;
+    int err;
 
     if (!entry || !S_ISREG(entry->mode))
         return -EINVAL;
@@ -375,26 +448,33 @@ int vtfs_storage_write(struct vtfs_entry *entry, const char *buffer,
     if (new_size > VTFS_MAX_FILE_SIZE)
         return -EFBIG;
 
-    spin_lock_irqsave(&vtfs_store.lock, flags);
-
-    if (new_size > entry->capacity) {
-        size_t new_capacity = max(new_size, entry->capacity * 2);
-        if (new_capacity < 64)
-            new_capacity = 64;
+    /* Room is made first, so that once the server has the data nothing can fail */
+    vtfs_store_lock(sbi, &flags);
+    rewrite = offset < entry->size;
+    err = reserve_locked(sbi, entry, new_size);
+    vtfs_store_unlock(sbi, flags);
+    if (err)
+        return err;
 
-        new_data = krealloc(entry->data, new_capacity, GFP_ATOMIC);
-        if (!new_data) {
-            spin_unlock_irqrestore(&vtfs_store.lock, flags);
-            return -ENOMEM;
-        }
-
-        if (offset > entry->size)
-            memset(new_data + entry->size, 0, offset - entry->size);
+    /* A change the server refuses never shows up locally */
+    if (!skip_sync) {
+        char path[VTFS_MAX_PATH_LEN];
 
-        entry->data = new_data;
-        entry->capacity = new_capacity;
+        build_path(entry, path, sizeof(path));
+        /* Overwritten data may be mostly what the server has already */
+        if (rewrite && len >= VTFS_DELTA_MIN)
+            err = vtfs_remote_write_delta(sbi, path, buffer, len, offset);
+        else
+            err = vtfs_remote_write(sbi, path, buffer, len, offset);
+        if (err)
+            return err;
     }
 
+    vtfs_store_lock(sbi, &flags);
+
+    /* Capacity left over from a longer past may hold old bytes */
+    if (offset > entry->size)
+        memset(entry->data + entry->size, 0, offset - entry->size);
     memcpy(entry->data + offset, buffer, len);
 
     if (new_size > entry->size)
@@ -402,26 +482,72 @@ int vtfs_storage_write(struct vtfs_entry *entry, const char *buffer,
 
     ktime_get_real_ts64(&entry->mtime);
     entry->ctime = entry->mtime;
+    if (!skip_sync)
+        entry->remote_mtime = 0;
 
-    spin_unlock_irqrestore(&vtfs_store.lock, flags);
+    vtfs_store_unlock(sbi, flags);
 
-    if (use_remote_server()) {
-        char path[512];
-        build_path(entry, path, sizeof(path));
-        sync_write_to_server(path, buffer, len);
+    trace_vtfs_storage_write(entry->ino, offset, len, len);
+    return len;
+}
+
+int vtfs_storage_write(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                       const char *buffer, size_t len, loff_t offset)
+{
+    return write_internal(sbi, entry, buffer, len, offset, false);
+}
+
+int vtfs_storage_write_no_sync(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                               const char *buffer, size_t len, loff_t offset)
+{
+    return write_internal(sbi, entry, buffer, len, offset, true);
+}
+
+/* Readers see either the old contents or the new ones, never a mix or an empty file */
+int vtfs_storage_replace_no_sync(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                                 const char *buffer, size_t len)
+{
+    unsigned long flags;
+    int err;
+
+    if (!entry || !S_ISREG(entry->mode))
+        return -EINVAL;
+
+    if (len > VTFS_MAX_FILE_SIZE)
+        return -EFBIG;
+
+    vtfs_store_lock(sbi, &flags);
+
+    err = reserve_locked(sbi, entry, len);
+    if (err) {
+        vtfs_store_unlock(sbi, flags);
+        return err;
     }
 
-    return len;
+    if (len)
+        memcpy(entry->data, buffer, len);
+    entry->size = len;
+
+    ktime_get_real_ts64(&entry->mtime);
+    entry->ctime = entry->mtime;
+
+    vtfs_store_unlock(sbi, flags);
+    return 0;
 }
 
-int vtfs_storage_add_link(struct vtfs_entry *entry,
+int vtfs_storage_add_link(struct vtfs_sb_info *sbi,
+                          struct vtfs_entry *entry,
                           struct vtfs_entry *parent,
                           const char *name)
 {
+    struct vtfs_storage *store = &sbi->storage;
     unsigned long flags;
     struct vtfs_entry *other;
     ino_t ino;
     unsigned int new_nlink;
+    char oldpath[VTFS_MAX_PATH_LEN];
+    char newpath[VTFS_MAX_PATH_LEN];
+    int ret;
 
     if (!entry || !parent)
         return -EINVAL;
@@ -429,18 +555,28 @@ int vtfs_storage_add_link(struct vtfs_entry *entry,
     if (S_ISDIR(entry->mode))
         return -EPERM;
 
-    spin_lock_irqsave(&vtfs_store.lock, flags);
+    build_path(entry, oldpath, sizeof(oldpath));
+    build_path(parent, newpath, sizeof(newpath));
+    if (!is_root(parent))
+        strlcat(newpath, "/", sizeof(newpath));
+    strlcat(newpath, name, sizeof(newpath));
+
+    ret = vtfs_remote_link(sbi, oldpath, newpath);
+    if (ret)
+        return ret;
+
+    vtfs_store_lock(sbi, &flags);
 
     ino = entry->ino;
     new_nlink = entry->nlink + 1;
 
-    list_for_each_entry(other, &vtfs_store.all_entries, global_list) {
+    list_for_each_entry(other, &store->all_entries, global_list) {
         if (other->ino == ino) {
             other->nlink = new_nlink;
         }
     }
 
-    spin_unlock_irqrestore(&vtfs_store.lock, flags);
+    vtfs_store_unlock(sbi, flags);
 
     return 0;
 }
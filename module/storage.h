@@ -21,6 +21,16 @@ struct vtfs_entry {
     struct timespec64 mtime;
     struct timespec64 ctime;
     
+    unsigned long attr_time;
+    time64_t remote_mtime;
+    bool stale;
+    /* From a directory prefetch: size is the server's, data is fetched on open */
+    bool unloaded;
+    /* From a directory prefetch and not looked up since */
+    bool prefetched;
+    /* For a directory, jiffies of its last prefetch, 0 if never */
+    unsigned long list_time;
+    
     struct vtfs_entry *parent;
     struct list_head children;
     struct list_head sibling;
@@ -32,29 +42,41 @@ struct vtfs_storage {
     struct list_head all_entries;
     spinlock_t lock;
     ino_t next_ino;
+    size_t bytes_used;
 };
 
-extern struct vtfs_storage vtfs_store;
-int vtfs_storage_init(void);
-void vtfs_storage_cleanup(void);
-struct vtfs_entry *vtfs_storage_get_root(void);
-struct vtfs_entry *vtfs_storage_create_entry(struct vtfs_entry *parent,
+int vtfs_storage_init(struct vtfs_sb_info *sbi);
+void vtfs_storage_cleanup(struct vtfs_sb_info *sbi);
+struct vtfs_entry *vtfs_storage_get_root(struct vtfs_sb_info *sbi);
+struct vtfs_entry *vtfs_storage_create_entry(struct vtfs_sb_info *sbi,
+                                             struct vtfs_entry *parent,
                                              const char *name,
                                              umode_t mode,
                                              ino_t ino);
-struct vtfs_entry *vtfs_storage_create_entry_no_sync(struct vtfs_entry *parent,
+struct vtfs_entry *vtfs_storage_create_entry_no_sync(struct vtfs_sb_info *sbi,
+                                                     struct vtfs_entry *parent,
                                                      const char *name,
                                                      umode_t mode,
                                                      ino_t ino);
-int vtfs_storage_delete_entry(struct vtfs_entry *entry);
-struct vtfs_entry *vtfs_storage_lookup(struct vtfs_entry *parent,
+int vtfs_storage_delete_entry(struct vtfs_sb_info *sbi, struct vtfs_entry *entry);
+int vtfs_storage_delete_entry_no_sync(struct vtfs_sb_info *sbi,
+                                      struct vtfs_entry *entry);
+struct vtfs_entry *vtfs_storage_lookup(struct vtfs_sb_info *sbi,
+                                       struct vtfs_entry *parent,
                                        const char *name);
-struct vtfs_entry *vtfs_storage_get_by_ino(ino_t ino);
-int vtfs_storage_read(struct vtfs_entry *entry, char *buffer,
-                      size_t len, loff_t offset);
-int vtfs_storage_write(struct vtfs_entry *entry, const char *buffer,
-                       size_t len, loff_t offset);
-int vtfs_storage_add_link(struct vtfs_entry *entry,
+struct vtfs_entry *vtfs_storage_lookup_path(struct vtfs_sb_info *sbi,
+                                            const char *path);
+struct vtfs_entry *vtfs_storage_get_by_ino(struct vtfs_sb_info *sbi, ino_t ino);
+int vtfs_storage_read(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                      char *buffer, size_t len, loff_t offset);
+int vtfs_storage_write(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                       const char *buffer, size_t len, loff_t offset);
+int vtfs_storage_write_no_sync(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                               const char *buffer, size_t len, loff_t offset);
+int vtfs_storage_replace_no_sync(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                                 const char *buffer, size_t len);
+int vtfs_storage_add_link(struct vtfs_sb_info *sbi,
+                          struct vtfs_entry *entry,
                           struct vtfs_entry *parent,
                           const char *name);
 void vtfs_get_full_path(struct vtfs_entry *entry, char *buf, size_t size);
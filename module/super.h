@@ -0,0 +1,139 @@
+#ifndef _VTFS_SUPER_H
+#define _VTFS_SUPER_H
+
+#include <linux/fs.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include "storage.h"
+#include "http.h"
+#include "stats.h"
+#include "vtfs.h"
+
+#define VTFS_DEFAULT_SERVER "http://127.0.0.1:8080"
+#define VTFS_DEFAULT_TTL_MS 1000
+#define VTFS_DEFAULT_POOL_SIZE 4
+#define VTFS_DEFAULT_JOURNAL_MAX (16 * 1024 * 1024)
+#define VTFS_DEFAULT_STRIPE_SIZE (256 * 1024)
+#define VTFS_DEFAULT_STRIPES 4
+#define VTFS_DEFAULT_READAHEAD (1024 * 1024)
+
+/*
+ * none:         every read and write goes to the server, nothing is trusted locally
+ * writethrough: reads are served locally, changes reach the server before returning
+ * writeback:    changes are queued and flushed to the server in the background
+ * offline:      the server is not contacted, changes are queued until remount
+ */
+enum vtfs_cache_mode {
+    VTFS_CACHE_NONE,
+    VTFS_CACHE_WRITETHROUGH,
+    VTFS_CACHE_WRITEBACK,
+    VTFS_CACHE_OFFLINE,
+};
+
+struct vtfs_mount_opts {
+    char *server;
+    char *token;
+    unsigned int attr_ttl_ms;
+    unsigned int entry_ttl_ms;
+    unsigned int pool_size;
+    size_t max_bytes;
+    enum vtfs_cache_mode cache_mode;
+    char *journal;
+    size_t journal_max;
+    /* Try vtfs-rpc before HTTP */
+    bool rpc;
+    size_t stripe_size;
+    unsigned int stripes;
+    /* Largest window read ahead of a sequential reader with cache=none */
+    size_t readahead;
+    /* Offer LZ4 for vtfs-rpc payloads */
+    bool compress;
+};
+
+struct vtfs_sb_info {
+    struct vtfs_mount_opts opts;
+    struct vtfs_storage storage;
+    struct vtfs_http_client http;
+
+    struct task_struct *changes_task;
+    char *changes_buffer;
+
+    /*
+     * Journal of remote operations not yet applied on the server, kept in
+     * order and optionally mirrored to a backing file (see remote.c)
+     */
+    struct mutex journal_lock;
+    struct list_head pending;
+    unsigned int pending_count;
+    size_t pending_bytes;
+    atomic64_t next_opid;
+    struct file *journal_file;
+    loff_t journal_pos;
+    bool server_down;
+    unsigned long down_since;
+    struct mutex flush_lock;
+    struct delayed_work flush_work;
+
+    /*
+     * Staging for transfers handed on in windows rather than chunks, allocated
+     * on first use and kept until unmount; held by one transfer at a time,
+     * others go without rather than wait
+     */
+    struct mutex window_lock;
+    char *window;
+
+    /* Directory listings fetched ahead of the lookups that follow them */
+    struct workqueue_struct *prefetch_wq;
+
+    struct vtfs_stats __percpu *stats;
+    struct dentry *debugfs_dir;
+};
+
+static inline struct vtfs_sb_info *VTFS_SB(struct super_block *sb)
+{
+    return sb->s_fs_info;
+}
+
+static inline enum vtfs_cache_mode vtfs_cache_mode(struct vtfs_sb_info *sbi)
+{
+    return READ_ONCE(sbi->opts.cache_mode);
+}
+
+/* False while offline or while the server is known to be unreachable */
+static inline bool vtfs_use_remote(struct vtfs_sb_info *sbi)
+{
+    return sbi->http.initialized && vtfs_cache_mode(sbi) != VTFS_CACHE_OFFLINE &&
+           !READ_ONCE(sbi->server_down);
+}
+
+static inline unsigned long vtfs_attr_ttl(struct vtfs_sb_info *sbi)
+{
+    if (vtfs_cache_mode(sbi) == VTFS_CACHE_NONE)
+        return 0;
+    return msecs_to_jiffies(sbi->opts.attr_ttl_ms);
+}
+
+static inline unsigned long vtfs_entry_ttl(struct vtfs_sb_info *sbi)
+{
+    if (vtfs_cache_mode(sbi) == VTFS_CACHE_NONE)
+        return 0;
+    return msecs_to_jiffies(sbi->opts.entry_ttl_ms);
+}
+
+/* Storage lock with the wait accounted as lock_wait in the stats */
+static inline void vtfs_store_lock(struct vtfs_sb_info *sbi, unsigned long *flags)
+{
+    u64 start = vtfs_stat_start();
+
+    spin_lock_irqsave(&sbi->storage.lock, *flags);
+    vtfs_stat_op(sbi->stats, VTFS_STAT_LOCK_WAIT, start, false);
+}
+
+static inline void vtfs_store_unlock(struct vtfs_sb_info *sbi, unsigned long flags)
+{
+    spin_unlock_irqrestore(&sbi->storage.lock, flags);
+}
+
+#endif
@@ -0,0 +1,3 @@
+/* Instantiates the tracepoints declared in vtfs_trace.h */
+#define CREATE_TRACE_POINTS
+#include "vtfs_trace.h"
@@ -18,6 +18,8 @@
 #define VTFS_ROOT_INO 1000
 #define VTFS_DEFAULT_MODE 0777
 #define VTFS_MAX_NAME_LEN 255
+/* Buffer size for a full path, root to entry, including the NUL */
+#define VTFS_MAX_PATH_LEN 512
 #define VTFS_MAX_FILE_SIZE (1024 * 1024)
 
 #define VTFS_LOG(fmt, ...) printk(KERN_INFO "[vtfs] " fmt, ##__VA_ARGS__)
@@ -25,39 +27,57 @@
 #define VTFS_DEBUG(fmt, ...) printk(KERN_DEBUG "[vtfs] " fmt, ##__VA_ARGS__)
 
 struct vtfs_entry;
+struct vtfs_sb_info;
+struct seq_file;
 
 extern const struct inode_operations vtfs_inode_ops;
 extern const struct inode_operations vtfs_file_inode_ops;
 extern const struct file_operations vtfs_dir_ops;
 extern const struct file_operations vtfs_file_ops;
-
-bool use_remote_server(void);
+extern const struct dentry_operations vtfs_dentry_ops;
 
 struct inode *vtfs_get_inode(struct super_block *sb,
                               const struct inode *dir,
                               umode_t mode,
                               ino_t ino);
 
-const char *vtfs_get_server_url(void);
-const char *vtfs_get_token(void);
-
-int vtfs_storage_init(void);
-void vtfs_storage_cleanup(void);
-struct vtfs_entry *vtfs_storage_get_root(void);
-struct vtfs_entry *vtfs_storage_create_entry(struct vtfs_entry *parent,
-                                              const char *name,
-                                              umode_t mode,
-                                              ino_t ino);
-int vtfs_storage_delete_entry(struct vtfs_entry *entry);
-struct vtfs_entry *vtfs_storage_lookup(struct vtfs_entry *parent,
-                                        const char *name);
-struct vtfs_entry *vtfs_storage_get_by_ino(ino_t ino);
-int vtfs_storage_read(struct vtfs_entry *entry, char *buffer,
-                      size_t len, loff_t offset);
-int vtfs_storage_write(struct vtfs_entry *entry, const char *buffer,
-                       size_t len, loff_t offset);
-int vtfs_storage_add_link(struct vtfs_entry *entry,
-                          struct vtfs_entry *parent,
-                          const char *name);
+int vtfs_refresh_from_remote(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                             struct inode *inode);
+int vtfs_revalidate_entry(struct vtfs_sb_info *sbi, struct vtfs_entry *entry,
+                          struct inode *inode, bool force);
+
+void vtfs_remote_init(struct vtfs_sb_info *sbi);
+int vtfs_remote_start(struct vtfs_sb_info *sbi);
+void vtfs_remote_cleanup(struct vtfs_sb_info *sbi);
+int vtfs_remote_create(struct vtfs_sb_info *sbi, const char *path, umode_t mode);
+int vtfs_remote_delete(struct vtfs_sb_info *sbi, const char *path);
+int vtfs_remote_write(struct vtfs_sb_info *sbi, const char *path,
+                      const char *data, size_t len, loff_t offset);
+/* Rewrites at least this long are checked against the server's block sums first */
+#define VTFS_DELTA_MIN (64 * 1024)
+int vtfs_remote_write_delta(struct vtfs_sb_info *sbi, const char *path,
+                            const char *data, size_t len, loff_t offset);
+int vtfs_remote_link(struct vtfs_sb_info *sbi, const char *oldpath,
+                     const char *newpath);
+bool vtfs_remote_pending(struct vtfs_sb_info *sbi, const char *path);
+void vtfs_remote_expire(struct vtfs_sb_info *sbi);
+int vtfs_remote_flush(struct vtfs_sb_info *sbi);
+void vtfs_remote_kick(struct vtfs_sb_info *sbi);
+void vtfs_remote_show(struct seq_file *m, struct vtfs_sb_info *sbi);
+
+int vtfs_file_init(void);
+void vtfs_file_exit(void);
+
+int vtfs_debugfs_init(void);
+void vtfs_debugfs_exit(void);
+void vtfs_debugfs_register(struct super_block *sb);
+void vtfs_debugfs_unregister(struct vtfs_sb_info *sbi);
+
+int vtfs_changes_start(struct super_block *sb);
+void vtfs_changes_stop(struct super_block *sb);
+
+int vtfs_prefetch_start(struct vtfs_sb_info *sbi);
+void vtfs_prefetch_stop(struct vtfs_sb_info *sbi);
+void vtfs_prefetch_dir(struct vtfs_sb_info *sbi, struct inode *dir);
 
 #endif
@@ -2,6 +2,10 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/fs.h>
+#include <linux/fs_context.h>
+#include <linux/fs_parser.h>
+#include <linux/seq_file.h>
+#include <linux/statfs.h>
 #include <linux/slab.h>
 #include <linux/mount.h>
 #include <linux/uidgid.h>
@@ -9,26 +13,20 @@
 #include <linux/pagemap.h>
 #include "storage.h"
 #include "http.h"
+#include "super.h"
 #include "vtfs.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Ivan Pasechnik");
 MODULE_DESCRIPTION("Virtual Trivial File System");
 
-static char *server_url = "http://127.0.0.1:8080";
+static char *server = VTFS_DEFAULT_SERVER;
 static char *token = "";
 
+module_param(server, charp, 0644);
+MODULE_PARM_DESC(server, "Default server URL for mounts without -o server= (empty for local only)");
 module_param(token, charp, 0644);
-MODULE_PARM_DESC(token, "Authentication token for remote server");
-const char *vtfs_get_server_url(void)
-{
-    return server_url;
-}
-
-const char *vtfs_get_token(void)
-{
-    return token;
-}
+MODULE_PARM_DESC(token, "Default authentication token for mounts without -o token=");
 
 struct inode *vtfs_get_inode(struct super_block *sb,
                               const struct inode *dir,
@@ -72,16 +70,239 @@ static int vtfs_drop_inode(struct inode *inode)
     return 1;
 }
 
+static int vtfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(dentry->d_sb);
+    size_t used = READ_ONCE(sbi->storage.bytes_used);
+    int ret;
+
+    ret = simple_statfs(dentry, buf);
+    if (ret || !sbi->opts.max_bytes)
+        return ret;
+
+    buf->f_blocks = sbi->opts.max_bytes >> PAGE_SHIFT;
+    buf->f_bfree = buf->f_bavail =
+        used < sbi->opts.max_bytes ? (sbi->opts.max_bytes - used) >> PAGE_SHIFT : 0;
+    return 0;
+}
+
+static int vtfs_sync_fs(struct super_block *sb, int wait)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(sb);
+
+    if (vtfs_cache_mode(sbi) != VTFS_CACHE_WRITEBACK)
+        return 0;
+
+    if (!wait) {
+        vtfs_remote_kick(sbi);
+        return 0;
+    }
+
+    return vtfs_remote_flush(sbi);
+}
+
+static const char *const vtfs_cache_names[] = {
+    [VTFS_CACHE_NONE]         = "none",
+    [VTFS_CACHE_WRITETHROUGH] = "writethrough",
+    [VTFS_CACHE_WRITEBACK]    = "writeback",
+    [VTFS_CACHE_OFFLINE]      = "offline",
+};
+
+static int vtfs_show_options(struct seq_file *m, struct dentry *root)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(root->d_sb);
+
+    seq_show_option(m, "server", sbi->opts.server);
+    seq_printf(m, ",cache=%s,proto=%s", vtfs_cache_names[vtfs_cache_mode(sbi)],
+               sbi->opts.rpc ? "rpc" : "http");
+    seq_printf(m, ",attr_ttl_ms=%u,entry_ttl_ms=%u,pool_size=%u",
+               sbi->opts.attr_ttl_ms, sbi->opts.entry_ttl_ms,
+               sbi->opts.pool_size);
+    if (sbi->opts.max_bytes)
+        seq_printf(m, ",max_bytes=%zu", sbi->opts.max_bytes);
+    if (sbi->opts.journal[0])
+        seq_show_option(m, "journal", sbi->opts.journal);
+    seq_printf(m, ",journal_max=%zu", sbi->opts.journal_max);
+    seq_printf(m, ",stripe_size=%zu,stripes=%u", sbi->opts.stripe_size, sbi->opts.stripes);
+    seq_printf(m, ",readahead=%zu,compress=%s", sbi->opts.readahead,
+               sbi->opts.compress ? "lz4" : "none");
+    return 0;
+}
+
 static const struct super_operations vtfs_super_ops = {
-    .statfs     = simple_statfs,
-    .drop_inode = vtfs_drop_inode,
+    .statfs       = vtfs_statfs,
+    .sync_fs      = vtfs_sync_fs,
+    .drop_inode   = vtfs_drop_inode,
+    .show_options = vtfs_show_options,
+};
+
+enum vtfs_param {
+    Opt_server,
+    Opt_token,
+    Opt_attr_ttl_ms,
+    Opt_entry_ttl_ms,
+    Opt_pool_size,
+    Opt_max_bytes,
+    Opt_cache,
+    Opt_journal,
+    Opt_journal_max,
+    Opt_proto,
+    Opt_stripe_size,
+    Opt_stripes,
+    Opt_readahead,
+    Opt_compress,
+};
+
+static const struct constant_table vtfs_param_cache[] = {
+    {"none",         VTFS_CACHE_NONE},
+    {"writethrough", VTFS_CACHE_WRITETHROUGH},
+    {"writeback",    VTFS_CACHE_WRITEBACK},
+    {"offline",      VTFS_CACHE_OFFLINE},
+    {}
 };
 
-static int vtfs_fill_super(struct super_block *sb, void *data, int silent)
+static const struct constant_table vtfs_param_proto[] = {
+    {"http", false},
+    {"rpc",  true},
+    {}
+};
+
+static const struct constant_table vtfs_param_compress[] = {
+    {"none", false},
+    {"lz4",  true},
+    {}
+};
+
+static const struct fs_parameter_spec vtfs_fs_parameters[] = {
+    fsparam_string("server",       Opt_server),
+    fsparam_string("token",        Opt_token),
+    fsparam_u32   ("attr_ttl_ms",  Opt_attr_ttl_ms),
+    fsparam_u32   ("entry_ttl_ms", Opt_entry_ttl_ms),
+    fsparam_u32   ("pool_size",    Opt_pool_size),
+    fsparam_string("max_bytes",    Opt_max_bytes),
+    fsparam_enum  ("cache",        Opt_cache, vtfs_param_cache),
+    fsparam_string("journal",      Opt_journal),
+    fsparam_string("journal_max",  Opt_journal_max),
+    fsparam_enum  ("proto",        Opt_proto, vtfs_param_proto),
+    fsparam_string("stripe_size",  Opt_stripe_size),
+    fsparam_u32   ("stripes",      Opt_stripes),
+    fsparam_string("readahead",    Opt_readahead),
+    fsparam_enum  ("compress",     Opt_compress, vtfs_param_compress),
+    {}
+};
+
+static void vtfs_free_opts(struct vtfs_mount_opts *opts)
+{
+    kfree(opts->server);
+    kfree(opts->token);
+    kfree(opts->journal);
+    opts->server = NULL;
+    opts->token = NULL;
+    opts->journal = NULL;
+}
+
+static int vtfs_parse_param(struct fs_context *fc, struct fs_parameter *param)
+{
+    struct vtfs_mount_opts *opts = fc->fs_private;
+    struct fs_parse_result result;
+    char *end;
+    int opt;
+
+    opt = fs_parse(fc, vtfs_fs_parameters, param, &result);
+    if (opt < 0)
+        return opt;
+
+    switch (opt) {
+    case Opt_server:
+        kfree(opts->server);
+        opts->server = param->string;
+        param->string = NULL;
+        break;
+    case Opt_token:
+        if (strlen(param->string) >= VTFS_HTTP_MAX_TOKEN_LEN)
+            return invalfc(fc, "token is too long");
+        kfree(opts->token);
+        opts->token = param->string;
+        param->string = NULL;
+        break;
+    case Opt_attr_ttl_ms:
+        opts->attr_ttl_ms = result.uint_32;
+        break;
+    case Opt_entry_ttl_ms:
+        opts->entry_ttl_ms = result.uint_32;
+        break;
+    case Opt_pool_size:
+        opts->pool_size = result.uint_32;
+        break;
+    case Opt_max_bytes:
+        opts->max_bytes = memparse(param->string, &end);
+        if (*end)
+            return invalfc(fc, "bad max_bytes value '%s'", param->string);
+        break;
+    case Opt_cache:
+        opts->cache_mode = result.uint_32;
+        break;
+    case Opt_journal:
+        kfree(opts->journal);
+        opts->journal = param->string;
+        param->string = NULL;
+        break;
+    case Opt_journal_max:
+        opts->journal_max = memparse(param->string, &end);
+        if (*end)
+            return invalfc(fc, "bad journal_max value '%s'", param->string);
+        break;
+    case Opt_proto:
+        opts->rpc = result.uint_32;
+        break;
+    case Opt_stripe_size:
+        opts->stripe_size = memparse(param->string, &end);
+        if (*end || (opts->stripe_size && opts->stripe_size < PAGE_SIZE))
+            return invalfc(fc, "bad stripe_size value '%s'", param->string);
+        break;
+    case Opt_stripes:
+        if (result.uint_32 > VTFS_HTTP_MAX_STRIPES)
+            return invalfc(fc, "stripes must be at most %d", VTFS_HTTP_MAX_STRIPES);
+        opts->stripes = result.uint_32;
+        break;
+    case Opt_readahead:
+        opts->readahead = memparse(param->string, &end);
+        if (*end)
+            return invalfc(fc, "bad readahead value '%s'", param->string);
+        break;
+    case Opt_compress:
+        opts->compress = result.uint_32;
+        break;
+    }
+
+    return 0;
+}
+
+static int vtfs_fill_super(struct super_block *sb, struct fs_context *fc)
 {
+    struct vtfs_mount_opts *opts = fc->fs_private;
+    struct vtfs_sb_info *sbi;
     struct inode *inode;
+    int ret;
+    
+    sbi = kzalloc(sizeof(*sbi), GFP_KERNEL);
+    if (!sbi)
+        return -ENOMEM;
+    
+    sbi->opts = *opts;
+    opts->server = NULL;
+    opts->token = NULL;
+    opts->journal = NULL;
+    sb->s_fs_info = sbi;
+    vtfs_remote_init(sbi);
+    mutex_init(&sbi->window_lock);
+    
+    sbi->stats = alloc_percpu(struct vtfs_stats);
+    if (!sbi->stats)
+        return -ENOMEM;
+    sbi->http.stats = sbi->stats;
     
-    sb->s_magic = 0x56544653;
+    sb->s_magic = VTFS_MAGIC;
     
     sb->s_blocksize = PAGE_SIZE;
     
@@ -89,11 +310,31 @@ static int vtfs_fill_super(struct super_block *sb, void *data, int silent)
     
     sb->s_op = &vtfs_super_ops;
     
+    sb->s_d_op = &vtfs_dentry_ops;
+    
     sb->s_maxbytes = VTFS_MAX_FILE_SIZE;
     
-    struct vtfs_entry *root_entry = vtfs_storage_get_root();
-    if (!root_entry)
-        return -ENOMEM;
+    ret = vtfs_storage_init(sbi);
+    if (ret)
+        return ret;
+    
+    if (sbi->opts.server[0]) {
+        ret = vtfs_http_init(&sbi->http, sbi->opts.server, sbi->opts.token,
+                             sbi->opts.pool_size, sbi->opts.rpc);
+        if (ret)
+            return invalfc(fc, "bad server address '%s'", sbi->opts.server);
+        sbi->http.stripe_size = sbi->opts.stripe_size;
+        sbi->http.stripes = sbi->opts.stripes;
+        sbi->http.compress = sbi->opts.compress;
+    }
+    
+    ret = vtfs_remote_start(sbi);
+    if (ret)
+        return invalfc(fc, "cannot open journal '%s': %d", sbi->opts.journal, ret);
+    
+    ret = vtfs_prefetch_start(sbi);
+    if (ret)
+        return ret;
     
     inode = vtfs_get_inode(sb, NULL, S_IFDIR | 0777, VTFS_ROOT_INO);
     if (!inode) {
@@ -105,33 +346,173 @@ static int vtfs_fill_super(struct super_block *sb, void *data, int silent)
         return -ENOMEM;
     }
     
+    ret = vtfs_changes_start(sb);
+    if (ret)
+        VTFS_ERR("Change feed disabled: %d\n", ret);
+    
+    vtfs_debugfs_register(sb);
+    
     return 0;
 }
 
-static struct dentry *vtfs_mount(struct file_system_type *fs_type,
-                                  int flags,
-                                  const char *dev_name,
-                                  void *data)
+static int vtfs_get_tree(struct fs_context *fc)
 {
-    struct dentry *ret;
-    
-    ret = mount_nodev(fs_type, flags, data, vtfs_fill_super);
-    
-    return ret;
+    return get_tree_nodev(fc, vtfs_fill_super);
+}
+
+static int vtfs_set_cache_mode(struct fs_context *fc, enum vtfs_cache_mode mode)
+{
+    struct super_block *sb = fc->root->d_sb;
+    struct vtfs_sb_info *sbi = VTFS_SB(sb);
+    enum vtfs_cache_mode old = sbi->opts.cache_mode;
+    int ret;
+
+    if (mode == old)
+        return 0;
+
+    /* Synchronous modes promise the server is current, so drain the queue first */
+    if (mode == VTFS_CACHE_NONE || mode == VTFS_CACHE_WRITETHROUGH) {
+        ret = vtfs_remote_flush(sbi);
+        if (ret)
+            return invalfc(fc, "cannot flush %u pending changes: %d",
+                           sbi->pending_count, ret);
+    }
+
+    WRITE_ONCE(sbi->opts.cache_mode, mode);
+
+    if (mode == VTFS_CACHE_OFFLINE) {
+        vtfs_changes_stop(sb);
+    } else {
+        if (old == VTFS_CACHE_OFFLINE) {
+            ret = vtfs_changes_start(sb);
+            if (ret)
+                VTFS_ERR("Change feed disabled: %d\n", ret);
+        }
+        vtfs_remote_kick(sbi);
+    }
+
+    return 0;
+}
+
+static int vtfs_reconfigure(struct fs_context *fc)
+{
+    struct vtfs_sb_info *sbi = VTFS_SB(fc->root->d_sb);
+    struct vtfs_mount_opts *opts = fc->fs_private;
+    int ret;
+
+    if (strcmp(opts->server, sbi->opts.server) != 0 ||
+        strcmp(opts->token, sbi->opts.token) != 0 ||
+        strcmp(opts->journal, sbi->opts.journal) != 0 ||
+        opts->rpc != sbi->opts.rpc)
+        return invalfc(fc, "server, token, proto and journal cannot be changed on remount");
+
+    ret = vtfs_set_cache_mode(fc, opts->cache_mode);
+    if (ret)
+        return ret;
+
+    WRITE_ONCE(sbi->opts.attr_ttl_ms, opts->attr_ttl_ms);
+    WRITE_ONCE(sbi->opts.entry_ttl_ms, opts->entry_ttl_ms);
+    WRITE_ONCE(sbi->opts.max_bytes, opts->max_bytes);
+    WRITE_ONCE(sbi->opts.journal_max, opts->journal_max);
+    WRITE_ONCE(sbi->opts.pool_size, opts->pool_size);
+    WRITE_ONCE(sbi->http.pool_size, opts->pool_size);
+    WRITE_ONCE(sbi->opts.stripe_size, opts->stripe_size);
+    WRITE_ONCE(sbi->http.stripe_size, opts->stripe_size);
+    WRITE_ONCE(sbi->opts.stripes, opts->stripes);
+    WRITE_ONCE(sbi->http.stripes, opts->stripes);
+    WRITE_ONCE(sbi->opts.readahead, opts->readahead);
+    WRITE_ONCE(sbi->opts.compress, opts->compress);
+    WRITE_ONCE(sbi->http.compress, opts->compress);
+    return 0;
+}
+
+static void vtfs_free_fc(struct fs_context *fc)
+{
+    struct vtfs_mount_opts *opts = fc->fs_private;
+
+    if (opts) {
+        vtfs_free_opts(opts);
+        kfree(opts);
+    }
+}
+
+static const struct fs_context_operations vtfs_context_ops = {
+    .parse_param = vtfs_parse_param,
+    .get_tree    = vtfs_get_tree,
+    .reconfigure = vtfs_reconfigure,
+    .free        = vtfs_free_fc,
+};
+
+static int vtfs_init_fs_context(struct fs_context *fc)
+{
+    struct vtfs_mount_opts *opts;
+
+    opts = kzalloc(sizeof(*opts), GFP_KERNEL);
+    if (!opts)
+        return -ENOMEM;
+
+    if (fc->purpose == FS_CONTEXT_FOR_RECONFIGURE) {
+        *opts = VTFS_SB(fc->root->d_sb)->opts;
+        opts->server = kstrdup(opts->server, GFP_KERNEL);
+        opts->token = kstrdup(opts->token, GFP_KERNEL);
+        opts->journal = kstrdup(opts->journal, GFP_KERNEL);
+    } else {
+        opts->attr_ttl_ms = VTFS_DEFAULT_TTL_MS;
+        opts->entry_ttl_ms = VTFS_DEFAULT_TTL_MS;
+        opts->pool_size = VTFS_DEFAULT_POOL_SIZE;
+        opts->cache_mode = VTFS_CACHE_WRITETHROUGH;
+        opts->journal_max = VTFS_DEFAULT_JOURNAL_MAX;
+        opts->rpc = true;
+        opts->stripe_size = VTFS_DEFAULT_STRIPE_SIZE;
+        opts->stripes = VTFS_DEFAULT_STRIPES;
+        opts->readahead = VTFS_DEFAULT_READAHEAD;
+        opts->server = kstrdup(server ? server : "", GFP_KERNEL);
+        opts->token = kstrdup(token ? token : "", GFP_KERNEL);
+        opts->journal = kstrdup("", GFP_KERNEL);
+    }
+
+    if (!opts->server || !opts->token || !opts->journal) {
+        vtfs_free_opts(opts);
+        kfree(opts);
+        return -ENOMEM;
+    }
+
+    fc->fs_private = opts;
+    fc->ops = &vtfs_context_ops;
+    return 0;
 }
 
 static void vtfs_kill_sb(struct super_block *sb)
 {
+    struct vtfs_sb_info *sbi = VTFS_SB(sb);
+    
+    if (sbi) {
+        vtfs_debugfs_unregister(sbi);
+        vtfs_changes_stop(sb);
+        vtfs_prefetch_stop(sbi);
+        vtfs_remote_cleanup(sbi);
+    }
+    
     if (sb->s_root && sb->s_root->d_inode) {
         truncate_inode_pages_final(&sb->s_root->d_inode->i_data);
     }
     
     kill_anon_super(sb);
+    
+    if (sbi) {
+        vtfs_storage_cleanup(sbi);
+        vtfs_http_cleanup(&sbi->http);
+        vtfs_free_opts(&sbi->opts);
+        free_percpu(sbi->stats);
+        kvfree(sbi->window);
+        kfree(sbi);
+    }
 }
 
 static struct file_system_type vtfs_fs_type = {
     .name = "vtfs",
-    .mount = vtfs_mount,
+    .init_fs_context = vtfs_init_fs_context,
+    .parameters = vtfs_fs_parameters,
     .kill_sb = vtfs_kill_sb,
     .owner = THIS_MODULE,
 };
@@ -140,29 +521,19 @@ static int __init vtfs_init(void)
 {
     int ret;
     
-    if (server_url && strlen(server_url) > 0) {
-        ret = vtfs_http_init(server_url);
-        if (ret) {
-            printk(KERN_ERR "[vtfs] Failed to initialize HTTP client\n");
-            return ret;
-        }
-    }
+    vtfs_codec_init();
+    VTFS_LOG("base64 codec: %s\n", vtfs_base64_impl_name(vtfs_base64_impl));
     
-    ret = vtfs_storage_init();
-    if (ret) {
-        printk(KERN_ERR "[vtfs] Failed to initialize storage\n");
-        if (server_url && strlen(server_url) > 0)
-            vtfs_http_cleanup();
+    ret = vtfs_file_init();
+    if (ret)
         return ret;
-    }
+    vtfs_debugfs_init();
     
     ret = register_filesystem(&vtfs_fs_type);
-    
     if (ret) {
-        vtfs_storage_cleanup();
-        if (server_url && strlen(server_url) > 0)
-            vtfs_http_cleanup();
         printk(KERN_ERR "[vtfs] Failed to register filesystem\n");
+        vtfs_debugfs_exit();
+        vtfs_file_exit();
         return ret;
     }
     
@@ -172,11 +543,8 @@ static int __init vtfs_init(void)
 static void __exit vtfs_exit(void)
 {
     unregister_filesystem(&vtfs_fs_type);
-    
-    vtfs_storage_cleanup();
-    
-    if (server_url && strlen(server_url) > 0)
-        vtfs_http_cleanup();
+    vtfs_debugfs_exit();
+    vtfs_file_exit();
 }
 
 module_init(vtfs_init);
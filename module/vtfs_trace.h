@@ -0,0 +1,237 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM vtfs
+
+#if !defined(_VTFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _VTFS_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+#include "stats.h"
+
+TRACE_DEFINE_ENUM(VTFS_STAT_LOOKUP);
+TRACE_DEFINE_ENUM(VTFS_STAT_READ);
+TRACE_DEFINE_ENUM(VTFS_STAT_WRITE);
+TRACE_DEFINE_ENUM(VTFS_STAT_ITERATE);
+TRACE_DEFINE_ENUM(VTFS_STAT_CREATE);
+TRACE_DEFINE_ENUM(VTFS_STAT_UNLINK);
+TRACE_DEFINE_ENUM(VTFS_STAT_MKDIR);
+TRACE_DEFINE_ENUM(VTFS_STAT_RMDIR);
+TRACE_DEFINE_ENUM(VTFS_STAT_LINK);
+TRACE_DEFINE_ENUM(VTFS_STAT_GETATTR);
+TRACE_DEFINE_ENUM(VTFS_STAT_REVALIDATE);
+
+#define show_vtfs_op(op)                                \
+    __print_symbolic(op,                                \
+        { VTFS_STAT_LOOKUP,     "lookup" },             \
+        { VTFS_STAT_READ,       "read" },               \
+        { VTFS_STAT_WRITE,      "write" },              \
+        { VTFS_STAT_ITERATE,    "iterate" },            \
+        { VTFS_STAT_CREATE,     "create" },             \
+        { VTFS_STAT_UNLINK,     "unlink" },             \
+        { VTFS_STAT_MKDIR,      "mkdir" },              \
+        { VTFS_STAT_RMDIR,      "rmdir" },              \
+        { VTFS_STAT_LINK,       "link" },               \
+        { VTFS_STAT_GETATTR,    "getattr" },            \
+        { VTFS_STAT_REVALIDATE, "revalidate" })
+
+/* VFS entry points: start and end, so a request can be laid out on a timeline */
+
+TRACE_EVENT(vtfs_op_start,
+    TP_PROTO(int op, unsigned long ino, const char *name),
+    TP_ARGS(op, ino, name),
+
+    TP_STRUCT__entry(
+        __field(int, op)
+        __field(unsigned long, ino)
+        __string(name, name)
+    ),
+
+    TP_fast_assign(
+        __entry->op = op;
+        __entry->ino = ino;
+        __assign_str(name, name);
+    ),
+
+    TP_printk("%s ino=%lu name=%s", show_vtfs_op(__entry->op),
+              __entry->ino, __get_str(name))
+);
+
+TRACE_EVENT(vtfs_op_end,
+    TP_PROTO(int op, unsigned long ino, const char *name, long ret, u64 start),
+    TP_ARGS(op, ino, name, ret, start),
+
+    TP_STRUCT__entry(
+        __field(int, op)
+        __field(unsigned long, ino)
+        __field(long, ret)
+        __field(u64, duration_ns)
+        __string(name, name)
+    ),
+
+    TP_fast_assign(
+        __entry->op = op;
+        __entry->ino = ino;
+        __entry->ret = ret;
+        __entry->duration_ns = ktime_get_ns() - start;
+        __assign_str(name, name);
+    ),
+
+    TP_printk("%s ino=%lu name=%s ret=%ld duration_ns=%llu",
+              show_vtfs_op(__entry->op), __entry->ino, __get_str(name),
+              __entry->ret, __entry->duration_ns)
+);
+
+/* Storage */
+
+TRACE_EVENT(vtfs_storage_create,
+    TP_PROTO(unsigned long parent_ino, const char *name, unsigned long ino,
+             umode_t mode),
+    TP_ARGS(parent_ino, name, ino, mode),
+
+    TP_STRUCT__entry(
+        __field(unsigned long, parent_ino)
+        __field(unsigned long, ino)
+        __field(umode_t, mode)
+        __string(name, name)
+    ),
+
+    TP_fast_assign(
+        __entry->parent_ino = parent_ino;
+        __entry->ino = ino;
+        __entry->mode = mode;
+        __assign_str(name, name);
+    ),
+
+    TP_printk("parent=%lu name=%s ino=%lu mode=0%o", __entry->parent_ino,
+              __get_str(name), __entry->ino, __entry->mode)
+);
+
+TRACE_EVENT(vtfs_storage_lookup,
+    TP_PROTO(unsigned long parent_ino, const char *name, unsigned long ino),
+    TP_ARGS(parent_ino, name, ino),
+
+    TP_STRUCT__entry(
+        __field(unsigned long, parent_ino)
+        __field(unsigned long, ino)
+        __string(name, name)
+    ),
+
+    TP_fast_assign(
+        __entry->parent_ino = parent_ino;
+        __entry->ino = ino;
+        __assign_str(name, name);
+    ),
+
+    TP_printk("parent=%lu name=%s %s ino=%lu", __entry->parent_ino,
+              __get_str(name), __entry->ino ? "hit" : "miss", __entry->ino)
+);
+
+DECLARE_EVENT_CLASS(vtfs_storage_io,
+    TP_PROTO(unsigned long ino, loff_t offset, size_t len, long ret),
+    TP_ARGS(ino, offset, len, ret),
+
+    TP_STRUCT__entry(
+        __field(unsigned long, ino)
+        __field(loff_t, offset)
+        __field(size_t, len)
+        __field(long, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->ino = ino;
+        __entry->offset = offset;
+        __entry->len = len;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("ino=%lu offset=%lld len=%zu ret=%ld", __entry->ino,
+              __entry->offset, __entry->len, __entry->ret)
+);
+
+DEFINE_EVENT(vtfs_storage_io, vtfs_storage_read,
+    TP_PROTO(unsigned long ino, loff_t offset, size_t len, long ret),
+    TP_ARGS(ino, offset, len, ret)
+);
+
+DEFINE_EVENT(vtfs_storage_io, vtfs_storage_write,
+    TP_PROTO(unsigned long ino, loff_t offset, size_t len, long ret),
+    TP_ARGS(ino, offset, len, ret)
+);
+
+TRACE_EVENT(vtfs_storage_grow,
+    TP_PROTO(unsigned long ino, size_t old_capacity, size_t new_capacity),
+    TP_ARGS(ino, old_capacity, new_capacity),
+
+    TP_STRUCT__entry(
+        __field(unsigned long, ino)
+        __field(size_t, old_capacity)
+        __field(size_t, new_capacity)
+    ),
+
+    TP_fast_assign(
+        __entry->ino = ino;
+        __entry->old_capacity = old_capacity;
+        __entry->new_capacity = new_capacity;
+    ),
+
+    TP_printk("ino=%lu capacity=%zu->%zu", __entry->ino,
+              __entry->old_capacity, __entry->new_capacity)
+);
+
+TRACE_EVENT(vtfs_storage_delete,
+    TP_PROTO(unsigned long ino, const char *name, int links_left),
+    TP_ARGS(ino, name, links_left),
+
+    TP_STRUCT__entry(
+        __field(unsigned long, ino)
+        __field(int, links_left)
+        __string(name, name)
+    ),
+
+    TP_fast_assign(
+        __entry->ino = ino;
+        __entry->links_left = links_left;
+        __assign_str(name, name);
+    ),
+
+    TP_printk("ino=%lu name=%s links_left=%d", __entry->ino,
+              __get_str(name), __entry->links_left)
+);
+
+/* HTTP client: one event per request, emitted when it completes */
+
+TRACE_EVENT(vtfs_http_request,
+    TP_PROTO(const char *method, const char *path, size_t sent, size_t received,
+             int status, u64 start),
+    TP_ARGS(method, path, sent, received, status, start),
+
+    TP_STRUCT__entry(
+        __field(size_t, sent)
+        __field(size_t, received)
+        __field(int, status)
+        __field(u64, duration_ns)
+        __string(method, method)
+        __string(path, path)
+    ),
+
+    TP_fast_assign(
+        __entry->sent = sent;
+        __entry->received = received;
+        __entry->status = status;
+        __entry->duration_ns = ktime_get_ns() - start;
+        __assign_str(method, method);
+        __assign_str(path, path);
+    ),
+
+    TP_printk("%s path=%s sent=%zu received=%zu status=%d duration_ns=%llu",
+              __get_str(method), __get_str(path), __entry->sent,
+              __entry->received, __entry->status, __entry->duration_ns)
+);
+
+#endif /* _VTFS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE vtfs_trace
+#include <trace/define_trace.h>
@@ -6,6 +6,7 @@ plugins {
     kotlin("jvm") version "1.9.20"
     kotlin("plugin.spring") version "1.9.20"
     kotlin("plugin.jpa") version "1.9.20"
+    id("me.champeau.jmh") version "0.7.2"
 }
 
 group = "com.vtfs"
@@ -22,12 +23,17 @@ repositories {
 dependencies {
     implementation("org.springframework.boot:spring-boot-starter-web")
     implementation("org.springframework.boot:spring-boot-starter-data-jpa")
+    implementation("org.springframework.boot:spring-boot-starter-actuator")
+    implementation("org.hibernate.orm:hibernate-micrometer")
+    runtimeOnly("io.micrometer:micrometer-registry-prometheus")
     runtimeOnly("org.postgresql:postgresql")
     implementation("org.jetbrains.kotlin:kotlin-reflect")
     implementation("org.jetbrains.kotlin:kotlin-stdlib-jdk8")
     implementation("com.fasterxml.jackson.module:jackson-module-kotlin")
+    implementation("org.lz4:lz4-java:1.8.0")
     implementation("org.springframework.boot:spring-boot-starter-logging")
     testImplementation("org.springframework.boot:spring-boot-starter-test")
+    jmhImplementation("com.h2database:h2")
 }
 
 tasks.withType<KotlinCompile> {
@@ -40,3 +46,19 @@ tasks.withType<KotlinCompile> {
 tasks.withType<Test> {
     useJUnitPlatform()
 }
+
+// ./gradlew jmh -Pjmh.includes=read    (allocation rate comes from the gc profiler)
+jmh {
+    jmhVersion.set("1.37")
+    profilers.add("gc")
+    resultFormat.set("JSON")
+    (findProperty("jmh.includes") as String?)?.let { includes.add(it) }
+}
+
+// ./gradlew loadTest --args="--url http://127.0.0.1:8080 --concurrency 32 --duration 60"
+tasks.register<JavaExec>("loadTest") {
+    group = "benchmark"
+    description = "Closed-loop HTTP load against a running server"
+    classpath = sourceSets["jmh"].runtimeClasspath
+    mainClass.set("com.vtfs.server.bench.LoadGenerator")
+}
@@ -0,0 +1,101 @@
+package com.vtfs.server.bench
+
+import com.vtfs.server.VtfsApplication
+import com.vtfs.server.common.Result
+import com.vtfs.server.service.FileSystemService
+import org.openjdk.jmh.annotations.*
+import org.openjdk.jmh.infra.Blackhole
+import org.springframework.boot.WebApplicationType
+import org.springframework.boot.builder.SpringApplicationBuilder
+import org.springframework.context.ConfigurableApplicationContext
+import java.util.concurrent.ThreadLocalRandom
+import java.util.concurrent.TimeUnit
+import java.util.concurrent.atomic.AtomicLong
+
+// FileSystemService against H2 in PostgreSQL mode, without the HTTP layer.
+// Every benchmark works in one directory of `fanout` files of `fileSize` bytes.
+@State(Scope.Benchmark)
+@BenchmarkMode(Mode.AverageTime, Mode.Throughput)
+@OutputTimeUnit(TimeUnit.MICROSECONDS)
+@Warmup(iterations = 2, time = 5)
+@Measurement(iterations = 5, time = 5)
+@Fork(1)
+open class FileSystemBenchmark {
+
+    companion object {
+        private const val DIR = "/bench"
+        private const val SCRATCH = "/scratch"
+    }
+
+    // Every combination is loaded up front; the largest is fanout * fileSize bytes in H2
+    @Param("1024", "16384", "131072")
+    @JvmField
+    var fileSize = 0
+
+    @Param("10", "1000")
+    @JvmField
+    var fanout = 0
+
+    private lateinit var context: ConfigurableApplicationContext
+    private lateinit var service: FileSystemService
+    private lateinit var payload: ByteArray
+    private val counter = AtomicLong()
+
+    @Setup(Level.Trial)
+    fun setUp() {
+        context = SpringApplicationBuilder(VtfsApplication::class.java)
+            .web(WebApplicationType.NONE)
+            .profiles("bench")
+            .run()
+        service = context.getBean(FileSystemService::class.java)
+
+        payload = ByteArray(fileSize) { it.toByte() }
+        service.create(DIR, "dir", 511).orFail()
+        service.create(SCRATCH, "dir", 511).orFail()
+        repeat(fanout) { i ->
+            service.create("$DIR/f$i", "file", 420).orFail()
+            service.write("$DIR/f$i", 0, payload).orFail()
+        }
+    }
+
+    @TearDown(Level.Trial)
+    fun tearDown() {
+        context.close()
+    }
+
+    // create leaves files behind; drop them so each iteration starts from the same tree
+    @TearDown(Level.Iteration)
+    fun clearScratch() {
+        service.listDir(SCRATCH).orFail().forEach { service.delete("$SCRATCH/${it["name"]}") }
+    }
+
+    private fun randomFile() = "$DIR/f${ThreadLocalRandom.current().nextInt(fanout)}"
+
+    @Benchmark
+    fun read(bh: Blackhole) = bh.consume(service.read(randomFile(), 0, fileSize).orFail())
+
+    @Benchmark
+    fun write(bh: Blackhole) = bh.consume(service.write(randomFile(), 0, payload).orFail())
+
+    @Benchmark
+    fun stat(bh: Blackhole) = bh.consume(service.stat(randomFile()).orFail())
+
+    @Benchmark
+    fun list(bh: Blackhole) = bh.consume(service.listDir(DIR).orFail())
+
+    @Benchmark
+    fun create(bh: Blackhole) =
+        bh.consume(service.create("$SCRATCH/c${counter.incrementAndGet()}", "file", 420).orFail())
+
+    @Benchmark
+    fun createDelete(bh: Blackhole) {
+        val path = "$SCRATCH/d${counter.incrementAndGet()}"
+        bh.consume(service.create(path, "file", 420).orFail())
+        bh.consume(service.delete(path).orFail())
+    }
+
+    private fun <T> Result<T>.orFail(): T = when (this) {
+        is Result.Success -> data
+        is Result.Error -> throw IllegalStateException(code)
+    }
+}
@@ -0,0 +1,188 @@
+package com.vtfs.server.bench
+
+import java.net.URI
+import java.net.URLEncoder
+import java.net.http.HttpClient
+import java.net.http.HttpRequest
+import java.net.http.HttpResponse
+import java.nio.charset.StandardCharsets
+import java.time.Duration
+import java.util.Base64
+import java.util.concurrent.Executors
+import java.util.concurrent.ThreadLocalRandom
+import java.util.concurrent.TimeUnit
+import kotlin.system.exitProcess
+
+// Closed-loop HTTP load against a running server: `concurrency` threads each issue
+// one request at a time for `duration` seconds, picking endpoints by weight.
+// Prints one key=value line per endpoint, like the tools under bench/, and the
+// server's allocation per request taken from /metrics before and after the run.
+object LoadGenerator {
+
+    private class Options(
+        val url: String = "http://127.0.0.1:8080",
+        val token: String = "bench",
+        val concurrency: Int = 16,
+        val durationSec: Long = 30,
+        val warmupSec: Long = 5,
+        val size: Int = 4096,
+        val fanout: Int = 100,
+        val mix: Map<String, Int> = mapOf("read" to 50, "write" to 20, "stat" to 20, "list" to 5, "create" to 5)
+    )
+
+    private class Samples {
+        var values = LongArray(1024)
+        var count = 0
+        var errors = 0L
+
+        fun add(ns: Long) {
+            if (count == values.size) values = values.copyOf(count * 2)
+            values[count++] = ns
+        }
+
+        fun addAll(other: Samples) {
+            for (i in 0 until other.count) add(other.values[i])
+            errors += other.errors
+        }
+    }
+
+    private val client: HttpClient = HttpClient.newBuilder()
+        .version(HttpClient.Version.HTTP_1_1)
+        .connectTimeout(Duration.ofSeconds(5))
+        .build()
+
+    private fun parse(args: Array<String>): Options {
+        val values = args.toList().chunked(2).associate { (key, value) -> key.removePrefix("--") to value }
+        val defaults = Options()
+        return Options(
+            url = values["url"] ?: defaults.url,
+            token = values["token"] ?: defaults.token,
+            concurrency = values["concurrency"]?.toInt() ?: defaults.concurrency,
+            durationSec = values["duration"]?.toLong() ?: defaults.durationSec,
+            warmupSec = values["warmup"]?.toLong() ?: defaults.warmupSec,
+            size = values["size"]?.toInt() ?: defaults.size,
+            fanout = values["fanout"]?.toInt() ?: defaults.fanout,
+            mix = values["mix"]?.split(',')?.associate {
+                val (name, weight) = it.split('=')
+                name to weight.toInt()
+            } ?: defaults.mix
+        )
+    }
+
+    private fun get(opts: Options, endpoint: String, vararg params: Pair<String, String>): HttpResponse<ByteArray> {
+        val query = (listOf("token" to opts.token) + params).joinToString("&") { (k, v) ->
+            "$k=${URLEncoder.encode(v, StandardCharsets.UTF_8)}"
+        }
+        val request = HttpRequest.newBuilder(URI.create("${opts.url}/$endpoint?$query"))
+            .timeout(Duration.ofSeconds(30))
+            .GET()
+            .build()
+        return client.send(request, HttpResponse.BodyHandlers.ofByteArray())
+    }
+
+    private fun allocatedBytes(opts: Options): Double? = runCatching {
+        val request = HttpRequest.newBuilder(URI.create("${opts.url}/metrics")).GET().build()
+        client.send(request, HttpResponse.BodyHandlers.ofString()).body()
+            .lineSequence()
+            .firstOrNull { it.startsWith("jvm_gc_memory_allocated_bytes_total") }
+            ?.substringAfterLast(' ')
+            ?.toDouble()
+    }.getOrNull()
+
+    private fun runOne(opts: Options, endpoint: String, data: String, scratch: Long): Boolean {
+        val file = "/load/f${ThreadLocalRandom.current().nextInt(opts.fanout)}"
+        val response = when (endpoint) {
+            "read" -> get(opts, "read", "path" to file, "offset" to "0", "size" to opts.size.toString())
+            "write" -> get(opts, "write", "path" to file, "offset" to "0", "data" to data)
+            "stat" -> get(opts, "stat", "path" to file)
+            "list" -> get(opts, "list", "path" to "/load")
+            "create" -> {
+                val path = "/load-scratch/t${Thread.currentThread().id}-$scratch"
+                val created = get(opts, "create", "path" to path, "type" to "file")
+                if (created.statusCode() == 200) get(opts, "delete", "path" to path) else created
+            }
+            else -> throw IllegalArgumentException("unknown endpoint $endpoint")
+        }
+        return response.statusCode() == 200
+    }
+
+    private fun runPhase(opts: Options, seconds: Long, data: String): Map<String, Samples> {
+        val names = opts.mix.keys.toList()
+        val weights = opts.mix.values.runningReduce(Int::plus)
+        val total = weights.last()
+        val deadline = System.nanoTime() + TimeUnit.SECONDS.toNanos(seconds)
+        val pool = Executors.newFixedThreadPool(opts.concurrency)
+
+        val futures = (0 until opts.concurrency).map {
+            pool.submit<Map<String, Samples>> {
+                val samples = names.associateWith { Samples() }
+                var scratch = 0L
+                while (System.nanoTime() < deadline) {
+                    val pick = ThreadLocalRandom.current().nextInt(total)
+                    val endpoint = names[weights.indexOfFirst { pick < it }]
+                    val start = System.nanoTime()
+                    val ok = runCatching { runOne(opts, endpoint, data, scratch++) }.getOrDefault(false)
+                    val s = samples.getValue(endpoint)
+                    if (ok) s.add(System.nanoTime() - start) else s.errors++
+                }
+                samples
+            }
+        }
+
+        val merged = names.associateWith { Samples() }
+        futures.forEach { future -> future.get().forEach { (name, s) -> merged.getValue(name).addAll(s) } }
+        pool.shutdown()
+        return merged
+    }
+
+    private fun percentileUs(sorted: LongArray, count: Int, p: Double): Double {
+        if (count == 0) return 0.0
+        val rank = Math.ceil(p * count).toInt().coerceIn(1, count)
+        return sorted[rank - 1] / 1000.0
+    }
+
+    @JvmStatic
+    fun main(args: Array<String>) {
+        val opts = parse(args)
+        val data = Base64.getEncoder().encodeToString(ByteArray(opts.size) { it.toByte() })
+
+        get(opts, "create", "path" to "/load", "type" to "dir")
+        get(opts, "create", "path" to "/load-scratch", "type" to "dir")
+        repeat(opts.fanout) { i ->
+            get(opts, "create", "path" to "/load/f$i", "type" to "file")
+            if (get(opts, "write", "path" to "/load/f$i", "offset" to "0", "data" to data).statusCode() != 200) {
+                System.err.println("cannot populate /load/f$i on ${opts.url}")
+                exitProcess(1)
+            }
+        }
+
+        if (opts.warmupSec > 0) runPhase(opts, opts.warmupSec, data)
+
+        val allocBefore = allocatedBytes(opts)
+        val start = System.nanoTime()
+        val results = runPhase(opts, opts.durationSec, data)
+        val seconds = (System.nanoTime() - start) / 1e9
+        val allocAfter = allocatedBytes(opts)
+
+        var totalOps = 0L
+        results.forEach { (endpoint, s) ->
+            val sorted = s.values.copyOf(s.count).also { it.sort() }
+            totalOps += s.count
+            println(
+                "endpoint=%s concurrency=%d ops=%d errors=%d ops_per_sec=%.0f p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f"
+                    .format(
+                        endpoint, opts.concurrency, s.count, s.errors, s.count / seconds,
+                        percentileUs(sorted, s.count, 0.50), percentileUs(sorted, s.count, 0.99),
+                        percentileUs(sorted, s.count, 0.999), percentileUs(sorted, s.count, 1.0)
+                    )
+            )
+        }
+        if (allocBefore != null && allocAfter != null && totalOps > 0) {
+            println("server_alloc_bytes_per_request=%.0f".format((allocAfter - allocBefore) / totalOps))
+        }
+
+        repeat(opts.fanout) { i -> get(opts, "delete", "path" to "/load/f$i") }
+        get(opts, "delete", "path" to "/load")
+        get(opts, "delete", "path" to "/load-scratch")
+    }
+}
@@ -0,0 +1,89 @@
+package com.vtfs.server.config
+
+import io.micrometer.core.instrument.DistributionSummary
+import io.micrometer.core.instrument.MeterRegistry
+import io.micrometer.core.instrument.binder.BaseUnits
+import jakarta.servlet.FilterChain
+import jakarta.servlet.ServletOutputStream
+import jakarta.servlet.WriteListener
+import jakarta.servlet.http.HttpServletRequest
+import jakarta.servlet.http.HttpServletResponse
+import jakarta.servlet.http.HttpServletResponseWrapper
+import org.springframework.stereotype.Component
+import org.springframework.web.filter.OncePerRequestFilter
+import java.io.OutputStreamWriter
+import java.io.PrintWriter
+
+// Bytes carried per endpoint. Requests are GETs with everything in the query
+// string, so the request size is the request line plus any body.
+@Component
+class TrafficMetricsFilter(private val registry: MeterRegistry) : OncePerRequestFilter() {
+
+    companion object {
+        private val ENDPOINTS = setOf("list", "create", "delete", "read", "write", "stat", "link", "changes")
+    }
+
+    override fun doFilterInternal(request: HttpServletRequest, response: HttpServletResponse, chain: FilterChain) {
+        val endpoint = request.requestURI.trim('/')
+        if (endpoint !in ENDPOINTS) {
+            chain.doFilter(request, response)
+            return
+        }
+
+        val counting = CountingResponse(response)
+        try {
+            chain.doFilter(request, counting)
+        } finally {
+            counting.flushWriter()
+            summary("vtfs.http.request.bytes", endpoint).record(requestBytes(request).toDouble())
+            summary("vtfs.http.response.bytes", endpoint).record(counting.bytes.toDouble())
+        }
+    }
+
+    private fun requestBytes(request: HttpServletRequest): Long =
+        request.method.length + 1L + request.requestURI.length +
+            (request.queryString?.let { it.length + 1L } ?: 0L) +
+            maxOf(request.contentLengthLong, 0L)
+
+    private fun summary(name: String, endpoint: String) =
+        DistributionSummary.builder(name)
+            .baseUnit(BaseUnits.BYTES)
+            .tag("endpoint", endpoint)
+            .register(registry)
+
+    private class CountingResponse(response: HttpServletResponse) : HttpServletResponseWrapper(response) {
+        var bytes = 0L
+            private set
+
+        private var writer: PrintWriter? = null
+
+        private val stream: ServletOutputStream by lazy {
+            val delegate = response.outputStream
+            object : ServletOutputStream() {
+                override fun isReady() = delegate.isReady
+                override fun setWriteListener(listener: WriteListener) = delegate.setWriteListener(listener)
+
+                override fun write(b: Int) {
+                    delegate.write(b)
+                    bytes++
+                }
+
+                override fun write(b: ByteArray, off: Int, len: Int) {
+                    delegate.write(b, off, len)
+                    bytes += len
+                }
+
+                override fun flush() = delegate.flush()
+            }
+        }
+
+        override fun getOutputStream(): ServletOutputStream = stream
+
+        override fun getWriter(): PrintWriter =
+            writer ?: PrintWriter(OutputStreamWriter(stream, characterEncoding)).also { writer = it }
+
+        fun flushWriter() {
+            writer?.flush()
+        }
+    }
+}
@@ -0,0 +1,40 @@
+package com.vtfs.server.config
+
+import io.micrometer.core.instrument.MeterRegistry
+import io.micrometer.core.instrument.Timer
+import org.springframework.stereotype.Component
+import org.springframework.transaction.TransactionExecution
+import org.springframework.transaction.TransactionExecutionListener
+import java.util.concurrent.TimeUnit
+
+// Wall time of every transaction from begin to commit or rollback, tagged with the
+// @Transactional method (e.g. FileSystemService.write). Registered with the
+// transaction manager by Spring Boot; only new transactions are reported.
+@Component
+class TransactionMetrics(private val registry: MeterRegistry) : TransactionExecutionListener {
+
+    private val started = ThreadLocal.withInitial { ArrayDeque<Long>() }
+
+    override fun afterBegin(transaction: TransactionExecution, beginFailure: Throwable?) {
+        if (beginFailure == null) {
+            started.get().addLast(System.nanoTime())
+        }
+    }
+
+    override fun afterCommit(transaction: TransactionExecution, commitFailure: Throwable?) =
+        record(transaction, if (commitFailure == null) "commit" else "failed")
+
+    override fun afterRollback(transaction: TransactionExecution, rollbackFailure: Throwable?) =
+        record(transaction, "rollback")
+
+    private fun record(transaction: TransactionExecution, outcome: String) {
+        val start = started.get().removeLastOrNull() ?: return
+        val name = transaction.transactionName.split('.').takeLast(2).joinToString(".")
+
+        Timer.builder("vtfs.transaction")
+            .tag("name", name)
+            .tag("outcome", outcome)
+            .register(registry)
+            .record(System.nanoTime() - start, TimeUnit.NANOSECONDS)
+    }
+}
@@ -0,0 +1,34 @@
+package com.vtfs.server.config
+
+import org.apache.catalina.connector.Connector
+import org.apache.coyote.http11.Http11NioProtocol
+import org.springframework.beans.factory.annotation.Value
+import org.springframework.boot.autoconfigure.condition.ConditionalOnProperty
+import org.springframework.boot.web.embedded.tomcat.TomcatServletWebServerFactory
+import org.springframework.boot.web.server.WebServerFactoryCustomizer
+import org.springframework.context.annotation.Bean
+import org.springframework.context.annotation.Configuration
+import java.nio.file.Files
+import java.nio.file.Path
+
+// A second Tomcat connector on a Unix domain socket, next to the TCP one, for a
+// module mounted with server=unix:<path> on the same host. The module connects
+// with the credentials of whichever process touched the file system, hence the
+// world-writable default, as open as the TCP port. A socket file left behind by
+// an unclean shutdown is removed first, or the bind would fail.
+@Configuration
+@ConditionalOnProperty("vtfs.unix-socket")
+class UnixSocketConfig(
+    @Value("\${vtfs.unix-socket}") private val path: String,
+    @Value("\${vtfs.unix-socket-permissions:rw-rw-rw-}") private val permissions: String
+) {
+
+    @Bean
+    fun unixSocketConnector() = WebServerFactoryCustomizer<TomcatServletWebServerFactory> { factory ->
+        Files.deleteIfExists(Path.of(path))
+        val connector = Connector(Http11NioProtocol::class.java.name)
+        connector.setProperty("unixDomainSocketPath", path)
+        connector.setProperty("unixDomainSocketPathPermissions", permissions)
+        factory.addAdditionalTomcatConnectors(connector)
+    }
+}
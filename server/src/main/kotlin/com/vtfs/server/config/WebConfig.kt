@@ -9,5 +9,6 @@ class WebConfig : WebMvcConfigurer {
     
     override fun addInterceptors(registry: InterceptorRegistry) {
         registry.addInterceptor(TokenInterceptor())
+            .excludePathPatterns("/metrics", "/health")
     }
 }
@@ -0,0 +1,44 @@
+package com.vtfs.server.controller
+
+import com.vtfs.server.rpc.RpcDispatcher
+import com.vtfs.server.rpc.RpcFrame
+import com.vtfs.server.rpc.RpcUpgradeHandler
+import jakarta.servlet.http.HttpServletRequest
+import jakarta.servlet.http.HttpServletResponse
+import org.springframework.http.HttpHeaders
+import org.springframework.http.ResponseEntity
+import org.springframework.web.bind.annotation.GetMapping
+import org.springframework.web.bind.annotation.RequestParam
+import org.springframework.web.bind.annotation.RestController
+
+// Switches the connection to vtfs-rpc when asked to with "Upgrade: vtfs-rpc/1".
+// The token has been checked by then, as for any request; the client id is kept
+// for the change log entries of every request the connection carries. A client
+// offering "Vtfs-Compression: lz4" gets it echoed back and LZ4 payloads.
+@RestController
+class RpcController(private val dispatcher: RpcDispatcher) {
+
+    @GetMapping("/rpc")
+    fun upgrade(
+        request: HttpServletRequest,
+        response: HttpServletResponse,
+        @RequestParam(required = false) client: String?
+    ): ResponseEntity<Map<String, Any>>? {
+        if (!RpcFrame.PROTOCOL.equals(request.getHeader(HttpHeaders.UPGRADE), ignoreCase = true)) {
+            return ResponseEntity.status(400).body(mapOf("error" to "EINVAL"))
+        }
+
+        val handler = request.upgrade(RpcUpgradeHandler::class.java)
+        handler.dispatcher = dispatcher
+        handler.client = client?.takeIf { it.isNotEmpty() }
+        handler.lz4 = RpcFrame.COMPRESSION.equals(request.getHeader(RpcFrame.COMPRESSION_HEADER), ignoreCase = true)
+
+        response.status = HttpServletResponse.SC_SWITCHING_PROTOCOLS
+        response.setHeader(HttpHeaders.UPGRADE, RpcFrame.PROTOCOL)
+        response.setHeader(HttpHeaders.CONNECTION, HttpHeaders.UPGRADE)
+        if (handler.lz4) {
+            response.setHeader(RpcFrame.COMPRESSION_HEADER, RpcFrame.COMPRESSION)
+        }
+        return null
+    }
+}
@@ -1,14 +1,19 @@
 package com.vtfs.server.controller
 
 import com.vtfs.server.common.Result
+import com.vtfs.server.service.ChangeLogService
 import com.vtfs.server.service.FileSystemService
+import com.vtfs.server.service.IdempotencyService
+import org.springframework.http.MediaType
 import org.springframework.http.ResponseEntity
 import org.springframework.web.bind.annotation.*
 import java.util.Base64
 
 @RestController
 class VtfsController(
-    private val fileSystemService: FileSystemService
+    private val fileSystemService: FileSystemService,
+    private val changeLogService: ChangeLogService,
+    private val idempotency: IdempotencyService
 ) {
     
     private fun <T> Result<T>.toResponse(): ResponseEntity<Map<String, Any>> = when (this) {
@@ -24,15 +29,18 @@ class VtfsController(
     fun create(
         @RequestParam path: String,
         @RequestParam(defaultValue = "file") type: String,
-        @RequestParam(defaultValue = "777") mode: String
+        @RequestParam(defaultValue = "777") mode: String,
+        @RequestParam(required = false) opid: String?
     ): ResponseEntity<Map<String, Any>> {
         val modeInt = mode.toIntOrNull(8) ?: return Result.Error("EINVAL").toResponse()
-        return fileSystemService.create(path, type, modeInt).toResponse()
+        return idempotency.execute(opid) { fileSystemService.create(path, type, modeInt) }.toResponse()
     }
     
     @GetMapping("/delete")
-    fun delete(@RequestParam path: String) = 
-        fileSystemService.delete(path).toResponse()
+    fun delete(
+        @RequestParam path: String,
+        @RequestParam(required = false) opid: String?
+    ) = idempotency.execute(opid) { fileSystemService.delete(path) }.toResponse()
     
     @GetMapping("/read")
     fun read(
@@ -53,23 +61,49 @@ class VtfsController(
     fun write(
         @RequestParam path: String,
         @RequestParam(defaultValue = "0") offset: Int,
-        @RequestParam data: String
+        @RequestParam data: String,
+        @RequestParam(required = false) opid: String?
     ): ResponseEntity<Map<String, Any>> {
         val decodedData = try {
             Base64.getDecoder().decode(data)
         } catch (e: IllegalArgumentException) {
             return Result.Error("EINVAL").toResponse()
         }
-        return fileSystemService.write(path, offset, decodedData).toResponse()
+        return idempotency.execute(opid) { fileSystemService.write(path, offset, decodedData) }.toResponse()
     }
     
+    // The kernel client sends the bytes themselves as the body, without base64
+    @PostMapping("/write", consumes = [MediaType.APPLICATION_OCTET_STREAM_VALUE])
+    fun writeRaw(
+        @RequestParam path: String,
+        @RequestParam(defaultValue = "0") offset: Int,
+        @RequestBody(required = false) data: ByteArray?,
+        @RequestParam(required = false) opid: String?
+    ) = idempotency.execute(opid) { fileSystemService.write(path, offset, data ?: ByteArray(0)) }.toResponse()
+    
     @GetMapping("/stat")
     fun stat(@RequestParam path: String) = 
         fileSystemService.stat(path).toResponse()
     
+    @GetMapping("/sums")
+    fun sums(
+        @RequestParam path: String,
+        @RequestParam(defaultValue = "0") offset: Int,
+        @RequestParam(required = false) size: Int?,
+        @RequestParam(required = false) max: Int?
+    ) = fileSystemService.sums(path, offset, size ?: Int.MAX_VALUE, max ?: Int.MAX_VALUE).toResponse()
+    
     @GetMapping("/link")
     fun link(
         @RequestParam oldpath: String,
-        @RequestParam newpath: String
-    ) = fileSystemService.link(oldpath, newpath).toResponse()
+        @RequestParam newpath: String,
+        @RequestParam(required = false) opid: String?
+    ) = idempotency.execute(opid) { fileSystemService.link(oldpath, newpath) }.toResponse()
+    
+    @GetMapping("/changes")
+    fun changes(
+        @RequestParam(defaultValue = "-1") since: Long,
+        @RequestParam(defaultValue = "0") timeout: Long,
+        @RequestParam(defaultValue = "64") limit: Int
+    ) = changeLogService.changesSince(since, timeout, limit).toResponse()
 }
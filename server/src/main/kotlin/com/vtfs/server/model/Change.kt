@@ -0,0 +1,17 @@
+package com.vtfs.server.model
+
+data class Change(
+    val seq: Long,
+    val op: String,
+    val path: String,
+    val ino: Long,
+    val client: String?
+) {
+    fun toMap(): Map<String, Any> = buildMap {
+        put("seq", seq)
+        put("op", op)
+        put("path", path)
+        put("ino", ino)
+        client?.let { put("client", it) }
+    }
+}
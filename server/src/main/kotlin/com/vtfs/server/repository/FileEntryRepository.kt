@@ -1,7 +1,11 @@
 package com.vtfs.server.repository
 
 import com.vtfs.server.model.FileEntry
+import jakarta.persistence.LockModeType
 import org.springframework.data.jpa.repository.JpaRepository
+import org.springframework.data.jpa.repository.Lock
+import org.springframework.data.jpa.repository.Query
+import org.springframework.data.repository.query.Param
 import org.springframework.stereotype.Repository
 
 @Repository
@@ -9,6 +13,10 @@ interface FileEntryRepository : JpaRepository<FileEntry, Long> {
     
     fun findByPath(path: String): FileEntry?
     
+    @Lock(LockModeType.PESSIMISTIC_WRITE)
+    @Query("select e from FileEntry e where e.path = :path")
+    fun findByPathForUpdate(@Param("path") path: String): FileEntry?
+    
     fun findByIno(ino: Long): FileEntry?
     
     fun findByParentPath(parentPath: String): List<FileEntry>
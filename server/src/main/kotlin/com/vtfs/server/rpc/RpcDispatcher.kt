@@ -0,0 +1,127 @@
+package com.vtfs.server.rpc
+
+import com.vtfs.server.common.Result
+import com.vtfs.server.service.ChangeLogService
+import com.vtfs.server.service.FileSystemService
+import com.vtfs.server.service.IdempotencyService
+import jakarta.annotation.PreDestroy
+import org.springframework.beans.factory.annotation.Value
+import org.springframework.stereotype.Service
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.util.concurrent.ExecutorService
+import java.util.concurrent.Executors
+import java.util.concurrent.atomic.AtomicInteger
+
+// Runs vtfs-rpc requests against the same services as the HTTP endpoints. The
+// error codes the HTTP API names in its "error" field travel as errno numbers.
+@Service
+class RpcDispatcher(
+    private val fileSystemService: FileSystemService,
+    private val changeLog: ChangeLogService,
+    private val idempotency: IdempotencyService,
+    @Value("\${vtfs.rpc.threads:16}") threads: Int
+) {
+
+    companion object {
+        private const val EIO = 5
+        private val ERRNO = mapOf(
+            "EPERM" to 1, "ENOENT" to 2, "EIO" to 5, "EACCES" to 13, "EBUSY" to 16,
+            "EEXIST" to 17, "ENOTDIR" to 20, "EISDIR" to 21, "EINVAL" to 22, "ENOTEMPTY" to 39
+        )
+    }
+
+    // Requests of one connection run side by side and may finish out of order
+    private val threadId = AtomicInteger()
+    val executor: ExecutorService = Executors.newFixedThreadPool(threads) { task ->
+        Thread(task, "vtfs-rpc-${threadId.incrementAndGet()}").apply { isDaemon = true }
+    }
+
+    @PreDestroy
+    fun shutdown() {
+        executor.shutdownNow()
+    }
+
+    fun handle(request: RpcFrame, client: String?, lz4: Boolean = false): RpcFrame {
+        val plain = request.decompressed(lz4)
+        val result = when {
+            plain == null -> Result.Error("EINVAL")
+            else -> try {
+                changeLog.asClient(client) { execute(plain) }
+            } catch (e: RuntimeException) {
+                Result.Error("EIO")
+            }
+        }
+
+        return when (result) {
+            is Result.Success -> RpcFrame(request.op, 0, request.id, replyFields(request.op, result.data))
+                .let { if (lz4) it.compressed() else it }
+            is Result.Error -> RpcFrame(request.op, ERRNO[result.code] ?: EIO, request.id)
+        }
+    }
+
+    private fun execute(request: RpcFrame): Result<Any> {
+        val path = request.string(RpcFrame.PATH) ?: return Result.Error("EINVAL")
+        val opid = request.string(RpcFrame.OPID)
+        val offset = request.long(RpcFrame.OFFSET) ?: 0L
+        if (offset !in 0L..Int.MAX_VALUE.toLong()) {
+            return Result.Error("EINVAL")
+        }
+
+        return when (request.op) {
+            RpcFrame.CREATE -> {
+                val type = request.string(RpcFrame.KIND) ?: "file"
+                val mode = (request.long(RpcFrame.MODE) ?: 511L).toInt()
+                idempotency.execute(opid) { fileSystemService.create(path, type, mode) }
+            }
+            RpcFrame.DELETE -> idempotency.execute(opid) { fileSystemService.delete(path) }
+            RpcFrame.READ -> {
+                val size = request.long(RpcFrame.SIZE)?.coerceIn(0L, Int.MAX_VALUE.toLong())?.toInt()
+                fileSystemService.read(path, offset.toInt(), size)
+            }
+            RpcFrame.WRITE -> {
+                val data = request.bytes(RpcFrame.DATA) ?: ByteArray(0)
+                idempotency.execute(opid) { fileSystemService.write(path, offset.toInt(), data) }
+            }
+            RpcFrame.STAT -> fileSystemService.stat(path)
+            RpcFrame.SUMS -> {
+                val size = request.long(RpcFrame.SIZE)?.coerceIn(0L, Int.MAX_VALUE.toLong())?.toInt()
+                val max = request.long(RpcFrame.MAX)?.coerceIn(0L, Int.MAX_VALUE.toLong())?.toInt()
+                fileSystemService.sums(path, offset.toInt(), size ?: Int.MAX_VALUE, max ?: Int.MAX_VALUE)
+            }
+            RpcFrame.LINK -> {
+                val newPath = request.string(RpcFrame.PATH2) ?: return Result.Error("EINVAL")
+                idempotency.execute(opid) { fileSystemService.link(path, newPath) }
+            }
+            else -> Result.Error("EINVAL")
+        }
+    }
+
+    private fun replyFields(op: Int, data: Any): Map<Int, Any> = when (op) {
+        RpcFrame.READ -> mapOf(RpcFrame.DATA to data as ByteArray)
+        RpcFrame.STAT -> {
+            val attrs = data as Map<*, *>
+            mapOf(
+                RpcFrame.KIND to attrs["type"] as String,
+                RpcFrame.SIZE to attrs["size"] as Number,
+                RpcFrame.MTIME to attrs["mtime"] as Number,
+                RpcFrame.INO to attrs["ino"] as Number,
+                RpcFrame.MODE to attrs["mode"] as Number,
+                RpcFrame.NLINK to attrs["nlink"] as Number
+            )
+        }
+        // The sums as u32 in a row, little-endian like the rest of the frame
+        RpcFrame.SUMS -> {
+            val manifest = data as Map<*, *>
+            val sums = manifest["sums"] as List<*>
+            val packed = ByteBuffer.allocate(sums.size * 4).order(ByteOrder.LITTLE_ENDIAN)
+            sums.forEach { packed.putInt((it as Long).toInt()) }
+            mapOf(
+                RpcFrame.BLOCK to manifest["block"] as Number,
+                RpcFrame.SIZE to manifest["size"] as Number,
+                RpcFrame.DATA to packed.array()
+            )
+        }
+        else -> emptyMap()
+    }
+}
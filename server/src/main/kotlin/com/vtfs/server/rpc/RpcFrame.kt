@@ -0,0 +1,196 @@
+package com.vtfs.server.rpc
+
+import net.jpountz.lz4.LZ4Exception
+import net.jpountz.lz4.LZ4Factory
+import java.io.EOFException
+import java.io.IOException
+import java.io.InputStream
+import java.io.OutputStream
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+// One vtfs-rpc/1 frame, laid out as in module/rpc.h: a 16-byte little-endian
+// header (len, op, status, id, count) and tag/type/len fields, a DATA payload last.
+// Field values are Long, String or ByteArray by type. A DATA payload sent as an
+// LZ4 block comes with RAW_SIZE, its length before compression.
+class RpcFrame(
+    val op: Int,
+    val status: Int,
+    val id: Int,
+    val fields: Map<Int, Any> = emptyMap()
+) {
+
+    companion object {
+        const val PROTOCOL = "vtfs-rpc/1"
+        const val COMPRESSION_HEADER = "Vtfs-Compression"
+        const val COMPRESSION = "lz4"
+        const val HEADER_SIZE = 16
+        const val FIELD_SIZE = 8
+        const val MAX_FRAME = 64 shl 20
+
+        const val CREATE = 1
+        const val DELETE = 2
+        const val READ = 3
+        const val WRITE = 4
+        const val STAT = 5
+        const val LINK = 6
+        const val SUMS = 7
+
+        const val PATH = 1
+        const val PATH2 = 2
+        const val OFFSET = 3
+        const val SIZE = 4
+        const val MODE = 5
+        const val KIND = 6
+        const val OPID = 7
+        const val INO = 8
+        const val MTIME = 9
+        const val NLINK = 10
+        const val DATA = 11
+        const val RAW_SIZE = 12
+        const val BLOCK = 13
+        const val MAX = 14
+
+        // Payloads shorter than this, or saving less than an eighth, go as they are
+        private const val COMPRESS_MIN = 512
+        private val lz4 = LZ4Factory.fastestInstance()
+
+        private const val U64 = 1
+        private const val STR = 2
+        private const val BYTES = 3
+
+        // The next frame, or null when the peer closed between frames
+        fun read(input: InputStream): RpcFrame? {
+            val header = ByteArray(HEADER_SIZE)
+            val got = input.readNBytes(header, 0, HEADER_SIZE)
+            if (got == 0) {
+                return null
+            }
+            if (got < HEADER_SIZE) {
+                throw EOFException("truncated frame header")
+            }
+
+            val h = ByteBuffer.wrap(header).order(ByteOrder.LITTLE_ENDIAN)
+            val len = h.int
+            val op = h.short.toInt() and 0xffff
+            val status = h.short.toInt() and 0xffff
+            val id = h.int
+            val count = h.short.toInt() and 0xffff
+            if (len < 0 || len > MAX_FRAME - HEADER_SIZE || h.short.toInt() != 0) {
+                throw IOException("bad frame header")
+            }
+
+            val body = input.readNBytes(len)
+            if (body.size < len) {
+                throw EOFException("truncated frame")
+            }
+
+            val b = ByteBuffer.wrap(body).order(ByteOrder.LITTLE_ENDIAN)
+            val fields = HashMap<Int, Any>(count)
+            repeat(count) {
+                if (b.remaining() < FIELD_SIZE) {
+                    throw IOException("bad field")
+                }
+                val tag = b.short.toInt() and 0xffff
+                val type = b.short.toInt() and 0xffff
+                val n = b.int
+                if (n < 0 || n > b.remaining()) {
+                    throw IOException("bad field")
+                }
+                val at = b.position()
+                fields[tag] = when {
+                    type == U64 && n == 8 -> b.long
+                    type == STR -> String(body, at, n, Charsets.UTF_8)
+                    type == BYTES -> body.copyOfRange(at, at + n)
+                    else -> throw IOException("bad field")
+                }
+                b.position(at + n)
+            }
+            if (b.hasRemaining()) {
+                throw IOException("bad frame length")
+            }
+
+            return RpcFrame(op, status, id, fields)
+        }
+    }
+
+    fun long(tag: Int) = fields[tag] as? Long
+
+    fun string(tag: Int) = fields[tag] as? String
+
+    fun bytes(tag: Int) = fields[tag] as? ByteArray
+
+    // This frame with its payload decompressed; null if it cannot be, or may not be
+    fun decompressed(allowed: Boolean): RpcFrame? {
+        val raw = long(RAW_SIZE) ?: return this
+        val data = bytes(DATA)
+        if (!allowed || data == null || raw !in 0L..MAX_FRAME.toLong()) {
+            return null
+        }
+
+        val plain = try {
+            lz4.safeDecompressor().decompress(data, raw.toInt())
+        } catch (e: LZ4Exception) {
+            return null
+        }
+        if (plain.size.toLong() != raw) {
+            return null
+        }
+        return RpcFrame(op, status, id, fields - RAW_SIZE + (DATA to plain))
+    }
+
+    // This frame with its payload as an LZ4 block, if that makes it worth sending so
+    fun compressed(): RpcFrame {
+        val data = bytes(DATA)
+        if (data == null || data.size < COMPRESS_MIN) {
+            return this
+        }
+
+        val packed = lz4.fastCompressor().compress(data)
+        if (packed.size >= data.size - data.size / 8) {
+            return this
+        }
+        return RpcFrame(op, status, id, fields + mapOf(RAW_SIZE to data.size.toLong(), DATA to packed))
+    }
+
+    // Header and fields in one buffer, then the payload as it is
+    fun write(output: OutputStream) {
+        val encoded = fields.filterKeys { it != DATA }.mapValues { (_, value) ->
+            when (value) {
+                is String -> value.toByteArray(Charsets.UTF_8)
+                is Number -> value.toLong()
+                else -> value as ByteArray
+            }
+        }
+        val data = bytes(DATA)
+
+        var size = HEADER_SIZE + (if (data != null) FIELD_SIZE else 0)
+        for (value in encoded.values) {
+            size += FIELD_SIZE + if (value is ByteArray) value.size else 8
+        }
+
+        val b = ByteBuffer.allocate(size).order(ByteOrder.LITTLE_ENDIAN)
+        b.putInt(size - HEADER_SIZE + (data?.size ?: 0))
+        b.putShort(op.toShort())
+        b.putShort(status.toShort())
+        b.putInt(id)
+        b.putShort((encoded.size + if (data != null) 1 else 0).toShort())
+        b.putShort(0)
+        for ((tag, value) in encoded) {
+            b.putShort(tag.toShort())
+            if (value is ByteArray) {
+                b.putShort(STR.toShort()).putInt(value.size).put(value)
+            } else {
+                b.putShort(U64.toShort()).putInt(8).putLong(value as Long)
+            }
+        }
+        if (data != null) {
+            b.putShort(DATA.toShort()).putShort(BYTES.toShort()).putInt(data.size)
+        }
+
+        output.write(b.array())
+        if (data != null) {
+            output.write(data)
+        }
+    }
+}
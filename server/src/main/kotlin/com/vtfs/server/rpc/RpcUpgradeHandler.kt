@@ -0,0 +1,61 @@
+package com.vtfs.server.rpc
+
+import jakarta.servlet.http.HttpUpgradeHandler
+import jakarta.servlet.http.WebConnection
+import java.io.IOException
+import java.util.concurrent.RejectedExecutionException
+
+// The server end of a connection upgraded to vtfs-rpc. A reader thread takes
+// frames off the socket with blocking reads, allowed as long as no ReadListener
+// is set, and hands each to the dispatcher's pool. Replies are written whole in
+// the order requests finish; the client matches them up by id.
+class RpcUpgradeHandler : HttpUpgradeHandler {
+
+    lateinit var dispatcher: RpcDispatcher
+    var client: String? = null
+    // Both sides may send LZ4 payloads
+    var lz4 = false
+
+    override fun init(connection: WebConnection) {
+        Thread({ serve(connection) }, "vtfs-rpc-reader").apply {
+            isDaemon = true
+            start()
+        }
+    }
+
+    override fun destroy() {}
+
+    private fun serve(connection: WebConnection) {
+        try {
+            val input = connection.inputStream
+            val output = connection.outputStream
+            while (true) {
+                val request = RpcFrame.read(input) ?: break
+                dispatcher.executor.execute {
+                    val reply = dispatcher.handle(request, client, lz4)
+                    try {
+                        synchronized(output) {
+                            reply.write(output)
+                            output.flush()
+                        }
+                    } catch (e: IOException) {
+                        close(connection)
+                    }
+                }
+            }
+        } catch (e: IOException) {
+            // A malformed frame leaves no way to find the next one
+        } catch (e: RejectedExecutionException) {
+            // Shutting down
+        }
+        close(connection)
+    }
+
+    private fun close(connection: WebConnection) {
+        try {
+            connection.close()
+        } catch (e: Exception) {
+            // Already closed
+        }
+    }
+}
@@ -0,0 +1,98 @@
+package com.vtfs.server.service
+
+import com.vtfs.server.common.Result
+import com.vtfs.server.model.Change
+import org.springframework.stereotype.Service
+import org.springframework.transaction.support.TransactionSynchronization
+import org.springframework.transaction.support.TransactionSynchronizationManager
+import org.springframework.web.context.request.RequestContextHolder
+import org.springframework.web.context.request.ServletRequestAttributes
+import java.util.concurrent.TimeUnit
+import java.util.concurrent.locks.ReentrantLock
+import kotlin.concurrent.withLock
+
+// Bounded in-memory log of mutations, polled by clients via /changes?since=N.
+// A client that falls behind the retained window gets reset = true and must drop its caches.
+@Service
+class ChangeLogService {
+
+    companion object {
+        private const val CAPACITY = 8192
+        private const val MAX_TIMEOUT_MS = 30_000L
+        private const val MAX_LIMIT = 256
+    }
+
+    private val lock = ReentrantLock()
+    private val appended = lock.newCondition()
+    private val log = ArrayDeque<Change>()
+    private var lastSeq = 0L
+    private val threadClient = ThreadLocal<String?>()
+
+    // Appended only after commit so pollers never see a rolled back mutation
+    fun record(op: String, path: String, ino: Long) {
+        val client = currentClient()
+
+        if (!TransactionSynchronizationManager.isSynchronizationActive()) {
+            append(op, path, ino, client)
+            return
+        }
+
+        TransactionSynchronizationManager.registerSynchronization(object : TransactionSynchronization {
+            override fun afterCommit() = append(op, path, ino, client)
+        })
+    }
+
+    // For requests that do not arrive as servlet requests, such as vtfs-rpc frames
+    fun <T> asClient(client: String?, block: () -> T): T {
+        threadClient.set(client)
+        try {
+            return block()
+        } finally {
+            threadClient.remove()
+        }
+    }
+
+    // Long-poll: waits up to timeoutMs for a change newer than since; since < 0 only reports the head
+    fun changesSince(since: Long, timeoutMs: Long, limit: Int): Result<Map<String, Any>> {
+        lock.withLock {
+            if (since < 0) {
+                return Result.Success(mapOf("seq" to lastSeq, "reset" to false, "changes" to emptyList<Any>()))
+            }
+
+            var remaining = TimeUnit.MILLISECONDS.toNanos(timeoutMs.coerceIn(0, MAX_TIMEOUT_MS))
+            while (lastSeq <= since && remaining > 0) {
+                remaining = appended.awaitNanos(remaining)
+            }
+
+            val oldest = log.firstOrNull()?.seq ?: (lastSeq + 1)
+            if (since > lastSeq || since + 1 < oldest) {
+                return Result.Success(mapOf("seq" to lastSeq, "reset" to true, "changes" to emptyList<Any>()))
+            }
+
+            val batch = log.asSequence()
+                .filter { it.seq > since }
+                .take(limit.coerceIn(1, MAX_LIMIT))
+                .toList()
+            val seq = batch.lastOrNull()?.seq ?: since
+
+            return Result.Success(mapOf("seq" to seq, "reset" to false, "changes" to batch.map { it.toMap() }))
+        }
+    }
+
+    private fun append(op: String, path: String, ino: Long, client: String?) {
+        lock.withLock {
+            lastSeq++
+            log.addLast(Change(lastSeq, op, path, ino, client))
+            while (log.size > CAPACITY) {
+                log.removeFirst()
+            }
+            appended.signalAll()
+        }
+    }
+
+    private fun currentClient(): String? = threadClient.get() ?:
+        (RequestContextHolder.getRequestAttributes() as? ServletRequestAttributes)
+            ?.request
+            ?.getParameter("client")
+            ?.takeIf { it.isNotEmpty() }
+}
@@ -0,0 +1,188 @@
+package com.vtfs.server.service
+
+import io.micrometer.core.instrument.Counter
+import io.micrometer.core.instrument.Gauge
+import io.micrometer.core.instrument.MeterRegistry
+import io.micrometer.core.instrument.Timer
+import net.jpountz.lz4.LZ4Factory
+import org.springframework.beans.factory.annotation.Value
+import org.springframework.stereotype.Service
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.util.zip.CRC32C
+
+// File content as kept in FileEntry.data: fixed-size chunks, each compressed on
+// its own with its codec recorded next to it, so a read decompresses only the
+// chunks it covers and a write re-encodes only those it touches. Layout, little
+// endian: chunk size u32, chunk count u32, per chunk codec u8, raw length u32,
+// stored length u32 and CRC32C of the raw bytes u32, then the chunks' bytes in
+// order. Every chunk but the last holds chunk size bytes; a file keeps the chunk
+// size it was first written with. The CRCs are the block manifest of sums().
+@Service
+class ContentStore(
+    @Value("\${vtfs.store.chunk-size:65536}") private val chunkSize: Int,
+    @Value("\${vtfs.store.codec:lz4}") codec: String,
+    meterRegistry: MeterRegistry
+) {
+
+    companion object {
+        const val NONE = 0
+        const val LZ4 = 1
+        private const val HEADER_SIZE = 8
+        private const val CHUNK_ENTRY_SIZE = 13
+    }
+
+    class Manifest(val block: Int, val size: Int, val sums: IntArray)
+
+    private class Chunk(
+        val codec: Int,
+        val rawLength: Int,
+        val crc: Int,
+        val bytes: ByteArray,
+        val at: Int,
+        val length: Int
+    )
+
+    private class Layout(val chunkSize: Int, val chunks: List<Chunk>) {
+        val size = chunks.sumOf { it.rawLength }
+    }
+
+    private val codec = when (codec.lowercase()) {
+        "none" -> NONE
+        "lz4" -> LZ4
+        else -> throw IllegalArgumentException("vtfs.store.codec must be none or lz4, not $codec")
+    }
+    private val lz4 = LZ4Factory.fastestInstance()
+
+    // Bytes of the chunks encoded and what they took stored; the ratio is the one of those
+    private val rawBytes = Counter.builder("vtfs.store.raw.bytes").register(meterRegistry)
+    private val storedBytes = Counter.builder("vtfs.store.stored.bytes").register(meterRegistry)
+    private val compressTimer = Timer.builder("vtfs.store.compress").register(meterRegistry)
+    private val decompressTimer = Timer.builder("vtfs.store.decompress").register(meterRegistry)
+
+    init {
+        require(chunkSize > 0) { "vtfs.store.chunk-size must be positive" }
+        Gauge.builder("vtfs.store.ratio", this) { it.rawBytes.count() / maxOf(it.storedBytes.count(), 1.0) }
+            .register(meterRegistry)
+    }
+
+    fun size(stored: ByteArray?) = parse(stored).size
+
+    // CRC32C of the chunks holding offset until offset + length, at most max of them
+    fun sums(stored: ByteArray?, offset: Int, length: Int, max: Int): Manifest {
+        val layout = parse(stored)
+        val first = minOf(offset / layout.chunkSize, layout.chunks.size)
+        val end = (offset.toLong() + length + layout.chunkSize - 1) / layout.chunkSize
+        val count = minOf(end, layout.chunks.size.toLong(), first.toLong() + max).toInt() - first
+        return Manifest(layout.chunkSize, layout.size, IntArray(maxOf(count, 0)) { layout.chunks[first + it].crc })
+    }
+
+    // length bytes from offset, which the caller has clamped to the content
+    fun read(stored: ByteArray?, offset: Int, length: Int): ByteArray {
+        val layout = parse(stored)
+        val out = ByteArray(length)
+        if (length == 0) {
+            return out
+        }
+
+        for (i in offset / layout.chunkSize..(offset + length - 1) / layout.chunkSize) {
+            val chunk = layout.chunks[i]
+            val start = i * layout.chunkSize
+            val from = maxOf(offset, start)
+            val to = minOf(offset + length, start + chunk.rawLength)
+            if (chunk.codec == NONE) {
+                System.arraycopy(chunk.bytes, chunk.at + from - start, out, from - offset, to - from)
+            } else {
+                decode(chunk).copyInto(out, from - offset, from - start, to - start)
+            }
+        }
+        return out
+    }
+
+    // The content with data written at offset; a gap before it reads as zeros
+    fun write(stored: ByteArray?, offset: Int, data: ByteArray): ByteArray {
+        val layout = parse(stored)
+        val size = maxOf(layout.size, offset + data.size)
+        val n = (size + layout.chunkSize - 1) / layout.chunkSize
+        val chunks = ArrayList<Chunk>(n)
+
+        for (i in 0 until n) {
+            val start = i * layout.chunkSize
+            val end = minOf(start + layout.chunkSize, size)
+            val old = layout.chunks.getOrNull(i)
+            val touched = data.isNotEmpty() && start < offset + data.size && end > offset
+            if (old != null && old.rawLength == end - start && !touched) {
+                chunks.add(old)
+                continue
+            }
+
+            val raw = ByteArray(end - start)
+            old?.let { decode(it).copyInto(raw) }
+            if (touched) {
+                val from = maxOf(offset, start)
+                data.copyInto(raw, from - start, from - offset, minOf(offset + data.size, end) - offset)
+            }
+            chunks.add(encode(raw))
+        }
+        return serialize(layout.chunkSize, chunks)
+    }
+
+    private fun parse(stored: ByteArray?): Layout {
+        if (stored == null || stored.isEmpty()) {
+            return Layout(chunkSize, emptyList())
+        }
+
+        val b = ByteBuffer.wrap(stored).order(ByteOrder.LITTLE_ENDIAN)
+        val fileChunkSize = b.int
+        val count = b.int
+        var at = HEADER_SIZE + count * CHUNK_ENTRY_SIZE
+        val chunks = List(count) {
+            val codec = b.get().toInt()
+            val rawLength = b.int
+            val length = b.int
+            val crc = b.int
+            Chunk(codec, rawLength, crc, stored, at, length).also { at += length }
+        }
+        check(at == stored.size) { "corrupt content: $at of ${stored.size} bytes" }
+        return Layout(fileChunkSize, chunks)
+    }
+
+    private fun decode(chunk: Chunk): ByteArray = when (chunk.codec) {
+        NONE -> chunk.bytes.copyOfRange(chunk.at, chunk.at + chunk.length)
+        LZ4 -> decompressTimer.recordCallable {
+            val raw = ByteArray(chunk.rawLength)
+            val n = lz4.safeDecompressor().decompress(chunk.bytes, chunk.at, chunk.length, raw, 0)
+            check(n == chunk.rawLength) { "corrupt chunk: $n of ${chunk.rawLength} bytes" }
+            raw
+        }
+        else -> throw IllegalStateException("unknown codec ${chunk.codec}")
+    }
+
+    // Kept raw when compression saves less than an eighth, which reads then copy as is
+    private fun encode(raw: ByteArray): Chunk {
+        val crc = CRC32C().apply { update(raw) }.value.toInt()
+        var chunk = Chunk(NONE, raw.size, crc, raw, 0, raw.size)
+        if (codec == LZ4) {
+            val packed = compressTimer.recordCallable { lz4.fastCompressor().compress(raw) }
+            if (packed.size < raw.size - raw.size / 8) {
+                chunk = Chunk(LZ4, raw.size, crc, packed, 0, packed.size)
+            }
+        }
+        rawBytes.increment(raw.size.toDouble())
+        storedBytes.increment(chunk.length.toDouble())
+        return chunk
+    }
+
+    private fun serialize(chunkSize: Int, chunks: List<Chunk>): ByteArray {
+        val b = ByteBuffer.allocate(HEADER_SIZE + chunks.size * CHUNK_ENTRY_SIZE + chunks.sumOf { it.length })
+            .order(ByteOrder.LITTLE_ENDIAN)
+        b.putInt(chunkSize).putInt(chunks.size)
+        for (chunk in chunks) {
+            b.put(chunk.codec.toByte()).putInt(chunk.rawLength).putInt(chunk.length).putInt(chunk.crc)
+        }
+        for (chunk in chunks) {
+            b.put(chunk.bytes, chunk.at, chunk.length)
+        }
+        return b.array()
+    }
+}
@@ -3,6 +3,8 @@ package com.vtfs.server.service
 import com.vtfs.server.common.Result
 import com.vtfs.server.model.FileEntry
 import com.vtfs.server.repository.FileEntryRepository
+import io.micrometer.core.instrument.MeterRegistry
+import io.micrometer.core.instrument.Timer
 import org.springframework.stereotype.Service
 import org.springframework.transaction.annotation.Transactional
 import java.nio.file.Paths
@@ -11,13 +13,20 @@ import java.time.Instant
 @Service
 @Transactional
 class FileSystemService(
-    private val repository: FileEntryRepository
+    private val repository: FileEntryRepository,
+    private val changeLog: ChangeLogService,
+    private val content: ContentStore,
+    meterRegistry: MeterRegistry
 ) {
     
+    // In-JVM part of a write, compression included, to tell it apart from Hibernate flush and PostgreSQL time
+    private val writeCopyTimer = Timer.builder("vtfs.write.copy").register(meterRegistry)
+    
     companion object {
         private const val ROOT_PATH = "/"
         private const val ROOT_INO = 1000L
         private const val MODE_MASK = 511 // 0o777
+        private const val MAX_SUMS = 1024
     }
     
     init {
@@ -56,14 +65,23 @@ class FileSystemService(
     
     private fun findEntry(path: String) = repository.findByPath(normalizePath(path))
     
-    private inline fun <T> withEntry(path: String, block: (FileEntry, String) -> Result<T>): Result<T> {
+    private inline fun <T> withEntry(
+        path: String,
+        forUpdate: Boolean = false,
+        block: (FileEntry, String) -> Result<T>
+    ): Result<T> {
         val normalizedPath = normalizePath(path)
-        val entry = repository.findByPath(normalizedPath) ?: return Result.Error("ENOENT")
+        val entry = (if (forUpdate) repository.findByPathForUpdate(normalizedPath)
+                     else repository.findByPath(normalizedPath)) ?: return Result.Error("ENOENT")
         return block(entry, normalizedPath)
     }
     
-    private inline fun <T> withFile(path: String, block: (FileEntry) -> Result<T>): Result<T> {
-        return withEntry(path) { entry, _ ->
+    private inline fun <T> withFile(
+        path: String,
+        forUpdate: Boolean = false,
+        block: (FileEntry) -> Result<T>
+    ): Result<T> {
+        return withEntry(path, forUpdate) { entry, _ ->
             if (entry.type != FileEntry.EntryType.FILE) Result.Error("EISDIR")
             else block(entry)
         }
@@ -84,7 +102,8 @@ class FileSystemService(
                     "ino" to child.ino,
                     "type" to child.type.name.lowercase(),
                     "mode" to child.mode,
-                    "size" to child.size
+                    "size" to child.size,
+                    "mtime" to child.mtime.epochSecond
                 )
             }
             Result.Success(children)
@@ -135,6 +154,8 @@ class FileSystemService(
             repository.save(parent)
         }
         
+        changeLog.record("create", normalizedPath, ino)
+        
         return Result.Success(mapOf("ino" to ino, "path" to normalizedPath))
     }
     
@@ -169,55 +190,62 @@ class FileSystemService(
             repository.save(entry)
         }
         
+        changeLog.record("delete", normalizedPath, entry.ino)
+        
         return Result.Success(mapOf("deleted" to normalizedPath))
     }
     
     fun read(path: String, offset: Int, size: Int?): Result<ByteArray> {
         return withFile(path) { entry ->
             val data = entry.data ?: return@withFile Result.Success(ByteArray(0))
+            val length = content.size(data)
             
-            if (offset >= data.size) {
+            if (offset >= length) {
                 return@withFile Result.Success(ByteArray(0))
             }
             
-            val end = size?.let { minOf(offset + it, data.size) } ?: data.size
+            val end = size?.let { minOf(offset + it, length) } ?: length
             
             entry.atime = Instant.now()
             repository.save(entry)
             
-            Result.Success(data.sliceArray(offset until end))
+            Result.Success(content.read(data, offset, end - offset))
         }
     }
     
+    // Ranges of one file may be written concurrently (striped uploads): the row
+    // lock keeps each read-modify-write of the data from undoing another
     fun write(path: String, offset: Int, data: ByteArray): Result<Map<String, Any>> {
-        return withFile(path) { entry ->
-            val currentData = entry.data ?: ByteArray(0)
-            val newSize = maxOf(offset + data.size, currentData.size)
-            val newData = ByteArray(newSize)
-            
-            if (offset == 0) {
-                data.copyInto(newData)
-            } else {
-                currentData.copyInto(newData, endIndex = minOf(currentData.size, offset))
-                data.copyInto(newData, destinationOffset = offset)
-                if (offset < currentData.size) {
-                    val remainingStart = offset + data.size
-                    if (remainingStart < currentData.size) {
-                        currentData.copyInto(newData, destinationOffset = remainingStart, startIndex = remainingStart)
-                    }
-                }
+        return withFile(path, forUpdate = true) { entry ->
+            val newData: ByteArray = writeCopyTimer.recordCallable {
+                content.write(entry.data, offset, data)
             }
             
             entry.data = newData
-            entry.size = newData.size.toLong()
+            entry.size = content.size(newData).toLong()
             entry.mtime = Instant.now()
             entry.ctime = Instant.now()
             repository.save(entry)
             
+            changeLog.record("write", entry.path, entry.ino)
+            
             Result.Success(mapOf("written" to data.size))
         }
     }
     
+    // The block manifest for a rewrite of size bytes at offset, at most max
+    // sums: the client sends only the blocks whose CRC32C differs from these
+    fun sums(path: String, offset: Int, size: Int, max: Int): Result<Map<String, Any>> {
+        return withFile(path) { entry ->
+            val manifest = content.sums(entry.data, offset, size, max.coerceIn(0, MAX_SUMS))
+            Result.Success(mapOf(
+                "block" to manifest.block,
+                "size" to manifest.size,
+                "sums" to manifest.sums.map { it.toLong() and 0xffffffffL }
+            ))
+        }
+    }
+    
     fun stat(path: String): Result<Map<String, Any>> {
         return withEntry(path) { entry, _ ->
             Result.Success(mapOf(
@@ -274,6 +302,8 @@ class FileSystemService(
         oldEntry.ctime = now
         repository.save(oldEntry)
         
+        changeLog.record("link", normalizedNewPath, oldEntry.ino)
+        
         return Result.Success(mapOf("linked" to normalizedNewPath))
     }
 }
@@ -0,0 +1,36 @@
+package com.vtfs.server.service
+
+import com.vtfs.server.common.Result
+import org.springframework.stereotype.Service
+
+// Remembers the outcome of recent mutations by client-supplied opid, so a client
+// replaying its journal after a lost response gets the original result back
+// instead of applying the operation twice.
+@Service
+class IdempotencyService {
+
+    companion object {
+        private const val CAPACITY = 16384
+    }
+
+    private val results = object : LinkedHashMap<String, Result<*>>(CAPACITY, 0.75f, true) {
+        override fun removeEldestEntry(eldest: MutableMap.MutableEntry<String, Result<*>>) = size > CAPACITY
+    }
+
+    fun <T> execute(opid: String?, block: () -> Result<T>): Result<T> {
+        if (opid.isNullOrEmpty()) {
+            return block()
+        }
+
+        synchronized(results) {
+            @Suppress("UNCHECKED_CAST")
+            results[opid]?.let { return it as Result<T> }
+        }
+
+        val result = block()
+        synchronized(results) {
+            results[opid] = result
+        }
+        return result
+    }
+}